@@ -64,7 +64,7 @@ do
       msg="file_name:$k:$config"
       echo $msg >> ../$output_file
       echo "running $msg ..."
-      ./sim/dmc_sim -c ../$config | awk '(/average/)' >> ../$output_file
+      ./sim/dmc_sim -c ../$config | awk '(/total time|percentiles/)' >> ../$output_file
     done # end repeat
     cd ..
     k=$(( $k + 1 ))
@@ -5,6 +5,7 @@ class DataPoint:
     self.nserver = 0;
     self.nclient = 0;
     self.heap_type = 0;  
+    # the p99 of each, in nanoseconds
     self.total_time_to_add_req = 0;
     self.total_time_to_complete_req = 0;
     self.config = ''
@@ -72,7 +73,7 @@ def make_aggregate_data_point(dps, config, heap_type):
 def parse_data_points(filename):
   dps = []; #data-points
   dp = None;
-  state = 0;
+  section = None;
   configs = {}
   k_ways  = {}
   
@@ -85,7 +86,7 @@ def parse_data_points(filename):
       if line.startswith("file_name"):      
         if dp:
           dps.append(dp);
-          state = 0;
+          section = None;
          
         # new data-point 
         dp = DataPoint();
@@ -103,14 +104,21 @@ def parse_data_points(filename):
         dp.nserver = params[0];
         dp.nclient = params[-1];
          
-      elif line.startswith("average"):	# take last 2 averages
-        r = [float(s) for s in line.split(' ') if isFloat(s)]
-        state +=1;
-        #print r, dp #if isFloat(s)
-        if state == 3:
-          dp.total_time_to_add_req = r[0]
-        elif state == 4:
-          dp.total_time_to_complete_req = r[0]
+      # the percentiles lines follow the "total time" line of the
+      # timing they belong to
+      elif line.startswith("total time to add requests"):
+        section = 'add'
+      elif line.startswith("total time to note requests complete"):
+        section = 'complete'
+      elif line.startswith("total time"):
+        section = None
+      elif line.startswith("percentiles"):	# take the p99
+        fields = line.split(' ')
+        p99 = float(fields[fields.index('p99') + 1])
+        if section == 'add':
+          dp.total_time_to_add_req = p99
+        elif section == 'complete':
+          dp.total_time_to_complete_req = p99
         else: pass
 
       else: 
@@ -51,10 +51,10 @@ set key top right
 set yrange [0:*]
 
 # plot 1
-set title 'Request Addition Time'
+set title 'Request Addition Time (p99)'
 plot for [COL=2:($k_way + 1)] '${output_file}.dat' using COL:xticlabels(1) title columnheader
 
 # plot 2
-set title 'Request Completion Time'
+set title 'Request Completion Time (p99)'
 plot for [COL=($k_way + 2):(2 * $k_way + 1)] '${output_file}.dat' using COL:xticlabels(1) title columnheader
 EOF
@@ -0,0 +1,104 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures the per-request cost of adding and pulling requests with
+ * add_requests/pull_requests at several batch sizes, compared with
+ * one add_request and pull_request per request.
+ *
+ * usage: bench_batch [clients] [run_millis]
+ */
+
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+using Queue = dmc::PullPriorityQueue<uint,Request>;
+
+
+// returns ns per request
+template<typename F>
+double measure(uint clients, std::chrono::milliseconds run_time, F cycle) {
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+  Queue queue(client_info_f);
+
+  uint64_t ops = 0;
+  uint client = 0;
+  bench::TimePoint start = bench::Clock::now();
+  bench::TimePoint end = start + run_time;
+  while (bench::Clock::now() < end) {
+    for (int i = 0; i < 100; ++i) {
+      ops += cycle(queue, client);
+      client = (client + 1) % clients;
+    }
+  }
+  return bench::elapsed_ns(start, bench::Clock::now()) / ops;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint clients = bench::arg_or(argc, argv, 1, 100);
+  const std::chrono::milliseconds run_time(bench::arg_or(argc, argv, 2, 1000));
+  const dmc::ReqParams req_params(1, 1);
+
+  std::cout << std::setw(8) << "batch" <<
+    std::setw(14) << "single ns" <<
+    std::setw(14) << "batched ns" <<
+    std::setw(10) << "speedup" << "  (per request)" << std::endl;
+
+  for (size_t batch : {1, 8, 32, 128}) {
+    // the same requests, added and pulled one call at a time
+    double single = measure(
+      clients, run_time,
+      [&] (Queue& q, uint client) -> uint64_t {
+	for (size_t i = 0; i < batch; ++i) {
+	  q.add_request(Request{client}, (client + i) % clients, req_params);
+	}
+	for (size_t i = 0; i < batch; ++i) {
+	  (void) q.pull_request();
+	}
+	return batch;
+      });
+
+    std::vector<Queue::AddReq> adds;
+    std::vector<Queue::PullReq::Retn> pulled;
+    adds.reserve(batch);
+    pulled.reserve(batch);
+
+    double batched = measure(
+      clients, run_time,
+      [&] (Queue& q, uint client) -> uint64_t {
+	adds.clear();
+	for (size_t i = 0; i < batch; ++i) {
+	  adds.emplace_back(Queue::RequestRef(new Request{client}),
+			    (client + i) % clients,
+			    req_params);
+	}
+	q.add_requests(adds.begin(), adds.end());
+	pulled.clear();
+	q.pull_requests(dmc::get_time(), batch, pulled);
+	return batch;
+      });
+
+    std::cout << std::setw(8) << batch <<
+      std::setw(14) << std::fixed << std::setprecision(1) << single <<
+      std::setw(14) << batched <<
+      std::setw(10) << std::setprecision(2) << single / batched << std::endl;
+  }
+}
@@ -0,0 +1,121 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Compares the calendar queue with 2-, 3-, and 4-ary heaps as the
+ * number of elements grows, on the way reservation tags move: the
+ * element with the lowest tag is served and its tag advances by the
+ * inverse of its rate.
+ *
+ * usage: bench_calendar_heap [max_clients] [ops]
+ */
+
+
+#include <random>
+
+#include "indirect_intrusive_heap.h"
+#include "calendar_heap.h"
+
+#include "bench_util.h"
+
+
+namespace c = crimson;
+namespace bench = crimson::dmc_bench;
+
+
+struct Client {
+  double tag;
+  double inv_rate;
+
+  c::IndIntruHeapData heap_data;
+};
+
+
+struct ClientCompare {
+  bool operator()(const Client& c1, const Client& c2) const {
+    return c1.tag < c2.tag;
+  }
+};
+
+
+struct TagKey {
+  double  value;
+  uint8_t rank;
+};
+
+
+struct TagKeyOf {
+  TagKey operator()(const Client& c) const {
+    return TagKey{c.tag, 0};
+  }
+};
+
+
+struct TagKeyCompare {
+  bool operator()(const TagKey& k1, const TagKey& k2) const {
+    return k1.value < k2.value;
+  }
+};
+
+
+template<uint K>
+using Heap = c::IndIntruHeap<Client*,
+			     Client,
+			     &Client::heap_data,
+			     ClientCompare,
+			     K>;
+
+using Calendar = c::CalendarHeap<Client*,
+				 Client,
+				 &Client::heap_data,
+				 TagKeyOf,
+				 TagKeyCompare>;
+
+
+template<typename H>
+double ns_per_op(uint clients, uint ops) {
+  std::mt19937 prng(7);
+  std::vector<Client> data(clients);
+  H heap;
+  for (auto& client : data) {
+    client.inv_rate = 1.0 / (1 + prng() % 100);
+    client.tag = client.inv_rate * (prng() % 1000) / 1000.0;
+    heap.push(&client);
+  }
+
+  bench::TimePoint start = bench::Clock::now();
+  for (uint i = 0; i < ops; ++i) {
+    Client& client = heap.top();
+    client.tag += client.inv_rate;
+    heap.demote(client);
+  }
+  bench::TimePoint end = bench::Clock::now();
+  return bench::elapsed_ns(start, end) / ops;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint max_clients = bench::arg_or(argc, argv, 1, 1000000);
+  const uint ops = bench::arg_or(argc, argv, 2, 2000000);
+
+  std::cout << "ns per operation" << std::endl;
+  std::cout << std::setw(10) << "clients" <<
+    std::setw(10) << "K=2" <<
+    std::setw(10) << "K=3" <<
+    std::setw(10) << "K=4" <<
+    std::setw(10) << "calendar" << std::endl;
+
+  for (uint clients = 1000; clients <= max_clients; clients *= 10) {
+    std::cout << std::setw(10) << clients <<
+      std::fixed << std::setprecision(1) <<
+      std::setw(10) << ns_per_op<Heap<2>>(clients, ops) <<
+      std::setw(10) << ns_per_op<Heap<3>>(clients, ops) <<
+      std::setw(10) << ns_per_op<Heap<4>>(clients, ops) <<
+      std::setw(10) << ns_per_op<Calendar>(clients, ops) << std::endl;
+  }
+}
@@ -0,0 +1,103 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures how long cleaning holds the queue's lock, and the latency
+ * of add_request while it runs, when many clients go idle. Each
+ * client adds and pulls one request, then a few clients keep adding
+ * and pulling while the rest age past the idle age and cleaning
+ * marks them idle. This is repeated with cleaning steps of unlimited
+ * size, limited by client count, limited by time, and piggy-backed
+ * on add and pull calls.
+ *
+ * usage: bench_clean [clients] [run_millis]
+ */
+
+
+#include "dmclock_server.h"
+#include "histogram.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+using Queue = dmc::PullPriorityQueue<uint,Request>;
+
+
+void run(const std::string& name,
+	 const dmc::CleanBudget& budget,
+	 uint clients,
+	 std::chrono::milliseconds run_time) {
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+  const dmc::ReqParams req_params(1, 1);
+  const uint active_clients = 8;
+
+  Queue queue(client_info_f,
+	      std::chrono::milliseconds(200),
+	      std::chrono::milliseconds(3600000),
+	      std::chrono::milliseconds(100),
+	      false,
+	      budget);
+  Request req{0};
+
+  for (uint c = 0; c < clients; ++c) {
+    queue.add_request_time(req, c, req_params, dmc::get_time(), 0.0);
+    (void) queue.pull_request();
+  }
+
+  crimson::Histogram add_hist;
+  uint c = 0;
+  bench::TimePoint end = bench::Clock::now() + run_time;
+  while (bench::Clock::now() < end) {
+    bench::TimePoint start = bench::Clock::now();
+    queue.add_request_time(req, c, req_params, dmc::get_time(), 0.0);
+    add_hist.record(bench::elapsed_ns(start, bench::Clock::now()));
+    (void) queue.pull_request();
+    c = (c + 1) % active_clients;
+  }
+
+  crimson::Histogram hold_hist = queue.clean_hold_histogram();
+  std::cout << std::setw(12) << name <<
+    std::setw(8) << hold_hist.get_count() <<
+    std::setw(10) << hold_hist.get_percentile(50) / 1000.0 <<
+    std::setw(10) << hold_hist.get_percentile(99) / 1000.0 <<
+    std::setw(10) << hold_hist.get_high() / 1000.0 <<
+    std::setw(10) << add_hist.get_percentile(99) / 1000.0 <<
+    std::setw(10) << add_hist.get_percentile(99.99) / 1000.0 <<
+    std::setw(10) << add_hist.get_high() / 1000.0 << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint clients = bench::arg_or(argc, argv, 1, 100000);
+  const std::chrono::milliseconds run_time(bench::arg_or(argc, argv, 2, 1500));
+
+  std::cout << "clients: " << clients << std::endl;
+  std::cout << std::setw(12) << "budget" <<
+    std::setw(8) << "steps" <<
+    std::setw(30) << "hold us p50/p99/max" <<
+    std::setw(30) << "add us p99/p99.99/max" << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+
+  run("unlimited", dmc::CleanBudget(0), clients, run_time);
+  run("1000", dmc::CleanBudget(1000), clients, run_time);
+  run("100us",
+      dmc::CleanBudget(0, std::chrono::microseconds(100)),
+      clients, run_time);
+  run("piggy 100",
+      dmc::CleanBudget(100, std::chrono::microseconds(0), true),
+      clients, run_time);
+}
@@ -0,0 +1,142 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures tenant churn: every request comes from a client the queue
+ * has not seen before, and the cleaner erases clients a couple of
+ * milliseconds after their last request. Reports add+pull operations
+ * per second and heap allocations per operation made by the thread
+ * calling add_request and pull_request (the cleaner's are excluded).
+ *
+ * usage: bench_client_churn [run_millis] [requests_per_client]
+ */
+
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+static thread_local uint64_t allocations = 0;
+
+
+// every form of the global operators is replaced, so each allocation
+// is counted and each is freed by the deallocator that matches it
+
+static void* counted_alloc(size_t size) noexcept {
+  ++allocations;
+  return malloc(size ? size : 1);
+}
+
+
+void* operator new(size_t size) {
+  void* p = counted_alloc(size);
+  if (nullptr == p) throw std::bad_alloc();
+  return p;
+}
+
+
+void* operator new[](size_t size) {
+  void* p = counted_alloc(size);
+  if (nullptr == p) throw std::bad_alloc();
+  return p;
+}
+
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return counted_alloc(size);
+}
+
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return counted_alloc(size);
+}
+
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  free(p);
+}
+
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  free(p);
+}
+
+
+struct Request {
+  uint64_t data;
+};
+
+
+int main(int argc, char* argv[]) {
+  const std::chrono::milliseconds run_time(bench::arg_or(argc, argv, 1, 2000));
+  const uint64_t per_client = bench::arg_or(argc, argv, 2, 1);
+
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint64_t c) -> dmc::ClientInfo { return info; };
+
+  // clients become idle and are erased 2ms after their last request
+  dmc::PullPriorityQueue<uint64_t,Request> queue(client_info_f,
+						 std::chrono::milliseconds(2),
+						 std::chrono::milliseconds(2),
+						 std::chrono::milliseconds(1),
+						 false);
+
+  uint64_t ops = 0;
+  uint64_t client = 0;
+  Request req{0};
+
+  uint64_t start_allocations = allocations;
+  bench::TimePoint start = bench::Clock::now();
+  bench::TimePoint end = start + run_time;
+  while (bench::Clock::now() < end) {
+    for (int i = 0; i < 1000; ++i) {
+      queue.add_request(req, client / per_client);
+      (void) queue.pull_request();
+      ++client;
+      ++ops;
+    }
+  }
+  double secs = bench::elapsed_ns(start, bench::Clock::now()) / 1e9;
+  uint64_t op_allocations = allocations - start_allocations;
+
+  std::cout << "clients created: " << client / per_client << std::endl;
+  std::cout << "clients remaining: " << queue.client_count() << std::endl;
+  std::cout << "ops/s: " << std::fixed << std::setprecision(0) <<
+    ops / secs << std::endl;
+  std::cout << "allocations/op: " << std::setprecision(2) <<
+    double(op_allocations) / ops << std::endl;
+}
@@ -0,0 +1,92 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures how long a cleaning pass takes to erase the oldest of
+ * many clients. The pass is run directly, with mark points made up
+ * rather than waited for, so the result doesn't depend on timing.
+ *
+ * usage: bench_client_erase [clients] [erased]
+ */
+
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+
+class Queue : public dmc::PullPriorityQueue<uint,Request> {
+  using super = dmc::PullPriorityQueue<uint,Request>;
+
+public:
+
+  Queue(super::ClientInfoFunc _client_info_f) :
+    super(_client_info_f)
+  {
+    // empty
+  }
+
+  // runs a whole cleaning pass as though now were when
+  void clean_at(super::TimePoint when) {
+    std::lock_guard<decltype(this->data_mtx)> l(this->data_mtx);
+    this->start_clean(when);
+    while (this->clean_step()) {
+      // empty
+    }
+  }
+
+  super::Duration get_erase_age() const {
+    return this->erase_age;
+  }
+};
+
+
+int main(int argc, char* argv[]) {
+  const uint clients = bench::arg_or(argc, argv, 1, 100000);
+  const uint erased = bench::arg_or(argc, argv, 2, 10000);
+
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+  const dmc::ReqParams req_params(1, 1);
+
+  Queue queue(client_info_f);
+  Request req{0};
+  auto add_clients = [&] (uint first, uint last) {
+    for (uint c = first; c < last; ++c) {
+      queue.add_request_time(req, c, req_params, dmc::get_time(), 0.0);
+      (void) queue.pull_request();
+    }
+  };
+
+  // the first clients are last used before the mark point, the rest
+  // after it
+  add_clients(0, erased);
+  auto mark = std::chrono::steady_clock::now();
+  queue.clean_at(mark);
+  add_clients(erased, clients);
+
+  bench::TimePoint start = bench::Clock::now();
+  queue.clean_at(mark + queue.get_erase_age());
+  bench::TimePoint end = bench::Clock::now();
+
+  double ns = bench::elapsed_ns(start, end);
+  std::cout << "clients: " << clients <<
+    ", erased: " << clients - queue.client_count() << std::endl;
+  std::cout << std::fixed << std::setprecision(1) <<
+    "pass ms: " << ns / 1e6 <<
+    ", ns per client erased: " << ns / erased << std::endl;
+}
@@ -0,0 +1,119 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures insert and lookup costs of the client_map candidates --
+ * std::map, std::unordered_map, and crimson::FlatHashMap -- with the
+ * same mapped type the priority queues use (a shared_ptr to the
+ * client record) at a series of client counts.
+ *
+ * usage: bench_client_map [lookups]
+ */
+
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "flat_hash_map.h"
+
+#include "bench_util.h"
+
+
+namespace c = crimson;
+namespace bench = crimson::dmc_bench;
+
+
+struct ClientRec {
+  uint64_t data;
+};
+
+using ClientRecRef = std::shared_ptr<ClientRec>;
+
+
+struct Result {
+  double insert_ns;
+  double lookup_ns;
+};
+
+
+template<typename M>
+Result measure(const std::vector<uint64_t>& keys,
+	       const std::vector<uint64_t>& lookups) {
+  Result result;
+  M map;
+
+  bench::TimePoint start = bench::Clock::now();
+  for (auto k : keys) {
+    map.emplace(k, ClientRecRef(new ClientRec{k}));
+  }
+  bench::TimePoint end = bench::Clock::now();
+  result.insert_ns = bench::elapsed_ns(start, end) / keys.size();
+
+  uint64_t sum = 0;
+  start = bench::Clock::now();
+  for (auto k : lookups) {
+    sum += map.find(k)->second->data;
+  }
+  end = bench::Clock::now();
+  result.lookup_ns = bench::elapsed_ns(start, end) / lookups.size();
+
+  // keep the lookups from being optimized away
+  if (0 == sum) std::cerr << "unexpected sum" << std::endl;
+
+  return result;
+}
+
+
+int main(int argc, char* argv[]) {
+  const size_t lookup_count = bench::arg_or(argc, argv, 1, 2000000);
+
+  std::cout << std::setw(10) << "clients" <<
+    std::setw(12) << "map ins" <<
+    std::setw(12) << "umap ins" <<
+    std::setw(12) << "flat ins" <<
+    std::setw(12) << "map find" <<
+    std::setw(12) << "umap find" <<
+    std::setw(12) << "flat find" <<
+    "  (ns/op)" << std::endl;
+
+  std::mt19937_64 gen(1);
+
+  for (size_t clients : {1000, 100000, 1000000}) {
+    // client ids are typically small integers handed out in order,
+    // but they arrive in no particular order
+    std::vector<uint64_t> keys(clients);
+    for (size_t i = 0; i < clients; ++i) {
+      keys[i] = i + 1;
+    }
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    std::vector<uint64_t> lookups(lookup_count);
+    std::uniform_int_distribution<size_t> dist(0, clients - 1);
+    for (auto& l : lookups) {
+      l = keys[dist(gen)];
+    }
+
+    Result m = measure<std::map<uint64_t,ClientRecRef>>(keys, lookups);
+    Result u =
+      measure<std::unordered_map<uint64_t,ClientRecRef>>(keys, lookups);
+    Result f = measure<c::FlatHashMap<uint64_t,ClientRecRef>>(keys, lookups);
+
+    std::cout << std::setw(10) << clients <<
+      std::fixed << std::setprecision(1) <<
+      std::setw(12) << m.insert_ns <<
+      std::setw(12) << u.insert_ns <<
+      std::setw(12) << f.insert_ns <<
+      std::setw(12) << m.lookup_ns <<
+      std::setw(12) << u.lookup_ns <<
+      std::setw(12) << f.lookup_ns << std::endl;
+  }
+}
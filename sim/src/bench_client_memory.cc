@@ -0,0 +1,94 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Reports the heap memory a PullPriorityQueue uses per client, as
+ * measured by the allocator, for clients with a given number of
+ * queued requests and after those requests have been pulled.
+ *
+ * usage: bench_client_memory [clients] [max_requests_per_client]
+ */
+
+
+#include <stdlib.h>
+#include <malloc.h>
+
+#include <new>
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+static std::atomic<int64_t> live_bytes(0);
+
+
+void* operator new(size_t size) {
+  void* p = malloc(size ? size : 1);
+  if (nullptr == p) throw std::bad_alloc();
+  live_bytes += malloc_usable_size(p);
+  return p;
+}
+
+
+void operator delete(void* p) noexcept {
+  live_bytes -= malloc_usable_size(p);
+  free(p);
+}
+
+
+void operator delete(void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+
+struct Request {
+  uint64_t data;
+};
+
+
+int main(int argc, char* argv[]) {
+  const uint64_t clients = bench::arg_or(argc, argv, 1, 100000);
+  const uint64_t max_requests = bench::arg_or(argc, argv, 2, 4);
+
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint64_t c) -> dmc::ClientInfo { return info; };
+
+  std::cout << std::setw(10) << "requests" <<
+    std::setw(18) << "active bytes" <<
+    std::setw(18) << "idle bytes" <<
+    "  (per client)" << std::endl;
+
+  for (uint64_t requests = 1; requests <= max_requests; requests *= 2) {
+    int64_t before = live_bytes;
+    {
+      dmc::PullPriorityQueue<uint64_t,Request> queue(client_info_f);
+
+      Request req{0};
+      for (uint64_t c = 0; c < clients; ++c) {
+	for (uint64_t r = 0; r < requests; ++r) {
+	  queue.add_request(req, c);
+	}
+      }
+      int64_t active = live_bytes - before;
+
+      while (queue.pull_request().is_retn()) {
+	// empty
+      }
+      int64_t idle = live_bytes - before;
+
+      std::cout << std::setw(10) << requests <<
+	std::setw(18) << active / clients <<
+	std::setw(18) << idle / clients << std::endl;
+    }
+  }
+}
@@ -0,0 +1,59 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures the cost of reading each clock policy a queue can time
+ * requests with.
+ *
+ * usage: bench_clock [reads]
+ */
+
+
+#include "dmclock_util.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+template<typename Clock>
+void report(const char* name, uint reads) {
+  // warm up, which also calibrates TscClock
+  bench::TimePoint warm_end =
+    bench::Clock::now() + std::chrono::milliseconds(50);
+  while (bench::Clock::now() < warm_end) {
+    Clock::now();
+  }
+
+  dmc::Time sum = dmc::TimeZero;
+  bench::TimePoint start = bench::Clock::now();
+  for (uint i = 0; i < reads; ++i) {
+    sum += Clock::now();
+  }
+  bench::TimePoint end = bench::Clock::now();
+
+  std::cout << std::setw(14) << name <<
+    std::fixed << std::setprecision(1) <<
+    std::setw(10) << bench::elapsed_ns(start, end) / reads <<
+    // keeps the reads from being optimized away
+    (sum == dmc::TimeZero ? " " : "") << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint reads = bench::arg_or(argc, argv, 1, 10000000);
+
+  std::cout << std::setw(14) << "clock" << std::setw(10) << "ns/read" <<
+    std::endl;
+  report<dmc::WallClock>("WallClock", reads);
+  report<dmc::SteadyClock>("SteadyClock", reads);
+  report<dmc::CoarseClock>("CoarseClock", reads);
+  report<dmc::TscClock>("TscClock", reads);
+}
@@ -0,0 +1,106 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures the cost of pulling a request and adding a replacement
+ * for the same client, as the number of clients grows, along with
+ * cache misses and instructions per operation where hardware
+ * counters are available. This is built three times:
+ * bench_heap_layout_keys keeps comparison keys inline in the heaps
+ * (USE_INLINE_HEAP_KEYS=1), bench_heap_layout_calendar keeps the
+ * reservation and limit orderings in calendar queues
+ * (USE_CALENDAR_HEAPS=1), and bench_heap_layout does neither.
+ *
+ * usage: bench_heap_layout [max_clients] [ops]
+ */
+
+
+#include <random>
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+using Queue = dmc::PullPriorityQueue<uint,Request>;
+
+
+int main(int argc, char* argv[]) {
+  const uint max_clients = bench::arg_or(argc, argv, 1, 100000);
+  const uint ops = bench::arg_or(argc, argv, 2, 1000000);
+  const uint queued = 4;
+
+  std::cout << "inline heap keys: " <<
+    (USE_INLINE_HEAP_KEYS ? "yes" : "no") << std::endl;
+  std::cout << "calendar heaps: " <<
+    (USE_CALENDAR_HEAPS ? "yes" : "no") << std::endl;
+  std::cout << std::setw(10) << "clients" <<
+    std::setw(10) << "ns/op" <<
+    std::setw(14) << "misses/op" <<
+    std::setw(14) << "instrs/op" << std::endl;
+
+  for (uint clients = 1000; clients <= max_clients; clients *= 10) {
+    // varied weights and some reservations, so clients are spread
+    // through the heaps
+    std::vector<dmc::ClientInfo> infos;
+    std::mt19937 prng(7);
+    for (uint c = 0; c < clients; ++c) {
+      infos.emplace_back(c % 4 ? 0.0 : 1.0, 1.0 + prng() % 100, 0.0);
+    }
+    auto client_info_f = [&] (uint c) -> dmc::ClientInfo {
+      return infos[c];
+    };
+    const dmc::ReqParams req_params(1, 1);
+
+    Queue queue(client_info_f);
+    Request req{0};
+    dmc::Time now = dmc::get_time();
+    for (uint i = 0; i < queued; ++i) {
+      for (uint c = 0; c < clients; ++c) {
+	queue.add_request_time(req, c, req_params, now, 0.0);
+      }
+    }
+
+    bench::PerfCounter misses(PERF_COUNT_HW_CACHE_MISSES);
+    bench::PerfCounter instrs(PERF_COUNT_HW_INSTRUCTIONS);
+    uint64_t misses_start = misses.read();
+    uint64_t instrs_start = instrs.read();
+    bench::TimePoint start = bench::Clock::now();
+    for (uint i = 0; i < ops; ++i) {
+      Queue::PullReq pr = queue.pull_request(now);
+      assert(Queue::NextReqType::returning == pr.type);
+      queue.add_request_time(req, pr.get_retn().client, req_params, now, 0.0);
+    }
+    bench::TimePoint end = bench::Clock::now();
+    uint64_t misses_used = misses.read() - misses_start;
+    uint64_t instrs_used = instrs.read() - instrs_start;
+
+    std::cout << std::setw(10) << clients <<
+      std::fixed << std::setprecision(1) <<
+      std::setw(10) << bench::elapsed_ns(start, end) / ops;
+    if (misses.valid()) {
+      std::cout << std::setw(14) << double(misses_used) / ops;
+    } else {
+      std::cout << std::setw(14) << "n/a";
+    }
+    if (instrs.valid()) {
+      std::cout << std::setw(14) << double(instrs_used) / ops;
+    } else {
+      std::cout << std::setw(14) << "n/a";
+    }
+    std::cout << std::endl;
+  }
+}
@@ -0,0 +1,67 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures the latency of add_request when it makes an idle client
+ * active, as the number of clients known to the queue grows. Each
+ * such add has to find the lowest proportion tag of the active
+ * clients. This is built twice: bench_idle_clients uses the
+ * prop_heap and bench_idle_clients_scan walks every client.
+ *
+ * usage: bench_idle_clients [max_clients] [reactivations]
+ */
+
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+
+int main(int argc, char* argv[]) {
+  const uint max_clients = bench::arg_or(argc, argv, 1, 100000);
+  const uint reactivations = bench::arg_or(argc, argv, 2, 1000);
+
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+
+  std::cout << "prop_heap: " << (USE_PROP_HEAP ? "yes" : "no") << std::endl;
+  std::cout << std::setw(10) << "clients" <<
+    std::setw(16) << "ns/reactivate" << std::endl;
+
+  for (uint clients = 1000; clients <= max_clients; clients *= 10) {
+    dmc::PullPriorityQueue<uint,Request> queue(client_info_f);
+    Request req{0};
+
+    // every client has been active once but has nothing queued
+    for (uint c = 0; c < clients; ++c) {
+      queue.add_request(req, c);
+      (void) queue.pull_request();
+    }
+
+    // each of these clients is new, and therefore idle when it adds
+    // its first request
+    bench::TimePoint start = bench::Clock::now();
+    for (uint i = 0; i < reactivations; ++i) {
+      queue.add_request(req, clients + i);
+    }
+    bench::TimePoint end = bench::Clock::now();
+
+    std::cout << std::setw(10) << clients <<
+      std::setw(16) << std::fixed << std::setprecision(1) <<
+      bench::elapsed_ns(start, end) / reactivations << std::endl;
+  }
+}
@@ -0,0 +1,112 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures how long producers spend in PushPriorityQueue::add_request
+ * when handle_f takes a while, with and without ingress mode.
+ *
+ * usage: bench_push_ingress [producers] [handle_nanos] [run_millis]
+ */
+
+
+#include <algorithm>
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+using Queue = dmc::PushPriorityQueue<uint,Request>;
+
+
+void spin_for(std::chrono::nanoseconds d) {
+  bench::TimePoint end = bench::Clock::now() + d;
+  while (bench::Clock::now() < end) {
+    // empty
+  }
+}
+
+
+void measure(const char* name, bool use_ingress, uint producers,
+	     std::chrono::nanoseconds handle_time,
+	     std::chrono::milliseconds run_time) {
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  std::atomic<uint64_t> handled(0);
+
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+  auto can_handle_f = [] () -> bool { return true; };
+  auto handle_f = [&] (const uint& c,
+		       std::unique_ptr<Request> req,
+		       dmc::PhaseType phase) {
+    spin_for(handle_time);
+    ++handled;
+  };
+
+  Queue queue(client_info_f, can_handle_f, handle_f, false, use_ingress);
+
+  std::vector<double> total_ns(producers, 0.0);
+  std::vector<double> max_ns(producers, 0.0);
+
+  double rate = bench::run_threads(
+    producers, run_time,
+    [&] (uint thread_idx, const std::atomic_bool& stop) -> uint64_t {
+      uint64_t ops = 0;
+      Request req{thread_idx};
+      const dmc::ReqParams req_params(1, 1);
+      while (!stop) {
+	bench::TimePoint start = bench::Clock::now();
+	queue.add_request(req, thread_idx, req_params);
+	double ns = bench::elapsed_ns(start, bench::Clock::now());
+	total_ns[thread_idx] += ns;
+	max_ns[thread_idx] = std::max(max_ns[thread_idx], ns);
+	++ops;
+	// keep producers from running arbitrarily far ahead of the
+	// requests being handled
+	while (!stop && handled + 1000 < ops * producers) {
+	  std::this_thread::yield();
+	}
+      }
+      return ops;
+    });
+
+  double total = 0.0;
+  double max = 0.0;
+  for (uint i = 0; i < producers; ++i) {
+    total += total_ns[i];
+    max = std::max(max, max_ns[i]);
+  }
+  double ops = rate * run_time.count() / 1000.0;
+
+  std::cout << std::setw(10) << name <<
+    std::setw(14) << std::fixed << std::setprecision(0) << rate <<
+    std::setw(14) << std::setprecision(1) << total / ops <<
+    std::setw(14) << std::setprecision(0) << max << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint producers = bench::arg_or(argc, argv, 1, 4);
+  const std::chrono::nanoseconds handle_time(bench::arg_or(argc, argv, 2, 2000));
+  const std::chrono::milliseconds run_time(bench::arg_or(argc, argv, 3, 1000));
+
+  std::cout << std::setw(10) << "mode" <<
+    std::setw(14) << "adds/s" <<
+    std::setw(14) << "mean add ns" <<
+    std::setw(14) << "max add ns" << std::endl;
+
+  measure("locked", false, producers, handle_time, run_time);
+  measure("ingress", true, producers, handle_time, run_time);
+}
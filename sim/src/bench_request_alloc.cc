@@ -0,0 +1,125 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Compares add_request of a copied request with emplace_request of a
+ * request type derived from crimson::PooledObject, reporting add+pull
+ * operations per second and heap allocations per operation.
+ *
+ * usage: bench_request_alloc [clients] [run_millis]
+ */
+
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+static thread_local uint64_t allocations = 0;
+
+
+// kept out of line so the compiler does not pair the inlined malloc
+// and free with the pool's operator new and delete
+__attribute__((noinline)) void* operator new(size_t size) {
+  ++allocations;
+  void* p = malloc(size ? size : 1);
+  if (nullptr == p) throw std::bad_alloc();
+  return p;
+}
+
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  free(p);
+}
+
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+
+struct Request {
+  uint64_t data[4];
+
+  Request(uint64_t d) : data{d, d, d, d} {}
+};
+
+
+struct PooledRequest : public crimson::PooledObject<PooledRequest> {
+  uint64_t data[4];
+
+  PooledRequest(uint64_t d) : data{d, d, d, d} {}
+};
+
+
+template<typename R, typename F>
+void measure(const char* name, uint clients,
+	     std::chrono::milliseconds run_time, F add) {
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+  dmc::PullPriorityQueue<uint,R> queue(client_info_f);
+  const dmc::ReqParams req_params(1, 1);
+
+  // prime the queue so each client has been seen and each later add
+  // has a request of its own to replace
+  for (uint c = 0; c < clients; ++c) {
+    add(queue, c, req_params, c);
+  }
+
+  uint64_t ops = 0;
+  uint client = 0;
+  uint64_t start_allocations = allocations;
+  bench::TimePoint start = bench::Clock::now();
+  bench::TimePoint end = start + run_time;
+  while (bench::Clock::now() < end) {
+    for (int i = 0; i < 1000; ++i) {
+      add(queue, client, req_params, ops);
+      (void) queue.pull_request();
+      client = (client + 1) % clients;
+      ++ops;
+    }
+  }
+  double secs = bench::elapsed_ns(start, bench::Clock::now()) / 1e9;
+
+  std::cout << std::setw(24) << name <<
+    std::setw(14) << std::fixed << std::setprecision(0) << ops / secs <<
+    std::setw(16) << std::setprecision(2) <<
+    double(allocations - start_allocations) / ops << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint clients = bench::arg_or(argc, argv, 1, 100);
+  const std::chrono::milliseconds run_time(bench::arg_or(argc, argv, 2, 1000));
+
+  std::cout << std::setw(24) << "path" <<
+    std::setw(14) << "ops/s" <<
+    std::setw(16) << "allocs/op" << std::endl;
+
+  measure<Request>(
+    "add_request copy", clients, run_time,
+    [] (dmc::PullPriorityQueue<uint,Request>& q, uint c,
+	const dmc::ReqParams& p, uint64_t d) {
+      q.add_request(Request(d), c, p);
+    });
+
+  measure<PooledRequest>(
+    "emplace_request pooled", clients, run_time,
+    [] (dmc::PullPriorityQueue<uint,PooledRequest>& q, uint c,
+	const dmc::ReqParams& p, uint64_t d) {
+      q.emplace_request(c, p, d);
+    });
+}
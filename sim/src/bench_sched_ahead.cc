@@ -0,0 +1,136 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures how accurately many PushPriorityQueues wake up to hand
+ * over requests that only become ready in the future, and the CPU
+ * time and threads that takes. Each queue always holds one request
+ * due a random 1 to max_delay_millis milliseconds ahead; when it is
+ * handled the next one is added.
+ *
+ * usage: bench_sched_ahead [queues] [max_delay_millis] [run_millis]
+ */
+
+
+#include <sys/resource.h>
+
+#include <mutex>
+#include <random>
+#include <fstream>
+#include <algorithm>
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  dmc::Time due;
+};
+
+using Queue = dmc::PushPriorityQueue<uint,Request>;
+
+
+double cpu_seconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+
+uint thread_count() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (0 == line.compare(0, 8, "Threads:")) {
+      return std::stoul(line.substr(8));
+    }
+  }
+  return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint queue_count = bench::arg_or(argc, argv, 1, 256);
+  const uint max_delay = bench::arg_or(argc, argv, 2, 20);
+  const std::chrono::milliseconds run_time(bench::arg_or(argc, argv, 3, 2000));
+
+  // the reservation and limit are high enough not to delay requests
+  // beyond the time they are added for
+  dmc::ClientInfo info(1000000.0, 0.0, 1000000.0);
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+  auto can_handle_f = [] () -> bool { return true; };
+  const dmc::ReqParams req_params(1, 1);
+
+  std::mutex mtx;
+  std::mt19937 prng(17);
+  std::uniform_real_distribution<double> delay_dist(0.001, max_delay / 1000.0);
+  std::vector<double> lateness_us;
+  std::atomic_bool stop(false);
+
+  std::vector<std::unique_ptr<Queue>> queues(queue_count);
+
+  auto add_next = [&] (uint q) {
+    double delay;
+    {
+      std::lock_guard<std::mutex> l(mtx);
+      delay = delay_dist(prng);
+    }
+    dmc::Time due = dmc::get_time() + delay;
+    queues[q]->add_request_time(Request{due}, 0, req_params, due, 0.0);
+  };
+
+  uint threads_before = thread_count();
+  for (uint q = 0; q < queue_count; ++q) {
+    auto handle_f = [&, q] (const uint& c,
+			    std::unique_ptr<Request> req,
+			    dmc::PhaseType phase) {
+      double late = 1e6 * (dmc::get_time() - req->due);
+      {
+	std::lock_guard<std::mutex> l(mtx);
+	lateness_us.push_back(late);
+      }
+      if (!stop) {
+	add_next(q);
+      }
+    };
+    queues[q].reset(new Queue(client_info_f, can_handle_f, handle_f));
+  }
+  uint threads_added = thread_count() - threads_before;
+
+  double cpu_start = cpu_seconds();
+  for (uint q = 0; q < queue_count; ++q) {
+    add_next(q);
+  }
+  std::this_thread::sleep_for(run_time);
+  stop = true;
+  double cpu_used = cpu_seconds() - cpu_start;
+  queues.clear();
+
+  std::sort(lateness_us.begin(), lateness_us.end());
+  double total = 0.0;
+  for (auto l : lateness_us) {
+    total += l;
+  }
+  size_t n = lateness_us.size();
+
+  std::cout << "queues: " << queue_count <<
+    ", threads added: " << threads_added << std::endl;
+  std::cout << "wakeups: " << n << std::fixed << std::setprecision(1) <<
+    ", lateness us mean: " << total / n <<
+    ", p50: " << lateness_us[n / 2] <<
+    ", p99: " << lateness_us[n * 99 / 100] <<
+    ", max: " << lateness_us[n - 1] << std::endl;
+  std::cout << "cpu seconds: " << std::setprecision(3) << cpu_used <<
+    " over " << run_time.count() / 1000.0 << " seconds" << std::endl;
+}
@@ -0,0 +1,89 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Compares the two client scheduling indexes, the reservation, ready,
+ * and limit heaps and the single tournament tree, by the cost of
+ * pulling a request and adding a replacement for the same client as
+ * the number of clients grows. Some clients have reservations and
+ * some have limits, so all three orderings change.
+ *
+ * usage: bench_sched_index [max_clients] [ops]
+ */
+
+
+#include <random>
+
+#include "dmclock_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+
+template<dmc::SchedIndex S>
+double ns_per_op(uint clients, uint ops) {
+  using Queue = dmc::PullPriorityQueue<uint,Request,2,S>;
+  const uint queued = 4;
+
+  std::vector<dmc::ClientInfo> infos;
+  std::mt19937 prng(7);
+  for (uint c = 0; c < clients; ++c) {
+    infos.emplace_back(c % 4 ? 0.0 : 1.0,
+		       1.0 + prng() % 100,
+		       c % 3 ? 0.0 : 1000.0 + prng() % 1000);
+  }
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo {
+    return infos[c];
+  };
+  const dmc::ReqParams req_params(1, 1);
+
+  Queue queue(client_info_f, true);
+  Request req{0};
+  dmc::Time now = dmc::get_time();
+  for (uint i = 0; i < queued; ++i) {
+    for (uint c = 0; c < clients; ++c) {
+      queue.add_request_time(req, c, req_params, now, 0.0);
+    }
+  }
+
+  bench::TimePoint start = bench::Clock::now();
+  for (uint i = 0; i < ops; ++i) {
+    typename Queue::PullReq pr = queue.pull_request(now);
+    assert(Queue::NextReqType::returning == pr.type);
+    queue.add_request_time(req, pr.get_retn().client, req_params, now, 0.0);
+  }
+  bench::TimePoint end = bench::Clock::now();
+  return bench::elapsed_ns(start, end) / ops;
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint max_clients = bench::arg_or(argc, argv, 1, 100000);
+  const uint ops = bench::arg_or(argc, argv, 2, 1000000);
+
+  std::cout << std::setw(10) << "clients" <<
+    std::setw(14) << "heaps ns/op" <<
+    std::setw(18) << "tournament ns/op" << std::endl;
+
+  for (uint clients = 1000; clients <= max_clients; clients *= 10) {
+    double heaps = ns_per_op<dmc::SchedIndex::heaps>(clients, ops);
+    double tournament = ns_per_op<dmc::SchedIndex::tournament>(clients, ops);
+    std::cout << std::setw(10) << clients <<
+      std::fixed << std::setprecision(1) <<
+      std::setw(14) << heaps <<
+      std::setw(18) << tournament << std::endl;
+  }
+}
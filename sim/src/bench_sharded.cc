@@ -0,0 +1,80 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Measures add_request + pull_request throughput as the number of
+ * threads grows, comparing PullPriorityQueue against
+ * ShardedPullPriorityQueue with one shard per thread.
+ *
+ * usage: bench_sharded [max_threads] [clients] [run_millis]
+ */
+
+
+#include "dmclock_server.h"
+#include "dmclock_sharded_server.h"
+
+#include "bench_util.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace bench = crimson::dmc_bench;
+
+
+struct Request {
+  uint64_t data;
+};
+
+
+template<typename Q>
+double measure(Q& queue, uint threads, uint clients,
+	       std::chrono::milliseconds run_time) {
+  return bench::run_threads(
+    threads, run_time,
+    [&] (uint thread_idx, const std::atomic_bool& stop) -> uint64_t {
+      uint64_t ops = 0;
+      uint client = thread_idx;
+      Request req{thread_idx};
+      while (!stop) {
+	queue.add_request(req, client);
+	(void) queue.pull_request();
+	client = (client + threads) % clients;
+	++ops;
+      }
+      return ops;
+    });
+}
+
+
+int main(int argc, char* argv[]) {
+  const uint max_threads = bench::arg_or(argc, argv, 1, 16);
+  const uint clients = bench::arg_or(argc, argv, 2, 1000);
+  const std::chrono::milliseconds run_time(bench::arg_or(argc, argv, 3, 1000));
+
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+  auto client_info_f = [&] (uint c) -> dmc::ClientInfo { return info; };
+
+  std::cout << std::setw(8) << "threads" <<
+    std::setw(16) << "pull ops/s" <<
+    std::setw(16) << "sharded ops/s" <<
+    std::setw(10) << "speedup" << std::endl;
+
+  for (uint threads = 1; threads <= max_threads; threads *= 2) {
+    dmc::PullPriorityQueue<uint,Request> pull_q(client_info_f);
+    double pull_rate = measure(pull_q, threads, clients, run_time);
+
+    dmc::ShardedPullPriorityQueue<uint,Request> sharded_q(client_info_f,
+							  threads);
+    double sharded_rate = measure(sharded_q, threads, clients, run_time);
+
+    std::cout << std::setw(8) << threads <<
+      std::setw(16) << std::fixed << std::setprecision(0) << pull_rate <<
+      std::setw(16) << sharded_rate <<
+      std::setw(10) << std::setprecision(2) << sharded_rate / pull_rate <<
+      std::endl;
+  }
+}
@@ -0,0 +1,124 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <iostream>
+#include <functional>
+
+
+namespace crimson {
+  namespace dmc_bench {
+
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    inline double elapsed_ns(const TimePoint& start, const TimePoint& end) {
+      return double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		      end - start).count());
+    }
+
+    // runs code, which is handed its thread index and a flag that
+    // turns true when the run time is up and which returns how many
+    // operations it completed, on thread_count threads at once;
+    // returns total operations per second
+    inline double run_threads(uint thread_count,
+			      std::chrono::milliseconds run_time,
+			      std::function<uint64_t(uint,
+						     const std::atomic_bool&)> code) {
+      std::atomic_bool stop(false);
+      std::atomic_uint started(0);
+      std::vector<uint64_t> ops(thread_count, 0);
+      std::vector<std::thread> threads;
+
+      for (uint i = 0; i < thread_count; ++i) {
+	threads.emplace_back([&, i] () {
+	    ++started;
+	    while (started < thread_count) {
+	      std::this_thread::yield();
+	    }
+	    ops[i] = code(i, stop);
+	  });
+      }
+
+      while (started < thread_count) {
+	std::this_thread::yield();
+      }
+      TimePoint start = Clock::now();
+      std::this_thread::sleep_for(run_time);
+      stop = true;
+      for (auto& t : threads) {
+	t.join();
+      }
+      TimePoint end = Clock::now();
+
+      uint64_t total = 0;
+      for (auto o : ops) {
+	total += o;
+      }
+      return total / (elapsed_ns(start, end) / 1e9);
+    }
+
+    // returns the integer value of the command-line argument at
+    // index or the default if it wasn't provided
+    inline long arg_or(int argc, char* argv[], int index, long def) {
+      return index < argc ? strtol(argv[index], nullptr, 10) : def;
+    }
+
+
+    // counts a hardware event (e.g., PERF_COUNT_HW_CACHE_MISSES) in
+    // user space for the calling thread; where the kernel or
+    // hardware doesn't provide it, valid() is false and read()
+    // returns 0
+    class PerfCounter {
+      int fd;
+
+    public:
+
+      PerfCounter(uint64_t config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+
+      ~PerfCounter() {
+	if (fd >= 0) {
+	  close(fd);
+	}
+      }
+
+      bool valid() const { return fd >= 0; }
+
+      uint64_t read() const {
+	uint64_t value = 0;
+	if (fd < 0 || sizeof(value) != ::read(fd, &value, sizeof(value))) {
+	  return 0;
+	}
+	return value;
+      }
+    }; // class PerfCounter
+  } // namespace dmc_bench
+} // namespace crimson
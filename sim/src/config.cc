@@ -130,6 +130,10 @@ int crimson::qos_simulation::parse_config_file(const std::string &fname, sim_con
     g_conf.server_random_selection = stobool(val);
   if (!cf.read("global", "server_soft_limit", val))
     g_conf.server_soft_limit = stobool(val);
+  if (!cf.read("global", "server_max_per_pass", val))
+    g_conf.server_max_per_pass = std::stoul(val);
+  if (!cf.read("global", "server_async_dispatch", val))
+    g_conf.server_async_dispatch = stobool(val);
 
   for (uint i = 0; i < g_conf.server_groups; i++) {
     srv_group_t st;
@@ -140,6 +144,8 @@ int crimson::qos_simulation::parse_config_file(const std::string &fname, sim_con
       st.server_iops = std::stoul(val);
     if (!cf.read(section, "server_threads", val))
       st.server_threads = std::stoul(val);
+    if (!cf.read(section, "server_handle_latency", val))
+      st.server_handle_latency = std::chrono::microseconds(std::stoul(val));
     g_conf.srv_group.push_back(st);
   }
 
@@ -73,13 +73,16 @@ namespace crimson {
       uint server_count;
       uint server_iops;
       uint server_threads;
+      std::chrono::microseconds server_handle_latency;
 
       srv_group_t(uint _server_count = 100,
 		  uint _server_iops = 40,
-		  uint _server_threads = 1) :
+		  uint _server_threads = 1,
+		  uint _server_handle_latency = 0) :
 	server_count(_server_count),
 	server_iops(_server_iops),
-	server_threads(_server_threads)
+	server_threads(_server_threads),
+	server_handle_latency(std::chrono::microseconds(_server_handle_latency))
       {
 	// empty
       }
@@ -89,7 +92,9 @@ namespace crimson {
 	out <<
 	  "server_count = " << srv_group.server_count << "\n" <<
 	  "server_iops = " << srv_group.server_iops << "\n" <<
-	  "server_threads = " << srv_group.server_threads;
+	  "server_threads = " << srv_group.server_threads << "\n" <<
+	  "server_handle_latency = " <<
+	  srv_group.server_handle_latency.count();
 	return out;
       }
     }; // class srv_group_t
@@ -100,6 +105,8 @@ namespace crimson {
       uint client_groups;
       bool server_random_selection;
       bool server_soft_limit;
+      uint server_max_per_pass;
+      bool server_async_dispatch;
 
       std::vector<cli_group_t> cli_group;
       std::vector<srv_group_t> srv_group;
@@ -107,11 +114,15 @@ namespace crimson {
       sim_config_t(uint _server_groups = 1,
 		   uint _client_groups = 1,
 		   bool _server_random_selection = false,
-		   bool _server_soft_limit = true) :
+		   bool _server_soft_limit = true,
+		   uint _server_max_per_pass = 1,
+		   bool _server_async_dispatch = false) :
 	server_groups(_server_groups),
 	client_groups(_client_groups),
 	server_random_selection(_server_random_selection),
-	server_soft_limit(_server_soft_limit)
+	server_soft_limit(_server_soft_limit),
+	server_max_per_pass(_server_max_per_pass),
+	server_async_dispatch(_server_async_dispatch)
       {
 	srv_group.reserve(server_groups);
 	cli_group.reserve(client_groups);
@@ -123,7 +134,9 @@ namespace crimson {
 	  "server_groups = " << sim_config.server_groups << "\n" <<
 	  "client_groups = " << sim_config.client_groups << "\n" <<
 	  "server_random_selection = " << sim_config.server_random_selection << "\n" <<
-	  "server_soft_limit = " << sim_config.server_soft_limit;
+	  "server_soft_limit = " << sim_config.server_soft_limit << "\n" <<
+	  "server_max_per_pass = " << sim_config.server_max_per_pass << "\n" <<
+	  "server_async_dispatch = " << sim_config.server_async_dispatch;
 	return out;
       }
     }; // class sim_config_t
@@ -74,6 +74,8 @@ namespace crimson {
 	std::mutex mtx;
 	std::chrono::nanoseconds track_resp_time;
 	std::chrono::nanoseconds get_req_params_time;
+	Histogram track_resp_hist;
+	Histogram get_req_params_hist;
 	uint32_t track_resp_count;
 	uint32_t get_req_params_count;
 
@@ -234,6 +236,7 @@ namespace crimson {
 		time_stats_w_return<decltype(internal_stats.get_req_params_time),
 				    ReqPm>(internal_stats.mtx,
 					   internal_stats.get_req_params_time,
+					   internal_stats.get_req_params_hist,
 					   [&]() -> ReqPm {
 					     return service_tracker.get_req_params(server);
 					   });
@@ -291,6 +294,7 @@ namespace crimson {
 
 	    time_stats(internal_stats.mtx,
 		       internal_stats.track_resp_time,
+		       internal_stats.track_resp_hist,
 		       [&](){
 			 service_tracker.track_resp(item.server_id, item.resp_params);
 		       });
@@ -22,6 +22,8 @@
 #include <mutex>
 #include <iostream>
 
+#include "histogram.h"
+
 
 using ClientId = uint;
 using ServerId = uint;
@@ -34,9 +36,11 @@ namespace crimson {
       raise(SIGCONT);
     }
 
+    // the histogram records each duration in units of T
     template<typename T>
     void time_stats(std::mutex& mtx,
 		    T& time_accumulate,
+		    Histogram& time_hist,
 		    std::function<void()> code) {
       auto t1 = std::chrono::steady_clock::now();
       code();
@@ -45,6 +49,7 @@ namespace crimson {
       auto cast_duration = std::chrono::duration_cast<T>(duration);
       std::lock_guard<std::mutex> lock(mtx);
       time_accumulate += cast_duration;
+      time_hist.record(cast_duration.count());
     }
 
     // unfortunately it's hard for the compiler to infer the types,
@@ -53,6 +58,7 @@ namespace crimson {
     template<typename T, typename R>
     R time_stats_w_return(std::mutex& mtx,
 			  T& time_accumulate,
+			  Histogram& time_hist,
 			  std::function<R()> code) {
       auto t1 = std::chrono::steady_clock::now();
       R result = code();
@@ -61,9 +67,23 @@ namespace crimson {
       auto cast_duration = std::chrono::duration_cast<T>(duration);
       std::lock_guard<std::mutex> lock(mtx);
       time_accumulate += cast_duration;
+      time_hist.record(cast_duration.count());
       return result;
     }
 
+    // one line listing the percentiles of a histogram of durations,
+    // e.g., "    percentiles: p50 1200 p90 ... nanoseconds"
+    inline void display_percentiles(std::ostream& out,
+				    const Histogram& hist,
+				    const std::string& time_unit) {
+      out << "    percentiles:" <<
+	" p50 " << hist.get_percentile(50) <<
+	" p90 " << hist.get_percentile(90) <<
+	" p99 " << hist.get_percentile(99) <<
+	" p99.9 " << hist.get_percentile(99.9) <<
+	" " << time_unit << std::endl;
+    }
+
     template<typename T>
     void count_stats(std::mutex& mtx,
 		     T& counter) {
@@ -14,6 +14,7 @@
 #include <condition_variable>
 #include <chrono>
 #include <deque>
+#include <algorithm>
 
 #include "sim_recs.h"
 
@@ -45,15 +46,27 @@ namespace crimson {
       struct InternalStats {
 	std::mutex mtx;
 	std::chrono::nanoseconds add_request_time;
+	std::chrono::nanoseconds add_request_max_time;
 	std::chrono::nanoseconds request_complete_time;
+	Histogram add_request_hist;
+	Histogram request_complete_hist;
+	// time worker threads wait for their next request after
+	// finishing one, i.e., how long a freed slot stays unfilled
+	std::chrono::nanoseconds worker_idle_time;
+	std::chrono::nanoseconds worker_idle_max_time;
 	uint32_t add_request_count;
 	uint32_t request_complete_count;
+	uint32_t worker_idle_count;
 
 	InternalStats() :
 	  add_request_time(0),
+	  add_request_max_time(0),
 	  request_complete_time(0),
+	  worker_idle_time(0),
+	  worker_idle_max_time(0),
 	  add_request_count(0),
-	  request_complete_count(0)
+	  request_complete_count(0),
+	  worker_idle_count(0)
 	{
 	  // empty
 	}
@@ -77,6 +90,9 @@ namespace crimson {
 
       bool                           finishing;
       std::chrono::microseconds      op_time;
+      // time the queue's handle function takes before handing the
+      // request to the thread pool, to model a slow server callback
+      std::chrono::microseconds      handle_latency;
 
       std::mutex                     inner_queue_mtx;
       std::condition_variable        inner_queue_cv;
@@ -107,7 +123,9 @@ namespace crimson {
 		      size_t _thread_pool_size,
 		      const ClientRespFunc& _client_resp_f,
 		      const ServerAccumFunc& _accum_f,
-		      CreateQueueF _create_queue_f) :
+		      CreateQueueF _create_queue_f,
+		      std::chrono::microseconds _handle_latency =
+		      std::chrono::microseconds(0)) :
 	id(_id),
 	priority_queue(_create_queue_f(std::bind(&SimulatedServer::has_avail_thread,
 						 this),
@@ -120,6 +138,7 @@ namespace crimson {
 	iops(_iops),
 	thread_pool_size(_thread_pool_size),
 	finishing(false),
+	handle_latency(_handle_latency),
 	accum_f(_accum_f)
       {
 	op_time =
@@ -149,13 +168,18 @@ namespace crimson {
 		const ClientId& client_id,
 		const ReqPm& req_params)
       {
-	time_stats(internal_stats.mtx,
-		   internal_stats.add_request_time,
-		   [&](){
-		     priority_queue->add_request(request, client_id, req_params);
-		   });
-	count_stats(internal_stats.mtx,
-		    internal_stats.add_request_count);
+	auto t1 = std::chrono::steady_clock::now();
+	priority_queue->add_request(request, client_id, req_params);
+	auto t2 = std::chrono::steady_clock::now();
+	auto duration =
+	  std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
+
+	std::lock_guard<std::mutex> lock(internal_stats.mtx);
+	internal_stats.add_request_time += duration;
+	internal_stats.add_request_max_time =
+	  std::max(internal_stats.add_request_max_time, duration);
+	internal_stats.add_request_hist.record(duration.count());
+	++internal_stats.add_request_count;
       }
 
       bool has_avail_thread() {
@@ -172,6 +196,10 @@ namespace crimson {
       void inner_post(const ClientId& client,
 		      std::unique_ptr<TestRequest> request,
 		      const RespPm& additional) {
+	if (handle_latency.count() > 0) {
+	  std::this_thread::sleep_for(handle_latency);
+	}
+
 	Lock l(inner_queue_mtx);
 	assert(!finishing);
 	accum_f(accumulator, additional);
@@ -183,11 +211,27 @@ namespace crimson {
 
       void run(std::chrono::milliseconds check_period) {
 	Lock l(inner_queue_mtx);
+	bool worked = false;
 	while(true) {
-	  while(inner_queue.empty() && !finishing) {
-	    inner_queue_cv.wait_for(l, check_period);
+	  if (inner_queue.empty() && !finishing) {
+	    auto idle_start = std::chrono::steady_clock::now();
+	    while(inner_queue.empty() && !finishing) {
+	      inner_queue_cv.wait_for(l, check_period);
+	    }
+	    // the wait before the first request is start-up, not a gap
+	    // in refilling the slot
+	    if (worked && !inner_queue.empty()) {
+	      auto idle = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - idle_start);
+	      std::lock_guard<std::mutex> g(internal_stats.mtx);
+	      internal_stats.worker_idle_time += idle;
+	      internal_stats.worker_idle_max_time =
+		std::max(internal_stats.worker_idle_max_time, idle);
+	      ++internal_stats.worker_idle_count;
+	    }
 	  }
 	  if (!inner_queue.empty()) {
+	    worked = true;
 	    auto& front = inner_queue.front();
 	    auto client = front.client;
 	    auto req = std::move(front.request);
@@ -207,6 +251,7 @@ namespace crimson {
 
 	    time_stats(internal_stats.mtx,
 		       internal_stats.request_complete_time,
+		       internal_stats.request_complete_hist,
 		       [&](){
 			 priority_queue->request_completed();
 		       });
@@ -12,6 +12,7 @@
 #include <assert.h>
 
 #include <memory>
+#include <algorithm>
 #include <chrono>
 #include <map>
 #include <random>
@@ -19,6 +20,8 @@
 #include <iomanip>
 #include <string>
 
+#include "sim_recs.h"
+
 
 namespace crimson {
   namespace qos_simulation {
@@ -289,19 +292,36 @@ namespace crimson {
       void display_server_internal_stats(std::ostream& out,
 					 std::string time_unit) {
 	T add_request_time(0);
+	T add_request_max_time(0);
 	T request_complete_time(0);
+	T worker_idle_time(0);
+	T worker_idle_max_time(0);
+	Histogram add_request_hist;
+	Histogram request_complete_hist;
 	uint32_t add_request_count = 0;
 	uint32_t request_complete_count = 0;
+	uint32_t worker_idle_count = 0;
 
 	for (uint i = 0; i < get_server_count(); ++i) {
 	  const auto& server = get_server(i);
 	  const auto& is = server.get_internal_stats();
 	  add_request_time +=
 	    std::chrono::duration_cast<T>(is.add_request_time);
+	  add_request_max_time =
+	    std::max(add_request_max_time,
+		     std::chrono::duration_cast<T>(is.add_request_max_time));
 	  request_complete_time +=
 	    std::chrono::duration_cast<T>(is.request_complete_time);
+	  add_request_hist.merge(is.add_request_hist);
+	  request_complete_hist.merge(is.request_complete_hist);
+	  worker_idle_time +=
+	    std::chrono::duration_cast<T>(is.worker_idle_time);
+	  worker_idle_max_time =
+	    std::max(worker_idle_max_time,
+		     std::chrono::duration_cast<T>(is.worker_idle_max_time));
 	  add_request_count += is.add_request_count;
 	  request_complete_count += is.request_complete_count;
+	  worker_idle_count += is.worker_idle_count;
 	}
 
 	double add_request_time_per_unit =
@@ -312,6 +332,9 @@ namespace crimson {
 	  "    count: " << add_request_count << ";" << std::endl <<
 	  "    average: " << add_request_time_per_unit <<
 	  " " << time_unit << " per request/response" << std::endl;
+	display_percentiles(out, add_request_hist, time_unit);
+	out << "    max: " << add_request_max_time.count() <<
+	  " " << time_unit << std::endl;
 
 	double request_complete_time_unit =
 	  double(request_complete_time.count()) / request_complete_count ;
@@ -321,6 +344,20 @@ namespace crimson {
 	  "    count: " << request_complete_count << ";" << std::endl <<
 	  "    average: " << request_complete_time_unit <<
 	  " " << time_unit << " per request/response" << std::endl;
+	display_percentiles(out, request_complete_hist, time_unit);
+
+	double worker_idle_time_unit =
+	  worker_idle_count ?
+	  double(worker_idle_time.count()) / worker_idle_count :
+	  0.0;
+	out << "total time server workers waited to be refilled: " <<
+	  std::fixed << worker_idle_time.count() << " " << time_unit << ";" <<
+	  std::endl <<
+	  "    count: " << worker_idle_count << ";" << std::endl <<
+	  "    average: " << worker_idle_time_unit << " " << time_unit <<
+	  " per wait" << std::endl <<
+	  "    max: " << worker_idle_max_time.count() <<
+	  " " << time_unit << std::endl;
 
 	out << std::endl;
 
@@ -336,6 +373,8 @@ namespace crimson {
 					 std::string time_unit) {
 	T track_resp_time(0);
 	T get_req_params_time(0);
+	Histogram track_resp_hist;
+	Histogram get_req_params_hist;
 	uint32_t track_resp_count = 0;
 	uint32_t get_req_params_count = 0;
 
@@ -346,6 +385,8 @@ namespace crimson {
 	    std::chrono::duration_cast<T>(is.track_resp_time);
 	  get_req_params_time +=
 	    std::chrono::duration_cast<T>(is.get_req_params_time);
+	  track_resp_hist.merge(is.track_resp_hist);
+	  get_req_params_hist.merge(is.get_req_params_hist);
 	  track_resp_count += is.track_resp_count;
 	  get_req_params_count += is.get_req_params_count;
 	}
@@ -358,6 +399,7 @@ namespace crimson {
 	  "    count: " << track_resp_count << ";" << std::endl <<
 	  "    average: " << track_resp_time_unit << " " << time_unit <<
 	  " per request/response" << std::endl;
+	display_percentiles(out, track_resp_hist, time_unit);
 
 	double get_req_params_time_unit =
 	  double(get_req_params_time.count()) / get_req_params_count;
@@ -367,6 +409,7 @@ namespace crimson {
 	  "    count: " << get_req_params_count << ";" << std::endl <<
 	  "    average: " << get_req_params_time_unit << " " << time_unit <<
 	  " per request/response" << std::endl;
+	display_percentiles(out, get_req_params_hist, time_unit);
 
 	out << std::endl;
 
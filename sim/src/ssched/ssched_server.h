@@ -15,9 +15,7 @@
 
 #include "ssched_recs.h"
 
-#ifdef PROFILE
 #include "profile.h"
-#endif
 
 namespace crimson {
 
@@ -70,15 +68,11 @@ namespace crimson {
 
       std::deque<QRequest> queue;
 
-#ifdef PROFILE
     public:
-      ProfileTimer<std::chrono::nanoseconds> pull_request_timer;
-      ProfileTimer<std::chrono::nanoseconds> add_request_timer;
-      ProfileTimer<std::chrono::nanoseconds> request_complete_timer;
-    protected:
-#endif
+      crimson::ConcurrentProfile<std::chrono::nanoseconds> pull_request_timer;
+      crimson::ConcurrentProfile<std::chrono::nanoseconds> add_request_timer;
+      crimson::ConcurrentProfile<std::chrono::nanoseconds> request_complete_timer;
 
-    public:
 
       // push full constructor
       SimpleQueue(CanHandleRequestFunc _can_handle_f,
@@ -110,43 +104,28 @@ namespace crimson {
 		       const C& client_id,
 		       const ReqParams& req_params) {
 	DataGuard g(queue_mtx);
+	crimson::ProfileScope<std::chrono::nanoseconds> p(add_request_timer);
 
-#ifdef PROFILE
-	add_request_timer.start();
-#endif
 	queue.emplace_back(QRequest{client_id, std::move(request)});
 
 	if (Mechanism::push == mechanism) {
 	  schedule_request();
 	}
-
-#ifdef PROFILE
-	add_request_timer.stop();
-#endif
       } // add_request
 
       void request_completed() {
 	assert(Mechanism::push == mechanism);
 	DataGuard g(queue_mtx);
+	crimson::ProfileScope<std::chrono::nanoseconds> p(request_complete_timer);
 
-#ifdef PROFILE
-	request_complete_timer.start();
-#endif
 	schedule_request();
-
-#ifdef PROFILE
-	request_complete_timer.stop();
-#endif
       } // request_completed
 
       PullReq pull_request() {
 	assert(Mechanism::pull == mechanism);
 	PullReq result;
 	DataGuard g(queue_mtx);
-
-#ifdef PROFILE
-	pull_request_timer.start();
-#endif
+	crimson::ProfileScope<std::chrono::nanoseconds> p(pull_request_timer);
 
 	if (queue.empty()) {
 	  result.type = PullReq::Type::none;
@@ -158,10 +137,6 @@ namespace crimson {
 	  queue.pop();
 	}
 
-#ifdef PROFILE
-	pull_request_timer.stop();
-#endif
-
 	return result;
       }
 
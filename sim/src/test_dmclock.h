@@ -28,7 +28,48 @@ namespace crimson {
       uint64_t proportion_count = 0;
     };
 
-    using DmcQueue = dmc::PushPriorityQueue<ClientId,sim::TestRequest>;
+    // the simulated server's handle function may sleep, to model a
+    // slow callback, so each queue runs its handed off passes on a
+    // work service of its own rather than on the process-wide one,
+    // whose workers are shared; the service is a base so it's
+    // constructed before the queue and destructed after it
+    struct DmcWorkService {
+      crimson::WorkService work_service;
+
+      DmcWorkService() : work_service(1) {}
+    };
+
+    class DmcQueue :
+      private DmcWorkService,
+      public dmc::PushPriorityQueue<ClientId,sim::TestRequest> {
+
+      using super = dmc::PushPriorityQueue<ClientId,sim::TestRequest>;
+
+    public:
+
+      DmcQueue(super::ClientInfoFunc client_info_f,
+	       CanHandleRequestFunc can_handle_f,
+	       HandleRequestFunc handle_f,
+	       bool allow_limit_break,
+	       uint max_per_pass,
+	       bool async_dispatch) :
+	super(client_info_f,
+	      can_handle_f,
+	      handle_f,
+	      std::chrono::minutes(10),
+	      std::chrono::minutes(15),
+	      std::chrono::minutes(6),
+	      allow_limit_break,
+	      false,
+	      max_per_pass,
+	      dmc::CleanBudget(),
+	      std::chrono::microseconds(0),
+	      work_service,
+	      async_dispatch)
+      {
+	// empty
+      }
+    };
 
     using DmcServer = sim::SimulatedServer<DmcQueue,
 					   dmc::ReqParams,
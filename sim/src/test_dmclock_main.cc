@@ -9,9 +9,7 @@
 #include "test_dmclock.h"
 #include "config.h"
 
-#ifdef PROFILE
 #include "profile.h"
-#endif
 
 
 namespace dmc = crimson::dmclock;
@@ -74,6 +72,8 @@ int main(int argc, char* argv[]) {
     const uint client_groups = g_conf.client_groups;
     const bool server_random_selection = g_conf.server_random_selection;
     const bool server_soft_limit = g_conf.server_soft_limit;
+    const uint server_max_per_pass = g_conf.server_max_per_pass;
+    const bool server_async_dispatch = g_conf.server_async_dispatch;
     uint server_total_count = 0;
     uint client_total_count = 0;
 
@@ -176,7 +176,10 @@ int main(int argc, char* argv[]) {
     test::CreateQueueF create_queue_f =
         [&](test::DmcQueue::CanHandleRequestFunc can_f,
             test::DmcQueue::HandleRequestFunc handle_f) -> test::DmcQueue* {
-        return new test::DmcQueue(client_info_f, can_f, handle_f, server_soft_limit);
+        return new test::DmcQueue(client_info_f, can_f, handle_f,
+                                  server_soft_limit,
+                                  server_max_per_pass,
+                                  server_async_dispatch);
     };
 
  
@@ -187,7 +190,8 @@ int main(int argc, char* argv[]) {
 				 srv_group[i].server_threads,
 				 client_response_f,
 				 test::dmc_server_accumulate_f,
-				 create_queue_f);
+				 create_queue_f,
+				 srv_group[i].server_handle_latency);
     };
 
     auto create_client_f = [&](ClientId id) -> test::DmcClient* {
@@ -295,28 +299,22 @@ void test::server_data(std::ostream& out,
 	" k-way heap: " << q.get_heap_branching_factor() << std::endl
 	<< std::endl;
 
-#ifdef PROFILE
+    // the queues' timers record only when profiling is on (see
+    // set_profiling), so there's nothing to show otherwise
     crimson::ProfileCombiner<std::chrono::nanoseconds> art_combiner;
     crimson::ProfileCombiner<std::chrono::nanoseconds> rct_combiner;
     for (uint i = 0; i < sim->get_server_count(); ++i) {
       const auto& q = sim->get_server(i).get_priority_queue();
-      const auto& art = q.add_request_timer;
-      art_combiner.combine(art);
-      const auto& rct = q.request_complete_timer;
-      rct_combiner.combine(rct);
+      art_combiner.combine(q.add_request_timer.get());
+      rct_combiner.combine(q.request_complete_timer.get());
+    }
+    if (art_combiner.get_count() > 0 || rct_combiner.get_count() > 0) {
+      out << "Server add_request_timer: ";
+      art_combiner.display(out) << std::endl;
+      out << "Server request_complete_timer: ";
+      rct_combiner.display(out) << std::endl;
+      out << "Server combined mean: " <<
+	(art_combiner.get_mean() + rct_combiner.get_mean()) <<
+	std::endl;
     }
-    out << "Server add_request_timer: count:" << art_combiner.get_count() <<
-      ", mean:" << art_combiner.get_mean() <<
-      ", std_dev:" << art_combiner.get_std_dev() <<
-      ", low:" << art_combiner.get_low() <<
-      ", high:" << art_combiner.get_high() << std::endl;
-    out << "Server request_complete_timer: count:" << rct_combiner.get_count() <<
-      ", mean:" << rct_combiner.get_mean() <<
-      ", std_dev:" << rct_combiner.get_std_dev() <<
-      ", low:" << rct_combiner.get_low() <<
-      ", high:" << rct_combiner.get_high() << std::endl;
-    out << "Server combined mean: " <<
-      (art_combiner.get_mean() + rct_combiner.get_mean()) <<
-      std::endl;
-#endif
 }
@@ -17,17 +17,58 @@
  * original behavior, define DO_NOT_DELAY_TAG_CALC (i.e., compiler
  * argument -DDO_NOT_DELAY_TAG_CALC).
  *
- * The prop_heap does not seem to be necessary. The only thing it
- * would help with is quickly finding the mininum proportion/prioity
- * when an idle client became active. To have the code maintain the
- * proportional heap, define USE_PROP_HEAP (i.e., compiler argument
- * -DUSE_PROP_HEAP).
+ * The prop_heap is used to quickly find the mininum
+ * proportion/prioity among the non-idle clients when an idle client
+ * becomes active, which otherwise requires a walk of every client. It
+ * is maintained by default. To instead walk the clients, define
+ * USE_PROP_HEAP as 0 (i.e., compiler argument -DUSE_PROP_HEAP=0).
+ *
+ * Each client record holds up to INLINE_REQUESTS of its queued
+ * requests without a separate allocation; clients with more queued
+ * requests move them to the heap. It defaults to 2 and can be set
+ * with, e.g., -DINLINE_REQUESTS=4.
+ *
+ * The reservation, limit, and ready heaps normally compare clients by
+ * following each one to the tag of its first request. Defining
+ * USE_INLINE_HEAP_KEYS as 1 instead has those heaps keep each
+ * client's comparison key (the tag plus any prop_delta, and whether
+ * it is ready) inline in the heap's vector, refreshed whenever the
+ * client moves in the heap (i.e., compiler argument
+ * -DUSE_INLINE_HEAP_KEYS=1).
+ *
+ * Defining USE_CALENDAR_HEAPS as 1 keeps the reservation and limit
+ * orderings in calendar queues bucketed by tag rather than in heaps,
+ * since those tags mostly advance with time (i.e., compiler argument
+ * -DUSE_CALENDAR_HEAPS=1). It applies to SchedIndex::heaps.
+ *
+ * The queues time add_request, pull_request, and request_completed
+ * when profiling is turned on with set_profiling, and push queues
+ * count their clock reads (see clock_stats) only then too. It starts
+ * on when PROFILE is defined (i.e., compiler argument -DPROFILE) and
+ * off otherwise; when off, the timers read no clock.
  */
 
+#ifndef USE_PROP_HEAP
+#define USE_PROP_HEAP 1
+#endif
+
+#ifndef INLINE_REQUESTS
+#define INLINE_REQUESTS 2
+#endif
+
+#ifndef USE_INLINE_HEAP_KEYS
+#define USE_INLINE_HEAP_KEYS 0
+#endif
+
+#ifndef USE_CALENDAR_HEAPS
+#define USE_CALENDAR_HEAPS 0
+#endif
+
 #include <assert.h>
 
 #include <cmath>
 #include <memory>
+#include <vector>
 #include <map>
 #include <deque>
 #include <queue>
@@ -42,13 +83,23 @@
 #include <boost/variant.hpp>
 
 #include "indirect_intrusive_heap.h"
+#include "indirect_intrusive_key_heap.h"
+#include "indirect_intrusive_tournament.h"
+#include "calendar_heap.h"
+#include "flat_hash_map.h"
+#include "object_pool.h"
+#include "ring_buffer.h"
+#include "pooled_object.h"
+#include "mpsc_queue.h"
+#include "timer_wheel.h"
+#include "work_service.h"
 #include "run_every.h"
+#include "histogram.h"
+#include "stat_mutex.h"
 #include "dmclock_util.h"
 #include "dmclock_recs.h"
 
-#ifdef PROFILE
 #include "profile.h"
-#endif
 
 #include "gtest/gtest_prod.h"
 
@@ -57,35 +108,57 @@ namespace crimson {
 
   namespace dmclock {
 
+    DMCLOCK_DECLARE_TEST(dmclock_server, client_idle_erase);
+    DMCLOCK_DECLARE_TEST(dmclock_server, idle_client_prop_delta);
+    DMCLOCK_DECLARE_TEST(dmclock_server, client_clean_steps);
+    DMCLOCK_DECLARE_TEST(dmclock_server, client_clean_piggyback);
+    DMCLOCK_DECLARE_TEST(dmclock_server, snapshot_during_clean);
+    DMCLOCK_DECLARE_TEST(dmclock_server_pull, pull_sched_index);
+    DMCLOCK_DECLARE_TEST(dmclock_integer_time, calendar_heaps);
+
+  // see DMCLOCK_INTEGER_TIME in dmclock_util.h
+  DMCLOCK_TIME_NS_BEGIN
+
     namespace c = crimson;
 
-    constexpr double max_tag = std::numeric_limits<double>::is_iec559 ?
-      std::numeric_limits<double>::infinity() :
-      std::numeric_limits<double>::max();
-    constexpr double min_tag = std::numeric_limits<double>::is_iec559 ?
-      -std::numeric_limits<double>::infinity() :
-      std::numeric_limits<double>::lowest();
+    constexpr Time max_tag = std::numeric_limits<Time>::has_infinity ?
+      std::numeric_limits<Time>::infinity() :
+      std::numeric_limits<Time>::max();
+    constexpr Time min_tag = std::numeric_limits<Time>::has_infinity ?
+      -std::numeric_limits<Time>::infinity() :
+      std::numeric_limits<Time>::lowest();
     constexpr uint tag_modulo = 1000000;
 
+    // adds delta to tag, leaving max_tag and min_tag as they are (as
+    // infinite doubles do by themselves)
+    inline Time tag_add(Time tag, Time delta) {
+#if DMCLOCK_INTEGER_TIME
+      return (max_tag == tag || min_tag == tag) ? tag : tag + delta;
+#else
+      return tag + delta;
+#endif
+    }
+
     struct ClientInfo {
       const double reservation;  // minimum
       const double weight;       // proportional
       const double limit;        // maximum
 
       // multiplicative inverses of above, which we use in calculations
-      // and don't want to recalculate repeatedly
-      const double reservation_inv;
-      const double weight_inv;
-      const double limit_inv;
+      // and don't want to recalculate repeatedly; these are the
+      // amounts of Time each request advances a tag by
+      const Time reservation_inv;
+      const Time weight_inv;
+      const Time limit_inv;
 
       // order parameters -- min, "normal", max
       ClientInfo(double _reservation, double _weight, double _limit) :
 	reservation(_reservation),
 	weight(_weight),
 	limit(_limit),
-	reservation_inv(0.0 == reservation ? 0.0 : 1.0 / reservation),
-	weight_inv(     0.0 == weight      ? 0.0 : 1.0 / weight),
-	limit_inv(      0.0 == limit       ? 0.0 : 1.0 / limit)
+	reservation_inv(inverse(reservation)),
+	weight_inv(     inverse(weight)),
+	limit_inv(      inverse(limit))
       {
 	// empty
       }
@@ -103,28 +176,33 @@ namespace crimson {
 	  " }";
 	return out;
       }
+
+    private:
+
+      static Time inverse(double rate) {
+	return 0.0 == rate ? TimeZero : seconds_to_time(1.0 / rate);
+      }
     }; // class ClientInfo
 
 
     struct RequestTag {
-      double reservation;
-      double proportion;
-      double limit;
+      Time   reservation;
+      Time   proportion;
+      Time   limit;
       bool   ready; // true when within limit
-#ifndef DO_NOT_DELAY_TAG_CALC
       Time   arrival;
-#endif
 
       RequestTag(const RequestTag& prev_tag,
 		 const ClientInfo& client,
 		 const ReqParams& req_params,
 		 const Time& time,
 		 const double cost = 0.0) :
-	reservation(cost + tag_calc(time,
-				    prev_tag.reservation,
-				    client.reservation_inv,
-				    req_params.rho,
-				    true)),
+	reservation(tag_add(tag_calc(time,
+				     prev_tag.reservation,
+				     client.reservation_inv,
+				     req_params.rho,
+				     true),
+			    seconds_to_time(cost))),
 	proportion(tag_calc(time,
 			    prev_tag.proportion,
 			    client.weight_inv,
@@ -135,22 +213,18 @@ namespace crimson {
 		       client.limit_inv,
 		       req_params.delta,
 		       false)),
-	ready(false)
-#ifndef DO_NOT_DELAY_TAG_CALC
-	, arrival(time)
-#endif
+	ready(false),
+	arrival(time)
       {
 	assert(reservation < max_tag || proportion < max_tag);
       }
 
-      RequestTag(double _res, double _prop, double _lim, const Time& _arrival) :
+      RequestTag(Time _res, Time _prop, Time _lim, const Time& _arrival) :
 	reservation(_res),
 	proportion(_prop),
 	limit(_lim),
-	ready(false)
-#ifndef DO_NOT_DELAY_TAG_CALC
-	, arrival(_arrival)
-#endif
+	ready(false),
+	arrival(_arrival)
       {
 	assert(reservation < max_tag || proportion < max_tag);
       }
@@ -159,15 +233,15 @@ namespace crimson {
 	reservation(other.reservation),
 	proportion(other.proportion),
 	limit(other.limit),
-	ready(other.ready)
-#ifndef DO_NOT_DELAY_TAG_CALC
-	, arrival(other.arrival)
-#endif
+	ready(other.ready),
+	arrival(other.arrival)
       {
 	// empty
       }
 
-      static std::string format_tag_change(double before, double after) {
+      RequestTag& operator=(const RequestTag&) = default;
+
+      static std::string format_tag_change(Time before, Time after) {
 	if (before == after) {
 	  return std::string("same");
 	} else {
@@ -177,7 +251,7 @@ namespace crimson {
 	}
       }
 
-      static std::string format_tag(double value) {
+      static std::string format_tag(Time value) {
 	if (max_tag == value) {
 	  return std::string("max");
 	} else if (min_tag == value) {
@@ -189,12 +263,12 @@ namespace crimson {
 
     private:
 
-      static double tag_calc(const Time& time,
-			     double prev,
-			     double increment,
-			     uint32_t dist_req_val,
-			     bool extreme_is_high) {
-	if (0.0 == increment) {
+      static Time tag_calc(const Time& time,
+			   Time prev,
+			   Time increment,
+			   uint32_t dist_req_val,
+			   bool extreme_is_high) {
+	if (TimeZero == increment) {
 	  return extreme_is_high ? max_tag : min_tag;
 	} else {
 	  if (0 != dist_req_val) {
@@ -212,9 +286,7 @@ namespace crimson {
 	  " p:" << format_tag(tag.proportion) <<
 	  " l:" << format_tag(tag.limit) <<
 #if 0 // try to resolve this to make sure Time is operator<<'able.
-#ifndef DO_NOT_DELAY_TAG_CALC
 	  " arrival:" << tag.arrival <<
-#endif
 #endif
 	  " }";
 	return out;
@@ -222,16 +294,175 @@ namespace crimson {
     }; // class RequestTag
 
 
+    // Limits how long a cleaning step holds data_mtx. Cleaning walks
+    // every client in steps; each step visits at most clients clients
+    // (0 for no limit) and stops early once time has passed (0 for
+    // no limit). Steps normally run back to back on the cleaning
+    // job, releasing data_mtx between them. With piggyback there is
+    // no cleaning job; instead add and pull calls each run a step
+    // while one is due, and start a new pass every check_time.
+    struct CleanBudget {
+      uint                      clients;
+      std::chrono::microseconds time;
+      bool                      piggyback;
+
+      CleanBudget(uint _clients = 1000,
+		  std::chrono::microseconds _time = std::chrono::microseconds(0),
+		  bool _piggyback = false) :
+	clients(_clients),
+	time(_time),
+	piggyback(_piggyback)
+      {
+	// empty
+      }
+    }; // struct CleanBudget
+
+
+    // A queue's statistics, as returned by stats(). Waits are in
+    // nanoseconds of the queue's time, from the time a request was
+    // added with to the time it was pulled or scheduled at. The lock
+    // statistics are those of data_mtx.
+    struct QueueStats {
+      // requests dispatched in each phase; those dispatched by
+      // breaking limits are also counted in their phase
+      uint64_t          reservation_count = 0;
+      uint64_t          priority_count = 0;
+      uint64_t          limit_break_count = 0;
+
+      // gauges: requests queued, and clients with requests queued
+      uint64_t          queued = 0;
+      uint64_t          backlogged_clients = 0;
+
+      c::Histogram      reservation_wait;
+      c::Histogram      priority_wait;
+      // how many requests a client had queued, seen at each add
+      c::Histogram      backlog;
+
+      c::StatMutex::Stats lock = c::StatMutex::Stats();
+
+      // adds in another queue's statistics, such as another shard's
+      void merge(const QueueStats& other) {
+	reservation_count += other.reservation_count;
+	priority_count += other.priority_count;
+	limit_break_count += other.limit_break_count;
+	queued += other.queued;
+	backlogged_clients += other.backlogged_clients;
+	reservation_wait.merge(other.reservation_wait);
+	priority_wait.merge(other.priority_wait);
+	backlog.merge(other.backlog);
+	lock.locks += other.lock.locks;
+	lock.contended += other.lock.contended;
+	lock.wait.merge(other.lock.wait);
+	lock.hold.merge(other.lock.hold);
+      }
+    }; // struct QueueStats
+
+
+    // Where a client stood when captured in a snapshot: with no
+    // requests queued; with its next request's reservation tag due;
+    // with its next request within limit; or held back by its limit.
+    enum class ClientPhase { empty, reservation, priority, limited };
+
+    inline std::ostream& operator<<(std::ostream& out,
+				    const ClientPhase& phase) {
+      switch (phase) {
+      case ClientPhase::empty:       return out << "empty";
+      case ClientPhase::reservation: return out << "reservation";
+      case ClientPhase::priority:    return out << "priority";
+      default:                       return out << "limited";
+      }
+    }
+
+
+    // One client's state, as returned in a QueueSnapshot.
+    template<typename C>
+    struct ClientSnapshot {
+      C           client;
+      ClientInfo  info;
+      RequestTag  prev_tag;      // tag of the most recently added request
+      RequestTag  next_tag;      // tag of the next request, if any
+      Time        prop_delta;
+      size_t      request_count;
+      bool        idle;
+      ClientPhase phase;
+    };
+
+
+    // The clients of a queue, as returned by snapshot(). Each client's
+    // entry is consistent, but the entries are captured in batches
+    // with the queue running between them, so clients added during
+    // the snapshot may be missing and those erased may be absent.
+    template<typename C>
+    struct QueueSnapshot {
+      Time                           time; // the time phases are as of
+      std::vector<ClientSnapshot<C>> clients;
+
+      // adds in another queue's clients, such as another shard's;
+      // ClientInfo can't be assigned, so they're appended one by one
+      void merge(QueueSnapshot&& other) {
+	clients.reserve(clients.size() + other.clients.size());
+	for (auto& c : other.clients) {
+	  clients.push_back(std::move(c));
+	}
+      }
+    }; // struct QueueSnapshot
+
+
+    // Identifies a group of requests that can be removed together with
+    // cancel, such as those of one epoch or placement group; requests
+    // added with no_cancel_key aren't in any group.
+    using CancelKey = uint64_t;
+    constexpr CancelKey no_cancel_key = 0;
+
+
+    // Selects how a queue keeps its clients ordered by reservation,
+    // limit, and proportion tags for scheduling: in three heaps, or in
+    // one tournament tree that replays each change to a client once
+    // for all three orderings.
+    enum class SchedIndex { heaps, tournament };
+
+
     // C is client identifier type, R is request type, B is heap
-    // branching factor
-    template<typename C, typename R, uint B>
+    // branching factor, S is the scheduling index, H is the hash of
+    // client identifiers used by client_map
+    template<typename C, typename R, uint B, SchedIndex S,
+	     typename H = std::hash<C>>
     class PriorityQueueBase {
-      FRIEND_TEST(dmclock_server, client_idle_erase);
+      DMCLOCK_FRIEND_TEST(dmclock_server, client_idle_erase);
+      DMCLOCK_FRIEND_TEST(dmclock_server, idle_client_prop_delta);
+      DMCLOCK_FRIEND_TEST(dmclock_server, client_clean_steps);
+      DMCLOCK_FRIEND_TEST(dmclock_server, client_clean_piggyback);
+      DMCLOCK_FRIEND_TEST(dmclock_server, snapshot_during_clean);
+      DMCLOCK_FRIEND_TEST(dmclock_server_pull, pull_sched_index);
+      DMCLOCK_FRIEND_TEST(dmclock_integer_time, calendar_heaps);
 
     public:
 
       using RequestRef = std::unique_ptr<R>;
 
+      // one of the requests passed to add_requests
+      struct AddReq {
+	RequestRef request;
+	C          client_id;
+	ReqParams  req_params;
+	double     addl_cost;
+	CancelKey  cancel_key;
+
+	AddReq(RequestRef&&     _request,
+	       const C&         _client_id,
+	       const ReqParams& _req_params,
+	       double           _addl_cost = 0.0,
+	       CancelKey        _cancel_key = no_cancel_key) :
+	  request(std::move(_request)),
+	  client_id(_client_id),
+	  req_params(_req_params),
+	  addl_cost(_addl_cost),
+	  cancel_key(_cancel_key)
+	{
+	  // empty
+	}
+      };
+
     protected:
 
       using TimePoint = decltype(std::chrono::steady_clock::now());
@@ -241,7 +472,7 @@ namespace crimson {
       enum class ReadyOption {ignore, lowers, raises};
 
       // forward decl for friend decls
-      template<double RequestTag::*, ReadyOption, bool>
+      template<Time RequestTag::*, ReadyOption, bool>
       struct ClientCompare;
 
       class ClientReq {
@@ -250,15 +481,18 @@ namespace crimson {
 	RequestTag tag;
 	C          client_id;
 	RequestRef request;
+	CancelKey  cancel_key;
 
       public:
 
 	ClientReq(const RequestTag& _tag,
 		  const C&          _client_id,
-		  RequestRef&&      _request) :
+		  RequestRef&&      _request,
+		  CancelKey         _cancel_key) :
 	  tag(_tag),
 	  client_id(_client_id),
-	  request(std::move(_request))
+	  request(std::move(_request)),
+	  cancel_key(_cancel_key)
 	{
 	  // empty
 	}
@@ -273,20 +507,25 @@ namespace crimson {
     public:
 
       // NOTE: ClientRec is in the "public" section for compatibility
-      // with g++ 4.8.4, which complains if it's not. By g++ 6.3.1
-      // ClientRec could be "protected" with no issue. [See comments
-      // associated with function submit_top_request.]
+      // with g++ 4.8.4, which complained when it was used in the
+      // derived classes' templated member functions if it was not. By
+      // g++ 6.3.1 ClientRec could be "protected" with no issue.
       class ClientRec {
-	friend PriorityQueueBase<C,R,B>;
+	friend PriorityQueueBase<C,R,B,S,H>;
+	DMCLOCK_FRIEND_TEST(dmclock_server, snapshot_during_clean);
 
 	C                     client;
 	RequestTag            prev_tag;
-	std::deque<ClientReq> requests;
+	// most clients have only a few outstanding requests, which are
+	// stored inside the ClientRec
+	c::RingBuffer<ClientReq,INLINE_REQUESTS> requests;
 
 	// amount added from the proportion tag as a result of
 	// an idle client becoming unidle
-	double                prop_delta = 0.0;
+	Time                  prop_delta = TimeZero;
 
+	// with SchedIndex::tournament, reserv_heap_data holds the
+	// client's leaf in the tournament tree instead
 	c::IndIntruHeapData   reserv_heap_data;
 	c::IndIntruHeapData   lim_heap_data;
 	c::IndIntruHeapData   ready_heap_data;
@@ -294,6 +533,9 @@ namespace crimson {
 	c::IndIntruHeapData   prop_heap_data;
 #endif
 
+	// next in the list of all clients that cleaning walks
+	ClientRec*            clean_next = nullptr;
+
       public:
 
 	ClientInfo            info;
@@ -306,7 +548,7 @@ namespace crimson {
 		  const ClientInfo& _info,
 		  Counter current_tick) :
 	  client(_client),
-	  prev_tag(0.0, 0.0, 0.0, TimeZero),
+	  prev_tag(TimeZero, TimeZero, TimeZero, TimeZero),
 	  info(_info),
 	  idle(true),
 	  last_tick(current_tick),
@@ -320,7 +562,7 @@ namespace crimson {
 	  return prev_tag;
 	}
 
-	static inline void assign_unpinned_tag(double& lhs, const double rhs) {
+	static inline void assign_unpinned_tag(Time& lhs, const Time rhs) {
 	  if (rhs != max_tag && rhs != min_tag) {
 	    lhs = rhs;
 	  }
@@ -336,8 +578,10 @@ namespace crimson {
 
 	inline void add_request(const RequestTag& tag,
 				const C&          client_id,
-				RequestRef&&      request) {
-	  requests.emplace_back(ClientReq(tag, client_id, std::move(request)));
+				RequestRef&&      request,
+				CancelKey         cancel_key) {
+	  requests.emplace_back(
+	    ClientReq(tag, client_id, std::move(request), cancel_key));
 	}
 
 	inline const ClientReq& next_request() const {
@@ -356,57 +600,22 @@ namespace crimson {
 	  return !requests.empty();
 	}
 
-	inline size_t request_count() const {
-	  return requests.size();
-	}
-
-	// NB: because a deque is the underlying structure, this
-	// operation might be expensive
-	bool remove_by_req_filter_fw(std::function<bool(const R&)> filter_accum) {
-	  bool any_removed = false;
-	  for (auto i = requests.begin();
-	       i != requests.end();
-	       /* no inc */) {
-	    if (filter_accum(*i->request)) {
-	      any_removed = true;
-	      i = requests.erase(i);
-	    } else {
-	      ++i;
-	    }
-	  }
-	  return any_removed;
-	}
-
-	// NB: because a deque is the underlying structure, this
-	// operation might be expensive
-	bool remove_by_req_filter_bw(std::function<bool(const R&)> filter_accum) {
-	  bool any_removed = false;
-	  for (auto i = requests.rbegin();
-	       i != requests.rend();
-	       /* no inc */) {
-	    if (filter_accum(*i->request)) {
-	      any_removed = true;
-	      i = decltype(i){ requests.erase(std::next(i).base()) };
-	    } else {
-	      ++i;
-	    }
-	  }
-	  return any_removed;
+	// the proportion tag this client competes with, which is either
+	// that of its next request or, if it has none, its previous one
+	inline Time effective_prop_tag() const {
+	  return tag_add(has_request() ?
+			 next_request().tag.proportion :
+			 prev_tag.proportion,
+			 prop_delta);
 	}
 
-	inline bool
-	remove_by_req_filter(std::function<bool(const R&)> filter_accum,
-			     bool visit_backwards) {
-	  if (visit_backwards) {
-	    return remove_by_req_filter_bw(filter_accum);
-	  } else {
-	    return remove_by_req_filter_fw(filter_accum);
-	  }
+	inline size_t request_count() const {
+	  return requests.size();
 	}
 
 	friend std::ostream&
 	operator<<(std::ostream& out,
-		   const typename PriorityQueueBase<C,R,B>::ClientRec& e) {
+		   const typename PriorityQueueBase<C,R,B,S,H>::ClientRec& e) {
 	  out << "{ ClientRec::" <<
 	    " client:" << e.client <<
 	    " prev_tag:" << e.prev_tag <<
@@ -423,15 +632,18 @@ namespace crimson {
 	}
       }; // class ClientRec
 
-      using ClientRecRef = std::shared_ptr<ClientRec>;
+      // client records are owned by the queue's client_pool; the
+      // client_map and the heaps refer to them by plain pointer
+      using ClientRecRef = ClientRec*;
 
       // when we try to get the next request, we'll be in one of three
       // situations -- we'll have one to return, have one that can
       // fire in the future, or not have any
       enum class NextReqType { returning, future, none };
 
-      // specifies which queue next request will get popped from
-      enum class HeapId { reservation, ready };
+      // specifies which queue next request will get popped from (the
+      // limit ordering is only used internally)
+      enum class HeapId { reservation, ready, limit };
 
       // this is returned from next_req to tell the caller the situation
       struct NextReq {
@@ -440,6 +652,18 @@ namespace crimson {
 	  HeapId    heap_id;
 	  Time      when_ready;
 	};
+	// returning only because limits may be broken
+	bool        limit_break = false;
+      };
+
+
+      // the tags of the requests at the tops of the heaps, which
+      // allows heap tops to be compared across queues
+      struct HeapTops {
+	Time   reservation; // next reservation tag
+	Time   proportion;  // next proportion tag including prop_delta
+	bool   ready;       // whether that proportion tag is within limit
+	Time   limit;       // next limit tag not yet reached
       };
 
 
@@ -449,44 +673,90 @@ namespace crimson {
 
       bool empty() const {
 	DataGuard g(data_mtx);
-	return (resv_heap.empty() || ! resv_heap.top().has_request());
+	return (client_index.empty() ||
+		! client_index.top(HeapId::reservation).has_request());
       }
 
 
       size_t client_count() const {
 	DataGuard g(data_mtx);
-	return resv_heap.size();
+	return client_index.size();
       }
 
 
+      // kept as requests are added and removed, so it takes no lock
       size_t request_count() const {
+	return queued_requests.load(std::memory_order_relaxed);
+      }
+
+
+      // how long (in nanoseconds) each cleaning step held data_mtx
+      c::Histogram clean_hold_histogram() const {
 	DataGuard g(data_mtx);
-	size_t total = 0;
-	for (auto i = resv_heap.cbegin(); i != resv_heap.cend(); ++i) {
-	  total += i->request_count();
-	}
-	return total;
+	return clean_hold_hist;
       }
 
 
+      // a copy of the queue's statistics, taken without data_mtx, so
+      // it doesn't hold up scheduling; as a result the values may not
+      // all be from the same instant
+      QueueStats stats() const {
+	QueueStats result;
+	result.reservation_count =
+	  reserv_sched_count.load(std::memory_order_relaxed);
+	result.priority_count =
+	  prop_sched_count.load(std::memory_order_relaxed);
+	result.limit_break_count =
+	  limit_break_sched_count.load(std::memory_order_relaxed);
+	result.queued = queued_requests.load(std::memory_order_relaxed);
+	result.backlogged_clients =
+	  backlogged_clients.load(std::memory_order_relaxed);
+	result.reservation_wait = reserv_wait_hist.snapshot();
+	result.priority_wait = prop_wait_hist.snapshot();
+	result.backlog = backlog_hist.snapshot();
+	result.lock = data_mtx.stats();
+	return result;
+      }
+
+
+      // Captures every client's tags, backlog, and phase as of time
+      // now. Clients are visited batch_clients at a time (0 for no
+      // limit), releasing data_mtx between batches, so a queue with
+      // many clients is not held up for the whole walk. Snapshots are
+      // taken one at a time.
+      QueueSnapshot<C> snapshot(Time now, uint batch_clients = 1000) const {
+	QueueSnapshot<C> result;
+	result.time = now;
+
+	std::lock_guard<std::mutex> sg(snapshot_mtx);
+	std::unique_lock<decltype(data_mtx)> l(data_mtx);
+	result.clients.reserve(client_map.size());
+	snapshot_cursor = &clean_list;
+	while (true) {
+	  for (uint visited = 0;
+	       nullptr != *snapshot_cursor &&
+		 (0 == batch_clients || visited < batch_clients);
+	       ++visited) {
+	    const ClientRec& client = **snapshot_cursor;
+	    result.clients.push_back(client_snapshot(client, now));
+	    snapshot_cursor = &client.clean_next;
+	  }
+	  if (nullptr == *snapshot_cursor) {
+	    break;
+	  }
+	  l.unlock();
+	  std::this_thread::yield();
+	  l.lock();
+	}
+	snapshot_cursor = nullptr;
+	return result;
+      } // snapshot
+
+
       bool remove_by_req_filter(std::function<bool(const R&)> filter_accum,
 				bool visit_backwards = false) {
-	bool any_removed = false;
 	DataGuard g(data_mtx);
-	for (auto i : client_map) {
-	  bool modified =
-	    i.second->remove_by_req_filter(filter_accum, visit_backwards);
-	  if (modified) {
-	    resv_heap.adjust(*i.second);
-	    limit_heap.adjust(*i.second);
-	    ready_heap.adjust(*i.second);
-#if USE_PROP_HEAP
-	    prop_heap.adjust(*i.second);
-#endif
-	    any_removed = true;
-	  }
-	}
-	return any_removed;
+	return do_remove_by_req_filter(filter_accum, visit_backwards);
       }
 
 
@@ -500,33 +770,27 @@ namespace crimson {
 			    bool reverse = false,
 			    std::function<void (const R&)> accum = request_sink) {
 	DataGuard g(data_mtx);
+	do_remove_by_client(client, reverse, accum);
+      }
 
-	auto i = client_map.find(client);
-
-	if (i == client_map.end()) return;
 
-	if (reverse) {
-	  for (auto j = i->second->requests.rbegin();
-	       j != i->second->requests.rend();
-	       ++j) {
-	    accum(*j->request);
-	  }
-	} else {
-	  for (auto j = i->second->requests.begin();
-	       j != i->second->requests.end();
-	       ++j) {
-	    accum(*j->request);
-	  }
+      // Removes every request added with cancel_key, passing each to
+      // accum, and returns how many were removed. This is a filtered
+      // remove over the clients that have such requests: only those
+      // clients are visited, but each one's whole backlog is scanned,
+      // so the cost is proportional to the backlogs of the matched
+      // clients rather than to the number of requests removed. When
+      // enough clients change that adjusting each in the scheduling
+      // orderings would cost more than rebuilding them, they're
+      // rebuilt once instead.
+      size_t cancel(CancelKey cancel_key,
+		    std::function<void (const R&)> accum = request_sink) {
+	if (no_cancel_key == cancel_key) {
+	  return 0;
 	}
 
-	i->second->requests.clear();
-
-	resv_heap.adjust(*i->second);
-	limit_heap.adjust(*i->second);
-	ready_heap.adjust(*i->second);
-#if USE_PROP_HEAP
-	prop_heap.adjust(*i->second);
-#endif
+	DataGuard g(data_mtx);
+	return do_cancel(cancel_key, accum);
       }
 
 
@@ -535,6 +799,8 @@ namespace crimson {
       }
 
 
+      // for debugging; holds data_mtx while it walks every client, so
+      // use snapshot on a busy queue
       friend std::ostream& operator<<(std::ostream& out,
 				      const PriorityQueueBase& q) {
 	std::lock_guard<decltype(q.data_mtx)> guard(q.data_mtx);
@@ -544,12 +810,12 @@ namespace crimson {
 	  out << "  { client:" << c.first << ", record:" << *c.second <<
 	    " }";
 	}
-	if (!q.resv_heap.empty()) {
-	  const auto& resv = q.resv_heap.top();
+	if (!q.client_index.empty()) {
+	  const auto& resv = q.client_index.top(HeapId::reservation);
 	  out << " { reservation_top:" << resv << " }";
-	  const auto& ready = q.ready_heap.top();
+	  const auto& ready = q.client_index.top(HeapId::ready);
 	  out << " { ready_top:" << ready << " }";
-	  const auto& limit = q.limit_heap.top();
+	  const auto& limit = q.client_index.top(HeapId::limit);
 	  out << " { limit_top:" << limit << " }";
 	} else {
 	  out << " HEAPS-EMPTY";
@@ -559,7 +825,7 @@ namespace crimson {
 	return out;
       }
 
-      // for debugging
+      // for debugging; like operator<<, holds data_mtx throughout
       void display_queues(std::ostream& out,
 			  bool show_res = true,
 			  bool show_lim = true,
@@ -568,13 +834,14 @@ namespace crimson {
 	auto filter = [](const ClientRec& e)->bool { return true; };
 	DataGuard g(data_mtx);
 	if (show_res) {
-	  resv_heap.display_sorted(out << "RESER:", filter);
+	  client_index.display_sorted(out << "RESER:",
+				      HeapId::reservation, filter);
 	}
 	if (show_lim) {
-	  limit_heap.display_sorted(out << "LIMIT:", filter);
+	  client_index.display_sorted(out << "LIMIT:", HeapId::limit, filter);
 	}
 	if (show_ready) {
-	  ready_heap.display_sorted(out << "READY:", filter);
+	  client_index.display_sorted(out << "READY:", HeapId::ready, filter);
 	}
 #if USE_PROP_HEAP
 	if (show_prop) {
@@ -606,7 +873,7 @@ namespace crimson {
       //
       // use_prop_delta determines whether the proportional delta is
       // added in for comparison
-      template<double RequestTag::*tag_field,
+      template<Time RequestTag::*tag_field,
 	       ReadyOption ready_opt,
 	       bool use_prop_delta>
       struct ClientCompare {
@@ -618,8 +885,8 @@ namespace crimson {
 	      if (ReadyOption::ignore == ready_opt || t1.ready == t2.ready) {
 		// if we don't care about ready or the ready values are the same
 		if (use_prop_delta) {
-		  return (t1.*tag_field + n1.prop_delta) <
-		    (t2.*tag_field + n2.prop_delta);
+		  return tag_add(t1.*tag_field, n1.prop_delta) <
+		    tag_add(t2.*tag_field, n2.prop_delta);
 		} else {
 		  return t1.*tag_field < t2.*tag_field;
 		}
@@ -643,44 +910,286 @@ namespace crimson {
 	}
       };
 
+      // The comparison ClientCompare makes, with what it needs from a
+      // client gathered into a key, for heaps that store keys
+      // inline. Clients sort first by rank, which orders them by the
+      // ready flag as ready_opt says and puts those without requests
+      // last, and then by value.
+      struct ClientKey {
+	Time    value;
+	uint8_t rank;
+      };
+
+      struct ClientKeyCompare {
+	bool operator()(const ClientKey& k1, const ClientKey& k2) const {
+	  if (k1.rank != k2.rank) {
+	    return k1.rank < k2.rank;
+	  } else {
+	    return k1.value < k2.value;
+	  }
+	}
+      };
+
+      template<Time RequestTag::*tag_field,
+	       ReadyOption ready_opt,
+	       bool use_prop_delta>
+      struct ClientKeyOf {
+	ClientKey operator()(const ClientRec& n) const {
+	  if (!n.has_request()) {
+	    return ClientKey{TimeZero, 2};
+	  }
+	  const auto& t = n.next_request().tag;
+	  uint8_t rank = 0;
+	  if (ReadyOption::raises == ready_opt) {
+	    rank = t.ready ? 0 : 1;
+	  } else if (ReadyOption::lowers == ready_opt) {
+	    rank = t.ready ? 1 : 0;
+	  }
+	  return ClientKey{use_prop_delta ? tag_add(t.*tag_field, n.prop_delta)
+					  : t.*tag_field,
+			   rank};
+	}
+      };
+
+      // the type of the reservation, limit, and ready heaps
+      template<IndIntruHeapData ClientRec::*heap_info,
+	       Time RequestTag::*tag_field,
+	       ReadyOption ready_opt,
+	       bool use_prop_delta>
+      using ClientHeap =
+	typename std::conditional<
+	USE_INLINE_HEAP_KEYS,
+	c::IndIntruKeyHeap<ClientRecRef,
+			   ClientRec,
+			   heap_info,
+			   ClientKeyOf<tag_field, ready_opt, use_prop_delta>,
+			   ClientKeyCompare,
+			   B>,
+	c::IndIntruHeap<ClientRecRef,
+			ClientRec,
+			heap_info,
+			ClientCompare<tag_field, ready_opt, use_prop_delta>,
+			B>>::type;
+
+      // the type of the reservation and limit heaps, whose tags
+      // mostly advance with time
+      template<IndIntruHeapData ClientRec::*heap_info,
+	       Time RequestTag::*tag_field,
+	       ReadyOption ready_opt>
+      using ClientTagHeap =
+	typename std::conditional<
+	USE_CALENDAR_HEAPS,
+	c::CalendarHeap<ClientRecRef,
+			ClientRec,
+			heap_info,
+			ClientKeyOf<tag_field, ready_opt, false>,
+			ClientKeyCompare,
+			3>,
+	ClientHeap<heap_info, tag_field, ready_opt, false>>::type;
+
+#if USE_PROP_HEAP
+      // Orders the prop_heap so its top is the non-idle client with
+      // the lowest effective proportion tag; idle clients follow all
+      // non-idle clients.
+      struct PropCompare {
+	bool operator()(const ClientRec& n1, const ClientRec& n2) const {
+	  if (n1.idle != n2.idle) {
+	    return n2.idle;
+	  } else if (n1.idle) {
+	    // both idle; keep stable w false
+	    return false;
+	  } else {
+	    return n1.effective_prop_tag() < n2.effective_prop_tag();
+	  }
+	}
+      };
+#endif
+
       ClientInfoFunc       client_info_f;
 
-      mutable std::mutex data_mtx;
+      // keeps the lock statistics reported by stats()
+      mutable c::StatMutex data_mtx;
       using DataGuard = std::lock_guard<decltype(data_mtx)>;
 
-      // stable mapping between client ids and client queues
-      std::map<C,ClientRecRef> client_map;
+      // storage for the client records; declared before the
+      // containers that point into it
+      c::ObjectPool<ClientRec> client_pool;
+
+      // stable mapping between client ids and client queues, hashed
+      // with H; when H is left as std::hash and that cannot handle the
+      // client ids, a std::map is used instead, so a client type
+      // without a std::hash should be given a hash of its own
+      using ClientMap =
+	typename std::conditional<c::is_std_hashable<C>::value ||
+				  !std::is_same<H,std::hash<C>>::value,
+				  c::FlatHashMap<C,ClientRecRef,H>,
+				  std::map<C,ClientRecRef>>::type;
+      ClientMap client_map;
+
+      // keeps the reservation, limit, and ready orderings of clients
+      // in a heap each
+      struct HeapClientIndex {
+	ClientTagHeap<&ClientRec::reserv_heap_data,
+		      &RequestTag::reservation,
+		      ReadyOption::ignore> resv_heap;
+	ClientTagHeap<&ClientRec::lim_heap_data,
+		      &RequestTag::limit,
+		      ReadyOption::lowers> limit_heap;
+	ClientHeap<&ClientRec::ready_heap_data,
+		   &RequestTag::proportion,
+		   ReadyOption::raises,
+		   true> ready_heap;
+
+	bool empty() const { return resv_heap.empty(); }
+
+	size_t size() const { return resv_heap.size(); }
+
+	ClientRec& top(HeapId id) {
+	  switch(id) {
+	  case HeapId::reservation: return resv_heap.top();
+	  case HeapId::ready: return ready_heap.top();
+	  default: return limit_heap.top();
+	  }
+	}
 
-      c::IndIntruHeap<ClientRecRef,
-		      ClientRec,
-		      &ClientRec::reserv_heap_data,
-		      ClientCompare<&RequestTag::reservation,
-				    ReadyOption::ignore,
-				    false>,
-		      B> resv_heap;
+	const ClientRec& top(HeapId id) const {
+	  switch(id) {
+	  case HeapId::reservation: return resv_heap.top();
+	  case HeapId::ready: return ready_heap.top();
+	  default: return limit_heap.top();
+	  }
+	}
+
+	void push(ClientRecRef client) {
+	  resv_heap.push(client);
+	  limit_heap.push(client);
+	  ready_heap.push(client);
+	}
+
+	void remove(ClientRec& client) {
+	  resv_heap.remove(client);
+	  limit_heap.remove(client);
+	  ready_heap.remove(client);
+	}
+
+	// any of client's orderings may have changed
+	void update(ClientRec& client) {
+	  resv_heap.adjust(client);
+	  limit_heap.adjust(client);
+	  ready_heap.adjust(client);
+	}
+
+	// any of any client's orderings may have changed
+	void update_all() {
+	  resv_heap.update_all();
+	  limit_heap.update_all();
+	  ready_heap.update_all();
+	}
+
+	// client's first request was popped
+	void update_popped(ClientRec& client) {
+	  resv_heap.demote(client);
+	  limit_heap.adjust(client);
+	  ready_heap.demote(client);
+	}
+
+	// client's first request became ready
+	void update_ready(ClientRec& client) {
+	  ready_heap.promote(client);
+	  limit_heap.demote(client);
+	}
+
+	// client's reservation tags were reduced
+	void update_reservation(ClientRec& client) {
+	  resv_heap.promote(client);
+	}
+
+	void display_sorted(std::ostream& out,
+			    HeapId id,
+			    std::function<bool(const ClientRec&)> filter) const {
+	  switch(id) {
+	  case HeapId::reservation:
+	    resv_heap.display_sorted(out, filter);
+	    break;
+	  case HeapId::ready:
+	    ready_heap.display_sorted(out, filter);
+	    break;
+	  default:
+	    limit_heap.display_sorted(out, filter);
+	  }
+	}
+      }; // struct HeapClientIndex
+
+      // the keys of each ordering, by HeapId
+      struct ClientKeysOf {
+	std::array<ClientKey,3> operator()(const ClientRec& n) const {
+	  return std::array<ClientKey,3>{{
+	      ClientKeyOf<&RequestTag::reservation,
+			  ReadyOption::ignore,
+			  false>()(n),
+	      ClientKeyOf<&RequestTag::proportion,
+			  ReadyOption::raises,
+			  true>()(n),
+	      ClientKeyOf<&RequestTag::limit,
+			  ReadyOption::lowers,
+			  false>()(n) }};
+	}
+      };
+
+      // keeps the reservation, limit, and ready orderings of clients
+      // in one tournament tree, so a change to a client is replayed
+      // once for all of them
+      struct TournamentClientIndex {
+	c::IndIntruTournament<ClientRecRef,
+			      ClientRec,
+			      &ClientRec::reserv_heap_data,
+			      ClientKeysOf,
+			      ClientKeyCompare,
+			      3> tree;
+
+	bool empty() const { return tree.empty(); }
+
+	size_t size() const { return tree.size(); }
+
+	ClientRec& top(HeapId id) {
+	  return tree.top(static_cast<uint>(id));
+	}
+
+	const ClientRec& top(HeapId id) const {
+	  return tree.top(static_cast<uint>(id));
+	}
+
+	void push(ClientRecRef client) { tree.push(client); }
+
+	void remove(ClientRec& client) { tree.remove(client); }
+
+	void update(ClientRec& client) { tree.update(client); }
+
+	void update_all() { tree.update_all(); }
+
+	void update_popped(ClientRec& client) { tree.update(client); }
+
+	void update_ready(ClientRec& client) { tree.update(client); }
+
+	void update_reservation(ClientRec& client) { tree.update(client); }
+
+	void display_sorted(std::ostream& out,
+			    HeapId id,
+			    std::function<bool(const ClientRec&)> filter) const {
+	  tree.display_sorted(out, static_cast<uint>(id), filter);
+	}
+      }; // struct TournamentClientIndex
+
+      typename std::conditional<SchedIndex::heaps == S,
+				HeapClientIndex,
+				TournamentClientIndex>::type client_index;
 #if USE_PROP_HEAP
       c::IndIntruHeap<ClientRecRef,
 		      ClientRec,
 		      &ClientRec::prop_heap_data,
-		      ClientCompare<&RequestTag::proportion,
-				    ReadyOption::ignore,
-				    true>,
+		      PropCompare,
 		      B> prop_heap;
 #endif
-      c::IndIntruHeap<ClientRecRef,
-		      ClientRec,
-		      &ClientRec::lim_heap_data,
-		      ClientCompare<&RequestTag::limit,
-				    ReadyOption::lowers,
-				    false>,
-		      B> limit_heap;
-      c::IndIntruHeap<ClientRecRef,
-		      ClientRec,
-		      &ClientRec::ready_heap_data,
-		      ClientCompare<&RequestTag::proportion,
-				    ReadyOption::raises,
-				    true>,
-		      B> ready_heap;
 
       // if all reservations are met and all other requestes are under
       // limit, this will allow the request next in terms of
@@ -692,16 +1201,56 @@ namespace crimson {
       // every request creates a tick
       Counter tick = 0;
 
-      // performance data collection
-      size_t reserv_sched_count = 0;
-      size_t prop_sched_count = 0;
-      size_t limit_break_sched_count = 0;
+      // performance data collection; written only with data_mtx
+      // held (see bump), and read by stats() without it
+      std::atomic<uint64_t> reserv_sched_count;
+      std::atomic<uint64_t> prop_sched_count;
+      std::atomic<uint64_t> limit_break_sched_count;
+      std::atomic<uint64_t> queued_requests;
+      std::atomic<uint64_t> backlogged_clients;
+      c::AtomicHistogram    reserv_wait_hist;
+      c::AtomicHistogram    prop_wait_hist;
+      c::AtomicHistogram    backlog_hist;
 
       Duration                  idle_age;
       Duration                  erase_age;
       Duration                  check_time;
       std::deque<MarkPoint>     clean_mark_points;
 
+      // cleaning walks all clients through this list in steps; while
+      // a pass is under way clean_cursor points at the link to the
+      // next client to visit, otherwise it is nullptr
+      const CleanBudget         clean_budget;
+      ClientRec*                clean_list = nullptr;
+      ClientRec**               clean_cursor = nullptr;
+      Counter                   clean_erase_point = 0;
+      Counter                   clean_idle_point = 0;
+      // for piggyback cleaning
+      TimePoint                 clean_next_pass;
+      uint                      clean_check_count = 0;
+
+      // nanoseconds each cleaning step held data_mtx
+      c::Histogram              clean_hold_hist;
+
+      // if set, called with data_mtx held after each step of the
+      // cleaning job, so a derived queue can refresh state it derives
+      // from the clients; set and cleared with data_mtx held
+      std::function<void()>     clean_step_f;
+
+      // the clients with requests under each cancel key, and how many
+      // each has, so cancel visits only those clients; keys are only
+      // present while they have requests. The requests themselves
+      // aren't indexed, since a client's requests are kept in a ring
+      // buffer that compacts as they're removed.
+      using KeyedClients = c::FlatHashMap<ClientRecRef,size_t>;
+      c::FlatHashMap<CancelKey,std::unique_ptr<KeyedClients>> cancel_index;
+
+      // while a snapshot is under way snapshot_cursor points at the
+      // link in clean_list to the next client to capture; cleaning
+      // keeps it valid when it erases a client
+      mutable std::mutex        snapshot_mtx;
+      mutable ClientRec* const* snapshot_cursor = nullptr;
+
       // NB: All threads declared at end, so they're destructed first!
 
       std::unique_ptr<RunEvery> cleaning_job;
@@ -714,104 +1263,231 @@ namespace crimson {
 			std::chrono::duration<Rep,Per> _idle_age,
 			std::chrono::duration<Rep,Per> _erase_age,
 			std::chrono::duration<Rep,Per> _check_time,
-			bool _allow_limit_break) :
+			bool _allow_limit_break,
+			const CleanBudget& _clean_budget) :
 	client_info_f(_client_info_f),
 	allow_limit_break(_allow_limit_break),
 	finishing(false),
+	reserv_sched_count(0),
+	prop_sched_count(0),
+	limit_break_sched_count(0),
+	queued_requests(0),
+	backlogged_clients(0),
 	idle_age(std::chrono::duration_cast<Duration>(_idle_age)),
 	erase_age(std::chrono::duration_cast<Duration>(_erase_age)),
-	check_time(std::chrono::duration_cast<Duration>(_check_time))
+	check_time(std::chrono::duration_cast<Duration>(_check_time)),
+	clean_budget(_clean_budget),
+	clean_next_pass(std::chrono::steady_clock::now() + check_time)
       {
 	assert(_erase_age >= _idle_age);
 	assert(_check_time < _idle_age);
-	cleaning_job =
-	  std::unique_ptr<RunEvery>(
-	    new RunEvery(check_time,
-			 std::bind(&PriorityQueueBase::do_clean, this)));
+	if (!clean_budget.piggyback) {
+	  cleaning_job =
+	    std::unique_ptr<RunEvery>(
+	      new RunEvery(check_time,
+			   std::bind(&PriorityQueueBase::do_clean, this)));
+	}
       }
 
 
       ~PriorityQueueBase() {
 	finishing = true;
+	// stop cleaning before releasing the client records
+	cleaning_job.reset();
+	for (auto& c : client_map) {
+	  client_pool.destroy(c.second);
+	}
       }
 
 
       // data_mtx must be held by caller
-      void do_add_request(RequestRef&&     request,
-			  const C&         client_id,
-			  const ReqParams& req_params,
-			  const Time       time,
-			  const double     cost = 0.0) {
-	++tick;
-
-	// this pointer will help us create a reference to a shared
-	// pointer, no matter which of two codepaths we take
-	ClientRec* temp_client;
-
-	auto client_it = client_map.find(client_id);
-	if (client_map.end() != client_it) {
-	  temp_client = &(*client_it->second); // address of obj of shared_ptr
-	} else {
-	  ClientInfo info = client_info_f(client_id);
-	  ClientRecRef client_rec =
-	    std::make_shared<ClientRec>(client_id, info, tick);
-	  resv_heap.push(client_rec);
+      bool do_remove_by_req_filter(
+	std::function<bool(const R&)> filter_accum,
+	bool visit_backwards) {
+	bool any_removed = false;
+	for (auto& i : client_map) {
+	  const size_t removed = remove_requests(
+	    *i.second,
+	    [&filter_accum] (const ClientReq& r) -> bool {
+	      return filter_accum(*r.request);
+	    },
+	    visit_backwards);
+	  if (removed > 0) {
+	    client_index.update(*i.second);
 #if USE_PROP_HEAP
-	  prop_heap.push(client_rec);
+	    prop_heap.adjust(*i.second);
 #endif
-	  limit_heap.push(client_rec);
-	  ready_heap.push(client_rec);
-	  client_map[client_id] = client_rec;
-	  temp_client = &(*client_rec); // address of obj of shared_ptr
+	    any_removed = true;
+	  }
 	}
+	return any_removed;
+      }
 
-	// for convenience, we'll create a reference to the shared pointer
-	ClientRec& client = *temp_client;
-
-	if (client.idle) {
-	  // We need to do an adjustment so that idle clients compete
-	  // fairly on proportional tags since those tags may have
-	  // drifted from real-time. Either use the lowest existing
-	  // proportion tag -- O(1) -- or the client with the lowest
-	  // previous proportion tag -- O(n) where n = # clients.
-	  //
-	  // So we don't have to maintain a propotional queue that
-	  // keeps the minimum on proportional tag alone (we're
-	  // instead using a ready queue), we'll have to check each
-	  // client.
-	  //
-	  // The alternative would be to maintain a proportional queue
-	  // (define USE_PROP_TAG) and do an O(1) operation here.
 
-	  // Was unable to confirm whether equality testing on
-	  // std::numeric_limits<double>::max() is guaranteed, so
-	  // we'll use a compile-time calculated trigger that is one
-	  // third the max, which should be much larger than any
-	  // expected organic value.
-	  constexpr double lowest_prop_tag_trigger =
-	    std::numeric_limits<double>::max() / 3.0;
+      // data_mtx must be held by caller
+      void do_remove_by_client(const C& client,
+			       bool reverse,
+			       std::function<void (const R&)> accum) {
+	auto i = client_map.find(client);
 
-	  double lowest_prop_tag = std::numeric_limits<double>::max();
-	  for (auto const &c : client_map) {
-	    // don't use ourselves (or anything else that might be
-	    // listed as idle) since we're now in the map
-	    if (!c.second->idle) {
-	      double p;
-	      // use either lowest proportion tag or previous proportion tag
-	      if (c.second->has_request()) {
-		p = c.second->next_request().tag.proportion +
-		  c.second->prop_delta;
-	      } else {
-	        p = c.second->get_req_tag().proportion + c.second->prop_delta;
-	      }
+	if (i == client_map.end()) return;
 
-	      if (p < lowest_prop_tag) {
-		lowest_prop_tag = p;
-	      }
-	    }
+	if (reverse) {
+	  for (auto j = i->second->requests.rbegin();
+	       j != i->second->requests.rend();
+	       ++j) {
+	    accum(*j->request);
 	  }
-
-	  // if this conditional does not fire, it
+	} else {
+	  for (auto j = i->second->requests.begin();
+	       j != i->second->requests.end();
+	       ++j) {
+	    accum(*j->request);
+	  }
+	}
+
+	note_removed(i->second->request_count(), 0);
+	unindex_requests(*i->second);
+	i->second->requests.clear();
+
+	client_index.update(*i->second);
+#if USE_PROP_HEAP
+	prop_heap.adjust(*i->second);
+#endif
+      }
+
+
+      // data_mtx must be held by caller; see cancel
+      size_t do_cancel(CancelKey cancel_key,
+		       std::function<void (const R&)> accum) {
+	auto i = cancel_index.find(cancel_key);
+	if (cancel_index.end() == i) {
+	  return 0;
+	}
+	// remove_requests keeps the index up to date as it goes, so
+	// work from a list of the clients
+	std::vector<ClientRecRef> clients;
+	clients.reserve(i->second->size());
+	for (const auto& c : *i->second) {
+	  clients.push_back(c.first);
+	}
+
+	size_t removed = 0;
+	for (ClientRecRef client : clients) {
+	  removed += remove_requests(
+	    *client,
+	    [cancel_key, &accum] (const ClientReq& r) -> bool {
+	      if (cancel_key != r.cancel_key) {
+		return false;
+	      }
+	      accum(*r.request);
+	      return true;
+	    },
+	    false);
+	}
+	assert(cancel_index.end() == cancel_index.find(cancel_key));
+
+	// each adjustment costs O(log n) and a rebuild O(n)
+	const size_t n = client_index.size();
+	size_t log_n = 1;
+	for (size_t k = n; k > 1; k /= 2) {
+	  ++log_n;
+	}
+	if (clients.size() * log_n >= n) {
+	  client_index.update_all();
+#if USE_PROP_HEAP
+	  prop_heap.update_all();
+#endif
+	} else {
+	  for (ClientRecRef client : clients) {
+	    client_index.update(*client);
+#if USE_PROP_HEAP
+	    prop_heap.adjust(*client);
+#endif
+	  }
+	}
+
+	return removed;
+      } // do_cancel
+
+
+      // data_mtx must be held by caller
+      void do_add_request(RequestRef&&     request,
+			  const C&         client_id,
+			  const ReqParams& req_params,
+			  const Time       time,
+			  const double     cost = 0.0,
+			  const CancelKey  cancel_key = no_cancel_key) {
+	maybe_clean();
+	++tick;
+
+	// this pointer will help us create a reference to the client
+	// record, no matter which of two codepaths we take
+	ClientRec* temp_client;
+
+	auto client_it = client_map.find(client_id);
+	if (client_map.end() != client_it) {
+	  temp_client = client_it->second;
+	} else {
+	  ClientInfo info = client_info_f(client_id);
+	  ClientRecRef client_rec =
+	    client_pool.create(client_id, info, tick);
+	  client_rec->clean_next = clean_list;
+	  clean_list = client_rec;
+	  client_index.push(client_rec);
+#if USE_PROP_HEAP
+	  prop_heap.push(client_rec);
+#endif
+	  client_map.emplace(client_id, client_rec);
+	  temp_client = client_rec;
+	}
+
+	// for convenience, we'll create a reference to the client record
+	ClientRec& client = *temp_client;
+
+	const bool was_idle = client.idle;
+	if (client.idle) {
+	  // We need to do an adjustment so that idle clients compete
+	  // fairly on proportional tags since those tags may have
+	  // drifted from real-time. Either use the lowest existing
+	  // proportion tag -- O(1) -- or the client with the lowest
+	  // previous proportion tag -- O(n) where n = # clients.
+	  //
+	  // The prop_heap keeps the non-idle client with the lowest
+	  // proportion tag on top, so unless it's disabled (define
+	  // USE_PROP_HEAP as 0) this is an O(1) operation. Otherwise
+	  // we'll have to check each client.
+
+	  // Was unable to confirm whether equality testing on
+	  // std::numeric_limits<Time>::max() is guaranteed, so
+	  // we'll use a compile-time calculated trigger that is one
+	  // third the max, which should be much larger than any
+	  // expected organic value.
+	  constexpr Time lowest_prop_tag_trigger =
+	    std::numeric_limits<Time>::max() / 3;
+
+	  Time lowest_prop_tag = std::numeric_limits<Time>::max();
+#if USE_PROP_HEAP
+	  // we're in the heap ourselves but, being idle, can only be on
+	  // top if all clients are idle
+	  const ClientRec& lowest = prop_heap.top();
+	  if (!lowest.idle) {
+	    lowest_prop_tag = lowest.effective_prop_tag();
+	  }
+#else
+	  for (auto const &c : client_map) {
+	    // don't use ourselves (or anything else that might be
+	    // listed as idle) since we're now in the map
+	    if (!c.second->idle) {
+	      Time p = c.second->effective_prop_tag();
+	      if (p < lowest_prop_tag) {
+		lowest_prop_tag = p;
+	      }
+	    }
+	  }
+#endif
+
+	  // if this conditional does not fire, it
 	  if (lowest_prop_tag < lowest_prop_tag_trigger) {
 	    client.prop_delta = lowest_prop_tag - time;
 	  }
@@ -819,7 +1495,7 @@ namespace crimson {
 	} // if this client was idle
 
 #ifndef DO_NOT_DELAY_TAG_CALC
-	RequestTag tag(0, 0, 0, time);
+	RequestTag tag(TimeZero, TimeZero, TimeZero, time);
 
 	if (!client.has_request()) {
 	  tag = RequestTag(client.get_req_tag(), client.info,
@@ -834,49 +1510,58 @@ namespace crimson {
 	client.update_req_tag(tag, tick);
 #endif
 
-	client.add_request(tag, client.client, std::move(request));
+	client.add_request(tag, client.client, std::move(request), cancel_key);
+	if (no_cancel_key != cancel_key) {
+	  index_request(&client, cancel_key);
+	}
+	bump(queued_requests);
 	if (1 == client.requests.size()) {
-	  // NB: can the following 4 calls to adjust be changed
-	  // promote? Can adding a request ever demote a client in the
-	  // heaps?
-	  resv_heap.adjust(client);
-	  limit_heap.adjust(client);
-	  ready_heap.adjust(client);
-#if USE_PROP_HEAP
-	  prop_heap.adjust(client);
-#endif
+	  bump(backlogged_clients);
 	}
+	backlog_hist.record(client.requests.size());
 
 	client.cur_rho = req_params.rho;
 	client.cur_delta = req_params.delta;
 
-	resv_heap.adjust(client);
-	limit_heap.adjust(client);
-	ready_heap.adjust(client);
+	// the heaps order clients by their first request (and by
+	// idleness and prop_delta), so appending a request behind
+	// others to an active client does not move it in any heap
+	if (was_idle || 1 == client.requests.size()) {
+	  client_index.update(client);
 #if USE_PROP_HEAP
-	prop_heap.adjust(client);
+	  prop_heap.adjust(client);
 #endif
+	}
       } // add_request
 
 
       // data_mtx should be held when called; top of heap should have
       // a ready request
-      template<typename C1, IndIntruHeapData ClientRec::*C2, typename C3>
-      void pop_process_request(IndIntruHeap<C1, ClientRec, C2, C3, B>& heap,
+      void pop_process_request(HeapId heap_id,
 			       std::function<void(const C& client,
 						  RequestRef& request)> process) {
 	// gain access to data
-	ClientRec& top = heap.top();
+	ClientRec& top = client_index.top(heap_id);
 	ClientReq& first = top.next_request();
 	RequestRef request = std::move(first.request);
+#ifndef DO_NOT_DELAY_TAG_CALC
+	// the next request's tag is based on this one's, so keep a copy
+	// before popping it
+	RequestTag first_tag = first.tag;
+#endif
+
+	if (no_cancel_key != first.cancel_key) {
+	  unindex_request(&top, first.cancel_key);
+	}
 
 	// pop request and adjust heaps
 	top.pop_request();
+	note_removed(top.request_count() + 1, top.request_count());
 
 #ifndef DO_NOT_DELAY_TAG_CALC
 	if (top.has_request()) {
 	  ClientReq& next_first = top.next_request();
-	  next_first.tag = RequestTag(first.tag, top.info,
+	  next_first.tag = RequestTag(first_tag, top.info,
 	                              ReqParams(top.cur_delta, top.cur_rho),
 				      next_first.tag.arrival);
 
@@ -885,18 +1570,149 @@ namespace crimson {
 	}
 #endif
 
-	resv_heap.demote(top);
-	limit_heap.adjust(top);
+	client_index.update_popped(top);
 #if USE_PROP_HEAP
-	prop_heap.demote(top);
+	// a client without a pinned proportion tag goes back to using
+	// its previous tag when its last request is popped, so this
+	// is not necessarily a demotion
+	prop_heap.adjust(top);
 #endif
-	ready_heap.demote(top);
 
 	// process
 	process(top.client, request);
       } // pop_process_request
 
 
+      // Statistics are only written with data_mtx held, so they don't
+      // need atomic read-modify-writes, just atomic loads and stores
+      // so that stats() can read them without data_mtx.
+      static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+	counter.store(counter.load(std::memory_order_relaxed) + n,
+		      std::memory_order_relaxed);
+      }
+
+
+      // data_mtx should be held when called; updates the gauges when
+      // a client's queued requests go from before to after
+      void note_removed(size_t before, size_t after) {
+	bump(queued_requests, -uint64_t(before - after));
+	if (before > 0 && 0 == after) {
+	  bump(backlogged_clients, -uint64_t(1));
+	}
+      }
+
+
+      // data_mtx should be held when called; notes that client has
+      // one more request with cancel_key
+      void index_request(ClientRecRef client, CancelKey cancel_key) {
+	auto i = cancel_index.find(cancel_key);
+	if (cancel_index.end() == i) {
+	  i = cancel_index.emplace(cancel_key,
+				   std::unique_ptr<KeyedClients>(
+				     new KeyedClients)).first;
+	}
+	++(*i->second)[client];
+      }
+
+
+      // data_mtx should be held when called; notes that client has
+      // one fewer request with cancel_key
+      void unindex_request(ClientRecRef client, CancelKey cancel_key) {
+	auto i = cancel_index.find(cancel_key);
+	assert(cancel_index.end() != i);
+	auto j = i->second->find(client);
+	assert(i->second->end() != j);
+	if (0 == --j->second) {
+	  i->second->erase(j);
+	  if (i->second->empty()) {
+	    cancel_index.erase(i);
+	  }
+	}
+      }
+
+
+      // data_mtx should be held when called, before client's requests
+      // are all dropped
+      void unindex_requests(ClientRec& client) {
+	for (const auto& r : client.requests) {
+	  if (no_cancel_key != r.cancel_key) {
+	    unindex_request(&client, r.cancel_key);
+	  }
+	}
+      }
+
+
+      // Removes the requests of client that remove selects, in one
+      // pass, and returns how many were removed; keeps the gauges and
+      // the cancel index up to date, but leaves the client's place in
+      // the scheduling orderings to the caller. Only the first
+      // request has a tag that's been calculated, so if it's removed
+      // the new first request takes its tag over. data_mtx should be
+      // held when called.
+      template<typename F>
+      size_t remove_requests(ClientRec& client,
+			     F remove,
+			     bool visit_backwards) {
+	if (!client.has_request()) {
+	  return 0;
+	}
+	const size_t before = client.request_count();
+	// remove_if visits each element in place, so the first can be
+	// recognized by its address
+	const ClientReq* first = &client.next_request();
+#ifndef DO_NOT_DELAY_TAG_CALC
+	const RequestTag first_tag = first->tag;
+#endif
+	bool removed_first = false;
+	ClientRecRef client_ref = &client;
+	client.requests.remove_if(
+	  [&] (const ClientReq& r) -> bool {
+	    if (!remove(r)) {
+	      return false;
+	    }
+	    if (&r == first) {
+	      removed_first = true;
+	    }
+	    if (no_cancel_key != r.cancel_key) {
+	      unindex_request(client_ref, r.cancel_key);
+	    }
+	    return true;
+	  },
+	  visit_backwards);
+
+#ifndef DO_NOT_DELAY_TAG_CALC
+	if (removed_first && client.has_request()) {
+	  RequestTag& tag = client.next_request().tag;
+	  const Time arrival = tag.arrival;
+	  tag = first_tag;
+	  tag.arrival = arrival;
+	}
+#endif
+
+	note_removed(before, client.request_count());
+	return before - client.request_count();
+      }
+
+
+      // data_mtx should be held when called, before the request that
+      // next chose is popped; counts it and records how long it waited
+      void note_dispatch(const NextReq& next, Time now) {
+	const ClientReq& first = client_index.top(next.heap_id).next_request();
+	const int64_t wait = time_to_nanoseconds(now - first.tag.arrival);
+	const uint64_t wait_ns = wait > 0 ? wait : 0;
+	if (HeapId::reservation == next.heap_id) {
+	  bump(reserv_sched_count);
+	  reserv_wait_hist.record(wait_ns);
+	} else {
+	  bump(prop_sched_count);
+	  prop_wait_hist.record(wait_ns);
+	}
+	if (next.limit_break) {
+	  bump(limit_break_sched_count);
+	}
+      }
+
+
       // data_mtx should be held when called
       void reduce_reservation_tags(ClientRec& client) {
 	for (auto& r : client.requests) {
@@ -909,7 +1725,7 @@ namespace crimson {
 	}
 	// don't forget to update previous tag
 	client.prev_tag.reservation -= client.info.reservation_inv;
-	resv_heap.promote(client);
+	client_index.update_reservation(client);
       }
 
 
@@ -926,17 +1742,19 @@ namespace crimson {
 
       // data_mtx should be held when called
       NextReq do_next_request(Time now) {
+	maybe_clean();
+
 	NextReq result;
 
-	// if reservation queue is empty, all are empty (i.e., no active clients)
-	if(resv_heap.empty()) {
+	// if there are no clients there are no requests
+	if(client_index.empty()) {
 	  result.type = NextReqType::none;
 	  return result;
 	}
 
 	// try constraint (reservation) based scheduling
 
-	auto& reserv = resv_heap.top();
+	auto& reserv = client_index.top(HeapId::reservation);
 	if (reserv.has_request() &&
 	    reserv.next_request().tag.reservation <= now) {
 	  result.type = NextReqType::returning;
@@ -949,18 +1767,9 @@ namespace crimson {
 
 	// all items that are within limit are eligible based on
 	// priority
-	auto limits = &limit_heap.top();
-	while (limits->has_request() &&
-	       !limits->next_request().tag.ready &&
-	       limits->next_request().tag.limit <= now) {
-	  limits->next_request().tag.ready = true;
-	  ready_heap.promote(*limits);
-	  limit_heap.demote(*limits);
+	do_promote_ready(now);
 
-	  limits = &limit_heap.top();
-	}
-
-	auto& readys = ready_heap.top();
+	auto& readys = client_index.top(HeapId::ready);
 	if (readys.has_request() &&
 	    readys.next_request().tag.ready &&
 	    readys.next_request().tag.proportion < max_tag) {
@@ -978,11 +1787,13 @@ namespace crimson {
 	      readys.next_request().tag.proportion < max_tag) {
 	    result.type = NextReqType::returning;
 	    result.heap_id = HeapId::ready;
+	    result.limit_break = true;
 	    return result;
 	  } else if (reserv.has_request() &&
 		     reserv.next_request().tag.reservation < max_tag) {
 	    result.type = NextReqType::returning;
 	    result.heap_id = HeapId::reservation;
+	    result.limit_break = true;
 	    return result;
 	  }
 	}
@@ -991,13 +1802,13 @@ namespace crimson {
 	// reservation item or next limited item comes up
 
 	Time next_call = TimeMax;
-	if (resv_heap.top().has_request()) {
+	if (client_index.top(HeapId::reservation).has_request()) {
 	  next_call =
 	    min_not_0_time(next_call,
-			   resv_heap.top().next_request().tag.reservation);
+			   client_index.top(HeapId::reservation).next_request().tag.reservation);
 	}
-	if (limit_heap.top().has_request()) {
-	  const auto& next = limit_heap.top().next_request();
+	if (client_index.top(HeapId::limit).has_request()) {
+	  const auto& next = client_index.top(HeapId::limit).next_request();
 	  assert(!next.tag.ready || max_tag == next.tag.proportion);
 	  next_call = min_not_0_time(next_call, next.tag.limit);
 	}
@@ -1012,6 +1823,52 @@ namespace crimson {
       } // do_next_request
 
 
+      // data_mtx should be held when called; marks as ready those
+      // clients whose limit tags have been reached and moves them up
+      // in the ready heap
+      void do_promote_ready(Time now) {
+	if (client_index.empty()) return;
+
+	auto limits = &client_index.top(HeapId::limit);
+	while (limits->has_request() &&
+	       !limits->next_request().tag.ready &&
+	       limits->next_request().tag.limit <= now) {
+	  limits->next_request().tag.ready = true;
+	  client_index.update_ready(*limits);
+
+	  limits = &client_index.top(HeapId::limit);
+	}
+      }
+
+
+      // data_mtx must be held by caller
+      HeapTops do_get_heap_tops() const {
+	HeapTops result{max_tag, max_tag, false, max_tag};
+	if (client_index.empty()) {
+	  return result;
+	}
+
+	const auto& resv = client_index.top(HeapId::reservation);
+	if (resv.has_request()) {
+	  result.reservation = resv.next_request().tag.reservation;
+	}
+
+	const auto& ready = client_index.top(HeapId::ready);
+	if (ready.has_request()) {
+	  result.proportion = tag_add(ready.next_request().tag.proportion,
+				      ready.prop_delta);
+	  result.ready = ready.next_request().tag.ready;
+	}
+
+	const auto& limit = client_index.top(HeapId::limit);
+	if (limit.has_request() && !limit.next_request().tag.ready) {
+	  result.limit = limit.next_request().tag.limit;
+	}
+
+	return result;
+      }
+
+
       // if possible is not zero and less than current then return it;
       // otherwise return current; the idea is we're trying to find
       // the minimal time but ignoring zero
@@ -1026,12 +1883,34 @@ namespace crimson {
        * called it notes the time and delta counter (mark point) in a
        * deque. It also looks at the deque to find the most recent
        * mark point that is older than clean_age. It then walks the
-       * map and delete all server entries that were last used before
-       * that mark point.
+       * clients and deletes all server entries that were last used
+       * before that mark point. The walk is done in steps bounded by
+       * clean_budget, releasing data_mtx between them so a large
+       * number of clients does not hold up adding and pulling
+       * requests.
        */
       void do_clean() {
-	TimePoint now = std::chrono::steady_clock::now();
-	DataGuard g(data_mtx);
+	std::unique_lock<decltype(data_mtx)> l(data_mtx);
+	start_clean(std::chrono::steady_clock::now());
+	bool more;
+	do {
+	  more = clean_step();
+	  if (clean_step_f) {
+	    clean_step_f();
+	  }
+	  if (more && !finishing) {
+	    l.unlock();
+	    std::this_thread::yield();
+	    l.lock();
+	  }
+	} while (more && !finishing);
+      } // do_clean
+
+
+      // Notes a mark point and, if any clients may have aged, starts
+      // a cleaning pass over them; a pass still under way restarts
+      // with the newer points. data_mtx must be held by caller.
+      void start_clean(TimePoint now) {
 	clean_mark_points.emplace_back(MarkPoint(now, tick));
 
 	// first erase the super-old client records
@@ -1054,46 +1933,140 @@ namespace crimson {
 	}
 
 	if (erase_point > 0 || idle_point > 0) {
-	  for (auto i = client_map.begin(); i != client_map.end(); /* empty */) {
-	    auto i2 = i++;
-	    if (erase_point && i2->second->last_tick <= erase_point) {
-	      delete_from_heaps(i2->second);
-	      client_map.erase(i2);
-	    } else if (idle_point && i2->second->last_tick <= idle_point) {
-	      i2->second->idle = true;
+	  clean_erase_point = erase_point;
+	  clean_idle_point = idle_point;
+	  clean_cursor = &clean_list;
+	}
+      } // start_clean
+
+
+      // Visits clients from clean_cursor on, within clean_budget,
+      // erasing or idling those last used before the mark points set
+      // by start_clean. Returns whether clients remain to be
+      // visited. data_mtx must be held by caller.
+      bool clean_step() {
+	if (nullptr == clean_cursor) {
+	  return false;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = start + clean_budget.time;
+	for (uint visited = 0; nullptr != *clean_cursor; ++visited) {
+	  if (clean_budget.clients > 0 && visited >= clean_budget.clients) {
+	    break;
+	  }
+	  // reading the clock is not free, so only check periodically
+	  if (clean_budget.time.count() > 0 && visited > 0 &&
+	      0 == visited % 64 &&
+	      std::chrono::steady_clock::now() >= deadline) {
+	    break;
+	  }
+
+	  ClientRecRef client = *clean_cursor;
+	  if (clean_erase_point && client->last_tick <= clean_erase_point) {
+	    if (snapshot_cursor == &client->clean_next) {
+	      snapshot_cursor = clean_cursor;
 	    }
-	  } // for
-	} // if
-      } // do_clean
+	    *clean_cursor = client->clean_next;
+	    note_removed(client->request_count(), 0);
+	    unindex_requests(*client);
+	    delete_from_heaps(client);
+	    client_map.erase(client->client);
+	    client_pool.destroy(client);
+	  } else {
+	    if (clean_idle_point && client->last_tick <= clean_idle_point &&
+		!client->idle) {
+	      client->idle = true;
+	      // idle clients rarely have many requests queued
+	      client->requests.shrink_to_fit();
+#if USE_PROP_HEAP
+	      prop_heap.adjust(*client);
+#endif
+	    }
+	    clean_cursor = &client->clean_next;
+	  }
+	}
+
+	const bool more = nullptr != *clean_cursor;
+	if (!more) {
+	  clean_cursor = nullptr;
+	}
+	clean_hold_hist.record(
+	  std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now() - start).count());
+	return more;
+      } // clean_step
+
+
+      // With piggyback cleaning, called by each add and pull to run a
+      // cleaning step, or every so often to check whether it is time
+      // for the next pass. data_mtx must be held by caller.
+      void maybe_clean() {
+	if (!clean_budget.piggyback) {
+	  return;
+	}
+	if (nullptr != clean_cursor) {
+	  (void) clean_step();
+	} else if (0 == ++clean_check_count % 64) {
+	  TimePoint now = std::chrono::steady_clock::now();
+	  if (now >= clean_next_pass) {
+	    clean_next_pass = now + check_time;
+	    start_clean(now);
+	    (void) clean_step();
+	  }
+	}
+      } // maybe_clean
 
 
       // data_mtx must be held by caller
-      template<IndIntruHeapData ClientRec::*C1,typename C2>
-      void delete_from_heap(ClientRecRef& client,
-			    c::IndIntruHeap<ClientRecRef,ClientRec,C1,C2,B>& heap) {
-	auto i = heap.rfind(client);
-	heap.remove(i);
+      static ClientSnapshot<C> client_snapshot(const ClientRec& client,
+					       Time now) {
+	ClientPhase phase;
+	if (!client.has_request()) {
+	  phase = ClientPhase::empty;
+	} else if (client.next_request().tag.reservation <= now) {
+	  phase = ClientPhase::reservation;
+	} else if (client.next_request().tag.limit <= now) {
+	  phase = ClientPhase::priority;
+	} else {
+	  phase = ClientPhase::limited;
+	}
+	return ClientSnapshot<C>{
+	  client.client,
+	  client.info,
+	  client.prev_tag,
+	  client.has_request() ? client.next_request().tag : client.prev_tag,
+	  client.prop_delta,
+	  client.request_count(),
+	  client.idle,
+	  phase };
       }
 
 
       // data_mtx must be held by caller
       void delete_from_heaps(ClientRecRef& client) {
-	delete_from_heap(client, resv_heap);
+	client_index.remove(*client);
 #if USE_PROP_HEAP
-	delete_from_heap(client, prop_heap);
+	prop_heap.remove(*client);
 #endif
-	delete_from_heap(client, limit_heap);
-	delete_from_heap(client, ready_heap);
       }
     }; // class PriorityQueueBase
 
 
-    template<typename C, typename R, uint B=2>
-    class PullPriorityQueue : public PriorityQueueBase<C,R,B> {
-      using super = PriorityQueueBase<C,R,B>;
+    // K is the clock policy (see dmclock_util.h) timing requests added
+    // and pulled without an explicit time; H is as for
+    // PriorityQueueBase
+    template<typename C, typename R, uint B=2,
+	     SchedIndex S=SchedIndex::heaps,
+	     typename K=DefaultClock,
+	     typename H=std::hash<C>>
+    class PullPriorityQueue : public PriorityQueueBase<C,R,B,S,H> {
+      using super = PriorityQueueBase<C,R,B,S,H>;
 
     public:
 
+      using Clock = K;
+
       // When a request is pulled, this is the return type.
       struct PullReq {
 	struct Retn {
@@ -1117,20 +2090,19 @@ namespace crimson {
       };
 
 
-#ifdef PROFILE
-      ProfileTimer<std::chrono::nanoseconds> pull_request_timer;
-      ProfileTimer<std::chrono::nanoseconds> add_request_timer;
-#endif
+      c::ConcurrentProfile<std::chrono::nanoseconds> pull_request_timer;
+      c::ConcurrentProfile<std::chrono::nanoseconds> add_request_timer;
 
       template<typename Rep, typename Per>
       PullPriorityQueue(typename super::ClientInfoFunc _client_info_f,
 			std::chrono::duration<Rep,Per> _idle_age,
 			std::chrono::duration<Rep,Per> _erase_age,
 			std::chrono::duration<Rep,Per> _check_time,
-			bool _allow_limit_break = false) :
+			bool _allow_limit_break = false,
+			const CleanBudget& _clean_budget = CleanBudget()) :
 	super(_client_info_f,
 	      _idle_age, _erase_age, _check_time,
-	      _allow_limit_break)
+	      _allow_limit_break, _clean_budget)
       {
 	// empty
       }
@@ -1156,7 +2128,7 @@ namespace crimson {
 	add_request(typename super::RequestRef(new R(request)),
 		    client_id,
 		    req_params,
-		    get_time(),
+		    K::now(),
 		    addl_cost);
       }
 
@@ -1168,7 +2140,7 @@ namespace crimson {
 	add_request(typename super::RequestRef(new R(request)),
 		    client_id,
 		    null_req_params,
-		    get_time(),
+		    K::now(),
 		    addl_cost);
       }
 
@@ -1187,11 +2159,35 @@ namespace crimson {
       }
 
 
+      // constructs the request in place from args rather than
+      // copying one. Requests, whether emplaced or copied by the
+      // const R& overloads above, are allocated with new R, so they
+      // avoid the general purpose allocator only if R opts in by
+      // deriving from crimson::PooledObject<R>; see pooled_object.h
+      // for how its free lists behave when requests are created and
+      // destroyed on different threads
+      template<typename... Args>
+      inline void emplace_request(const C& client_id,
+				  const ReqParams& req_params,
+				  Args&&... args) {
+	add_request(typename super::RequestRef(
+		      new R(std::forward<Args>(args)...)),
+		    client_id,
+		    req_params,
+		    K::now(),
+		    0.0);
+      }
+
+
       inline void add_request(typename super::RequestRef&& request,
 			      const C& client_id,
 			      const ReqParams& req_params,
 			      double addl_cost = 0.0) {
-	add_request(request, req_params, client_id, get_time(), addl_cost);
+	add_request(std::move(request),
+		    client_id,
+		    req_params,
+		    K::now(),
+		    addl_cost);
       }
 
 
@@ -1199,43 +2195,113 @@ namespace crimson {
 			      const C& client_id,
 			      double addl_cost = 0.0) {
 	static const ReqParams null_req_params;
-	add_request(request, null_req_params, client_id, get_time(), addl_cost);
+	add_request(std::move(request),
+		    client_id,
+		    null_req_params,
+		    K::now(),
+		    addl_cost);
       }
 
 
-      // this does the work; the versions above provide alternate interfaces
+      // this does the work; the versions above provide alternate
+      // interfaces. Requests added with a cancel_key can be removed
+      // together with cancel.
       void add_request(typename super::RequestRef&& request,
 		       const C&                     client_id,
 		       const ReqParams&             req_params,
 		       const Time                   time,
-		       double                       addl_cost = 0.0) {
+		       double                       addl_cost = 0.0,
+		       CancelKey                    cancel_key = no_cancel_key) {
 	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	add_request_timer.start();
-#endif
+	c::ProfileScope<std::chrono::nanoseconds> p(add_request_timer);
 	super::do_add_request(std::move(request),
 			      client_id,
 			      req_params,
 			      time,
-			      addl_cost);
+			      addl_cost,
+			      cancel_key);
 	// no call to schedule_request for pull version
-#ifdef PROFILE
-	add_request_timer.stop();
-#endif
+      }
+
+
+      // Adds the requests in the range [begin, end), whose elements
+      // are AddReqs, taking data_mtx only once; the requests are
+      // moved out of the range.
+      template<typename I>
+      void add_requests(I begin, I end, const Time time) {
+	typename super::DataGuard g(this->data_mtx);
+	for (I i = begin; i != end; ++i) {
+	  typename super::AddReq& a = *i;
+	  super::do_add_request(std::move(a.request),
+				a.client_id,
+				a.req_params,
+				time,
+				a.addl_cost,
+				a.cancel_key);
+	}
+      }
+
+
+      template<typename I>
+      inline void add_requests(I begin, I end) {
+	add_requests(begin, end, K::now());
       }
 
 
       inline PullReq pull_request() {
-	return pull_request(get_time());
+	return pull_request(K::now());
       }
 
 
       PullReq pull_request(Time now) {
-	PullReq result;
 	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	pull_request_timer.start();
-#endif
+	c::ProfileScope<std::chrono::nanoseconds> p(pull_request_timer);
+	return do_pull_request(now);
+      } // pull_request
+
+
+      // turns timing of add_request and pull_request on or off
+      void set_profiling(bool on) {
+	add_request_timer.set_enabled(on);
+	pull_request_timer.set_enabled(on);
+      }
+
+
+      // Pulls up to max_n requests that can be scheduled at time now,
+      // taking data_mtx only once, and appends them to out in the
+      // order pull_request would have returned them. Returns the
+      // number pulled. If when_ready is provided it is set to when
+      // pulling could next succeed: now if max_n requests were
+      // pulled, the future time at which a request becomes ready, or
+      // TimeMax if there are no requests.
+      size_t pull_requests(Time now,
+			   size_t max_n,
+			   std::vector<typename PullReq::Retn>& out,
+			   Time* when_ready = nullptr) {
+	typename super::DataGuard g(this->data_mtx);
+	Time next = now;
+	size_t count = 0;
+	for (; count < max_n; ++count) {
+	  PullReq result = do_pull_request(now);
+	  if (!result.is_retn()) {
+	    next = result.is_future() ? result.getTime() : TimeMax;
+	    break;
+	  }
+	  out.emplace_back(std::move(result.get_retn()));
+	}
+	if (nullptr != when_ready) {
+	  *when_ready = next;
+	}
+	return count;
+      } // pull_requests
+
+
+    protected:
+
+
+      // data_mtx should be held when called
+      PullReq do_pull_request(Time now) {
+	PullReq result;
 
 	typename super::NextReq next = super::do_next_request(now);
 	result.type = next.type;
@@ -1267,57 +2333,69 @@ namespace crimson {
 	  };
 	};
 
+	super::note_dispatch(next, now);
 	switch(next.heap_id) {
 	case super::HeapId::reservation:
-	  super::pop_process_request(this->resv_heap,
+	  super::pop_process_request(super::HeapId::reservation,
 				     process_f(result, PhaseType::reservation));
-	  ++this->reserv_sched_count;
 	  break;
 	case super::HeapId::ready:
-	  super::pop_process_request(this->ready_heap,
+	  super::pop_process_request(super::HeapId::ready,
 				     process_f(result, PhaseType::priority));
 	  { // need to use retn temporarily
 	    auto& retn = boost::get<typename PullReq::Retn>(result.data);
 	    super::reduce_reservation_tags(retn.client);
 	  }
-	  ++this->prop_sched_count;
 	  break;
 	default:
 	  assert(false);
 	}
 
-#ifdef PROFILE
-	pull_request_timer.stop();
-#endif
 	return result;
-      } // pull_request
-
-
-    protected:
+      } // do_pull_request
 
 
       // data_mtx should be held when called; unfortunately this
       // function has to be repeated in both push & pull
       // specializations
       typename super::NextReq next_request() {
-	return next_request(get_time());
+	return next_request(K::now());
       }
     }; // class PullPriorityQueue
 
 
-    // PUSH version
-    template<typename C, typename R, uint B=2>
-    class PushPriorityQueue : public PriorityQueueBase<C,R,B> {
+    // PUSH version; K and H are as for PullPriorityQueue
+    template<typename C, typename R, uint B=2,
+	     SchedIndex S=SchedIndex::heaps,
+	     typename K=DefaultClock,
+	     typename H=std::hash<C>>
+    class PushPriorityQueue : public PriorityQueueBase<C,R,B,S,H> {
 
     protected:
 
-      using super = PriorityQueueBase<C,R,B>;
+      using super = PriorityQueueBase<C,R,B,S,H>;
 
     public:
 
+      using Clock = K;
+
       // a function to see whether the server can handle another request
       using CanHandleRequestFunc = std::function<bool(void)>;
 
+      // how often the queue read K, compared to the requests added;
+      // reuses are times the queue needed and took from the current
+      // time epoch instead. Counted only while profiling is on, so
+      // that otherwise threads don't contend on the counters.
+      struct ClockStats {
+	uint64_t reads;
+	uint64_t reuses;
+	uint64_t requests;
+
+	double reads_per_request() const {
+	  return requests ? double(reads) / requests : 0.0;
+	}
+      };
+
       // a function to submit a request to the server; the second
       // parameter is a callback when it's completed
       using HandleRequestFunc =
@@ -1327,25 +2405,117 @@ namespace crimson {
 
       CanHandleRequestFunc can_handle_f;
       HandleRequestFunc    handle_f;
-      // for handling timed scheduling
-      std::mutex  sched_ahead_mtx;
-      std::condition_variable sched_ahead_cv;
-      Time sched_ahead_when = TimeZero;
 
-#ifdef PROFILE
+      // can_handle_f and handle_f are called without data_mtx held,
+      // but by only one thread at a time, the dispatcher. Every event
+      // that may make a request schedulable (an add, a completion, a
+      // scheduled time arriving) adds one to sched_pending, and the
+      // thread whose increment finds it at zero becomes the
+      // dispatcher. The other threads return immediately. Since
+      // passes are serialized, handle_f sees requests in the order
+      // they were chosen and can_handle_f always reflects the
+      // requests already handed over. A producer or completing
+      // thread that becomes the dispatcher runs only the passes for
+      // its own events, so it never pays for handle_f on other
+      // threads' requests, and hands off (see hand_off) any others
+      // that are pending by then. A timer that becomes the
+      // dispatcher hands off all of them, since it runs on a timer
+      // thread shared with other queues. In async dispatch mode
+      // every thread does the same, so add_request and
+      // request_completed never call can_handle_f or handle_f, at the
+      // cost of a handoff whenever the queue goes from idle to busy.
+      std::atomic<uint> sched_pending;
+
+      // the most requests a single scheduling pass hands to the
+      // server; with 1 each event dispatches at most one request, and
+      // with more a pass keeps dispatching while can_handle_f allows
+      // and a request is ready, so free server capacity is filled
+      // without waiting for further events
+      const uint max_per_pass;
+
+      // whether every scheduling pass is handed off; see sched_pending
+      const bool async_dispatch;
+
+      // In ingress mode add_request only pushes onto the lock-free
+      // ingress queue, and the ingress thread moves requests from it
+      // into the heaps and schedules them, so producers never wait
+      // for data_mtx or for handle_f. Requests still in the ingress
+      // queue are not included in request_count and the like, but the
+      // removals and cancel move them into the heaps first.
+      struct IngressReq : public super::AddReq {
+	Time time;
+
+	IngressReq(typename super::RequestRef&& _request,
+		   const C&                     _client_id,
+		   const ReqParams&             _req_params,
+		   Time                         _time,
+		   double                       _addl_cost,
+		   CancelKey                    _cancel_key) :
+	  super::AddReq(std::move(_request),
+			_client_id,
+			_req_params,
+			_addl_cost,
+			_cancel_key),
+	  time(_time)
+	{
+	  // empty
+	}
+      };
+
+      const bool                use_ingress;
+      c::MpscQueue<IngressReq>  ingress;
+      std::mutex                ingress_mtx;
+      std::condition_variable   ingress_cv;
+      // set, under ingress_mtx, when the ingress thread is to become
+      // the dispatcher
+      bool                      ingress_dispatch = false;
+
+      // With a non-zero max_time_staleness, the time used for adds
+      // and scheduling passes (when the caller doesn't give one) is
+      // read from K once and then reused by every thread until the
+      // epoch closes, so a busy queue reads the clock about once per
+      // epoch rather than two or three times per request. epoch_timer
+      // closes an epoch no later than max_time_staleness (plus a timer
+      // tick) after it opens, and it's also closed when a scheduled
+      // time arrives, so requests that were in the future are judged
+      // against a fresh time. The cost is that tags and readiness may
+      // be computed from a time up to max_time_staleness old. With
+      // zero, K is read each time.
+      const std::chrono::microseconds max_time_staleness;
+      std::atomic<bool>         epoch_open;
+      std::atomic<Time>         epoch_time;
+
+      std::atomic<uint64_t>     clock_reads;
+      std::atomic<uint64_t>     clock_reuses;
+      std::atomic<uint64_t>     requests_added;
+
     public:
-      ProfileTimer<std::chrono::nanoseconds> add_request_timer;
-      ProfileTimer<std::chrono::nanoseconds> request_complete_timer;
+      c::ConcurrentProfile<std::chrono::nanoseconds> add_request_timer;
+      c::ConcurrentProfile<std::chrono::nanoseconds> request_complete_timer;
     protected:
-#endif
 
-      // NB: threads declared last, so constructed last and destructed first
+      // NB: threads and timers declared last, so constructed last and
+      // destructed first
 
-      std::thread sched_ahead_thd;
+      // runs a scheduling pass when the earliest future request
+      // becomes ready; the timer is on the process-wide timer
+      // service, so queues don't each need a thread for this
+      c::TimerService::Timer sched_ahead_timer;
+      c::TimerService::Timer epoch_timer;
+      // runs handed off scheduling passes on the queue's work service
+      // when there's no ingress thread
+      c::WorkService::Task   dispatch_task;
+      std::thread ingress_thd;
 
     public:
 
-      // push full constructor
+      // push full constructor; handed off scheduling passes, and so
+      // some calls to handle_f, or all of them with async_dispatch,
+      // run on work_service unless there's an ingress thread. By
+      // default that's the process-wide service, whose few workers are
+      // shared by every queue using it, so handle_f must not block
+      // there; a handle_f that may block (e.g., to throttle
+      // submission) needs a service of its own.
       template<typename Rep, typename Per>
       PushPriorityQueue(typename super::ClientInfoFunc _client_info_f,
 			CanHandleRequestFunc _can_handle_f,
@@ -1353,14 +2523,40 @@ namespace crimson {
 			std::chrono::duration<Rep,Per> _idle_age,
 			std::chrono::duration<Rep,Per> _erase_age,
 			std::chrono::duration<Rep,Per> _check_time,
-			bool _allow_limit_break = false) :
+			bool _allow_limit_break = false,
+			bool _use_ingress = false,
+			uint _max_per_pass = 1,
+			const CleanBudget& _clean_budget = CleanBudget(),
+			std::chrono::microseconds _max_time_staleness =
+			std::chrono::microseconds(0),
+			c::WorkService& _work_service =
+			c::WorkService::global(),
+			bool _async_dispatch = false) :
 	super(_client_info_f,
 	      _idle_age, _erase_age, _check_time,
-	      _allow_limit_break)
+	      _allow_limit_break, _clean_budget),
+	sched_pending(0),
+	max_per_pass(_max_per_pass),
+	async_dispatch(_async_dispatch),
+	use_ingress(_use_ingress),
+	max_time_staleness(_max_time_staleness),
+	epoch_open(false),
+	epoch_time(TimeZero),
+	clock_reads(0),
+	clock_reuses(0),
+	requests_added(0),
+	sched_ahead_timer(c::TimerService::global(),
+			  std::bind(&PushPriorityQueue::run_sched_ahead, this)),
+	epoch_timer(c::TimerService::global(),
+		    std::bind(&PushPriorityQueue::close_epoch, this)),
+	dispatch_task(_work_service,
+		      std::bind(&PushPriorityQueue::run_passes, this))
       {
 	can_handle_f = _can_handle_f;
 	handle_f = _handle_f;
-	sched_ahead_thd = std::thread(&PushPriorityQueue::run_sched_ahead, this);
+	if (use_ingress) {
+	  ingress_thd = std::thread(&PushPriorityQueue::run_ingress, this);
+	}
       }
 
 
@@ -1368,14 +2564,18 @@ namespace crimson {
       PushPriorityQueue(typename super::ClientInfoFunc _client_info_f,
 			CanHandleRequestFunc _can_handle_f,
 			HandleRequestFunc _handle_f,
-			bool _allow_limit_break = false) :
+			bool _allow_limit_break = false,
+			bool _use_ingress = false,
+			uint _max_per_pass = 1) :
 	PushPriorityQueue(_client_info_f,
 			  _can_handle_f,
 			  _handle_f,
 			  std::chrono::minutes(10),
 			  std::chrono::minutes(15),
 			  std::chrono::minutes(6),
-			  _allow_limit_break)
+			  _allow_limit_break,
+			  _use_ingress,
+			  _max_per_pass)
       {
 	// empty
       }
@@ -1383,8 +2583,19 @@ namespace crimson {
 
       ~PushPriorityQueue() {
 	this->finishing = true;
-	sched_ahead_cv.notify_one();
-	sched_ahead_thd.join();
+	if (use_ingress) {
+	  {
+	    std::lock_guard<std::mutex> l(ingress_mtx);
+	    ingress_cv.notify_one();
+	  }
+	  ingress_thd.join();
+	}
+	// the ingress thread may have scheduled the timers, so cancel
+	// them only once that thread is done, and the sched-ahead timer
+	// may have posted the dispatch task
+	sched_ahead_timer.cancel_sync();
+	epoch_timer.cancel_sync();
+	dispatch_task.cancel_sync();
       }
 
     public:
@@ -1396,7 +2607,7 @@ namespace crimson {
 	add_request(typename super::RequestRef(new R(request)),
 		    client_id,
 		    req_params,
-		    get_time(),
+		    current_time(),
 		    addl_cost);
       }
 
@@ -1405,7 +2616,11 @@ namespace crimson {
 			      const C& client_id,
 			      const ReqParams& req_params,
 			      double addl_cost = 0.0) {
-	add_request(request, req_params, client_id, get_time(), addl_cost);
+	add_request(std::move(request),
+		    client_id,
+		    req_params,
+		    current_time(),
+		    addl_cost);
       }
 
 
@@ -1422,83 +2637,212 @@ namespace crimson {
       }
 
 
+      // constructs the request in place from args rather than
+      // copying one; allocation is as for PullPriorityQueue's
+      // emplace_request
+      template<typename... Args>
+      inline void emplace_request(const C& client_id,
+				  const ReqParams& req_params,
+				  Args&&... args) {
+	add_request(typename super::RequestRef(
+		      new R(std::forward<Args>(args)...)),
+		    client_id,
+		    req_params,
+		    current_time(),
+		    0.0);
+      }
+
+
+      // requests added with a cancel_key can be removed together with
+      // cancel
       void add_request(typename super::RequestRef&& request,
 		       const C&         client_id,
 		       const ReqParams& req_params,
 		       const Time       time,
-		       double           addl_cost = 0.0) {
-	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	add_request_timer.start();
-#endif
-	super::do_add_request(std::move(request),
-			      client_id,
-			      req_params,
-			      time,
-			      addl_cost);
+		       double           addl_cost = 0.0,
+		       CancelKey        cancel_key = no_cancel_key) {
+	count_clock_stat(requests_added);
+	if (use_ingress) {
+	  push_ingress(std::move(request),
+		       client_id,
+		       req_params,
+		       time,
+		       addl_cost,
+		       cancel_key);
+	  return;
+	}
+
+	{
+	  typename super::DataGuard g(this->data_mtx);
+	  c::ProfileScope<std::chrono::nanoseconds> p(add_request_timer);
+	  super::do_add_request(std::move(request),
+				client_id,
+				req_params,
+				time,
+				addl_cost,
+				cancel_key);
+	}
 	schedule_request();
-#ifdef PROFILE
-	add_request_timer.stop();
-#endif
+      }
+
+
+      // Adds the requests in the range [begin, end), whose elements
+      // are AddReqs, taking data_mtx only once; the requests are
+      // moved out of the range. As with add_request, one scheduling
+      // pass is run for each request added.
+      template<typename I>
+      void add_requests(I begin, I end, const Time time) {
+	if (use_ingress) {
+	  for (I i = begin; i != end; ++i) {
+	    typename super::AddReq& a = *i;
+	    count_clock_stat(requests_added);
+	    push_ingress(std::move(a.request),
+			 a.client_id,
+			 a.req_params,
+			 time,
+			 a.addl_cost,
+			 a.cancel_key);
+	  }
+	  return;
+	}
+
+	uint count = 0;
+	{
+	  typename super::DataGuard g(this->data_mtx);
+	  for (I i = begin; i != end; ++i) {
+	    typename super::AddReq& a = *i;
+	    super::do_add_request(std::move(a.request),
+				  a.client_id,
+				  a.req_params,
+				  time,
+				  a.addl_cost,
+				  a.cancel_key);
+	    ++count;
+	  }
+	}
+	count_clock_stat(requests_added, count);
+	schedule_request(count);
+      }
+
+
+      template<typename I>
+      inline void add_requests(I begin, I end) {
+	add_requests(begin, end, current_time());
       }
 
 
       void request_completed() {
-	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	request_complete_timer.start();
-#endif
+	c::ProfileScope<std::chrono::nanoseconds> p(request_complete_timer);
 	schedule_request();
-#ifdef PROFILE
-	request_complete_timer.stop();
-#endif
+      }
+
+
+      // In ingress mode the removals below first move any requests
+      // still in the ingress queue into the heaps, under the same hold
+      // of data_mtx, so requests added before the call are removed
+      // rather than dispatched later. Requests that aren't removed are
+      // then scheduled as the ingress thread would have.
+
+      bool remove_by_req_filter(std::function<bool(const R&)> filter_accum,
+				bool visit_backwards = false) {
+	bool any_removed;
+	size_t drained;
+	{
+	  typename super::DataGuard g(this->data_mtx);
+	  drained = drain_ingress();
+	  any_removed =
+	    super::do_remove_by_req_filter(filter_accum, visit_backwards);
+	}
+	schedule_request(drained);
+	return any_removed;
+      }
+
+
+      void remove_by_client(const C& client,
+			    bool reverse = false,
+			    std::function<void (const R&)> accum =
+			    super::request_sink) {
+	size_t drained;
+	{
+	  typename super::DataGuard g(this->data_mtx);
+	  drained = drain_ingress();
+	  super::do_remove_by_client(client, reverse, accum);
+	}
+	schedule_request(drained);
+      }
+
+
+      size_t cancel(CancelKey cancel_key,
+		    std::function<void (const R&)> accum =
+		    super::request_sink) {
+	if (no_cancel_key == cancel_key) {
+	  return 0;
+	}
+
+	size_t removed;
+	size_t drained;
+	{
+	  typename super::DataGuard g(this->data_mtx);
+	  drained = drain_ingress();
+	  removed = super::do_cancel(cancel_key, accum);
+	}
+	schedule_request(drained);
+	return removed;
+      }
+
+
+      // turns timing of add_request and request_completed, and
+      // counting for clock_stats, on or off
+      void set_profiling(bool on) {
+	add_request_timer.set_enabled(on);
+	request_complete_timer.set_enabled(on);
+      }
+
+
+      ClockStats clock_stats() const {
+	return ClockStats{ clock_reads.load(std::memory_order_relaxed),
+			   clock_reuses.load(std::memory_order_relaxed),
+			   requests_added.load(std::memory_order_relaxed) };
       }
 
     protected:
 
+      // a request chosen under data_mtx, to be handed to handle_f
+      // once data_mtx is released
+      struct Dispatch {
+	C                            client;
+	typename super::RequestRef   request;
+	PhaseType                    phase;
+      };
+
       // data_mtx should be held when called; furthermore, the heap
       // should not be empty and the top element of the heap should
       // not be already handled
-      //
-      // NOTE: the use of "super::ClientRec" in either the template
-      // construct or as a parameter to submit_top_request generated
-      // a compiler error in g++ 4.8.4, when ClientRec was
-      // "protected" rather than "public". By g++ 6.3.1 this was not
-      // an issue. But for backwards compatibility
-      // PriorityQueueBase::ClientRec is public.
-      template<typename C1,
-	       IndIntruHeapData super::ClientRec::*C2,
-	       typename C3,
-	       uint B4>
-      C submit_top_request(IndIntruHeap<C1,typename super::ClientRec,C2,C3,B4>& heap,
-			   PhaseType phase) {
-	C client_result;
-	super::pop_process_request(heap,
-				   [this, phase, &client_result]
+      void submit_top_request(typename super::HeapId heap_id,
+			      PhaseType phase,
+			      Dispatch& out) {
+	super::pop_process_request(heap_id,
+				   [phase, &out]
 				   (const C& client,
 				    typename super::RequestRef& request) {
-				     client_result = client;
-				     handle_f(client, std::move(request), phase);
+				     out.client = client;
+				     out.request = std::move(request);
+				     out.phase = phase;
 				   });
-	return client_result;
       }
 
 
       // data_mtx should be held when called
-      void submit_request(typename super::HeapId heap_id) {
-	C client;
+      void submit_request(typename super::HeapId heap_id, Dispatch& out) {
 	switch(heap_id) {
 	case super::HeapId::reservation:
-	  // don't need to note client
-	  (void) submit_top_request(this->resv_heap, PhaseType::reservation);
+	  submit_top_request(heap_id, PhaseType::reservation, out);
 	  // unlike the other two cases, we do not reduce reservation
 	  // tags here
-	  ++this->reserv_sched_count;
 	  break;
 	case super::HeapId::ready:
-	  client = submit_top_request(this->ready_heap, PhaseType::priority);
-	  super::reduce_reservation_tags(client);
-	  ++this->prop_sched_count;
+	  submit_top_request(heap_id, PhaseType::priority, out);
+	  super::reduce_reservation_tags(out.client);
 	  break;
 	default:
 	  assert(false);
@@ -1506,83 +2850,235 @@ namespace crimson {
       } // submit_request
 
 
-      // data_mtx should be held when called; unfortunately this
-      // function has to be repeated in both push & pull
-      // specializations
-      typename super::NextReq next_request() {
-	return next_request(get_time());
+      // data_mtx should NOT be held when called; runs count
+      // scheduling passes, either on this thread or, if another
+      // thread is already dispatching, by that one; passes other
+      // threads add while this one runs its own are handed off, as
+      // are all of them in async dispatch mode
+      void schedule_request(uint count = 1) {
+	if (0 == count || sched_pending.fetch_add(count) > 0) {
+	  return;
+	}
+
+	if (async_dispatch) {
+	  hand_off();
+	  return;
+	}
+
+	for (uint i = 0; i < count; ++i) {
+	  schedule_pass();
+	}
+	if (sched_pending.fetch_sub(count) > count) {
+	  hand_off();
+	}
       }
 
 
-      // data_mtx should be held when called; overrides member
-      // function in base class to add check for whether a request can
-      // be pushed to the server
-      typename super::NextReq next_request(Time now) {
-	if (!can_handle_f()) {
-	  typename super::NextReq result;
-	  result.type = super::NextReqType::none;
-	  return result;
+      // runs scheduling passes until none are pending; only called by
+      // the dispatcher, and data_mtx should NOT be held when called
+      void run_passes() {
+	do {
+	  schedule_pass();
+	} while (sched_pending.fetch_sub(1) > 1);
+      }
+
+
+      // makes the ingress thread, or a worker of the queue's work
+      // service, the dispatcher in place of the calling thread; only
+      // called by the dispatcher
+      void hand_off() {
+	if (use_ingress) {
+	  std::lock_guard<std::mutex> l(ingress_mtx);
+	  ingress_dispatch = true;
+	  ingress_cv.notify_one();
 	} else {
-	  return super::do_next_request(now);
+	  dispatch_task.post();
 	}
-      } // next_request
+      }
 
 
-      // data_mtx should be held when called
-      void schedule_request() {
-	typename super::NextReq next_req = next_request();
-	switch (next_req.type) {
-	case super::NextReqType::none:
-	  return;
-	case super::NextReqType::future:
-	  sched_at(next_req.when_ready);
-	  break;
-	case super::NextReqType::returning:
-	  submit_request(next_req.heap_id);
-	  break;
-	default:
-	  assert(false);
+      // a single scheduling pass, handing up to max_per_pass requests
+      // to the server; only called by the dispatcher, and data_mtx
+      // should NOT be held when called
+      void schedule_pass() {
+	for (uint i = 0; i < max_per_pass; ++i) {
+	  if (!schedule_one()) {
+	    return;
+	  }
+	}
+      }
+
+
+      // tries to hand one request to the server and returns whether
+      // it did; data_mtx should NOT be held when called
+      bool schedule_one() {
+	if (!can_handle_f()) {
+	  return false;
+	}
+
+	Dispatch dispatch;
+	{
+	  typename super::DataGuard g(this->data_mtx);
+	  const Time now = current_time();
+	  typename super::NextReq next_req = super::do_next_request(now);
+	  switch (next_req.type) {
+	  case super::NextReqType::none:
+	    return false;
+	  case super::NextReqType::future:
+	    sched_at(next_req.when_ready, now);
+	    return false;
+	  case super::NextReqType::returning:
+	    super::note_dispatch(next_req, now);
+	    submit_request(next_req.heap_id, dispatch);
+	    break;
+	  default:
+	    assert(false);
+	  }
 	}
+
+	handle_f(dispatch.client, std::move(dispatch.request), dispatch.phase);
+	return true;
       }
 
 
-      // this is the thread that handles running schedule_request at
-      // future times when nothing can be scheduled immediately
+      // runs on the timer service when nothing could be scheduled
+      // immediately and the time given to sched_at arrives; the
+      // timer thread is shared, so the pass is handed off rather than
+      // run here, where a slow handle_f would delay other queues
       void run_sched_ahead() {
-	std::unique_lock<std::mutex> l(sched_ahead_mtx);
+	if (!this->finishing) {
+	  close_epoch();
+	  if (0 == sched_pending.fetch_add(1)) {
+	    hand_off();
+	  }
+	}
+      }
 
-	while (!this->finishing) {
-	  if (TimeZero == sched_ahead_when) {
-	    sched_ahead_cv.wait(l);
-	  } else {
-	    Time now;
-	    while (!this->finishing && (now = get_time()) < sched_ahead_when) {
-	      long microseconds_l = long(1 + 1000000 * (sched_ahead_when - now));
-	      auto microseconds = std::chrono::microseconds(microseconds_l);
-	      sched_ahead_cv.wait_for(l, microseconds);
-	    }
-	    sched_ahead_when = TimeZero;
-	    if (this->finishing) return;
 
+      // the time to use now, from the current epoch if one is open;
+      // otherwise K is read and, when epochs are in use, a new epoch
+      // opens with that time
+      Time current_time() {
+	if (0 == max_time_staleness.count()) {
+	  count_clock_stat(clock_reads);
+	  return K::now();
+	}
+
+	if (epoch_open.load(std::memory_order_acquire)) {
+	  count_clock_stat(clock_reuses);
+	  return epoch_time.load(std::memory_order_relaxed);
+	}
+
+	count_clock_stat(clock_reads);
+	const Time now = K::now();
+	epoch_time.store(now, std::memory_order_relaxed);
+	// if threads race to open an epoch, the one that opens it
+	// schedules its close, which covers the others' times too
+	if (!epoch_open.exchange(true, std::memory_order_release)) {
+	  epoch_timer.schedule_by(
+	    c::TimerWheel::Clock::now() +
+	    std::chrono::duration_cast<c::TimerWheel::Clock::duration>(
+	      max_time_staleness));
+	}
+	return now;
+      }
+
+
+      // adds n to one of the clock_stats counters if profiling is on
+      void count_clock_stat(std::atomic<uint64_t>& counter,
+			    uint64_t n = 1) {
+	if (add_request_timer.is_enabled()) {
+	  counter.fetch_add(n, std::memory_order_relaxed);
+	}
+      }
+
+
+      void close_epoch() {
+	epoch_open.store(false, std::memory_order_release);
+      }
+
+
+      // makes sure a scheduling pass runs no later than when, given
+      // that it's now; the timer keeps an earlier time if it already
+      // has one
+      void sched_at(Time when, Time now) {
+	auto delay =
+	  std::chrono::duration<double>(time_to_seconds(when - now));
+	sched_ahead_timer.schedule_by(
+	  c::TimerWheel::Clock::now() +
+	  std::chrono::duration_cast<c::TimerWheel::Clock::duration>(delay));
+      }
+
+
+      void push_ingress(typename super::RequestRef&& request,
+			const C&                     client_id,
+			const ReqParams&             req_params,
+			const Time                   time,
+			double                       addl_cost,
+			CancelKey                    cancel_key) {
+	bool was_empty = ingress.push(std::move(request),
+				      client_id,
+				      req_params,
+				      time,
+				      addl_cost,
+				      cancel_key);
+	// the ingress thread only waits after finding the queue empty
+	// while holding ingress_mtx, so taking it here, which only
+	// happens on the transition from empty, ensures the wakeup
+	// isn't lost
+	if (was_empty) {
+	  std::lock_guard<std::mutex> l(ingress_mtx);
+	  ingress_cv.notify_one();
+	}
+      }
+
+
+      // moves the requests in the ingress queue into the heaps and
+      // returns how many there were; data_mtx must be held, which also
+      // keeps drains from running concurrently
+      size_t drain_ingress() {
+	return ingress.drain([this] (IngressReq& r) {
+	    super::do_add_request(std::move(r.request),
+				  r.client_id,
+				  r.req_params,
+				  r.time,
+				  r.addl_cost,
+				  r.cancel_key);
+	  });
+      }
+
+
+      // this is the thread that, in ingress mode, moves requests from
+      // the ingress queue into the heaps and schedules them, and runs
+      // the scheduling passes handed off to it
+      void run_ingress() {
+	std::unique_lock<std::mutex> l(ingress_mtx);
+
+	while (!this->finishing) {
+	  if (ingress_dispatch) {
+	    ingress_dispatch = false;
 	    l.unlock();
-	    if (!this->finishing) {
-	      typename super::DataGuard g(this->data_mtx);
-	      schedule_request();
-	    }
+	    run_passes();
 	    l.lock();
+	    continue;
 	  }
-	}
-      }
 
+	  if (ingress.empty()) {
+	    ingress_cv.wait(l);
+	    continue;
+	  }
 
-      void sched_at(Time when) {
-	std::lock_guard<std::mutex> l(sched_ahead_mtx);
-	if (TimeZero == sched_ahead_when || when < sched_ahead_when) {
-	  sched_ahead_when = when;
-	  sched_ahead_cv.notify_one();
+	  l.unlock();
+	  size_t count;
+	  {
+	    typename super::DataGuard g(this->data_mtx);
+	    count = drain_ingress();
+	  }
+	  schedule_request(count);
+	  l.lock();
 	}
       }
     }; // class PushPriorityQueue
 
-  } // namespace dmclock
+  DMCLOCK_TIME_NS_END } // namespace dmclock
 } // namespace crimson
@@ -0,0 +1,591 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+/*
+ * ShardedPullPriorityQueue partitions clients across a number of
+ * independent PullPriorityQueue shards by hashing the client
+ * identifier. Each shard has its own data_mtx, client_map and heaps,
+ * so add_request calls for clients in different shards do not
+ * contend.
+ *
+ * After every operation that changes a shard, the shard publishes
+ * the tags at the top of its heaps into a set of atomics. The
+ * dispatcher (pull_request) reads those published tops without
+ * taking any shard lock, picks the shard with the globally best tag
+ * following the usual dmclock phase order (reservation, then
+ * proportion of clients within limit, then optionally limit break),
+ * and only locks that one shard to pull from it. Because the
+ * published tops can be stale by the time the lock is taken, the
+ * shard re-runs its own scheduling decision under its lock; if it
+ * has nothing to return the dispatcher tries again with the fresh
+ * tops. If every attempt loses such a race, the dispatcher locks all
+ * the shards and chooses once more, so it never reports that nothing
+ * is ready while a shard has a ready request.
+ *
+ * Clients become un-idle relative to the lowest proportion tag of
+ * their own shard rather than of all clients, so proportional
+ * fairness between clients in different shards is approximate
+ * whenever clients go idle.
+ */
+
+#include <assert.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+#include "dmclock_server.h"
+
+
+namespace crimson {
+
+  namespace dmclock {
+
+    DMCLOCK_DECLARE_TEST(dmclock_server_sharded, pull_locked);
+
+  DMCLOCK_TIME_NS_BEGIN
+
+    // C is client identifier type, R is request type, B is heap
+    // branching factor, H is the hash used to map clients to shards
+    // and within each shard's client_map, S is each shard's
+    // scheduling index, K is the clock policy
+    template<typename C, typename R, uint B=2, typename H=std::hash<C>,
+	     SchedIndex S=SchedIndex::heaps,
+	     typename K=DefaultClock>
+    class ShardedPullPriorityQueue {
+      using Queue = PullPriorityQueue<C,R,B,S,K,H>;
+
+      DMCLOCK_FRIEND_TEST(dmclock_server_sharded, pull_locked);
+
+    public:
+
+      using Clock = K;
+
+      using RequestRef = typename Queue::RequestRef;
+      using PullReq = typename Queue::PullReq;
+      using NextReqType = typename Queue::NextReqType;
+      using ClientInfoFunc = typename Queue::ClientInfoFunc;
+
+    protected:
+
+      // the tags at the tops of a shard's heaps, readable without
+      // holding the shard's data_mtx
+      struct ShardTops {
+	std::atomic<Time>   reservation; // next reservation tag
+	std::atomic<Time>   proportion;  // next proportion tag w/ prop_delta
+	std::atomic<bool>   ready;       // whether proportion is within limit
+	std::atomic<Time>   limit;       // next limit tag not yet reached
+
+	ShardTops() :
+	  reservation(max_tag),
+	  proportion(max_tag),
+	  ready(false),
+	  limit(max_tag)
+	{
+	  // empty
+	}
+      };
+
+      class Shard : public Queue {
+	using super = Queue;
+
+	ShardTops tops;
+
+      public:
+
+	template<typename Rep, typename Per>
+	Shard(ClientInfoFunc _client_info_f,
+	      std::chrono::duration<Rep,Per> _idle_age,
+	      std::chrono::duration<Rep,Per> _erase_age,
+	      std::chrono::duration<Rep,Per> _check_time,
+	      bool _allow_limit_break,
+	      const CleanBudget& _clean_budget) :
+	  super(_client_info_f,
+		_idle_age, _erase_age, _check_time,
+		_allow_limit_break, _clean_budget)
+	{
+	  // the cleaning job erases and idles clients, so it must
+	  // publish the changed tops too
+	  typename super::DataGuard g(this->data_mtx);
+	  this->clean_step_f = [this] () { publish_tops(); };
+	}
+
+	~Shard() {
+	  // tops goes before the base class stops the cleaning job
+	  typename super::DataGuard g(this->data_mtx);
+	  this->clean_step_f = nullptr;
+	}
+
+	const ShardTops& get_tops() const { return tops; }
+
+	std::unique_lock<c::StatMutex> lock() {
+	  return std::unique_lock<c::StatMutex>(this->data_mtx);
+	}
+
+	void add(RequestRef&&     request,
+		 const C&         client_id,
+		 const ReqParams& req_params,
+		 const Time       time,
+		 double           addl_cost,
+		 CancelKey        cancel_key) {
+	  typename super::DataGuard g(this->data_mtx);
+	  super::do_add_request(std::move(request),
+				client_id,
+				req_params,
+				time,
+				addl_cost,
+				cancel_key);
+	  publish_tops();
+	}
+
+	PullReq pull(Time now) {
+	  typename super::DataGuard g(this->data_mtx);
+	  PullReq result = super::do_pull_request(now);
+	  publish_tops();
+	  return result;
+	}
+
+	void promote_ready(Time now) {
+	  typename super::DataGuard g(this->data_mtx);
+	  promote_ready_locked(now);
+	}
+
+	// the _locked variants are for when the caller holds the lock
+	// returned by lock()
+
+	PullReq pull_locked(Time now) {
+	  PullReq result = super::do_pull_request(now);
+	  publish_tops();
+	  return result;
+	}
+
+	void promote_ready_locked(Time now) {
+	  super::do_promote_ready(now);
+	  publish_tops();
+	}
+
+	// the removals publish the changed tops under the same hold of
+	// data_mtx, as add and pull do, so no other thread sees tops
+	// that lag behind the shard
+
+	bool remove_by_req_filter(std::function<bool(const R&)> filter_accum,
+				  bool visit_backwards) {
+	  typename super::DataGuard g(this->data_mtx);
+	  bool result = super::do_remove_by_req_filter(filter_accum,
+						       visit_backwards);
+	  publish_tops();
+	  return result;
+	}
+
+	void remove_by_client(const C& client,
+			      bool reverse,
+			      std::function<void (const R&)> accum) {
+	  typename super::DataGuard g(this->data_mtx);
+	  super::do_remove_by_client(client, reverse, accum);
+	  publish_tops();
+	}
+
+	size_t cancel(CancelKey cancel_key,
+		      std::function<void (const R&)> accum) {
+	  if (no_cancel_key == cancel_key) {
+	    return 0;
+	  }
+	  typename super::DataGuard g(this->data_mtx);
+	  size_t result = super::do_cancel(cancel_key, accum);
+	  if (result > 0) {
+	    publish_tops();
+	  }
+	  return result;
+	}
+
+      protected:
+
+	// data_mtx must be held by caller
+	void publish_tops() {
+	  typename super::HeapTops t = super::do_get_heap_tops();
+	  tops.reservation.store(t.reservation, std::memory_order_relaxed);
+	  tops.proportion.store(t.proportion, std::memory_order_relaxed);
+	  tops.ready.store(t.ready, std::memory_order_relaxed);
+	  tops.limit.store(t.limit, std::memory_order_relaxed);
+	}
+      }; // class Shard
+
+      using ShardRef = std::unique_ptr<Shard>;
+
+      std::vector<ShardRef> shards;
+      H                     hasher;
+      bool                  allow_limit_break;
+
+    public:
+
+      template<typename Rep, typename Per>
+      ShardedPullPriorityQueue(ClientInfoFunc _client_info_f,
+			       uint _shard_count,
+			       std::chrono::duration<Rep,Per> _idle_age,
+			       std::chrono::duration<Rep,Per> _erase_age,
+			       std::chrono::duration<Rep,Per> _check_time,
+			       bool _allow_limit_break = false,
+			       const CleanBudget& _clean_budget = CleanBudget()) :
+	allow_limit_break(_allow_limit_break)
+      {
+	assert(_shard_count > 0);
+	for (uint i = 0; i < _shard_count; ++i) {
+	  shards.emplace_back(new Shard(_client_info_f,
+					_idle_age, _erase_age, _check_time,
+					_allow_limit_break, _clean_budget));
+	}
+      }
+
+
+      // pull convenience constructor
+      ShardedPullPriorityQueue(ClientInfoFunc _client_info_f,
+			       uint _shard_count,
+			       bool _allow_limit_break = false) :
+	ShardedPullPriorityQueue(_client_info_f,
+				 _shard_count,
+				 std::chrono::minutes(10),
+				 std::chrono::minutes(15),
+				 std::chrono::minutes(6),
+				 _allow_limit_break)
+      {
+	// empty
+      }
+
+
+      uint get_shard_count() const {
+	return shards.size();
+      }
+
+
+      uint get_heap_branching_factor() const {
+	return B;
+      }
+
+
+      bool empty() const {
+	for (const auto& s : shards) {
+	  if (!s->empty()) return false;
+	}
+	return true;
+      }
+
+
+      size_t client_count() const {
+	size_t total = 0;
+	for (const auto& s : shards) {
+	  total += s->client_count();
+	}
+	return total;
+      }
+
+
+      size_t request_count() const {
+	size_t total = 0;
+	for (const auto& s : shards) {
+	  total += s->request_count();
+	}
+	return total;
+      }
+
+
+      // how long (in nanoseconds) each cleaning step held a shard's
+      // lock, over all shards
+      c::Histogram clean_hold_histogram() const {
+	c::Histogram total;
+	for (const auto& s : shards) {
+	  total.merge(s->clean_hold_histogram());
+	}
+	return total;
+      }
+
+
+      // the statistics of all shards together, taken without any
+      // shard's lock
+      QueueStats stats() const {
+	QueueStats total;
+	for (const auto& s : shards) {
+	  total.merge(s->stats());
+	}
+	return total;
+      }
+
+
+      // the clients of every shard, each shard snapshotted in turn
+      QueueSnapshot<C> snapshot(Time now, uint batch_clients = 1000) const {
+	QueueSnapshot<C> total;
+	total.time = now;
+	for (const auto& s : shards) {
+	  total.merge(s->snapshot(now, batch_clients));
+	}
+	return total;
+      }
+
+
+      bool remove_by_req_filter(std::function<bool(const R&)> filter_accum,
+				bool visit_backwards = false) {
+	bool any_removed = false;
+	for (auto& s : shards) {
+	  if (s->remove_by_req_filter(filter_accum, visit_backwards)) {
+	    any_removed = true;
+	  }
+	}
+	return any_removed;
+      }
+
+
+      void remove_by_client(const C& client,
+			    bool reverse = false,
+			    std::function<void (const R&)> accum =
+			    Queue::request_sink) {
+	shard_of(client).remove_by_client(client, reverse, accum);
+      }
+
+
+      // cancels the requests added with cancel_key in every shard
+      size_t cancel(CancelKey cancel_key,
+		    std::function<void (const R&)> accum = Queue::request_sink) {
+	size_t total = 0;
+	for (auto& s : shards) {
+	  total += s->cancel(cancel_key, accum);
+	}
+	return total;
+      }
+
+
+      inline void add_request(const R& request,
+			      const C& client_id,
+			      const ReqParams& req_params,
+			      double addl_cost = 0.0) {
+	add_request(RequestRef(new R(request)),
+		    client_id,
+		    req_params,
+		    K::now(),
+		    addl_cost);
+      }
+
+
+      inline void add_request(const R& request,
+			      const C& client_id,
+			      double addl_cost = 0.0) {
+	static const ReqParams null_req_params;
+	add_request(RequestRef(new R(request)),
+		    client_id,
+		    null_req_params,
+		    K::now(),
+		    addl_cost);
+      }
+
+
+      inline void add_request_time(const R& request,
+				   const C& client_id,
+				   const ReqParams& req_params,
+				   const Time time,
+				   double addl_cost = 0.0) {
+	add_request(RequestRef(new R(request)),
+		    client_id,
+		    req_params,
+		    time,
+		    addl_cost);
+      }
+
+
+      // constructs the request in place from args rather than
+      // copying one; allocation is as for PullPriorityQueue's
+      // emplace_request
+      template<typename... Args>
+      inline void emplace_request(const C& client_id,
+				  const ReqParams& req_params,
+				  Args&&... args) {
+	add_request(RequestRef(new R(std::forward<Args>(args)...)),
+		    client_id,
+		    req_params,
+		    K::now(),
+		    0.0);
+      }
+
+
+      void add_request(RequestRef&&     request,
+		       const C&         client_id,
+		       const ReqParams& req_params,
+		       const Time       time,
+		       double           addl_cost = 0.0,
+		       CancelKey        cancel_key = no_cancel_key) {
+	shard_of(client_id).add(std::move(request),
+				client_id,
+				req_params,
+				time,
+				addl_cost,
+				cancel_key);
+      }
+
+
+      inline PullReq pull_request() {
+	return pull_request(K::now());
+      }
+
+
+      PullReq pull_request(Time now) {
+	// the published tops may be stale by the time we lock the
+	// chosen shard; each failed attempt re-reads them, and since
+	// every failed attempt means some other thread changed a
+	// shard, we bound the number of attempts
+	for (uint attempt = 0; attempt <= shards.size(); ++attempt) {
+	  Shard* shard = choose_shard(now);
+	  if (nullptr == shard) {
+	    return next_future();
+	  }
+	  PullReq result = shard->pull(now);
+	  if (result.is_retn()) {
+	    return result;
+	  }
+	}
+
+	// every attempt lost a race with another thread; rather than
+	// report nothing while a shard may have a ready request, lock
+	// all the shards so the tops cannot change under the choice
+	return pull_locked(now);
+      } // pull_request
+
+
+    protected:
+
+      Shard& shard_of(const C& client_id) {
+	return *shards[hasher(client_id) % shards.size()];
+      }
+
+
+      // locks every shard, in order, then chooses and pulls with
+      // tops that cannot go stale
+      PullReq pull_locked(Time now) {
+	std::vector<std::unique_lock<c::StatMutex>> locks;
+	locks.reserve(shards.size());
+	for (auto& s : shards) {
+	  locks.push_back(s->lock());
+	}
+	Shard* shard = choose_shard(now, true);
+	if (nullptr != shard) {
+	  PullReq result = shard->pull_locked(now);
+	  if (result.is_retn()) {
+	    return result;
+	  }
+	}
+	return next_future();
+      }
+
+
+      // returns the shard that holds the globally best request to
+      // schedule at time now, or nullptr if no shard has a request
+      // that can be scheduled now; shards_locked says whether the
+      // caller holds every shard's lock
+      Shard* choose_shard(Time now, bool shards_locked = false) {
+	// try constraint (reservation) based scheduling
+	Shard* best = nullptr;
+	Time best_tag = max_tag;
+	for (auto& s : shards) {
+	  Time tag = s->get_tops().reservation.load(std::memory_order_relaxed);
+	  if (tag < best_tag) {
+	    best_tag = tag;
+	    best = s.get();
+	  }
+	}
+	if (nullptr != best && best_tag <= now) {
+	  return best;
+	}
+
+	// only the shards that have clients reaching their limit tags
+	// need to be locked, so the proportion tags of those clients
+	// get published
+	for (auto& s : shards) {
+	  if (s->get_tops().limit.load(std::memory_order_relaxed) <= now) {
+	    if (shards_locked) {
+	      s->promote_ready_locked(now);
+	    } else {
+	      s->promote_ready(now);
+	    }
+	  }
+	}
+
+	// try weight-based scheduling of clients within limit
+	Shard* best_any = nullptr;
+	Time best_any_tag = max_tag;
+	best = nullptr;
+	best_tag = max_tag;
+	for (auto& s : shards) {
+	  const ShardTops& tops = s->get_tops();
+	  Time tag = tops.proportion.load(std::memory_order_relaxed);
+	  if (tag < best_any_tag) {
+	    best_any_tag = tag;
+	    best_any = s.get();
+	  }
+	  if (tops.ready.load(std::memory_order_relaxed) && tag < best_tag) {
+	    best_tag = tag;
+	    best = s.get();
+	  }
+	}
+	if (nullptr != best) {
+	  return best;
+	}
+
+	// if nothing is schedulable by reservation or
+	// proportion/weight, and if we allow limit break, try to
+	// schedule something with the lowest proportion tag or
+	// alternatively lowest reservation tag.
+	if (allow_limit_break) {
+	  if (nullptr != best_any) {
+	    return best_any;
+	  }
+	  best = nullptr;
+	  best_tag = max_tag;
+	  for (auto& s : shards) {
+	    Time tag =
+	      s->get_tops().reservation.load(std::memory_order_relaxed);
+	    if (tag < best_tag) {
+	      best_tag = tag;
+	      best = s.get();
+	    }
+	  }
+	  return best;
+	}
+
+	return nullptr;
+      } // choose_shard
+
+
+      // nothing can be scheduled now, so find out when something
+      // could be from the published tops
+      PullReq next_future() {
+	PullReq result;
+	Time next_call = TimeMax;
+	for (auto& s : shards) {
+	  const ShardTops& tops = s->get_tops();
+	  Time resv = tops.reservation.load(std::memory_order_relaxed);
+	  Time limit = tops.limit.load(std::memory_order_relaxed);
+	  if (resv < max_tag && TimeZero != resv) {
+	    next_call = std::min(next_call, resv);
+	  }
+	  if (limit < max_tag && TimeZero != limit) {
+	    next_call = std::min(next_call, limit);
+	  }
+	}
+
+	if (next_call < TimeMax) {
+	  result.type = NextReqType::future;
+	  result.data = next_call;
+	} else {
+	  result.type = NextReqType::none;
+	}
+	return result;
+      }
+    }; // class ShardedPullPriorityQueue
+
+  DMCLOCK_TIME_NS_END } // namespace dmclock
+} // namespace crimson
@@ -11,35 +11,202 @@
 
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include <limits>
 #include <cmath>
 #include <chrono>
+#include <string>
+
+#include "tsc_clock.h"
+
+
+/* COMPILATION OPTIONS
+ *
+ * Time, and so the tags, which are times, is a double count of
+ * seconds by default. Defining DMCLOCK_INTEGER_TIME as 1 makes it a
+ * 64-bit integer count of nanoseconds instead (i.e., compiler argument
+ * -DDMCLOCK_INTEGER_TIME=1), so tags compare as integers and keep
+ * their precision however far they advance. Rates and costs are still
+ * given as doubles and converted.
+ *
+ * With integer time, the declarations that depend on it are put in
+ * an inline namespace (between DMCLOCK_TIME_NS_BEGIN and
+ * DMCLOCK_TIME_NS_END), so code built each way can be linked into one
+ * program.
+ */
+
+#ifndef DMCLOCK_INTEGER_TIME
+#define DMCLOCK_INTEGER_TIME 0
+#endif
+
+#if DMCLOCK_INTEGER_TIME
+#define DMCLOCK_TIME_NS_BEGIN inline namespace integer_time {
+#define DMCLOCK_TIME_NS_END }
+#else
+#define DMCLOCK_TIME_NS_BEGIN
+#define DMCLOCK_TIME_NS_END
+#endif
+
+// FRIEND_TEST names its test class in the innermost namespace, which
+// with integer time is the inline one, but the tests themselves are
+// in crimson::dmclock. So classes inside DMCLOCK_TIME_NS_BEGIN use
+// DMCLOCK_FRIEND_TEST instead, after the test class is declared in
+// crimson::dmclock with DMCLOCK_DECLARE_TEST.
+#define DMCLOCK_TEST_CLASS(test_case, test_name) \
+  test_case##_##test_name##_Test
+#define DMCLOCK_DECLARE_TEST(test_case, test_name) \
+  class DMCLOCK_TEST_CLASS(test_case, test_name)
+#define DMCLOCK_FRIEND_TEST(test_case, test_name) \
+  friend class ::crimson::dmclock::DMCLOCK_TEST_CLASS(test_case, test_name)
 
 
 namespace crimson {
   namespace dmclock {
-    // we're using double to represent time, but we could change it by
-    // changing the following declarations (and by making sure a min
-    // function existed)
+
+    std::string format_time(const double& time, uint modulo = 1000);
+
+    void debugger();
+
+    DMCLOCK_TIME_NS_BEGIN
+
+#if DMCLOCK_INTEGER_TIME
+    using Time = int64_t;
+    static const Time TimeZero = 0;
+    static const Time TimeMax = std::numeric_limits<Time>::max();
+#else
+    // we're using double to represent time, but we could change it
+    // by changing the following declarations (and by making sure a
+    // min function existed)
     using Time = double;
     static const Time TimeZero = 0.0;
     static const Time TimeMax = std::numeric_limits<Time>::max();
+#endif
     static const double NaN = nan("");
 
 
+    // converts a (finite) number of seconds to a Time; with integer
+    // time, whole and fractional seconds are converted separately, as
+    // a double can't hold the nanoseconds since the epoch exactly
+    inline Time seconds_to_time(double seconds) {
+#if DMCLOCK_INTEGER_TIME
+      const double whole = std::floor(seconds);
+      return Time(whole) * 1000000000 + std::llround((seconds - whole) * 1e9);
+#else
+      return seconds;
+#endif
+    }
+
+    inline double time_to_seconds(Time time) {
+#if DMCLOCK_INTEGER_TIME
+      const Time whole = time / 1000000000;
+      return whole + (time - whole * 1000000000) / 1e9;
+#else
+      return time;
+#endif
+    }
+
+#if DMCLOCK_INTEGER_TIME
+    inline std::string format_time(const Time& time, uint modulo = 1000) {
+      return crimson::dmclock::format_time(time_to_seconds(time), modulo);
+    }
+#endif
+
+    inline Time nanoseconds_to_time(int64_t ns) {
+#if DMCLOCK_INTEGER_TIME
+      return ns;
+#else
+      return ns / 1e9;
+#endif
+    }
+
+    inline int64_t time_to_nanoseconds(Time time) {
+#if DMCLOCK_INTEGER_TIME
+      return time;
+#else
+      return std::llround(time * 1e9);
+#endif
+    }
+
+
+    /*
+     * Clock policies. Each provides a static now() returning the
+     * current Time, and a queue takes one as a template parameter to
+     * time requests added and pulled without an explicit time. Times
+     * passed to a queue explicitly must come from the same clock.
+     */
+
+    // time of day, which jumps when the system clock is set (e.g., by
+    // NTP), so tags taken across a jump are out of order
+    struct WallClock {
+      static Time now() {
+	struct timeval now;
+	auto result = gettimeofday(&now, NULL);
+	(void) result;
+	assert(0 == result);
+#if DMCLOCK_INTEGER_TIME
+	return Time(now.tv_sec) * 1000000000 + Time(now.tv_usec) * 1000;
+#else
+	return now.tv_sec + (now.tv_usec / 1000000.0);
+#endif
+      }
+    };
+
+    // monotonic; std::chrono::steady_clock
+    struct SteadyClock {
+      static Time now() {
+	return nanoseconds_to_time(
+	  std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count());
+      }
+    };
+
+    // monotonic and cheaper to read, but only advancing every few
+    // milliseconds (the kernel tick); Linux only, otherwise the same
+    // as SteadyClock
+    struct CoarseClock {
+      static Time now() {
+#ifdef CLOCK_MONOTONIC_COARSE
+	struct timespec now;
+	auto result = clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	(void) result;
+	assert(0 == result);
+	return nanoseconds_to_time(int64_t(now.tv_sec) * 1000000000 +
+				   now.tv_nsec);
+#else
+	return SteadyClock::now();
+#endif
+      }
+    };
+
+    // Reads the CPU's time stamp counter, scaled to SteadyClock, so
+    // it's cheaper to read on most x86 machines; see crimson::tsc_clock
+    // for how threads keep in step. Each thread's times never go
+    // backwards. x86 only, otherwise the same as SteadyClock.
+    struct TscClock {
+      static Time now() {
+	return nanoseconds_to_time(tsc_clock::now_ns());
+      }
+    };
+
+    // the clock queues use unless given another through their K
+    // parameter
+    using DefaultClock = SteadyClock;
+
+    // the current time by the default clock, so it matches the tags
+    // of queues that keep their default K; it is not the time of day
     inline Time get_time() {
-      struct timeval now;
-      auto result = gettimeofday(&now, NULL);
-      (void) result;
-      assert(0 == result);
-      return now.tv_sec + (now.tv_usec / 1000000.0);
+      return DefaultClock::now();
     }
 
-    std::string format_time(const Time& time, uint modulo = 1000);
+    // the time of day, for callers that want it rather than a time to
+    // pass to a queue with the default clock
+    inline Time get_time_of_day() {
+      return WallClock::now();
+    }
 
-    void debugger();
+    DMCLOCK_TIME_NS_END
 
   } // namespace dmclock
 } // namespace crimson
@@ -0,0 +1,446 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <array>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+
+#include "assert.h"
+
+#include "indirect_intrusive_heap.h"
+
+
+namespace crimson {
+
+  /* A calendar queue with the interface of IndIntruHeap, for keys
+   * that are times and mostly advance. Elements are bucketed by key
+   * over a window of time, so moving an element to a later time is
+   * usually moving it between two small buckets, and the top is found
+   * by stepping forward to the first non-empty bucket. Each bucket is
+   * a small binary heap, so many elements with the same key (which
+   * land in one bucket) still cost O(log n) per operation.
+   *
+   * Elements past the end of the window (including infinite keys) are
+   * kept in an overflow heap. For an integral value type, its highest
+   * and lowest values stand in for infinities and are treated as
+   * them. When every bucket in the window is
+   * empty, the calendar is rebuilt starting at the overflow's top,
+   * with a bucket width estimated from the keys; it's also rebuilt
+   * as the number of elements grows.
+   *
+   * T, I, and heap_info are as for IndIntruHeap.
+   *
+   * KF is a functor that, given a const T&, returns its key. A key
+   *   has an integral rank less than R, compared before anything
+   *   else, and an arithmetic value. Each rank has its own calendar.
+   *
+   * C is a functor that, given two keys, returns true if the first
+   *   must precede the second.
+   */
+  template<typename I,
+	   typename T,
+	   IndIntruHeapData T::*heap_info,
+	   typename KF,
+	   typename C,
+	   uint R = 1>
+  class CalendarHeap {
+
+    static_assert(
+      std::is_same<T,typename std::pointer_traits<I>::element_type>::value,
+      "class I must resolve to class T by indirection (pointer dereference)");
+
+    static_assert(sizeof(IndIntruHeapData) >= 8,
+		  "heap_info must hold a rank, bucket, and position");
+
+    static_assert(R >= 1 && R <= 256, "R (number of ranks) out of range");
+
+  public:
+
+    using Key = typename std::result_of<KF(const T&)>::type;
+
+    static_assert(
+      std::is_same<bool,
+      typename std::result_of<C(const Key&,const Key&)>::type>::value,
+      "class C must define operator() to take two const Key& and return a bool");
+
+    using Value = typename std::decay<decltype(std::declval<Key>().value)>::type;
+
+  protected:
+
+    static constexpr uint min_buckets = 16;
+    static constexpr uint max_buckets = 1u << 22;
+
+    struct Entry {
+      Key key;
+      I   item;
+
+      Entry(const Key& _key, I&& _item) :
+	key(_key),
+	item(std::move(_item))
+      {
+	// empty
+      }
+    };
+
+    using Bucket = std::vector<Entry>;
+
+    struct Calendar {
+      // the window's buckets, followed by the overflow heap
+      std::vector<Bucket> buckets;
+      double              base = 0.0;
+      double              width = 1.0;
+      // no bucket before cursor holds an element
+      uint                cursor = 0;
+      size_t              count = 0;
+
+      uint bucket_count() const { return buckets.size() - 1; }
+      uint overflow() const { return buckets.size() - 1; }
+    };
+
+    // finding the top may move the cursor or rebuild a calendar,
+    // neither of which changes the order
+    mutable std::array<Calendar,R> calendars;
+    size_t                         count = 0;
+    KF                             key_of;
+    C                              comparator;
+
+  public:
+
+    bool empty() const { return 0 == count; }
+
+    size_t size() const { return count; }
+
+    T& top() { return *top_entry().item; }
+
+    const T& top() const { return *top_entry().item; }
+
+    I& top_ind() { return top_entry().item; }
+
+    const I& top_ind() const { return top_entry().item; }
+
+    void push(I&& item) {
+      Key key = key_of(*item);
+      place(Entry(key, std::move(item)));
+      ++count;
+    }
+
+    void push(const I& item) {
+      I copy(item);
+      push(std::move(copy));
+    }
+
+    void pop() {
+      remove(top());
+    }
+
+    void remove(T& item) {
+      take(item.*heap_info);
+      --count;
+    }
+
+    void promote(T& item) { adjust(item); }
+
+    void demote(T& item) { adjust(item); }
+
+    void adjust(T& item) {
+      const IndIntruHeapData where = item.*heap_info;
+      Key key = key_of(item);
+      Calendar& cal = calendars[rank_of(where)];
+      if (key.rank == rank_of(where) &&
+	  bucket_for(cal, key.value) == bucket_of(where)) {
+	Bucket& bucket = cal.buckets[bucket_of(where)];
+	bucket[pos_of(where)].key = key;
+	sift(bucket, rank_of(where), bucket_of(where), pos_of(where));
+      } else {
+	Entry e = take(where);
+	e.key = key;
+	place(std::move(e));
+      }
+    }
+
+    // retakes every element's key and re-buckets it, in O(n) time
+    // rather than adjusting each one
+    void update_all() {
+      std::vector<Entry> entries;
+      entries.reserve(count);
+      for (auto& cal : calendars) {
+	for (auto& bucket : cal.buckets) {
+	  for (auto& e : bucket) {
+	    entries.push_back(std::move(e));
+	  }
+	  bucket.clear();
+	}
+	cal.count = 0;
+	cal.cursor = cal.buckets.empty() ? 0 : cal.bucket_count();
+      }
+      for (auto& e : entries) {
+	e.key = key_of(*e.item);
+	place(std::move(e));
+      }
+    }
+
+    // copies the elements into a vector and sorts it before
+    // displaying it
+    std::ostream&
+    display_sorted(std::ostream& out,
+		   std::function<bool(const T&)> filter = all_filter) const {
+      std::vector<const Entry*> entries;
+      for (const auto& cal : calendars) {
+	for (const auto& bucket : cal.buckets) {
+	  for (const auto& e : bucket) {
+	    entries.push_back(&e);
+	  }
+	}
+      }
+      std::sort(entries.begin(), entries.end(),
+		[this] (const Entry* first, const Entry* second) -> bool {
+		  return comparator(first->key, second->key);
+		});
+
+      bool first = true;
+      for (auto e : entries) {
+	if (filter(*e->item)) {
+	  if (!first) {
+	    out << ", ";
+	  } else {
+	    first = false;
+	  }
+	  out << *e->item;
+	}
+      }
+
+      return out;
+    }
+
+
+  protected:
+
+    static IndIntruHeapData& intru_data_of(I& item) {
+      return (*item).*heap_info;
+    }
+
+    // default value of filter parameter to display_sorted
+    static bool all_filter(const T& data) { return true; }
+
+    // an element's heap_info holds its rank in the top 8 bits, its
+    // bucket in the next 24, and its position in the bucket in the
+    // low 32
+    static IndIntruHeapData where(uint rank, uint bucket, size_t pos) {
+      return (IndIntruHeapData(rank) << 56) |
+	(IndIntruHeapData(bucket) << 32) |
+	IndIntruHeapData(pos);
+    }
+
+    static uint rank_of(IndIntruHeapData w) { return w >> 56; }
+
+    static uint bucket_of(IndIntruHeapData w) {
+      return (w >> 32) & 0xffffff;
+    }
+
+    static size_t pos_of(IndIntruHeapData w) { return w & 0xffffffff; }
+
+    // whether value is finite, counting the highest and lowest
+    // values of an integral Value as infinite
+    static bool is_finite(const Value& value) {
+      if (std::numeric_limits<Value>::has_infinity) {
+	return std::isfinite(double(value));
+      } else {
+	return std::numeric_limits<Value>::max() != value &&
+	  std::numeric_limits<Value>::lowest() != value;
+      }
+    }
+
+    // the bucket holding value; values before the window go in the
+    // first bucket and values past it (or not finite) in the overflow
+    static uint bucket_for(const Calendar& cal, const Value& value) {
+      if (!is_finite(value)) {
+	return value < Value(0) ? 0 : cal.overflow();
+      }
+      double b = (double(value) - cal.base) / cal.width;
+      if (!(b < cal.bucket_count())) {
+	return cal.overflow();
+      } else if (b < 1.0) {
+	return 0;
+      } else {
+	return uint(b);
+      }
+    }
+
+    void place(Entry&& e) {
+      const uint rank = e.key.rank;
+      assert(rank < R);
+      Calendar& cal = calendars[rank];
+      if (cal.buckets.empty()) {
+	cal.buckets.resize(min_buckets + 1);
+	if (is_finite(e.key.value)) {
+	  cal.base = double(e.key.value);
+	}
+      }
+      const uint b = bucket_for(cal, e.key.value);
+      Bucket& bucket = cal.buckets[b];
+      bucket.push_back(std::move(e));
+      intru_data_of(bucket.back().item) = where(rank, b, bucket.size() - 1);
+      sift_up(bucket, rank, b, bucket.size() - 1);
+      if (b < cal.cursor) {
+	cal.cursor = b;
+      }
+      ++cal.count;
+      if (cal.count > 2 * cal.bucket_count() &&
+	  cal.bucket_count() < max_buckets) {
+	rebuild(rank);
+      }
+    }
+
+    // removes the element at w from its bucket and returns it
+    Entry take(IndIntruHeapData w) {
+      Calendar& cal = calendars[rank_of(w)];
+      Bucket& bucket = cal.buckets[bucket_of(w)];
+      const size_t i = pos_of(w);
+      assert(i < bucket.size());
+      Entry e = std::move(bucket[i]);
+      const size_t last = bucket.size() - 1;
+      if (i != last) {
+	bucket[i] = std::move(bucket[last]);
+	intru_data_of(bucket[i].item) = w;
+	bucket.pop_back();
+	sift(bucket, rank_of(w), bucket_of(w), i);
+      } else {
+	bucket.pop_back();
+      }
+      --cal.count;
+      return e;
+    }
+
+    Entry& top_entry() const {
+      for (uint rank = 0; rank < R; ++rank) {
+	Calendar& cal = calendars[rank];
+	if (0 == cal.count) {
+	  continue;
+	}
+	while (cal.cursor < cal.bucket_count() &&
+	       cal.buckets[cal.cursor].empty()) {
+	  ++cal.cursor;
+	}
+	if (cal.cursor == cal.bucket_count() &&
+	    is_finite(cal.buckets[cal.overflow()].front().key.value)) {
+	  // the window is empty, so start a new one at the overflow's
+	  // top, which becomes the first bucket's top
+	  const_cast<CalendarHeap*>(this)->rebuild(rank);
+	  assert(!cal.buckets[0].empty());
+	  cal.cursor = 0;
+	}
+	return cal.buckets[cal.cursor].front();
+      }
+      assert(false);
+      return calendars[0].buckets[0].front();
+    }
+
+    // re-buckets every element of a rank, sizing the window to the
+    // number of elements and starting it at the lowest finite key
+    void rebuild(uint rank) {
+      Calendar& cal = calendars[rank];
+      std::vector<Entry> entries;
+      entries.reserve(cal.count);
+      for (auto& bucket : cal.buckets) {
+	for (auto& e : bucket) {
+	  entries.push_back(std::move(e));
+	}
+	bucket.clear();
+      }
+
+      std::vector<double> values;
+      for (const auto& e : entries) {
+	if (is_finite(e.key.value)) {
+	  values.push_back(double(e.key.value));
+	}
+      }
+      if (!values.empty()) {
+	const double lowest = *std::min_element(values.begin(), values.end());
+	cal.base = lowest;
+	// about three elements per bucket between the lowest and the
+	// median value
+	const size_t k = values.size() / 2;
+	if (k > 0) {
+	  std::nth_element(values.begin(), values.begin() + k, values.end());
+	  const double width = 3.0 * (values[k] - lowest) / k;
+	  if (width > 0.0 && std::isfinite(width)) {
+	    cal.width = width;
+	  }
+	}
+      }
+
+      uint bucket_count = min_buckets;
+      while (bucket_count < entries.size() && bucket_count < max_buckets) {
+	bucket_count *= 2;
+      }
+      cal.buckets.resize(bucket_count + 1);
+      cal.cursor = bucket_count;
+      cal.count = 0;
+      for (auto& e : entries) {
+	place(std::move(e));
+      }
+    }
+
+    bool precedes(const Bucket& bucket, size_t i, size_t j) const {
+      return comparator(bucket[i].key, bucket[j].key);
+    }
+
+    void swap_entries(Bucket& bucket, uint rank, uint b, size_t i, size_t j) {
+      std::swap(bucket[i], bucket[j]);
+      intru_data_of(bucket[i].item) = where(rank, b, i);
+      intru_data_of(bucket[j].item) = where(rank, b, j);
+    }
+
+    void sift_up(Bucket& bucket, uint rank, uint b, size_t i) {
+      while (i > 0) {
+	size_t pi = (i - 1) / 2;
+	if (!precedes(bucket, i, pi)) {
+	  break;
+	}
+	swap_entries(bucket, rank, b, i, pi);
+	i = pi;
+      }
+    }
+
+    void sift_down(Bucket& bucket, uint rank, uint b, size_t i) {
+      const size_t count = bucket.size();
+      while (true) {
+	size_t min_i = 2 * i + 1;
+	if (min_i >= count) {
+	  break;
+	}
+	if (min_i + 1 < count && precedes(bucket, min_i + 1, min_i)) {
+	  ++min_i;
+	}
+	if (!precedes(bucket, min_i, i)) {
+	  break;
+	}
+	swap_entries(bucket, rank, b, i, min_i);
+	i = min_i;
+      }
+    }
+
+    void sift(Bucket& bucket, uint rank, uint b, size_t i) {
+      if (i > 0 && precedes(bucket, i, (i - 1) / 2)) {
+	sift_up(bucket, rank, b, i);
+      } else {
+	sift_down(bucket, rank, b, i);
+      }
+    }
+  }; // class CalendarHeap
+
+} // namespace crimson
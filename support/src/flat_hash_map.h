@@ -0,0 +1,368 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <tuple>
+#include <memory>
+#include <utility>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+
+
+namespace crimson {
+
+  // true when std::hash can be used with K
+  template<typename K, typename = void>
+  struct is_std_hashable : std::false_type {};
+
+  template<typename K>
+  struct is_std_hashable<
+    K,
+    decltype(void(std::declval<const std::hash<K>&>()(std::declval<const K&>())))>
+    : std::true_type {};
+
+
+  /* A hash map using open addressing with linear probing, so that a
+   * lookup touches a run of contiguous slots rather than chasing
+   * tree nodes.
+   *
+   * K is the key type, V the mapped type, H the hash functor, and E
+   * the key equality functor.
+   *
+   * The slot states are kept apart from the slots themselves so a
+   * probe scans a compact byte array. Erased slots become tombstones
+   * (unless they end a probe run) so erasing does not move any other
+   * entry; therefore erasing while iterating is safe in the same way
+   * it is with std::map. Inserting may rehash, which invalidates
+   * iterators and moves values, so V should be a handle (e.g., a
+   * pointer) when stable addresses are needed.
+   */
+  template<typename K,
+	   typename V,
+	   typename H = std::hash<K>,
+	   typename E = std::equal_to<K>>
+  class FlatHashMap {
+
+  public:
+
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K,V>;
+
+  protected:
+
+    enum : uint8_t { slot_empty = 0, slot_full, slot_deleted };
+
+    using Slot =
+      typename std::aligned_storage<sizeof(value_type),
+				    alignof(value_type)>::type;
+
+    // the table is rehashed when full plus deleted slots exceed
+    // max_load_num / max_load_den of the capacity
+    static constexpr size_t max_load_num = 3;
+    static constexpr size_t max_load_den = 4;
+    static constexpr size_t min_capacity = 16;
+
+    std::unique_ptr<uint8_t[]> states;
+    std::unique_ptr<Slot[]>    slots;
+    size_t                     capacity = 0; // always a power of 2 or 0
+    size_t                     count = 0;
+    size_t                     deleted = 0;
+    H                          hasher;
+    E                          equal;
+
+    template<bool is_const>
+    class IteratorBase {
+      friend FlatHashMap;
+      friend IteratorBase<!is_const>;
+
+      using Map = typename std::conditional<is_const,
+					    const FlatHashMap,
+					    FlatHashMap>::type;
+      using Value = typename std::conditional<is_const,
+					      const value_type,
+					      value_type>::type;
+
+      Map*   map;
+      size_t index;
+
+      IteratorBase(Map* _map, size_t _index) :
+	map(_map),
+	index(_index)
+      {
+	skip_unused();
+      }
+
+      void skip_unused() {
+	while (index < map->capacity && slot_full != map->states[index]) {
+	  ++index;
+	}
+      }
+
+    public:
+
+      IteratorBase(const IteratorBase&) = default;
+      IteratorBase& operator=(const IteratorBase&) = default;
+
+      // allow conversion from iterator to const_iterator; a template
+      // so it is never iterator's copy constructor
+      template<bool c = is_const,
+	       typename = typename std::enable_if<c>::type>
+      IteratorBase(const IteratorBase<false>& other) :
+	map(other.map),
+	index(other.index)
+      {
+	// empty
+      }
+
+      IteratorBase& operator++() {
+	++index;
+	skip_unused();
+	return *this;
+      }
+
+      IteratorBase operator++(int) {
+	IteratorBase result(*this);
+	++(*this);
+	return result;
+      }
+
+      bool operator==(const IteratorBase& other) const {
+	return map == other.map && index == other.index;
+      }
+
+      bool operator!=(const IteratorBase& other) const {
+	return !(*this == other);
+      }
+
+      Value& operator*() const {
+	return map->value_at(index);
+      }
+
+      Value* operator->() const {
+	return &map->value_at(index);
+      }
+    }; // class IteratorBase
+
+  public:
+
+    using iterator = IteratorBase<false>;
+    using const_iterator = IteratorBase<true>;
+
+    FlatHashMap() {
+      // empty
+    }
+
+    FlatHashMap(const FlatHashMap&) = delete;
+    FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+    ~FlatHashMap() {
+      clear();
+    }
+
+    bool empty() const { return 0 == count; }
+
+    size_t size() const { return count; }
+
+    size_t bucket_count() const { return capacity; }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, capacity); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, capacity); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    iterator find(const K& key) {
+      return iterator(this, find_index(key));
+    }
+
+    const_iterator find(const K& key) const {
+      return const_iterator(this, find_index(key));
+    }
+
+    V& at(const K& key) {
+      size_t i = find_index(key);
+      if (i == capacity) throw std::out_of_range("FlatHashMap::at");
+      return value_at(i).second;
+    }
+
+    const V& at(const K& key) const {
+      size_t i = find_index(key);
+      if (i == capacity) throw std::out_of_range("FlatHashMap::at");
+      return value_at(i).second;
+    }
+
+    V& operator[](const K& key) {
+      return emplace(key, V()).first->second;
+    }
+
+    template<typename... Args>
+    std::pair<iterator,bool> emplace(const K& key, Args&&... args) {
+      size_t i = find_index(key);
+      if (i != capacity) {
+	return std::make_pair(iterator(this, i), false);
+      }
+
+      reserve_one();
+      i = insert_index(key);
+      if (slot_deleted == states[i]) {
+	--deleted;
+      }
+      new (&slots[i]) value_type(std::piecewise_construct,
+				 std::forward_as_tuple(key),
+				 std::forward_as_tuple(std::forward<Args>(args)...));
+      states[i] = slot_full;
+      ++count;
+      return std::make_pair(iterator(this, i), true);
+    }
+
+    // returns the iterator following the erased element; no other
+    // elements move, so iterators to them remain valid
+    iterator erase(const_iterator pos) {
+      size_t i = pos.index;
+      assert(i < capacity && slot_full == states[i]);
+      value_at(i).~value_type();
+      --count;
+
+      // if the next slot is empty no probe run continues past this
+      // one, so this slot and any tombstones before it can be empty
+      if (slot_empty == states[(i + 1) & (capacity - 1)]) {
+	states[i] = slot_empty;
+	for (size_t j = (i - 1) & (capacity - 1);
+	     slot_deleted == states[j];
+	     j = (j - 1) & (capacity - 1)) {
+	  states[j] = slot_empty;
+	  --deleted;
+	}
+      } else {
+	states[i] = slot_deleted;
+	++deleted;
+      }
+
+      return iterator(this, i + 1);
+    }
+
+    size_t erase(const K& key) {
+      size_t i = find_index(key);
+      if (i == capacity) return 0;
+      erase(const_iterator(this, i));
+      return 1;
+    }
+
+    void clear() {
+      for (size_t i = 0; i < capacity; ++i) {
+	if (slot_full == states[i]) {
+	  value_at(i).~value_type();
+	}
+	states[i] = slot_empty;
+      }
+      count = 0;
+      deleted = 0;
+    }
+
+    // make sure at least n elements fit without a rehash
+    void reserve(size_t n) {
+      size_t needed = min_capacity;
+      while (needed * max_load_num / max_load_den < n) {
+	needed *= 2;
+      }
+      if (needed > capacity) {
+	rehash(needed);
+      }
+    }
+
+  protected:
+
+    value_type& value_at(size_t i) {
+      return *reinterpret_cast<value_type*>(&slots[i]);
+    }
+
+    const value_type& value_at(size_t i) const {
+      return *reinterpret_cast<const value_type*>(&slots[i]);
+    }
+
+    // integer hashes are frequently the identity function, so the
+    // bits are mixed (finalizer from MurmurHash3) before being
+    // masked to the table size
+    size_t home_index(const K& key) const {
+      uint64_t h = hasher(key);
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return size_t(h) & (capacity - 1);
+    }
+
+    // returns capacity when key is not found
+    size_t find_index(const K& key) const {
+      if (0 == count) return capacity;
+      for (size_t i = home_index(key); ; i = (i + 1) & (capacity - 1)) {
+	if (slot_empty == states[i]) {
+	  return capacity;
+	} else if (slot_full == states[i] && equal(value_at(i).first, key)) {
+	  return i;
+	}
+      }
+    }
+
+    // first unused slot in key's probe run; key must not be present
+    size_t insert_index(const K& key) const {
+      for (size_t i = home_index(key); ; i = (i + 1) & (capacity - 1)) {
+	if (slot_full != states[i]) {
+	  return i;
+	}
+      }
+    }
+
+    // make room for one more element
+    void reserve_one() {
+      if (0 == capacity) {
+	rehash(min_capacity);
+      } else if ((count + deleted + 1) * max_load_den >
+		 capacity * max_load_num) {
+	// if tombstones are taking the space, rehashing at the same
+	// size is enough to clear them out
+	if ((count + 1) * max_load_den * 2 > capacity * max_load_num) {
+	  rehash(2 * capacity);
+	} else {
+	  rehash(capacity);
+	}
+      }
+    }
+
+    void rehash(size_t new_capacity) {
+      std::unique_ptr<uint8_t[]> old_states(std::move(states));
+      std::unique_ptr<Slot[]> old_slots(std::move(slots));
+      size_t old_capacity = capacity;
+
+      states.reset(new uint8_t[new_capacity]());
+      slots.reset(new Slot[new_capacity]);
+      capacity = new_capacity;
+      deleted = 0;
+
+      for (size_t i = 0; i < old_capacity; ++i) {
+	if (slot_full == old_states[i]) {
+	  value_type& v = *reinterpret_cast<value_type*>(&old_slots[i]);
+	  size_t j = insert_index(v.first);
+	  new (&slots[j]) value_type(std::move(v));
+	  states[j] = slot_full;
+	  v.~value_type();
+	}
+      }
+    }
+  }; // class FlatHashMap
+
+} // namespace crimson
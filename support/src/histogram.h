@@ -0,0 +1,215 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <math.h>
+
+#include <array>
+#include <atomic>
+#include <algorithm>
+
+
+namespace crimson {
+
+  /* A histogram of non-negative integer values (e.g., durations in
+   * nanoseconds) with log-linear buckets: values below 8 each get
+   * their own bucket, and every power of two range above that is
+   * split into 8 equal buckets. So the bucket a value falls in is
+   * within 12.5% of it, over the whole range of uint64_t, in a fixed
+   * 4KB of counters. Histograms can be merged, and percentiles are
+   * reported as the upper bound of the bucket they fall in (but no
+   * more than the highest value recorded).
+   */
+  class Histogram {
+    friend class AtomicHistogram;
+
+  public:
+
+    static constexpr uint sub_bucket_bits = 3;
+    static constexpr uint sub_bucket_count = 1u << sub_bucket_bits;
+    static constexpr uint bucket_count =
+      (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+  protected:
+
+    std::array<uint64_t,bucket_count> buckets;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+  public:
+
+    Histogram() {
+      buckets.fill(0);
+    }
+
+    static uint bucket_of(uint64_t value) {
+      if (value < sub_bucket_count) {
+	return uint(value);
+      }
+      uint msb = 63 - __builtin_clzll(value);
+      uint shift = msb - sub_bucket_bits;
+      uint sub = uint(value >> shift) & (sub_bucket_count - 1);
+      return (shift + 1) * sub_bucket_count + sub;
+    }
+
+    // the smallest value in bucket
+    static uint64_t bucket_low(uint bucket) {
+      uint group = bucket / sub_bucket_count;
+      uint64_t sub = bucket % sub_bucket_count;
+      if (0 == group) {
+	return sub;
+      }
+      return (sub_bucket_count + sub) << (group - 1);
+    }
+
+    // the largest value in bucket
+    static uint64_t bucket_high(uint bucket) {
+      return bucket + 1 < bucket_count ?
+	bucket_low(bucket + 1) - 1 :
+	~uint64_t(0);
+    }
+
+    void record(uint64_t value, uint64_t n = 1) {
+      if (0 == n) return;
+      buckets[bucket_of(value)] += n;
+      if (0 == count) {
+	low = high = value;
+      } else {
+	low = std::min(low, value);
+	high = std::max(high, value);
+      }
+      count += n;
+      sum += value * n;
+    }
+
+    void merge(const Histogram& other) {
+      if (0 == other.count) return;
+      for (uint i = 0; i < bucket_count; ++i) {
+	buckets[i] += other.buckets[i];
+      }
+      if (0 == count) {
+	low = other.low;
+	high = other.high;
+      } else {
+	low = std::min(low, other.low);
+	high = std::max(high, other.high);
+      }
+      count += other.count;
+      sum += other.sum;
+    }
+
+    void clear() {
+      buckets.fill(0);
+      count = sum = low = high = 0;
+    }
+
+    uint64_t get_count() const { return count; }
+    uint64_t get_sum() const { return sum; }
+    uint64_t get_low() const { return low; }
+    uint64_t get_high() const { return high; }
+    uint64_t get_bucket(uint bucket) const { return buckets[bucket]; }
+
+    double get_mean() const {
+      if (0 == count) return nan("");
+      return sum / double(count);
+    }
+
+    // the value that percent of the recorded values are at or below;
+    // 0 when nothing has been recorded
+    uint64_t get_percentile(double percent) const {
+      if (0 == count) return 0;
+      uint64_t rank = uint64_t(ceil(count * percent / 100.0));
+      rank = std::max(uint64_t(1), std::min(rank, count));
+      uint64_t seen = 0;
+      for (uint i = 0; i < bucket_count; ++i) {
+	seen += buckets[i];
+	if (seen >= rank) {
+	  return std::max(low, std::min(high, bucket_high(i)));
+	}
+      }
+      return high;
+    }
+  }; // class Histogram
+
+
+  /* A Histogram whose counters are atomics, so that it can be copied
+   * out by snapshot while it's being recorded into, without a lock.
+   * Calls to record are not atomic with respect to each other and
+   * must be serialized, e.g., by only recording with a lock held that
+   * readers don't need. A snapshot taken during a record may include
+   * only part of it, but its count always matches its buckets.
+   */
+  class AtomicHistogram {
+    std::array<std::atomic<uint64_t>,Histogram::bucket_count> buckets;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> low;
+    std::atomic<uint64_t> high;
+    // whether anything has been recorded, so low and high are set
+    std::atomic<bool> any;
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+      counter.store(counter.load(std::memory_order_relaxed) + n,
+		    std::memory_order_relaxed);
+    }
+
+  public:
+
+    AtomicHistogram() {
+      clear();
+    }
+
+    AtomicHistogram(const AtomicHistogram&) = delete;
+    AtomicHistogram& operator=(const AtomicHistogram&) = delete;
+
+    void record(uint64_t value, uint64_t n = 1) {
+      if (0 == n) return;
+      add(buckets[Histogram::bucket_of(value)], n);
+      add(sum, value * n);
+      if (!any.load(std::memory_order_relaxed)) {
+	low.store(value, std::memory_order_relaxed);
+	high.store(value, std::memory_order_relaxed);
+	any.store(true, std::memory_order_relaxed);
+      } else if (value < low.load(std::memory_order_relaxed)) {
+	low.store(value, std::memory_order_relaxed);
+      } else if (value > high.load(std::memory_order_relaxed)) {
+	high.store(value, std::memory_order_relaxed);
+      }
+    }
+
+    // must not be called concurrently with record
+    void clear() {
+      for (auto& b : buckets) {
+	b.store(0, std::memory_order_relaxed);
+      }
+      sum.store(0, std::memory_order_relaxed);
+      low.store(0, std::memory_order_relaxed);
+      high.store(0, std::memory_order_relaxed);
+      any.store(false, std::memory_order_relaxed);
+    }
+
+    Histogram snapshot() const {
+      Histogram result;
+      for (uint i = 0; i < Histogram::bucket_count; ++i) {
+	result.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+	result.count += result.buckets[i];
+      }
+      if (result.count > 0) {
+	result.sum = sum.load(std::memory_order_relaxed);
+	result.low = low.load(std::memory_order_relaxed);
+	result.high = high.load(std::memory_order_relaxed);
+      }
+      return result;
+    }
+  }; // class AtomicHistogram
+
+} // namespace crimson
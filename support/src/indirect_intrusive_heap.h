@@ -61,11 +61,13 @@ namespace crimson {
     class Iterator {
       friend IndIntruHeap<I, T, heap_info, C, K>;
 
-      IndIntruHeap<I, T, heap_info, C, K>& heap;
+      // a pointer rather than a reference so iterators can be
+      // assigned
+      IndIntruHeap<I, T, heap_info, C, K>* heap;
       HeapIndex                            index;
 
       Iterator(IndIntruHeap<I, T, heap_info, C, K>& _heap, HeapIndex _index) :
-	heap(_heap),
+	heap(&_heap),
 	index(_index)
       {
 	// empty
@@ -88,25 +90,26 @@ namespace crimson {
       }
 
       Iterator& operator=(Iterator&& other) {
-	std::swap(heap, other.heap);
-	std::swap(index, other.index);
+	heap = other.heap;
+	index = other.index;
 	return *this;
       }
 
       Iterator& operator=(const Iterator& other) {
 	heap = other.heap;
 	index = other.index;
+	return *this;
       }
 
       Iterator& operator++() {
-	if (index <= heap.count) {
+	if (index <= heap->count) {
 	  ++index;
 	}
 	return *this;
       }
 
       bool operator==(const Iterator& other) const {
-	return &heap == &other.heap && index == other.index;
+	return heap == other.heap && index == other.index;
       }
 
       bool operator!=(const Iterator& other) const {
@@ -114,17 +117,17 @@ namespace crimson {
       }
 
       T& operator*() {
-	return *heap.data[index];
+	return *heap->data[index];
       }
 
       T* operator->() {
-	return &(*heap.data[index]);
+	return &(*heap->data[index]);
       }
 
 #if 0
       // the item this iterator refers to
       void increase() {
-	heap.sift_up(index);
+	heap->sift_up(index);
       }
 #endif
     }; // class Iterator
@@ -133,12 +136,12 @@ namespace crimson {
     class ConstIterator {
       friend IndIntruHeap<I, T, heap_info, C, K>;
 
-      const IndIntruHeap<I, T, heap_info, C, K>& heap;
+      const IndIntruHeap<I, T, heap_info, C, K>* heap;
       HeapIndex                                  index;
 
       ConstIterator(const IndIntruHeap<I, T, heap_info, C, K>& _heap,
 		    HeapIndex _index) :
-	heap(_heap),
+	heap(&_heap),
 	index(_index)
       {
 	// empty
@@ -161,25 +164,26 @@ namespace crimson {
       }
 
       ConstIterator& operator=(ConstIterator&& other) {
-	std::swap(heap, other.heap);
-	std::swap(index, other.index);
+	heap = other.heap;
+	index = other.index;
 	return *this;
       }
 
       ConstIterator& operator=(const ConstIterator& other) {
 	heap = other.heap;
 	index = other.index;
+	return *this;
       }
 
       ConstIterator& operator++() {
-	if (index <= heap.count) {
+	if (index <= heap->count) {
 	  ++index;
 	}
 	return *this;
       }
 
       bool operator==(const ConstIterator& other) const {
-	return &heap == &other.heap && index == other.index;
+	return heap == other.heap && index == other.index;
       }
 
       bool operator!=(const ConstIterator& other) const {
@@ -187,11 +191,11 @@ namespace crimson {
       }
 
       const T& operator*() {
-	return *heap.data[index];
+	return *heap->data[index];
       }
 
       const T* operator->() {
-	return &(*heap.data[index]);
+	return &(*heap->data[index]);
       }
     }; // class ConstIterator
 
@@ -246,6 +250,12 @@ namespace crimson {
       remove(0);
     }
 
+    // removes item using the index it stores, so takes O(log n) time
+    // rather than the O(n) of finding it first
+    void remove(T& item) {
+      remove(item.*heap_info);
+    }
+
     void remove(Iterator& i) {
       remove(i.index);
       i = end();
@@ -349,6 +359,17 @@ namespace crimson {
       sift(item.*heap_info);
     }
 
+    // restores the heap after any number of elements have changed,
+    // in O(n) time rather than O(log n) for each one adjusted
+    void update_all() {
+      if (count < 2) {
+	return;
+      }
+      for (HeapIndex i = parent(count - 1) + 1; i > 0; --i) {
+	sift_down(i - 1);
+      }
+    }
+
     Iterator begin() {
       return Iterator(*this, 0);
     }
@@ -414,7 +435,13 @@ namespace crimson {
     }
 
     void remove(HeapIndex i) {
-      std::swap(data[i], data[--count]);
+      assert(i < count);
+      if (i == --count) {
+	// the last element, so nothing else moves
+	data.pop_back();
+	return;
+      }
+      std::swap(data[i], data[count]);
       intru_data_of(data[i]) = i;
       data.pop_back();
 
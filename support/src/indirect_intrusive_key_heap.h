@@ -0,0 +1,322 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+
+#include "assert.h"
+
+#include "indirect_intrusive_heap.h"
+
+
+namespace crimson {
+
+  /* A variant of IndIntruHeap that keeps each element's sort key in
+   * the heap vector next to the indirect item, so sifting compares
+   * keys stored contiguously instead of following each item to
+   * compute the comparison. The key is taken from the element when
+   * it's pushed and whenever it's promoted, demoted, or adjusted, so
+   * those must be called after every change that affects the key.
+   *
+   * T, I, heap_info, and K are as for IndIntruHeap.
+   *
+   * KF is a functor that, given a const T&, returns its key.
+   *
+   * C is a functor that, given two keys, returns true if the first
+   *   must precede the second.
+   */
+  template<typename I,
+	   typename T,
+	   IndIntruHeapData T::*heap_info,
+	   typename KF,
+	   typename C,
+	   uint K = 2>
+  class IndIntruKeyHeap {
+
+    // shorthand
+    using HeapIndex = IndIntruHeapData;
+
+    static_assert(
+      std::is_same<T,typename std::pointer_traits<I>::element_type>::value,
+      "class I must resolve to class T by indirection (pointer dereference)");
+
+    static_assert(K >= 2, "K (degree of branching) must be at least 2");
+
+  public:
+
+    using Key = typename std::result_of<KF(const T&)>::type;
+
+    static_assert(
+      std::is_same<bool,
+      typename std::result_of<C(const Key&,const Key&)>::type>::value,
+      "class C must define operator() to take two const Key& and return a bool");
+
+  protected:
+
+    struct Entry {
+      Key key;
+      I   item;
+
+      Entry(const Key& _key, I&& _item) :
+	key(_key),
+	item(std::move(_item))
+      {
+	// empty
+      }
+    };
+
+  public:
+
+    class ConstIterator {
+      friend IndIntruKeyHeap<I, T, heap_info, KF, C, K>;
+
+      const IndIntruKeyHeap<I, T, heap_info, KF, C, K>* heap;
+      HeapIndex                                         index;
+
+      ConstIterator(const IndIntruKeyHeap<I, T, heap_info, KF, C, K>& _heap,
+		    HeapIndex _index) :
+	heap(&_heap),
+	index(_index)
+      {
+	// empty
+      }
+
+    public:
+
+      ConstIterator& operator++() {
+	if (index <= heap->data.size()) {
+	  ++index;
+	}
+	return *this;
+      }
+
+      bool operator==(const ConstIterator& other) const {
+	return heap == other.heap && index == other.index;
+      }
+
+      bool operator!=(const ConstIterator& other) const {
+	return !(*this == other);
+      }
+
+      const T& operator*() {
+	return *heap->data[index].item;
+      }
+
+      const T* operator->() {
+	return &(*heap->data[index].item);
+      }
+    }; // class ConstIterator
+
+
+  protected:
+
+    std::vector<Entry> data;
+    KF                 key_of;
+    C                  comparator;
+
+  public:
+
+    bool empty() const { return data.empty(); }
+
+    size_t size() const { return data.size(); }
+
+    T& top() { return *data[0].item; }
+
+    const T& top() const { return *data[0].item; }
+
+    I& top_ind() { return data[0].item; }
+
+    const I& top_ind() const { return data[0].item; }
+
+    void push(I&& item) {
+      HeapIndex i = data.size();
+      intru_data_of(item) = i;
+      Key key = key_of(*item);
+      data.emplace_back(key, std::move(item));
+      sift_up(i);
+    }
+
+    void push(const I& item) {
+      I copy(item);
+      push(std::move(copy));
+    }
+
+    void pop() {
+      remove(0);
+    }
+
+    void remove(T& item) {
+      remove(item.*heap_info);
+    }
+
+    void promote(T& item) {
+      HeapIndex i = item.*heap_info;
+      data[i].key = key_of(item);
+      sift_up(i);
+    }
+
+    void demote(T& item) {
+      HeapIndex i = item.*heap_info;
+      data[i].key = key_of(item);
+      sift_down(i);
+    }
+
+    void adjust(T& item) {
+      HeapIndex i = item.*heap_info;
+      data[i].key = key_of(item);
+      sift(i);
+    }
+
+    // retakes every element's key and restores the heap, in O(n) time
+    // rather than O(log n) for each one adjusted
+    void update_all() {
+      for (auto& e : data) {
+	e.key = key_of(*e.item);
+      }
+      if (data.size() < 2) {
+	return;
+      }
+      for (HeapIndex i = parent(data.size() - 1) + 1; i > 0; --i) {
+	sift_down(i - 1);
+      }
+    }
+
+    ConstIterator cbegin() const {
+      return ConstIterator(*this, 0);
+    }
+
+    ConstIterator cend() const {
+      return ConstIterator(*this, data.size());
+    }
+
+    // can only be called if I is copyable; copies heap into a vector
+    // and sorts it before displaying it
+    std::ostream&
+    display_sorted(std::ostream& out,
+		   std::function<bool(const T&)> filter = all_filter) const {
+      static_assert(std::is_copy_constructible<I>::value,
+		    "cannot call display_sorted when class I is not copy"
+		    " constructible");
+      std::vector<Entry> copy(data);
+      std::sort(copy.begin(), copy.end(),
+		[this] (const Entry& first, const Entry& second) -> bool {
+		  return this->comparator(first.key, second.key);
+		});
+
+      bool first = true;
+      for (auto c = copy.begin(); c != copy.end(); ++c) {
+	if (filter(*c->item)) {
+	  if (!first) {
+	    out << ", ";
+	  } else {
+	    first = false;
+	  }
+	  out << *c->item;
+	}
+      }
+
+      return out;
+    }
+
+
+  protected:
+
+    static IndIntruHeapData& intru_data_of(I& item) {
+      return (*item).*heap_info;
+    }
+
+    void remove(HeapIndex i) {
+      assert(i < data.size());
+      HeapIndex last = data.size() - 1;
+      if (i == last) {
+	data.pop_back();
+	return;
+      }
+      std::swap(data[i], data[last]);
+      intru_data_of(data[i].item) = i;
+      data.pop_back();
+      // the moved element can go up or down; see IndIntruHeap::remove
+      sift(i);
+    }
+
+    // default value of filter parameter to display_sorted
+    static bool all_filter(const T& data) { return true; }
+
+    static inline HeapIndex parent(HeapIndex i) {
+      assert(0 != i);
+      return (i - 1) / K;
+    }
+
+    // index of left-most child
+    static inline HeapIndex lhs(HeapIndex i) { return K*i + 1; }
+
+    bool precedes(HeapIndex i, HeapIndex j) const {
+      return comparator(data[i].key, data[j].key);
+    }
+
+    void swap_entries(HeapIndex i, HeapIndex j) {
+      std::swap(data[i], data[j]);
+      intru_data_of(data[i].item) = i;
+      intru_data_of(data[j].item) = j;
+    }
+
+    void sift_up(HeapIndex i) {
+      while (i > 0) {
+	HeapIndex pi = parent(i);
+	if (!precedes(i, pi)) {
+	  break;
+	}
+	swap_entries(i, pi);
+	i = pi;
+      }
+    } // sift_up
+
+    void sift_down(HeapIndex i) {
+      const HeapIndex count = data.size();
+      while (true) {
+	HeapIndex li = lhs(i);
+	if (li >= count) {
+	  // no children
+	  break;
+	}
+
+	// find the index of min. child
+	HeapIndex ri = std::min(li + K - 1, count - 1);
+	HeapIndex min_i = li;
+	for (HeapIndex k = li + 1; k <= ri; ++k) {
+	  if (precedes(k, min_i)) {
+	    min_i = k;
+	  }
+	}
+
+	if (!precedes(min_i, i)) {
+	  // no child is smaller
+	  break;
+	}
+	swap_entries(i, min_i);
+	i = min_i;
+      }
+    } // sift_down
+
+    void sift(HeapIndex i) {
+      if (i > 0 && precedes(i, parent(i))) {
+	sift_up(i);
+      } else {
+	sift_down(i);
+      }
+    } // sift
+  }; // class IndIntruKeyHeap
+
+} // namespace crimson
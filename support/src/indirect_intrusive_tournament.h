@@ -0,0 +1,253 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <vector>
+#include <array>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+
+#include "assert.h"
+
+#include "indirect_intrusive_heap.h"
+
+
+namespace crimson {
+
+  /* A tournament (winner) tree that orders the same elements N ways
+   * at once. Each element has a leaf holding its N keys; each
+   * internal node holds, for each of the N orderings, the leaf that
+   * wins among those below it. So changing an element's keys
+   * replays a single path from its leaf to the root for all N
+   * orderings together, rather than sifting it in N separate heaps.
+   * The path stops early once no ordering changes further up. The
+   * top of every ordering is found at the root in O(1).
+   *
+   * Leaves keep their position for as long as their element is in
+   * the tree; removed elements' leaves are reused. When all leaves
+   * are in use the tree doubles in size and is rebuilt.
+   *
+   * T, I, and heap_info are as for IndIntruHeap; heap_info holds the
+   * element's leaf.
+   *
+   * KF is a functor that, given a const T&, returns a std::array of
+   *   the element's N keys, one for each ordering.
+   *
+   * C is a functor that, given two keys, returns true if the first
+   *   must precede the second. Ties go to the leaf further left.
+   */
+  template<typename I,
+	   typename T,
+	   IndIntruHeapData T::*heap_info,
+	   typename KF,
+	   typename C,
+	   uint N>
+  class IndIntruTournament {
+
+    // shorthand
+    using Index = uint32_t;
+
+    static_assert(
+      std::is_same<T,typename std::pointer_traits<I>::element_type>::value,
+      "class I must resolve to class T by indirection (pointer dereference)");
+
+  public:
+
+    using Keys = typename std::result_of<KF(const T&)>::type;
+    using Key = typename Keys::value_type;
+
+    static_assert(std::is_same<Keys,std::array<Key,N>>::value,
+		  "class KF must return a std::array of N keys");
+
+  protected:
+
+    // number of leaves; always a power of two, and so leaf i is node
+    // capacity + i, and node n's children are 2n and 2n+1
+    Index                          capacity = 0;
+    size_t                         count = 0;
+    // leaves that have never been used start here
+    Index                          unused = 0;
+    std::vector<Index>             free_leaves;
+
+    // by leaf
+    std::vector<I>                 items;
+    std::vector<Keys>              keys;
+    // by internal node (node 0 is not used)
+    std::vector<std::array<Index,N>> winners;
+
+    KF                             keys_of;
+    C                              comparator;
+
+  public:
+
+    bool empty() const { return 0 == count; }
+
+    size_t size() const { return count; }
+
+    // the element that comes first in ordering k
+    T& top(uint k) { return *items[winner(1, k)]; }
+
+    const T& top(uint k) const { return *items[winner(1, k)]; }
+
+    I& top_ind(uint k) { return items[winner(1, k)]; }
+
+    const I& top_ind(uint k) const { return items[winner(1, k)]; }
+
+    void push(I&& item) {
+      Index leaf;
+      if (!free_leaves.empty()) {
+	leaf = free_leaves.back();
+	free_leaves.pop_back();
+      } else {
+	if (unused == capacity) {
+	  grow();
+	}
+	leaf = unused++;
+      }
+      intru_data_of(item) = leaf;
+      keys[leaf] = keys_of(*item);
+      items[leaf] = std::move(item);
+      ++count;
+      replay(leaf);
+    }
+
+    void push(const I& item) {
+      I copy(item);
+      push(std::move(copy));
+    }
+
+    void remove(T& item) {
+      Index leaf = item.*heap_info;
+      assert(leaf < unused && items[leaf]);
+      items[leaf] = I();
+      free_leaves.push_back(leaf);
+      --count;
+      replay(leaf);
+    }
+
+    // must be called after any change to item's keys
+    void update(T& item) {
+      Index leaf = item.*heap_info;
+      keys[leaf] = keys_of(item);
+      replay(leaf);
+    }
+
+    // retakes every element's keys and replays the whole tree, in
+    // O(n) time rather than O(log n) for each one updated
+    void update_all() {
+      for (Index l = 0; l < unused; ++l) {
+	if (items[l]) {
+	  keys[l] = keys_of(*items[l]);
+	}
+      }
+      replay_all();
+    }
+
+    // copies ordering k into a vector and sorts it before displaying
+    // it
+    std::ostream&
+    display_sorted(std::ostream& out,
+		   uint k,
+		   std::function<bool(const T&)> filter = all_filter) const {
+      std::vector<Index> leaves;
+      for (Index l = 0; l < unused; ++l) {
+	if (items[l]) {
+	  leaves.push_back(l);
+	}
+      }
+      std::stable_sort(leaves.begin(), leaves.end(),
+		       [this, k] (Index l1, Index l2) -> bool {
+			 return comparator(keys[l1][k], keys[l2][k]);
+		       });
+
+      bool first = true;
+      for (auto l : leaves) {
+	if (filter(*items[l])) {
+	  if (!first) {
+	    out << ", ";
+	  } else {
+	    first = false;
+	  }
+	  out << *items[l];
+	}
+      }
+
+      return out;
+    }
+
+
+  protected:
+
+    static IndIntruHeapData& intru_data_of(I& item) {
+      return (*item).*heap_info;
+    }
+
+    // default value of filter parameter to display_sorted
+    static bool all_filter(const T& data) { return true; }
+
+    // the leaf that wins ordering k at node
+    Index winner(Index node, uint k) const {
+      return node >= capacity ? node - capacity : winners[node][k];
+    }
+
+    // the better of two leaves in ordering k; unused leaves always
+    // lose
+    Index better(Index l1, Index l2, uint k) const {
+      if (!items[l2]) {
+	return l1;
+      } else if (!items[l1]) {
+	return l2;
+      } else {
+	return comparator(keys[l2][k], keys[l1][k]) ? l2 : l1;
+      }
+    }
+
+    // recomputes the winners on the path from leaf to the root
+    void replay(Index leaf) {
+      for (Index node = (capacity + leaf) / 2; node > 0; node /= 2) {
+	bool changed = false;
+	for (uint k = 0; k < N; ++k) {
+	  Index w = better(winner(2 * node, k), winner(2 * node + 1, k), k);
+	  // if leaf still wins here its keys changed, so nodes above
+	  // still need replaying
+	  if (w != winners[node][k] || w == leaf) {
+	    winners[node][k] = w;
+	    changed = true;
+	  }
+	}
+	if (!changed) {
+	  break;
+	}
+      }
+    }
+
+    // recomputes the winners at every internal node, bottom up
+    void replay_all() {
+      for (Index node = capacity - 1; node > 0; --node) {
+	for (uint k = 0; k < N; ++k) {
+	  winners[node][k] =
+	    better(winner(2 * node, k), winner(2 * node + 1, k), k);
+	}
+      }
+    }
+
+    void grow() {
+      capacity = std::max(Index(2), 2 * capacity);
+      items.resize(capacity);
+      keys.resize(capacity);
+      winners.resize(capacity);
+      replay_all();
+    }
+  }; // class IndIntruTournament
+
+} // namespace crimson
@@ -0,0 +1,115 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <utility>
+
+#include "pooled_object.h"
+
+
+namespace crimson {
+
+  /* A lock-free queue with any number of producers and a single
+   * consumer. Producers push onto an atomic singly-linked stack with
+   * a compare-and-swap. The consumer takes the whole stack with one
+   * exchange, so it never races with another pop and there is no ABA
+   * problem. It then reverses the stack, which restores the order
+   * of the pushes.
+   *
+   * Only one thread may call drain at a time; push may be called
+   * from any thread.
+   */
+  template<typename T>
+  class MpscQueue {
+
+    struct Node : public PooledObject<Node> {
+      T     value;
+      Node* next;
+
+      template<typename... Args>
+      Node(Args&&... args) :
+	value(std::forward<Args>(args)...),
+	next(nullptr)
+      {
+	// empty
+      }
+    };
+
+    std::atomic<Node*> head;
+
+  public:
+
+    MpscQueue() :
+      head(nullptr)
+    {
+      // empty
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue() {
+      Node* n = head.exchange(nullptr);
+      while (nullptr != n) {
+	Node* next = n->next;
+	delete n;
+	n = next;
+      }
+    }
+
+    // Constructs an element from args at the back of the queue.
+    // Returns true if the queue was empty, in which case the consumer
+    // may need waking.
+    template<typename... Args>
+    bool push(Args&&... args) {
+      Node* n = new Node(std::forward<Args>(args)...);
+      Node* old_head = head.load(std::memory_order_relaxed);
+      do {
+	n->next = old_head;
+      } while (!head.compare_exchange_weak(old_head, n,
+					   std::memory_order_release,
+					   std::memory_order_relaxed));
+      return nullptr == old_head;
+    }
+
+    bool empty() const {
+      return nullptr == head.load(std::memory_order_acquire);
+    }
+
+    // Removes every element currently in the queue, passing each to
+    // f (as a T&) in the order they were pushed; f must not
+    // throw. Returns the number of elements removed.
+    template<typename F>
+    size_t drain(F f) {
+      Node* n = head.exchange(nullptr, std::memory_order_acquire);
+
+      // reverse to get the order of the pushes
+      Node* first = nullptr;
+      while (nullptr != n) {
+	Node* next = n->next;
+	n->next = first;
+	first = n;
+	n = next;
+      }
+
+      size_t count = 0;
+      while (nullptr != first) {
+	Node* next = first->next;
+	f(first->value);
+	delete first;
+	first = next;
+	++count;
+      }
+      return count;
+    }
+  }; // class MpscQueue
+
+} // namespace crimson
@@ -0,0 +1,103 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <assert.h>
+
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+
+namespace crimson {
+
+  /* Hands out objects of type T from slabs of S slots each. Destroyed
+   * objects return their slot to a free list, so once the pool has
+   * grown to its high-water mark creating and destroying objects does
+   * not touch the general-purpose allocator. Slabs are only released
+   * when the pool itself is destroyed.
+   *
+   * The pool is not thread-safe; callers provide any locking. All
+   * objects must be destroyed before the pool is.
+   */
+  template<typename T, size_t S = 64>
+  class ObjectPool {
+
+    static_assert(S > 0, "S (slots per slab) must be at least 1");
+
+    union Slot {
+      Slot* next_free;
+      typename std::aligned_storage<sizeof(T),alignof(T)>::type storage;
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> slabs;
+    Slot*                                free_list = nullptr;
+    size_t                               live = 0;
+
+  public:
+
+    ObjectPool() {
+      // empty
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    ~ObjectPool() {
+      assert(0 == live);
+    }
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+      if (nullptr == free_list) {
+	add_slab();
+      }
+      Slot* slot = free_list;
+      free_list = slot->next_free;
+      T* result;
+      try {
+	result = new (&slot->storage) T(std::forward<Args>(args)...);
+      } catch (...) {
+	slot->next_free = free_list;
+	free_list = slot;
+	throw;
+      }
+      ++live;
+      return result;
+    }
+
+    void destroy(T* item) {
+      item->~T();
+      Slot* slot = reinterpret_cast<Slot*>(item);
+      slot->next_free = free_list;
+      free_list = slot;
+      --live;
+    }
+
+    // number of objects created and not yet destroyed
+    size_t size() const { return live; }
+
+    // number of objects that fit without allocating another slab
+    size_t capacity() const { return slabs.size() * S; }
+
+  protected:
+
+    void add_slab() {
+      Slot* slab = new Slot[S];
+      slabs.emplace_back(slab);
+      for (size_t i = S; i > 0; --i) {
+	slab[i - 1].next_free = free_list;
+	free_list = &slab[i - 1];
+      }
+    }
+  }; // class ObjectPool
+
+} // namespace crimson
@@ -0,0 +1,179 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <new>
+#include <mutex>
+#include <vector>
+
+
+namespace crimson {
+
+  /* Deriving T from PooledObject<T> (i.e., class T : public
+   * crimson::PooledObject<T>) makes new and delete of T reuse memory
+   * from per-thread free lists rather than going to the general
+   * purpose allocator. Code that creates and destroys T does not
+   * change, including code using std::unique_ptr<T>.
+   *
+   * Each thread caches up to cache_max freed objects. Beyond that,
+   * batches of batch_size objects are handed to a shared depot, from
+   * which threads with empty caches refill. This keeps memory flowing
+   * from threads that mostly delete to threads that mostly create
+   * (e.g., consumers and producers of requests) with one lock
+   * acquisition per batch.
+   *
+   * An object goes to the cache of the thread that deletes it, not
+   * the one that created it. A thread that only deletes holds up to
+   * cache_max objects and passes the rest on to the depot; a thread
+   * that only creates takes a batch from the depot when its cache is
+   * empty, and falls back to the general purpose allocator when the
+   * depot is empty too. The depot holds at most depot_max batches and
+   * frees batches beyond that. Cached objects are freed only when
+   * their thread exits, so each thread that has deleted T may keep
+   * cache_max of them.
+   *
+   * Classes derived from T that are larger than T use the general
+   * purpose allocator.
+   */
+  template<typename T, size_t cache_max = 256, size_t batch_size = 64>
+  class PooledObject {
+
+    static_assert(batch_size > 0 && batch_size <= cache_max,
+		  "batch_size must be between 1 and cache_max");
+
+    struct Node {
+      Node* next;
+    };
+
+    // a list of batch_size free nodes
+    using Batch = Node*;
+
+    static constexpr size_t node_size =
+      sizeof(T) > sizeof(Node) ? sizeof(T) : sizeof(Node);
+
+    // most full batches the depot holds before freeing them
+    static constexpr size_t depot_max = 64;
+
+    struct Depot {
+      std::mutex         mtx;
+      std::vector<Batch> batches;
+
+      ~Depot() {
+	for (auto b : batches) {
+	  free_list(b);
+	}
+      }
+    };
+
+    struct Cache {
+      Node*  head = nullptr;
+      size_t count = 0;
+
+      ~Cache() {
+	while (count >= batch_size) {
+	  give_batch(*this);
+	}
+	free_list(head);
+      }
+    };
+
+  public:
+
+    static void* operator new(size_t size) {
+      if (size != sizeof(T)) {
+	return ::operator new(size);
+      }
+
+      Cache& c = cache();
+      if (nullptr == c.head) {
+	take_batch(c);
+	if (nullptr == c.head) {
+	  return ::operator new(node_size);
+	}
+      }
+
+      Node* n = c.head;
+      c.head = n->next;
+      --c.count;
+      return n;
+    }
+
+    static void operator delete(void* p, size_t size) {
+      if (nullptr == p) return;
+      if (size != sizeof(T)) {
+	::operator delete(p);
+	return;
+      }
+
+      Cache& c = cache();
+      Node* n = static_cast<Node*>(p);
+      n->next = c.head;
+      c.head = n;
+      if (++c.count > cache_max) {
+	give_batch(c);
+      }
+    }
+
+  protected:
+
+    static Cache& cache() {
+      static thread_local Cache c;
+      return c;
+    }
+
+    static Depot& depot() {
+      static Depot d;
+      return d;
+    }
+
+    static void free_list(Node* n) {
+      while (nullptr != n) {
+	Node* next = n->next;
+	::operator delete(n);
+	n = next;
+      }
+    }
+
+    // moves batch_size nodes from the cache to the depot
+    static void give_batch(Cache& c) {
+      Batch b = c.head;
+      Node* last = c.head;
+      for (size_t i = 1; i < batch_size; ++i) {
+	last = last->next;
+      }
+      c.head = last->next;
+      c.count -= batch_size;
+      last->next = nullptr;
+
+      Depot& d = depot();
+      {
+	std::lock_guard<std::mutex> g(d.mtx);
+	if (d.batches.size() < depot_max) {
+	  d.batches.push_back(b);
+	  return;
+	}
+      }
+      free_list(b);
+    }
+
+    // moves a batch from the depot into the empty cache, if the
+    // depot has one
+    static void take_batch(Cache& c) {
+      Depot& d = depot();
+      std::lock_guard<std::mutex> g(d.mtx);
+      if (!d.batches.empty()) {
+	c.head = d.batches.back();
+	c.count = batch_size;
+	d.batches.pop_back();
+      }
+    }
+  }; // class PooledObject
+
+} // namespace crimson
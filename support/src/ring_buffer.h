@@ -0,0 +1,296 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <assert.h>
+
+#include <memory>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+
+
+namespace crimson {
+
+  /* A double-ended queue of T kept in a growable circular buffer. The
+   * first N elements are stored inside the RingBuffer itself, so a
+   * queue that never holds more than N elements never allocates.
+   * When it needs more room, the buffer moves to the heap, doubling
+   * its capacity each time it grows; shrink_to_fit moves it back
+   * inside when the elements fit again.
+   *
+   * Elements can only be added at the back and popped at the front,
+   * but remove_if removes any number of elements from the middle in
+   * a single pass.
+   */
+  template<typename T, size_t N = 2>
+  class RingBuffer {
+
+    static_assert(N > 0, "N (inline capacity) must be at least 1");
+
+    using Slot =
+      typename std::aligned_storage<sizeof(T),alignof(T)>::type;
+
+    Slot   inline_slots[N];
+    Slot*  slots;
+    size_t capacity;
+    size_t head;  // index of slot holding front element
+    size_t count;
+
+    template<bool is_const>
+    class IteratorBase {
+      friend RingBuffer;
+
+      using Ring = typename std::conditional<is_const,
+					     const RingBuffer,
+					     RingBuffer>::type;
+
+      Ring*  ring;
+      size_t index; // logical index, 0 is front
+
+      IteratorBase(Ring* _ring, size_t _index) :
+	ring(_ring),
+	index(_index)
+      {
+	// empty
+      }
+
+    public:
+
+      using iterator_category = std::bidirectional_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer =
+	typename std::conditional<is_const,const T*,T*>::type;
+      using reference =
+	typename std::conditional<is_const,const T&,T&>::type;
+
+      // allow conversion from iterator to const_iterator
+      IteratorBase(const IteratorBase<false>& other) :
+	ring(other.ring),
+	index(other.index)
+      {
+	// empty
+      }
+
+      IteratorBase& operator++() {
+	++index;
+	return *this;
+      }
+
+      IteratorBase operator++(int) {
+	IteratorBase result(*this);
+	++index;
+	return result;
+      }
+
+      IteratorBase& operator--() {
+	--index;
+	return *this;
+      }
+
+      IteratorBase operator--(int) {
+	IteratorBase result(*this);
+	--index;
+	return result;
+      }
+
+      bool operator==(const IteratorBase& other) const {
+	return ring == other.ring && index == other.index;
+      }
+
+      bool operator!=(const IteratorBase& other) const {
+	return !(*this == other);
+      }
+
+      reference operator*() const {
+	return (*ring)[index];
+      }
+
+      pointer operator->() const {
+	return &(*ring)[index];
+      }
+    }; // class IteratorBase
+
+  public:
+
+    using value_type = T;
+    using iterator = IteratorBase<false>;
+    using const_iterator = IteratorBase<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    RingBuffer() :
+      slots(inline_slots),
+      capacity(N),
+      head(0),
+      count(0)
+    {
+      // empty
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    ~RingBuffer() {
+      clear();
+      release();
+    }
+
+    bool empty() const { return 0 == count; }
+
+    size_t size() const { return count; }
+
+    // true when the elements are stored inside the RingBuffer
+    bool is_inline() const { return inline_slots == slots; }
+
+    T& operator[](size_t i) {
+      return *reinterpret_cast<T*>(&slots[physical(i)]);
+    }
+
+    const T& operator[](size_t i) const {
+      return *reinterpret_cast<const T*>(&slots[physical(i)]);
+    }
+
+    T& front() { return (*this)[0]; }
+    const T& front() const { return (*this)[0]; }
+
+    T& back() { return (*this)[count - 1]; }
+    const T& back() const { return (*this)[count - 1]; }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, count); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const {
+      return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const {
+      return const_reverse_iterator(begin());
+    }
+
+    template<typename... Args>
+    void emplace_back(Args&&... args) {
+      if (count == capacity) {
+	relocate(2 * capacity);
+      }
+      new (&slots[physical(count)]) T(std::forward<Args>(args)...);
+      ++count;
+    }
+
+    void push_back(T&& item) {
+      emplace_back(std::move(item));
+    }
+
+    void pop_front() {
+      assert(count > 0);
+      front().~T();
+      head = physical(1);
+      --count;
+    }
+
+    void clear() {
+      for (size_t i = 0; i < count; ++i) {
+	(*this)[i].~T();
+      }
+      head = 0;
+      count = 0;
+    }
+
+    // returns the storage to the inline slots if the elements fit
+    void shrink_to_fit() {
+      if (!is_inline() && count <= N) {
+	relocate(N);
+      }
+    }
+
+    // Removes every element for which filter returns true in a
+    // single pass, visiting elements front to back or, if
+    // visit_backwards is true, back to front; the remaining elements
+    // keep their order. Returns true if any element was removed.
+    template<typename F>
+    bool remove_if(F filter, bool visit_backwards = false) {
+      // invariant: logical slots strictly between the read and write
+      // positions hold no element
+      size_t keep;
+      if (visit_backwards) {
+	keep = count;
+	for (size_t r = count; r > 0; --r) {
+	  if (filter((*this)[r - 1])) {
+	    (*this)[r - 1].~T();
+	  } else {
+	    --keep;
+	    move_element(r - 1, keep);
+	  }
+	}
+	// the remaining elements are packed against the back
+	head = physical(keep);
+	keep = count - keep;
+      } else {
+	keep = 0;
+	for (size_t r = 0; r < count; ++r) {
+	  if (filter((*this)[r])) {
+	    (*this)[r].~T();
+	  } else {
+	    move_element(r, keep);
+	    ++keep;
+	  }
+	}
+      }
+
+      bool any_removed = keep != count;
+      count = keep;
+      return any_removed;
+    }
+
+  protected:
+
+    // slot index of logical index i
+    size_t physical(size_t i) const {
+      size_t p = head + i;
+      return p < capacity ? p : p - capacity;
+    }
+
+    // moves the element at logical index from to the empty logical
+    // index to
+    void move_element(size_t from, size_t to) {
+      if (from != to) {
+	new (&slots[physical(to)]) T(std::move((*this)[from]));
+	(*this)[from].~T();
+      }
+    }
+
+    void release() {
+      if (!is_inline()) {
+	delete[] slots;
+      }
+    }
+
+    // moves the elements, front first, to new storage with
+    // new_capacity slots, which is inline if new_capacity is N
+    void relocate(size_t new_capacity) {
+      assert(new_capacity >= count);
+      Slot* new_slots =
+	N == new_capacity ? inline_slots : new Slot[new_capacity];
+      for (size_t i = 0; i < count; ++i) {
+	new (&new_slots[i]) T(std::move((*this)[i]));
+	(*this)[i].~T();
+      }
+      release();
+      slots = new_slots;
+      capacity = new_capacity;
+      head = 0;
+    }
+  }; // class RingBuffer
+
+} // namespace crimson
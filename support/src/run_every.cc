@@ -5,7 +5,7 @@
  */
 
 
-#include <iostream>
+#include <random>
 
 #include "run_every.h"
 
@@ -17,7 +17,9 @@ namespace chrono = std::chrono;
 
 
 #ifdef ADD_MOVE_SEMANTICS
-crimson::RunEvery::RunEvery()
+crimson::RunEvery::RunEvery() :
+  wait_period(0),
+  timer(shared_executor(), std::bind(&RunEvery::run, this))
 {
   // empty
 }
@@ -25,27 +27,14 @@ crimson::RunEvery::RunEvery()
 
 crimson::RunEvery& crimson::RunEvery::operator=(crimson::RunEvery&& other)
 {
-  // finish run every thread
-  {
-    Guard g(mtx);
-    finishing = true;
-    cv.notify_one();
-  }
-  if (thd.joinable()) {
-    thd.join();
-  }
-
-  // transfer info over from previous thread
-  finishing.store(other.finishing);
+  // stop this job and the other one
+  timer.cancel_sync();
+  other.timer.cancel_sync();
+
+  // transfer info over from the other job and start it here
   wait_period = other.wait_period;
   body = other.body;
-
-  // finish other thread
-  other.finishing.store(true);
-  other.cv.notify_one();
-
-  // start this thread
-  thd = std::thread(&RunEvery::run, this);
+  schedule();
 
   return *this;
 }
@@ -53,21 +42,26 @@ crimson::RunEvery& crimson::RunEvery::operator=(crimson::RunEvery&& other)
 
 
 crimson::RunEvery::~RunEvery() {
-  finishing = true;
-  cv.notify_all();
-  thd.join();
+  timer.cancel_sync();
+}
+
+
+crimson::TimerService& crimson::RunEvery::shared_executor() {
+  static TimerService executor(2);
+  return executor;
+}
+
+
+void crimson::RunEvery::schedule() {
+  static thread_local std::minstd_rand prng(std::random_device{}());
+  auto jitter_max = wait_period.count() / 16;
+  auto jitter = jitter_max > 0 ? long(prng() % (jitter_max + 1)) : 0;
+  timer.schedule_by(TimerWheel::Clock::now() +
+		    wait_period + chrono::milliseconds(jitter));
 }
 
 
 void crimson::RunEvery::run() {
-  Lock l(mtx);
-  while(!finishing) {
-    TimePoint until = chrono::steady_clock::now() + wait_period;
-    while (!finishing && chrono::steady_clock::now() < until) {
-      cv.wait_until(l, until);
-    }
-    if (!finishing) {
-      body();
-    }
-  }
+  body();
+  schedule();
 }
@@ -8,9 +8,9 @@
 #pragma once
 
 #include <chrono>
-#include <mutex>
-#include <condition_variable>
-#include <thread>
+#include <functional>
+
+#include "timer_wheel.h"
 
 
 namespace crimson {
@@ -18,22 +18,21 @@ namespace crimson {
   using std::chrono::milliseconds;
 
   // runs a given simple function object waiting wait_period
-  // milliseconds between; the destructor stops the other thread
-  // immediately
+  // milliseconds between; the destructor stops it immediately
+  //
+  // Rather than each RunEvery having a thread of its own, the
+  // function runs on an executor shared by many RunEvery
+  // instances, by default the process-wide one from
+  // shared_executor(). Each wait is lengthened by a random amount of
+  // up to 1/16 of wait_period, so that jobs created together don't
+  // keep running at the same moment.
   class RunEvery {
-    using Lock      = std::unique_lock<std::mutex>;
-    using Guard     = std::lock_guard<std::mutex>;
-    using TimePoint = std::chrono::steady_clock::time_point;
-
-    bool                      finishing = false;
     std::chrono::milliseconds wait_period;
     std::function<void()>     body;
-    std::mutex                mtx;
-    std::condition_variable   cv;
 
-    // put threads last so all other variables are initialized first
+    // put the timer last so all other variables are initialized first
 
-    std::thread               thd;
+    TimerService::Timer       timer;
 
   public:
 
@@ -43,11 +42,13 @@ namespace crimson {
 
     template<typename D>
     RunEvery(D                     _wait_period,
-	     std::function<void()> _body) :
+	     std::function<void()> _body,
+	     TimerService&         _executor = shared_executor()) :
       wait_period(duration_cast<milliseconds>(_wait_period)),
-      body(_body)
+      body(_body),
+      timer(_executor, std::bind(&RunEvery::run, this))
     {
-      thd = std::thread(&RunEvery::run, this);
+      schedule();
     }
 
     RunEvery(const RunEvery& other) = delete;
@@ -61,8 +62,14 @@ namespace crimson {
 
     ~RunEvery();
 
+    // a small pool of threads shared by all RunEvery instances that
+    // aren't given an executor; separate from TimerService::global()
+    // so long-running jobs don't delay short timers there
+    static TimerService& shared_executor();
+
   protected:
 
+    void schedule();
     void run();
   };
 }
@@ -0,0 +1,126 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "histogram.h"
+
+
+namespace crimson {
+
+  /* A std::mutex that keeps statistics on how it's used: how often
+   * it's locked, how often a locker had to wait, how long (in
+   * nanoseconds) those lockers waited, and how long it was held. It
+   * meets the Lockable requirements, so std::lock_guard and
+   * std::unique_lock work with it.
+   *
+   * To keep the cost down, an uncontended lock reads no clock; only
+   * lockers that fail to get the mutex straight away time their
+   * wait. Hold times are timed on one lock in every hold_sample.
+   * Statistics are written only with the mutex held, and stats()
+   * reads them without taking it.
+   */
+  class StatMutex {
+  public:
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+      uint64_t  locks;     // times locked
+      uint64_t  contended; // times a locker had to wait
+      Histogram wait;      // ns each contended locker waited
+      Histogram hold;      // ns held, for the sampled locks
+    };
+
+  protected:
+
+    std::mutex            mtx;
+    const uint            hold_sample;
+
+    std::atomic<uint64_t> locks;
+    std::atomic<uint64_t> contended;
+    AtomicHistogram       wait_hist;
+    AtomicHistogram       hold_hist;
+
+    // when the current holder locked, if its hold is being timed
+    Clock::time_point     hold_start;
+    bool                  timing_hold = false;
+
+    static uint64_t ns_between(Clock::time_point start, Clock::time_point end) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	end - start).count();
+    }
+
+    static void bump(std::atomic<uint64_t>& counter) {
+      counter.store(counter.load(std::memory_order_relaxed) + 1,
+		    std::memory_order_relaxed);
+    }
+
+    // mtx must be held by caller
+    void locked() {
+      const uint64_t n = locks.load(std::memory_order_relaxed);
+      locks.store(n + 1, std::memory_order_relaxed);
+      if (0 == n % hold_sample) {
+	hold_start = Clock::now();
+	timing_hold = true;
+      }
+    }
+
+  public:
+
+    explicit StatMutex(uint _hold_sample = 64) :
+      hold_sample(_hold_sample > 0 ? _hold_sample : 1),
+      locks(0),
+      contended(0)
+    {
+      // empty
+    }
+
+    StatMutex(const StatMutex&) = delete;
+    StatMutex& operator=(const StatMutex&) = delete;
+
+    void lock() {
+      if (!mtx.try_lock()) {
+	const Clock::time_point start = Clock::now();
+	mtx.lock();
+	wait_hist.record(ns_between(start, Clock::now()));
+	bump(contended);
+      }
+      locked();
+    }
+
+    bool try_lock() {
+      if (!mtx.try_lock()) {
+	return false;
+      }
+      locked();
+      return true;
+    }
+
+    void unlock() {
+      if (timing_hold) {
+	hold_hist.record(ns_between(hold_start, Clock::now()));
+	timing_hold = false;
+      }
+      mtx.unlock();
+    }
+
+    Stats stats() const {
+      return Stats{ locks.load(std::memory_order_relaxed),
+		    contended.load(std::memory_order_relaxed),
+		    wait_hist.snapshot(),
+		    hold_hist.snapshot() };
+    }
+  }; // class StatMutex
+
+} // namespace crimson
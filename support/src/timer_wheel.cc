@@ -0,0 +1,225 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <assert.h>
+
+#include "timer_wheel.h"
+
+
+crimson::TimerWheel::~TimerWheel() {
+  {
+    Guard g(mtx);
+    finishing = true;
+    cv.notify_all();
+  }
+  thd.join();
+}
+
+
+size_t crimson::TimerWheel::pending_count() {
+  Guard g(mtx);
+  return count;
+}
+
+
+void crimson::TimerWheel::schedule_by(Timer& timer, TimePoint when) {
+  Guard g(mtx);
+  uint64_t t = to_tick(when);
+  if (timer.pending) {
+    if (timer.expires <= t) return;
+    remove(timer);
+  } else {
+    timer.pending = true;
+    ++count;
+  }
+  timer.expires = t;
+  insert(timer);
+
+  // the wheel thread only needs waking if it would otherwise sleep
+  // past this timer
+  if (std::max(t, current) < wake_tick) {
+    cv.notify_one();
+  }
+}
+
+
+bool crimson::TimerWheel::cancel(Timer& timer) {
+  Guard g(mtx);
+  if (!timer.pending) return false;
+  remove(timer);
+  timer.pending = false;
+  --count;
+  return true;
+}
+
+
+void crimson::TimerWheel::cancel_sync(Timer& timer) {
+  Lock l(mtx);
+  while (true) {
+    if (timer.pending) {
+      remove(timer);
+      timer.pending = false;
+      --count;
+    }
+    if (running != &timer || std::this_thread::get_id() == thd.get_id()) {
+      break;
+    }
+    done_cv.wait(l);
+  }
+}
+
+
+// places timer in the slot of the lowest level that reaches its
+// expiry tick; expiry ticks already passed are treated as current,
+// and those beyond the reach of the top level go in its furthest
+// slot and are re-inserted when that slot is cascaded
+void crimson::TimerWheel::insert(Timer& timer) {
+  const uint64_t reach = uint64_t(1) << (slot_bits * level_count);
+  uint64_t e = std::max(timer.expires, current);
+  if (e - current >= reach) {
+    e = current + reach - 1;
+  }
+
+  uint level = 0;
+  while (e - current >= (uint64_t(1) << (slot_bits * (level + 1)))) {
+    ++level;
+  }
+
+  uint slot = (e >> (slot_bits * level)) & (slot_count - 1);
+  levels[level].slots[slot].push_back(&timer);
+  levels[level].occupied |= uint64_t(1) << slot;
+  timer.level = level;
+  timer.slot = slot;
+}
+
+
+void crimson::TimerWheel::remove(Timer& timer) {
+  timer.unlink();
+  Level& level = levels[timer.level];
+  if (level.slots[timer.slot].empty()) {
+    level.occupied &= ~(uint64_t(1) << timer.slot);
+  }
+}
+
+
+// the first tick at or after current at which a level 0 slot holds
+// timers or a higher level slot holding timers needs cascading
+uint64_t crimson::TimerWheel::next_event_tick() const {
+  if (0 == count) return no_tick;
+
+  uint64_t result = no_tick;
+  for (uint l = 0; l < level_count; ++l) {
+    uint64_t occupied = levels[l].occupied;
+    if (0 == occupied) continue;
+
+    // the first slot of this level starting at or after current,
+    // and the distance from it to the next occupied slot
+    uint shift = slot_bits * l;
+    uint64_t first = (current + (uint64_t(1) << shift) - 1) >> shift;
+    uint rotate = first & (slot_count - 1);
+    uint64_t rotated = rotate ?
+      (occupied >> rotate) | (occupied << (slot_count - rotate)) :
+      occupied;
+    uint64_t t = (first + __builtin_ctzll(rotated)) << shift;
+    result = std::min(result, t);
+  }
+  return result;
+}
+
+
+void crimson::TimerWheel::run_tick(Lock& l, uint64_t t) {
+  current = t;
+
+  // cascade the higher level slots starting at this tick, highest
+  // first, so timers moved down can be cascaded again at once
+  for (uint level = level_count - 1; level > 0; --level) {
+    uint shift = slot_bits * level;
+    if (0 != (t & ((uint64_t(1) << shift) - 1))) continue;
+
+    uint slot = (t >> shift) & (slot_count - 1);
+    Level& lvl = levels[level];
+    if (0 == (lvl.occupied & (uint64_t(1) << slot))) continue;
+
+    Link cascading;
+    Link& head = lvl.slots[slot];
+    while (!head.empty()) {
+      Link* link = head.next;
+      link->unlink();
+      cascading.push_back(link);
+    }
+    lvl.occupied &= ~(uint64_t(1) << slot);
+
+    while (!cascading.empty()) {
+      Timer* timer = static_cast<Timer*>(cascading.next);
+      timer->unlink();
+      insert(*timer);
+    }
+  }
+
+  // fire the timers that expire now; bodies may schedule timers
+  // that expire now too, which join the same slot
+  Link& head = levels[0].slots[t & (slot_count - 1)];
+  while (!head.empty()) {
+    Timer* timer = static_cast<Timer*>(head.next);
+    remove(*timer);
+    timer->pending = false;
+    --count;
+
+    running = timer;
+    l.unlock();
+    timer->body();
+    l.lock();
+    running = nullptr;
+    done_cv.notify_all();
+  }
+}
+
+
+void crimson::TimerWheel::run() {
+  Lock l(mtx);
+  while (!finishing) {
+    // the latest tick whose time has been reached
+    uint64_t now = uint64_t((Clock::now() - start) / tick);
+
+    for (uint64_t t = next_event_tick();
+	 t <= now && !finishing;
+	 t = next_event_tick()) {
+      run_tick(l, t);
+      current = t + 1;
+    }
+    if (finishing) break;
+
+    // nothing happens in the remaining ticks up to now
+    if (current <= now) {
+      current = now + 1;
+    }
+
+    wake_tick = next_event_tick();
+    if (no_tick == wake_tick) {
+      cv.wait(l);
+    } else {
+      cv.wait_until(l, to_time(wake_tick));
+    }
+    wake_tick = no_tick;
+  }
+}
+
+
+crimson::TimerService::TimerService(uint wheel_count) :
+  next_wheel(0)
+{
+  assert(wheel_count > 0);
+  for (uint i = 0; i < wheel_count; ++i) {
+    wheels.emplace_back(new TimerWheel());
+  }
+}
+
+
+crimson::TimerService& crimson::TimerService::global() {
+  static TimerService service;
+  return service;
+}
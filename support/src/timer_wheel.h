@@ -0,0 +1,252 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <functional>
+
+
+namespace crimson {
+
+  /* A hashed hierarchical timer wheel driven by one thread.
+   *
+   * Time is divided into ticks. Level 0 has a slot for each of the
+   * next 64 ticks, level 1 a slot for each of the next 64 runs of 64
+   * ticks, and so on. A timer goes in the slot of the lowest level
+   * that reaches its expiry tick, and when the wheel reaches the
+   * start of a slot at a higher level the timers in it are
+   * re-inserted (cascaded) into lower levels. Scheduling and
+   * cancelling are O(1), and each level keeps a bitmap of its
+   * non-empty slots so the thread can sleep straight to the next tick
+   * that has anything to do rather than waking every tick.
+   *
+   * Timers never fire early; they fire at most a tick late plus
+   * whatever the operating system adds to the thread's sleep.
+   * Timer bodies run on the wheel's thread, one at a time, so they
+   * should be short.
+   */
+  class TimerWheel {
+  public:
+
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    class Timer;
+
+  protected:
+
+    using Lock  = std::unique_lock<std::mutex>;
+    using Guard = std::lock_guard<std::mutex>;
+
+    static constexpr uint     slot_bits = 6;
+    static constexpr uint     slot_count = 1u << slot_bits;
+    static constexpr uint     level_count = 6;
+    static constexpr uint64_t no_tick = ~uint64_t(0);
+
+    // circular, doubly linked list links; a slot's list head is a
+    // Link that is not part of a Timer
+    struct Link {
+      Link* prev;
+      Link* next;
+
+      Link() : prev(this), next(this) {}
+
+      bool empty() const { return next == this; }
+
+      void unlink() {
+	prev->next = next;
+	next->prev = prev;
+	prev = next = this;
+      }
+
+      void push_back(Link* l) {
+	l->prev = prev;
+	l->next = this;
+	prev->next = l;
+	prev = l;
+      }
+    };
+
+    struct Level {
+      Link     slots[slot_count];
+      uint64_t occupied = 0; // bit i set when slots[i] is non-empty
+    };
+
+    const Clock::duration   tick;
+    const TimePoint         start;
+
+    std::mutex              mtx;
+    std::condition_variable cv;      // wakes the wheel thread
+    std::condition_variable done_cv; // signalled after each body runs
+
+    Level                   levels[level_count];
+    uint64_t                current = 0; // all earlier ticks are done
+    uint64_t                wake_tick = no_tick; // when thread will wake
+    size_t                  count = 0;
+    Timer*                  running = nullptr;
+    bool                    finishing = false;
+
+    // put threads last so all other variables are initialized first
+
+    std::thread             thd;
+
+  public:
+
+    // A Timer can be scheduled on a single TimerWheel and runs body
+    // each time it fires. It is not pending once it fires, so a
+    // body that wants to run again needs to schedule its timer again.
+    class Timer : Link {
+      friend TimerWheel;
+
+      TimerWheel&           wheel;
+      std::function<void()> body;
+      uint64_t              expires = 0;   // tick
+      uint8_t               level = 0;     // where it is while pending
+      uint8_t               slot = 0;
+      bool                  pending = false;
+
+    public:
+
+      Timer(TimerWheel& _wheel, std::function<void()> _body) :
+	wheel(_wheel),
+	body(_body)
+      {
+	// empty
+      }
+
+      Timer(const Timer&) = delete;
+      Timer& operator=(const Timer&) = delete;
+
+      // cancels the timer and waits for a running body to finish
+      ~Timer() {
+	cancel_sync();
+      }
+
+      // makes sure body runs no later than when; an earlier pending
+      // time is kept, and a later one is moved up
+      void schedule_by(TimePoint when) {
+	wheel.schedule_by(*this, when);
+      }
+
+      // returns whether the timer was pending; does not wait for a
+      // running body, which may schedule the timer again
+      bool cancel() {
+	return wheel.cancel(*this);
+      }
+
+      // cancels the timer and, unless called from the body itself,
+      // waits until body is not running; it is cancelled again if the
+      // body scheduled it
+      void cancel_sync() {
+	wheel.cancel_sync(*this);
+      }
+
+      bool is_pending() const;
+    }; // class Timer
+
+    template<typename D>
+    explicit TimerWheel(D _tick) :
+      tick(std::chrono::duration_cast<Clock::duration>(_tick)),
+      start(Clock::now())
+    {
+      thd = std::thread(&TimerWheel::run, this);
+    }
+
+    TimerWheel() :
+      TimerWheel(std::chrono::microseconds(10))
+    {
+      // empty
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // timers still pending never fire; all timers must be destructed
+    // before the wheel
+    ~TimerWheel();
+
+    size_t pending_count();
+
+  protected:
+
+    // rounds up, so timers never fire early
+    uint64_t to_tick(TimePoint when) const {
+      if (when <= start) return 0;
+      return uint64_t((when - start + tick - Clock::duration(1)) / tick);
+    }
+
+    TimePoint to_time(uint64_t t) const {
+      return start + tick * t;
+    }
+
+    void schedule_by(Timer& timer, TimePoint when);
+    bool cancel(Timer& timer);
+    void cancel_sync(Timer& timer);
+
+    // mtx must be held for all of the following
+
+    void insert(Timer& timer);
+    void remove(Timer& timer);
+    uint64_t next_event_tick() const;
+    void run_tick(Lock& l, uint64_t t);
+    void run();
+  }; // class TimerWheel
+
+
+  inline bool TimerWheel::Timer::is_pending() const {
+    Guard g(wheel.mtx);
+    return pending;
+  }
+
+
+  /* A fixed set of timer wheels, each with its own thread, shared by
+   * any number of users; timers are spread across the wheels
+   * round-robin. global() returns a process-wide instance, so that
+   * many queues don't each need a timer thread of their own.
+   */
+  class TimerService {
+    std::vector<std::unique_ptr<TimerWheel>> wheels;
+    std::atomic<uint>                        next_wheel;
+
+  public:
+
+    // a Timer on one of the service's wheels
+    class Timer : public TimerWheel::Timer {
+    public:
+      Timer(TimerService& service, std::function<void()> body) :
+	TimerWheel::Timer(service.choose_wheel(), body)
+      {
+	// empty
+      }
+    };
+
+    explicit TimerService(uint wheel_count = 2);
+
+    static TimerService& global();
+
+    uint get_wheel_count() const {
+      return wheels.size();
+    }
+
+  protected:
+
+    TimerWheel& choose_wheel() {
+      return *wheels[next_wheel++ % wheels.size()];
+    }
+  }; // class TimerService
+
+} // namespace crimson
@@ -0,0 +1,92 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <chrono>
+
+
+namespace crimson {
+
+  /* A std::chrono clock that reads the CPU's time stamp counter,
+   * scaled to steady_clock. Each thread calibrates the counter against
+   * steady_clock over its first resync of calls (reading steady_clock
+   * meanwhile) and then resyncs every resync, so threads agree to
+   * within the counter's drift over that interval. Each thread's
+   * times never go backwards, but times read on different threads
+   * may, so it's not marked steady. x86 only, otherwise the same as
+   * steady_clock.
+   */
+  struct tsc_clock {
+    using duration   = std::chrono::nanoseconds;
+    using rep        = duration::rep;
+    using period     = duration::period;
+    using time_point = std::chrono::time_point<tsc_clock>;
+
+    static constexpr bool is_steady = false;
+
+    static constexpr int64_t resync = 10000000; // ns
+
+    static time_point now() {
+      return time_point(duration(now_ns()));
+    }
+
+    // nanoseconds since steady_clock's epoch
+    static int64_t now_ns() {
+#if defined(__x86_64__) || defined(__i386__)
+      static thread_local Sync sync;
+      const uint64_t tsc = __rdtsc();
+      int64_t ns;
+      // an unsigned difference, so a counter that went backwards
+      // (e.g., after moving to another CPU) also resyncs
+      if (sync.ns_per_tick > 0.0 && tsc - sync.base_tsc < sync.resync_ticks) {
+	ns = sync.base_ns + int64_t((tsc - sync.base_tsc) * sync.ns_per_tick);
+      } else {
+	ns = steady_ns();
+	if (0 == sync.base_tsc) {
+	  sync.base_tsc = tsc;
+	  sync.base_ns = ns;
+	} else if (ns - sync.base_ns >= resync && tsc > sync.base_tsc) {
+	  sync.ns_per_tick = double(ns - sync.base_ns) / (tsc - sync.base_tsc);
+	  sync.resync_ticks = uint64_t(resync / sync.ns_per_tick);
+	  sync.base_tsc = tsc;
+	  sync.base_ns = ns;
+	}
+      }
+      if (ns > sync.last_ns) {
+	sync.last_ns = ns;
+      }
+      return sync.last_ns;
+#else
+      return steady_ns();
+#endif
+    }
+
+  private:
+
+    struct Sync {
+      uint64_t base_tsc = 0;
+      int64_t  base_ns = 0;
+      double   ns_per_tick = 0.0; // 0 until calibrated
+      uint64_t resync_ticks = 0;
+      int64_t  last_ns = 0;
+    };
+
+    static int64_t steady_ns() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+  }; // struct tsc_clock
+
+} // namespace crimson
@@ -0,0 +1,95 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <assert.h>
+
+#include "work_service.h"
+
+
+crimson::WorkService::WorkService(uint worker_count) {
+  assert(worker_count > 0);
+  for (uint i = 0; i < worker_count; ++i) {
+    workers.emplace_back(&WorkService::run, this);
+  }
+}
+
+
+crimson::WorkService::~WorkService() {
+  {
+    Guard g(mtx);
+    finishing = true;
+    cv.notify_all();
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+}
+
+
+crimson::WorkService& crimson::WorkService::global() {
+  static WorkService service;
+  return service;
+}
+
+
+void crimson::WorkService::post(Task& task) {
+  Guard g(mtx);
+  if (std::thread::id() != task.runner) {
+    // the worker running it posts it again when body returns
+    task.run_again = true;
+  } else if (!task.is_waiting) {
+    task.is_waiting = true;
+    waiting.push_back(&task);
+    cv.notify_one();
+  }
+}
+
+
+void crimson::WorkService::cancel_sync(Task& task) {
+  Lock l(mtx);
+  task.run_again = false;
+  while (true) {
+    if (task.is_waiting) {
+      task.unlink();
+      task.is_waiting = false;
+    }
+    if (std::thread::id() == task.runner ||
+	std::this_thread::get_id() == task.runner) {
+      break;
+    }
+    done_cv.wait(l);
+  }
+}
+
+
+void crimson::WorkService::run() {
+  Lock l(mtx);
+  while (!finishing) {
+    if (waiting.empty()) {
+      cv.wait(l);
+      continue;
+    }
+
+    Task* task = static_cast<Task*>(waiting.next);
+    task->unlink();
+    task->is_waiting = false;
+    task->runner = std::this_thread::get_id();
+
+    l.unlock();
+    task->body();
+    l.lock();
+
+    task->runner = std::thread::id();
+    if (task->run_again) {
+      task->run_again = false;
+      task->is_waiting = true;
+      waiting.push_back(task);
+      cv.notify_one();
+    }
+    done_cv.notify_all();
+  }
+}
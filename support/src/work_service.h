@@ -0,0 +1,138 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <functional>
+
+
+namespace crimson {
+
+  /* A fixed set of worker threads shared by any number of users, for
+   * work that shouldn't hold up the thread that finds it, such as a
+   * timer body or a producer. A Task is posted to run its body once
+   * on one of the workers; posting a task that is already waiting
+   * does nothing, and posting one whose body is running makes it run
+   * again afterwards, so a task's body never runs on two workers at
+   * once. Tasks run in the order posted. global() returns a
+   * process-wide instance, so that many queues don't each need a
+   * thread of their own.
+   */
+  class WorkService {
+  public:
+
+    class Task;
+
+  protected:
+
+    using Lock  = std::unique_lock<std::mutex>;
+    using Guard = std::lock_guard<std::mutex>;
+
+    // circular, doubly linked list links; the list head is a Link
+    // that is not part of a Task
+    struct Link {
+      Link* prev;
+      Link* next;
+
+      Link() : prev(this), next(this) {}
+
+      bool empty() const { return next == this; }
+
+      void unlink() {
+	prev->next = next;
+	next->prev = prev;
+	prev = next = this;
+      }
+
+      void push_back(Link* l) {
+	l->prev = prev;
+	l->next = this;
+	prev->next = l;
+	prev = l;
+      }
+    };
+
+    std::mutex               mtx;
+    std::condition_variable  cv;      // wakes a worker
+    std::condition_variable  done_cv; // signalled after each body runs
+
+    Link                     waiting;
+    bool                     finishing = false;
+
+    // put threads last so all other variables are initialized first
+
+    std::vector<std::thread> workers;
+
+  public:
+
+    class Task : Link {
+      friend WorkService;
+
+      WorkService&          service;
+      std::function<void()> body;
+      bool                  is_waiting = false;
+      bool                  run_again = false;
+      std::thread::id       runner; // worker running body, if any
+
+    public:
+
+      Task(WorkService& _service, std::function<void()> _body) :
+	service(_service),
+	body(_body)
+      {
+	// empty
+      }
+
+      Task(const Task&) = delete;
+      Task& operator=(const Task&) = delete;
+
+      // withdraws the task and waits for a running body to finish
+      ~Task() {
+	cancel_sync();
+      }
+
+      // makes sure body runs, on a worker, after this call
+      void post() {
+	service.post(*this);
+      }
+
+      // withdraws the task if it's waiting and, unless called from
+      // the body itself, waits until body is not running
+      void cancel_sync() {
+	service.cancel_sync(*this);
+      }
+    }; // class Task
+
+    explicit WorkService(uint worker_count = 4);
+
+    WorkService(const WorkService&) = delete;
+    WorkService& operator=(const WorkService&) = delete;
+
+    // tasks still waiting never run; all tasks must be destructed
+    // before the service
+    ~WorkService();
+
+    static WorkService& global();
+
+    uint get_worker_count() const {
+      return workers.size();
+    }
+
+  protected:
+
+    void post(Task& task);
+    void cancel_sync(Task& task);
+    void run();
+  }; // class WorkService
+
+} // namespace crimson
@@ -0,0 +1,299 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "calendar_heap.h"
+
+#include "gtest/gtest.h"
+
+
+namespace {
+
+struct CalKey {
+  double  value;
+  uint8_t rank;
+};
+
+
+struct CalElem {
+  double  time;
+  uint8_t rank;
+
+  crimson::IndIntruHeapData heap_data;
+
+  CalElem(double _time, uint8_t _rank = 0) : time(_time), rank(_rank) { }
+};
+
+
+struct CalElemKeyOf {
+  CalKey operator()(const CalElem& e) const {
+    return CalKey{e.time, e.rank};
+  }
+};
+
+
+struct CalKeyLess {
+  bool operator()(const CalKey& k1, const CalKey& k2) const {
+    if (k1.rank != k2.rank) {
+      return k1.rank < k2.rank;
+    } else {
+      return k1.value < k2.value;
+    }
+  }
+};
+
+
+using Calendar = crimson::CalendarHeap<CalElem*,
+				       CalElem,
+				       &CalElem::heap_data,
+				       CalElemKeyOf,
+				       CalKeyLess,
+				       2>;
+
+const double inf = std::numeric_limits<double>::infinity();
+
+} // namespace
+
+
+TEST(calendar_heap, push_pop) {
+  Calendar heap;
+  EXPECT_TRUE(heap.empty());
+
+  std::vector<std::unique_ptr<CalElem>> elems;
+  for (double t : { 2.0, 99.0, inf, 1.0, -5.0, 12.0, -inf, -12.0, 12.0 }) {
+    elems.emplace_back(new CalElem(t));
+    heap.push(elems.back().get());
+  }
+  EXPECT_EQ(9u, heap.size());
+
+  for (double t : { -inf, -12.0, -5.0, 1.0, 2.0, 12.0, 12.0, 99.0, inf }) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_EQ(t, heap.top().time);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+
+// rank comes before time, and changing either moves the element
+TEST(calendar_heap, ranks) {
+  Calendar heap;
+  CalElem a(10.0), b(20.0, 1), c(5.0, 1);
+  heap.push(&a);
+  heap.push(&b);
+  heap.push(&c);
+  EXPECT_EQ(&a, &heap.top());
+
+  a.rank = 1;
+  heap.demote(a);
+  EXPECT_EQ(&c, &heap.top());
+
+  b.rank = 0;
+  b.time = 1000.0;
+  heap.promote(b);
+  EXPECT_EQ(&b, &heap.top());
+
+  b.time = inf;
+  heap.adjust(b);
+  EXPECT_EQ(&b, &heap.top());
+
+  heap.remove(b);
+  EXPECT_EQ(&c, &heap.top());
+  c.time = 11.0;
+  heap.adjust(c);
+  EXPECT_EQ(&a, &heap.top());
+}
+
+
+// elements repeatedly move forward in time, as reservation and
+// limit tags do, along with some removals, re-additions, and elements
+// that share a time; the top is checked against a scan of every
+// element
+TEST(calendar_heap, hold) {
+  std::mt19937 prng(17);
+  std::vector<std::unique_ptr<CalElem>> elems;
+  std::vector<CalElem*> in_heap;
+  Calendar heap;
+
+  for (int i = 0; i < 500; ++i) {
+    elems.emplace_back(new CalElem(0 == i % 50 ? inf : prng() % 100,
+				   0 == i % 7 ? 1 : 0));
+    heap.push(elems.back().get());
+    in_heap.push_back(elems.back().get());
+  }
+
+  auto check = [&] () {
+    ASSERT_EQ(in_heap.size(), heap.size());
+    CalKeyLess less;
+    CalElemKeyOf key_of;
+    const CalElem* lowest =
+      *std::min_element(in_heap.begin(), in_heap.end(),
+			[&] (const CalElem* e1, const CalElem* e2) -> bool {
+			  return less(key_of(*e1), key_of(*e2));
+			});
+    EXPECT_EQ(lowest->rank, heap.top().rank);
+    EXPECT_EQ(lowest->time, heap.top().time);
+  };
+
+  for (int i = 0; i < 20000; ++i) {
+    uint op = prng() % 10;
+    if (op < 7) {
+      CalElem& e = heap.top();
+      e.time += 1 + prng() % 200;
+      heap.demote(e);
+    } else if (7 == op && in_heap.size() > 1) {
+      size_t k = prng() % in_heap.size();
+      heap.remove(*in_heap[k]);
+      in_heap.erase(in_heap.begin() + k);
+    } else if (8 == op) {
+      elems.emplace_back(new CalElem(heap.top().time, prng() % 2));
+      heap.push(elems.back().get());
+      in_heap.push_back(elems.back().get());
+    } else {
+      CalElem& e = *in_heap[prng() % in_heap.size()];
+      e.rank = prng() % 2;
+      e.time = heap.top().time + prng() % 1000;
+      heap.adjust(e);
+    }
+    check();
+  }
+}
+
+
+// elements change time and rank, and are re-bucketed all at once
+TEST(calendar_heap, update_all) {
+  std::mt19937 prng(29);
+  std::vector<std::unique_ptr<CalElem>> elems;
+  Calendar heap;
+  for (int i = 0; i < 400; ++i) {
+    elems.emplace_back(new CalElem(prng() % 100, prng() % 2));
+    heap.push(elems.back().get());
+  }
+
+  for (auto& e : elems) {
+    if (0 == prng() % 3) {
+      e->time = 0 == prng() % 20 ? inf : prng() % 1000;
+      e->rank = prng() % 2;
+    }
+  }
+  heap.update_all();
+  ASSERT_EQ(elems.size(), heap.size());
+
+  CalKeyLess less;
+  CalElemKeyOf key_of;
+  std::vector<CalElem*> expected;
+  for (auto& e : elems) {
+    expected.push_back(e.get());
+  }
+  std::stable_sort(expected.begin(), expected.end(),
+		   [&] (const CalElem* e1, const CalElem* e2) -> bool {
+		     return less(key_of(*e1), key_of(*e2));
+		   });
+  for (const CalElem* e : expected) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_EQ(e->rank, heap.top().rank);
+    EXPECT_EQ(e->time, heap.top().time);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+
+namespace {
+
+// integer nanosecond times, as with DMCLOCK_INTEGER_TIME, where the
+// highest and lowest values stand for unset tags
+struct IntKey {
+  int64_t value;
+  uint8_t rank;
+};
+
+
+struct IntElem {
+  int64_t time;
+
+  crimson::IndIntruHeapData heap_data;
+
+  IntElem(int64_t _time) : time(_time) { }
+};
+
+
+struct IntElemKeyOf {
+  IntKey operator()(const IntElem& e) const {
+    return IntKey{e.time, 0};
+  }
+};
+
+
+struct IntKeyLess {
+  bool operator()(const IntKey& k1, const IntKey& k2) const {
+    return k1.value < k2.value;
+  }
+};
+
+
+// exposes which bucket an element is in
+struct IntCalendar : public crimson::CalendarHeap<IntElem*,
+						  IntElem,
+						  &IntElem::heap_data,
+						  IntElemKeyOf,
+						  IntKeyLess> {
+  uint bucket(const IntElem& e) const {
+    return bucket_of(e.heap_data);
+  }
+};
+
+} // namespace
+
+
+// the limits of an integral key are kept out of the window, so when
+// they're most of the keys the finite ones are still spread over
+// buckets rather than all put in the first
+TEST(calendar_heap, integer_limits) {
+  const int64_t max = std::numeric_limits<int64_t>::max();
+  const int64_t lowest = std::numeric_limits<int64_t>::lowest();
+  const int64_t start = int64_t(1500000000) * 1000000000;
+
+  std::vector<std::unique_ptr<IntElem>> elems;
+  IntCalendar heap;
+  for (int i = 0; i < 600; ++i) {
+    elems.emplace_back(new IntElem(0 == i % 3 ? start + i * 1000000 : max));
+    heap.push(elems.back().get());
+  }
+  elems.emplace_back(new IntElem(lowest));
+  heap.push(elems.back().get());
+
+  EXPECT_EQ(lowest, heap.top().time);
+  heap.pop();
+
+  std::vector<uint> buckets;
+  for (auto& e : elems) {
+    if (max != e->time && lowest != e->time) {
+      buckets.push_back(heap.bucket(*e));
+    }
+  }
+  std::sort(buckets.begin(), buckets.end());
+  EXPECT_GT(std::unique(buckets.begin(), buckets.end()) - buckets.begin(), 10)
+    << "finite keys should be spread over the window";
+
+  int64_t prev = lowest;
+  for (size_t i = 1; i < elems.size(); ++i) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_LE(prev, heap.top().time);
+    prev = heap.top().time;
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+  EXPECT_EQ(max, prev);
+}
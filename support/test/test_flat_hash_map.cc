@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <map>
+#include <memory>
+#include <string>
+#include <random>
+#include <iostream>
+
+#include "flat_hash_map.h"
+
+#include "gtest/gtest.h"
+
+
+struct NotHashable {
+  int v;
+  bool operator<(const NotHashable& other) const { return v < other.v; }
+};
+
+
+TEST(flat_hash_map, hashable_trait) {
+  EXPECT_TRUE(crimson::is_std_hashable<int>::value);
+  EXPECT_TRUE(crimson::is_std_hashable<std::string>::value);
+  EXPECT_FALSE(crimson::is_std_hashable<NotHashable>::value);
+}
+
+
+TEST(flat_hash_map, insert_find) {
+  crimson::FlatHashMap<int,int> map;
+
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.end(), map.find(3));
+
+  for (int i = 0; i < 1000; ++i) {
+    auto r = map.emplace(i, i * 10);
+    EXPECT_TRUE(r.second);
+    EXPECT_EQ(i, r.first->first);
+    EXPECT_EQ(i * 10, r.first->second);
+  }
+
+  EXPECT_EQ(1000u, map.size());
+  EXPECT_LE(1000u, map.bucket_count());
+
+  // emplacing an existing key leaves the value alone
+  auto r = map.emplace(7, -1);
+  EXPECT_FALSE(r.second);
+  EXPECT_EQ(70, r.first->second);
+
+  for (int i = 0; i < 1000; ++i) {
+    auto it = map.find(i);
+    ASSERT_NE(map.end(), it);
+    EXPECT_EQ(i * 10, it->second);
+    EXPECT_EQ(i * 10, map.at(i));
+  }
+  EXPECT_EQ(map.end(), map.find(1000));
+  EXPECT_THROW(map.at(1000), std::out_of_range);
+
+  map[1000] = 5;
+  EXPECT_EQ(5, map.at(1000));
+  EXPECT_EQ(1001u, map.size());
+}
+
+
+TEST(flat_hash_map, iterators) {
+  using Map = crimson::FlatHashMap<int,int>;
+  static_assert(std::is_convertible<Map::iterator,
+				    Map::const_iterator>::value,
+		"iterator converts to const_iterator");
+  static_assert(!std::is_convertible<Map::const_iterator,
+				     Map::iterator>::value,
+		"const_iterator does not convert to iterator");
+
+  Map map;
+  map.emplace(1, 10);
+  map.emplace(2, 20);
+
+  Map::iterator it = map.find(1);
+  Map::iterator copy(it);
+  it = map.find(2);
+  EXPECT_EQ(10, copy->second);
+  EXPECT_EQ(20, it->second);
+
+  Map::const_iterator cit = it;
+  EXPECT_EQ(20, cit->second);
+  cit = copy;
+  EXPECT_EQ(10, cit->second);
+  cit = map.cend();
+  EXPECT_EQ(map.cend(), cit);
+}
+
+
+TEST(flat_hash_map, erase) {
+  crimson::FlatHashMap<int,std::string> map;
+
+  for (int i = 0; i < 200; ++i) {
+    map.emplace(i, std::to_string(i));
+  }
+
+  for (int i = 0; i < 200; i += 2) {
+    EXPECT_EQ(1u, map.erase(i));
+  }
+  EXPECT_EQ(0u, map.erase(0));
+  EXPECT_EQ(100u, map.size());
+
+  for (int i = 0; i < 200; ++i) {
+    if (i % 2) {
+      EXPECT_EQ(std::to_string(i), map.at(i));
+    } else {
+      EXPECT_EQ(map.end(), map.find(i));
+    }
+  }
+
+  // erased slots can be reused
+  for (int i = 0; i < 200; i += 2) {
+    EXPECT_TRUE(map.emplace(i, "again").second);
+  }
+  EXPECT_EQ(200u, map.size());
+  EXPECT_EQ("again", map.at(10));
+  EXPECT_EQ("11", map.at(11));
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.begin(), map.end());
+}
+
+
+TEST(flat_hash_map, erase_while_iterating) {
+  crimson::FlatHashMap<int,int> map;
+
+  for (int i = 0; i < 500; ++i) {
+    map.emplace(i, i);
+  }
+
+  int visited = 0;
+  for (auto i = map.begin(); i != map.end(); /* empty */) {
+    ++visited;
+    if (i->first % 3 == 0) {
+      i = map.erase(i);
+    } else {
+      ++i;
+    }
+  }
+
+  EXPECT_EQ(500, visited);
+  EXPECT_EQ(333u, map.size());
+
+  int sum = 0;
+  for (const auto& p : map) {
+    EXPECT_NE(0, p.first % 3);
+    sum += p.second;
+  }
+  EXPECT_EQ(124750 - 41583, sum);
+}
+
+
+TEST(flat_hash_map, matches_std_map) {
+  crimson::FlatHashMap<uint32_t,std::unique_ptr<int>> map;
+  std::map<uint32_t,int> reference;
+
+  std::mt19937 gen(17);
+  std::uniform_int_distribution<uint32_t> key_dist(0, 2000);
+
+  // a long mix of inserts and erases builds up tombstones and
+  // forces rehashes at the same capacity
+  for (int i = 0; i < 100000; ++i) {
+    uint32_t key = key_dist(gen);
+    if (gen() % 2) {
+      bool inserted =
+	map.emplace(key, std::unique_ptr<int>(new int(i))).second;
+      EXPECT_EQ(reference.emplace(key, i).second, inserted);
+    } else {
+      EXPECT_EQ(reference.erase(key), map.erase(key));
+    }
+  }
+
+  EXPECT_EQ(reference.size(), map.size());
+  for (const auto& p : reference) {
+    auto it = map.find(p.first);
+    ASSERT_NE(map.end(), it);
+    EXPECT_EQ(p.second, *it->second);
+  }
+
+  size_t count = 0;
+  for (auto it = map.cbegin(); it != map.cend(); ++it) {
+    EXPECT_EQ(1u, reference.count(it->first));
+    ++count;
+  }
+  EXPECT_EQ(reference.size(), count);
+}
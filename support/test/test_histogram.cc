@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <random>
+
+#include "histogram.h"
+
+#include "gtest/gtest.h"
+
+
+using Histogram = crimson::Histogram;
+
+
+TEST(histogram, buckets) {
+  // small values are exact
+  for (uint64_t v = 0; v < Histogram::sub_bucket_count; ++v) {
+    EXPECT_EQ(v, Histogram::bucket_of(v));
+    EXPECT_EQ(v, Histogram::bucket_low(v));
+    EXPECT_EQ(v, Histogram::bucket_high(v));
+  }
+
+  // buckets are contiguous and cover every value
+  for (uint b = 0; b + 1 < Histogram::bucket_count; ++b) {
+    EXPECT_EQ(Histogram::bucket_high(b) + 1, Histogram::bucket_low(b + 1));
+  }
+  EXPECT_EQ(Histogram::bucket_count - 1, Histogram::bucket_of(~uint64_t(0)));
+
+  std::mt19937_64 prng(5);
+  for (int i = 0; i < 10000; ++i) {
+    uint64_t v = prng() >> (prng() % 64);
+    uint b = Histogram::bucket_of(v);
+    EXPECT_LE(Histogram::bucket_low(b), v);
+    EXPECT_GE(Histogram::bucket_high(b), v);
+    // bucket width is at most 1/8 of its low end
+    EXPECT_LE(Histogram::bucket_high(b) - Histogram::bucket_low(b),
+	      std::max(uint64_t(1), Histogram::bucket_low(b) / 8));
+  }
+}
+
+
+TEST(histogram, percentiles) {
+  Histogram h;
+  EXPECT_EQ(0u, h.get_percentile(50));
+
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    h.record(v);
+  }
+  EXPECT_EQ(1000u, h.get_count());
+  EXPECT_EQ(500500u, h.get_sum());
+  EXPECT_EQ(1u, h.get_low());
+  EXPECT_EQ(1000u, h.get_high());
+  EXPECT_DOUBLE_EQ(500.5, h.get_mean());
+
+  uint64_t p50 = h.get_percentile(50);
+  EXPECT_GE(p50, 500u);
+  EXPECT_LE(p50, 500u + 500u / 8);
+  uint64_t p99 = h.get_percentile(99);
+  EXPECT_GE(p99, 990u);
+  EXPECT_LE(p99, 1000u);
+  EXPECT_EQ(1000u, h.get_percentile(100));
+  EXPECT_EQ(1u, h.get_percentile(0));
+}
+
+
+TEST(histogram, merge) {
+  Histogram a;
+  Histogram b;
+  a.record(10, 3);
+  b.record(5000);
+  b.record(2);
+
+  a.merge(b);
+  EXPECT_EQ(5u, a.get_count());
+  EXPECT_EQ(30u + 5000u + 2u, a.get_sum());
+  EXPECT_EQ(2u, a.get_low());
+  EXPECT_EQ(5000u, a.get_high());
+  EXPECT_EQ(3u, a.get_bucket(Histogram::bucket_of(10)));
+
+  a.clear();
+  EXPECT_EQ(0u, a.get_count());
+  a.merge(b);
+  EXPECT_EQ(2u, a.get_low());
+}
+
+
+TEST(histogram, atomic) {
+  crimson::AtomicHistogram a;
+  Histogram h;
+  EXPECT_EQ(0u, a.snapshot().get_count());
+
+  for (uint64_t v : { 70u, 3u, 900u, 70u, 12345u }) {
+    a.record(v);
+    h.record(v);
+  }
+  a.record(5, 2);
+  h.record(5, 2);
+
+  Histogram s = a.snapshot();
+  EXPECT_EQ(h.get_count(), s.get_count());
+  EXPECT_EQ(h.get_sum(), s.get_sum());
+  EXPECT_EQ(3u, s.get_low());
+  EXPECT_EQ(12345u, s.get_high());
+  for (uint b = 0; b < Histogram::bucket_count; ++b) {
+    EXPECT_EQ(h.get_bucket(b), s.get_bucket(b));
+  }
+  EXPECT_EQ(h.get_percentile(50), s.get_percentile(50));
+
+  a.clear();
+  EXPECT_EQ(0u, a.snapshot().get_count());
+  a.record(8);
+  EXPECT_EQ(8u, a.snapshot().get_low());
+}
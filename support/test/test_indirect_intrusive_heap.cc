@@ -8,6 +8,8 @@
 #include <iostream>
 #include <memory>
 #include <set>
+#include <vector>
+#include <algorithm>
 
 #include "gtest/gtest.h"
 
@@ -883,6 +885,59 @@ TEST_F(HeapFixture1, iterator_remove) {
 }
 
 
+TEST_F(HeapFixture1, element_remove) {
+  // the top, then whichever element is stored last, then one in the
+  // middle
+  heap.remove(*data6);
+  EXPECT_EQ(6u, heap.size());
+
+  Elem* last = nullptr;
+  for (auto i = heap.begin(); i != heap.end(); ++i) {
+    last = &*i;
+  }
+  int last_data = last->data;
+  heap.remove(*last);
+  EXPECT_EQ(5u, heap.size());
+  for (auto i = heap.begin(); i != heap.end(); ++i) {
+    EXPECT_NE(last_data, i->data);
+  }
+
+  Elem& middle = last == data1.get() ? *data3 : *data1;
+  int middle_data = middle.data;
+  heap.remove(middle);
+  EXPECT_EQ(4u, heap.size());
+
+  std::vector<int> expected = { -7, -5, 1, 2, 12, 99 };
+  expected.erase(std::find(expected.begin(), expected.end(), last_data));
+  expected.erase(std::find(expected.begin(), expected.end(), middle_data));
+  for (int e : expected) {
+    EXPECT_EQ(e, heap.top().data);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+
+TEST_F(HeapFixture1, iterator_assign) {
+  auto it1 = heap.begin();
+  auto it2 = heap.end();
+  it2 = it1;
+  EXPECT_EQ(heap.begin(), it2);
+  EXPECT_EQ(7u, heap.size()) << "assigning iterators leaves heap alone";
+
+  const auto& c_heap = heap;
+  auto cit1 = c_heap.cbegin();
+  auto cit2 = c_heap.cend();
+  cit2 = cit1;
+  EXPECT_EQ(c_heap.cbegin(), cit2);
+
+  heap.remove(it1);
+  EXPECT_EQ(heap.end(), it1);
+  EXPECT_EQ(6u, heap.size());
+  EXPECT_EQ(-7, heap.top().data);
+}
+
+
 TEST_F(HeapFixture1, four_tops) {
   Elem& top1 = heap.top();
   EXPECT_EQ(-12, top1.data);
@@ -928,3 +983,37 @@ TEST_F(HeapFixture1, display_sorted) {
   std::cout << s << std::endl;
 #endif
 }
+
+
+TEST(IndIntruHeap, update_all) {
+  crimson::IndIntruHeap<std::shared_ptr<Elem>,
+			Elem,
+			&Elem::heap_data,
+			ElemCompare,
+			3> heap;
+
+  std::vector<std::shared_ptr<Elem>> elems;
+  for (int i = 0; i < 100; ++i) {
+    elems.push_back(std::make_shared<Elem>(i));
+    heap.push(elems.back());
+  }
+
+  // change every other element without telling the heap, then
+  // restore it all at once
+  for (int i = 0; i < 100; i += 2) {
+    elems[i]->data = 1000 - i;
+  }
+  heap.update_all();
+
+  std::vector<int> expected;
+  for (auto& e : elems) {
+    expected.push_back(e->data);
+  }
+  std::sort(expected.begin(), expected.end());
+  for (int d : expected) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_EQ(d, heap.top().data);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
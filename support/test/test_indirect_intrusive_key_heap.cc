@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <memory>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "indirect_intrusive_key_heap.h"
+
+#include "gtest/gtest.h"
+
+
+namespace {
+
+struct KeyElem {
+  int data;
+
+  crimson::IndIntruHeapData heap_data;
+
+  KeyElem(int _data) : data(_data) { }
+};
+
+
+struct KeyElemKeyOf {
+  int operator()(const KeyElem& e) const {
+    return e.data;
+  }
+};
+
+
+struct KeyLess {
+  bool operator()(const int k1, const int k2) const {
+    return k1 < k2;
+  }
+};
+
+
+template<uint K>
+using Heap = crimson::IndIntruKeyHeap<KeyElem*,
+				      KeyElem,
+				      &KeyElem::heap_data,
+				      KeyElemKeyOf,
+				      KeyLess,
+				      K>;
+
+} // namespace
+
+
+TEST(ind_intru_key_heap, push_pop) {
+  Heap<2> heap;
+  EXPECT_TRUE(heap.empty());
+
+  std::vector<std::unique_ptr<KeyElem>> elems;
+  for (int d : { 2, 99, 1, -5, 12, -12, -7 }) {
+    elems.emplace_back(new KeyElem(d));
+    heap.push(elems.back().get());
+  }
+  EXPECT_EQ(7u, heap.size());
+
+  for (int d : { -12, -7, -5, 1, 2, 12, 99 }) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_EQ(d, heap.top().data);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+
+// keys only change when the heap is told
+TEST(ind_intru_key_heap, adjust) {
+  Heap<3> heap;
+  KeyElem a(10), b(20), c(30);
+  heap.push(&a);
+  heap.push(&b);
+  heap.push(&c);
+
+  c.data = 5;
+  EXPECT_EQ(10, heap.top().data) << "key not yet refreshed";
+  heap.promote(c);
+  EXPECT_EQ(&c, &heap.top());
+
+  c.data = 25;
+  heap.demote(c);
+  EXPECT_EQ(&a, &heap.top());
+
+  a.data = 40;
+  heap.adjust(a);
+  EXPECT_EQ(&b, &heap.top());
+
+  b.data = 1;
+  heap.adjust(b);
+  EXPECT_EQ(&b, &heap.top());
+}
+
+
+TEST(ind_intru_key_heap, remove) {
+  Heap<2> heap;
+  std::vector<std::unique_ptr<KeyElem>> elems;
+  for (int d : { 0, 10, 100, 20, 30, 200, 300, 40 }) {
+    elems.emplace_back(new KeyElem(d));
+    heap.push(elems.back().get());
+  }
+
+  // 40 moves into the removed 200's place and has to go up
+  heap.remove(*elems[5]);
+  // the top
+  heap.remove(*elems[0]);
+  heap.remove(*elems[7]);
+
+  for (int d : { 10, 20, 30, 100, 300 }) {
+    EXPECT_EQ(d, heap.top().data);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+
+TEST(ind_intru_key_heap, random) {
+  std::mt19937 prng(11);
+  std::vector<std::unique_ptr<KeyElem>> elems;
+  Heap<4> heap;
+  for (int i = 0; i < 1000; ++i) {
+    elems.emplace_back(new KeyElem(prng() % 10000));
+    heap.push(elems.back().get());
+  }
+
+  // change half of the keys, and remove a quarter of the elements
+  for (int i = 0; i < 500; ++i) {
+    KeyElem& e = *elems[prng() % elems.size()];
+    e.data = prng() % 10000;
+    heap.adjust(e);
+  }
+  for (int i = 0; i < 250; ++i) {
+    size_t k = prng() % elems.size();
+    heap.remove(*elems[k]);
+    elems.erase(elems.begin() + k);
+  }
+
+  std::vector<int> expected;
+  for (auto& e : elems) {
+    expected.push_back(e->data);
+  }
+  std::sort(expected.begin(), expected.end());
+
+  uint count = 0;
+  for (auto i = heap.cbegin(); i != heap.cend(); ++i) {
+    ++count;
+  }
+  EXPECT_EQ(expected.size(), count);
+
+  for (int d : expected) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_EQ(d, heap.top().data);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+
+// keys are retaken for every element at once
+TEST(ind_intru_key_heap, update_all) {
+  std::mt19937 prng(19);
+  std::vector<std::unique_ptr<KeyElem>> elems;
+  Heap<2> heap;
+  heap.update_all();
+  for (int i = 0; i < 500; ++i) {
+    elems.emplace_back(new KeyElem(prng() % 10000));
+    heap.push(elems.back().get());
+  }
+
+  for (auto& e : elems) {
+    if (0 == prng() % 3) {
+      e->data = prng() % 10000;
+    }
+  }
+  heap.update_all();
+
+  std::vector<int> expected;
+  for (auto& e : elems) {
+    expected.push_back(e->data);
+  }
+  std::sort(expected.begin(), expected.end());
+  for (int d : expected) {
+    ASSERT_FALSE(heap.empty());
+    EXPECT_EQ(d, heap.top().data);
+    heap.pop();
+  }
+}
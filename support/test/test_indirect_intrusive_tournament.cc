@@ -0,0 +1,168 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <memory>
+#include <random>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include "indirect_intrusive_tournament.h"
+
+#include "gtest/gtest.h"
+
+
+namespace {
+
+struct TourElem {
+  int a;
+  int b;
+
+  crimson::IndIntruHeapData leaf;
+
+  TourElem(int _a, int _b) : a(_a), b(_b) { }
+};
+
+
+// orders elements by a, and separately by b
+struct TourElemKeysOf {
+  std::array<int,2> operator()(const TourElem& e) const {
+    return std::array<int,2>{{ e.a, e.b }};
+  }
+};
+
+
+struct KeyLess {
+  bool operator()(const int k1, const int k2) const {
+    return k1 < k2;
+  }
+};
+
+
+using Tournament = crimson::IndIntruTournament<TourElem*,
+					       TourElem,
+					       &TourElem::leaf,
+					       TourElemKeysOf,
+					       KeyLess,
+					       2>;
+
+} // namespace
+
+
+TEST(ind_intru_tournament, two_orderings) {
+  Tournament tree;
+  EXPECT_TRUE(tree.empty());
+
+  TourElem e1(1, 30), e2(2, 20), e3(3, 10);
+  tree.push(&e1);
+  tree.push(&e2);
+  tree.push(&e3);
+  EXPECT_EQ(3u, tree.size());
+  EXPECT_EQ(&e1, &tree.top(0));
+  EXPECT_EQ(&e3, &tree.top(1));
+
+  // one update reorders both
+  e1.a = 5;
+  e1.b = 5;
+  tree.update(e1);
+  EXPECT_EQ(&e2, &tree.top(0));
+  EXPECT_EQ(&e1, &tree.top(1));
+
+  tree.remove(e2);
+  EXPECT_EQ(2u, tree.size());
+  EXPECT_EQ(&e3, &tree.top(0));
+  EXPECT_EQ(&e1, &tree.top(1));
+
+  // the freed leaf is reused
+  TourElem e4(0, 0);
+  tree.push(&e4);
+  EXPECT_EQ(e2.leaf, e4.leaf);
+  EXPECT_EQ(&e4, &tree.top(0));
+  EXPECT_EQ(&e4, &tree.top(1));
+
+  tree.remove(e4);
+  tree.remove(e3);
+  tree.remove(e1);
+  EXPECT_TRUE(tree.empty());
+}
+
+
+// checks tops against a scan of every element as elements are
+// added, changed, and removed, with the tree growing as it goes
+TEST(ind_intru_tournament, random) {
+  std::mt19937 prng(13);
+  std::vector<std::unique_ptr<TourElem>> elems;
+  Tournament tree;
+
+  auto check = [&] () {
+    ASSERT_EQ(elems.size(), tree.size());
+    if (elems.empty()) return;
+    int min_a = elems[0]->a;
+    int min_b = elems[0]->b;
+    for (auto& e : elems) {
+      min_a = std::min(min_a, e->a);
+      min_b = std::min(min_b, e->b);
+    }
+    EXPECT_EQ(min_a, tree.top(0).a);
+    EXPECT_EQ(min_b, tree.top(1).b);
+  };
+
+  for (int i = 0; i < 5000; ++i) {
+    uint op = prng() % 5;
+    if (op < 2 || elems.size() < 2) {
+      elems.emplace_back(new TourElem(prng() % 1000, prng() % 1000));
+      tree.push(elems.back().get());
+    } else if (2 == op) {
+      size_t k = prng() % elems.size();
+      tree.remove(*elems[k]);
+      elems.erase(elems.begin() + k);
+    } else {
+      TourElem& e = *elems[prng() % elems.size()];
+      e.a = prng() % 1000;
+      e.b = prng() % 1000;
+      tree.update(e);
+    }
+    check();
+  }
+}
+
+
+// many elements change and the tree is replayed once
+TEST(ind_intru_tournament, update_all) {
+  std::mt19937 prng(23);
+  std::vector<std::unique_ptr<TourElem>> elems;
+  Tournament tree;
+  for (int i = 0; i < 300; ++i) {
+    elems.emplace_back(new TourElem(prng() % 1000, prng() % 1000));
+    tree.push(elems.back().get());
+  }
+  // leave some leaves free
+  for (int i = 0; i < 50; ++i) {
+    tree.remove(*elems.back());
+    elems.pop_back();
+  }
+
+  for (int round = 0; round < 10; ++round) {
+    for (auto& e : elems) {
+      if (0 == prng() % 4) {
+	e->a = prng() % 1000;
+	e->b = prng() % 1000;
+      }
+    }
+    tree.update_all();
+
+    int min_a = elems[0]->a;
+    int min_b = elems[0]->b;
+    for (auto& e : elems) {
+      min_a = std::min(min_a, e->a);
+      min_b = std::min(min_b, e->b);
+    }
+    EXPECT_EQ(min_a, tree.top(0).a);
+    EXPECT_EQ(min_b, tree.top(1).b);
+  }
+}
@@ -0,0 +1,80 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <utility>
+
+#include "mpsc_queue.h"
+
+#include "gtest/gtest.h"
+
+
+TEST(mpsc_queue, fifo) {
+  crimson::MpscQueue<std::unique_ptr<int>> queue;
+
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.push(new int(0)));
+  EXPECT_FALSE(queue.push(new int(1)));
+  EXPECT_FALSE(queue.push(new int(2)));
+  EXPECT_FALSE(queue.empty());
+
+  std::vector<int> drained;
+  EXPECT_EQ(3u, queue.drain([&] (std::unique_ptr<int>& i) {
+	drained.push_back(*i);
+      }));
+  EXPECT_EQ(std::vector<int>({0, 1, 2}), drained);
+  EXPECT_TRUE(queue.empty());
+
+  // pushing onto a drained queue reports it was empty again
+  EXPECT_TRUE(queue.push(new int(3)));
+  EXPECT_EQ(1u, queue.drain([] (std::unique_ptr<int>&) {}));
+  EXPECT_EQ(0u, queue.drain([] (std::unique_ptr<int>&) {}));
+
+  // elements left in the queue are destroyed with it
+  queue.push(new int(4));
+}
+
+
+TEST(mpsc_queue, multiple_producers) {
+  using Item = std::pair<int,int>; // producer, sequence number
+  crimson::MpscQueue<Item> queue;
+
+  const int producer_count = 4;
+  const int per_producer = 20000;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < producer_count; ++p) {
+    producers.emplace_back([&queue, p] () {
+	for (int i = 0; i < per_producer; ++i) {
+	  queue.push(p, i);
+	}
+      });
+  }
+
+  // each producer's elements must come out in the order it pushed
+  // them, while draining concurrently with the pushes
+  std::vector<int> next(producer_count, 0);
+  int total = 0;
+  while (total < producer_count * per_producer) {
+    total += queue.drain([&] (Item& item) {
+	EXPECT_EQ(next[item.first], item.second);
+	next[item.first] = item.second + 1;
+      });
+  }
+
+  for (auto& t : producers) {
+    t.join();
+  }
+
+  EXPECT_TRUE(queue.empty());
+  for (int p = 0; p < producer_count; ++p) {
+    EXPECT_EQ(per_producer, next[p]);
+  }
+}
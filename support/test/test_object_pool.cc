@@ -0,0 +1,120 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <set>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "object_pool.h"
+
+#include "gtest/gtest.h"
+
+
+struct Counted {
+  static int instances;
+
+  std::string name;
+  int value;
+
+  Counted(const std::string& _name, int _value) :
+    name(_name),
+    value(_value)
+  {
+    if (_value < 0) throw std::invalid_argument("negative value");
+    ++instances;
+  }
+
+  ~Counted() {
+    --instances;
+  }
+};
+
+int Counted::instances = 0;
+
+
+TEST(object_pool, create_destroy) {
+  crimson::ObjectPool<Counted,8> pool;
+
+  EXPECT_EQ(0u, pool.size());
+  EXPECT_EQ(0u, pool.capacity());
+
+  std::vector<Counted*> items;
+  for (int i = 0; i < 20; ++i) {
+    items.push_back(pool.create(std::to_string(i), i));
+  }
+
+  EXPECT_EQ(20, Counted::instances);
+  EXPECT_EQ(20u, pool.size());
+  EXPECT_EQ(24u, pool.capacity());
+
+  std::set<Counted*> distinct(items.begin(), items.end());
+  EXPECT_EQ(20u, distinct.size());
+
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(std::to_string(i), items[i]->name);
+    EXPECT_EQ(i, items[i]->value);
+  }
+
+  for (auto c : items) {
+    pool.destroy(c);
+  }
+
+  EXPECT_EQ(0, Counted::instances);
+  EXPECT_EQ(0u, pool.size());
+}
+
+
+TEST(object_pool, reuse) {
+  crimson::ObjectPool<Counted,4> pool;
+
+  Counted* a = pool.create("a", 1);
+  Counted* b = pool.create("b", 2);
+  pool.destroy(a);
+
+  // the most recently freed slot is handed out first
+  Counted* c = pool.create("c", 3);
+  EXPECT_EQ(a, c);
+  EXPECT_EQ("c", c->name);
+
+  // churning through many objects never grows the pool past its
+  // high-water mark
+  for (int i = 0; i < 1000; ++i) {
+    Counted* d = pool.create("d", i);
+    Counted* e = pool.create("e", i);
+    pool.destroy(d);
+    pool.destroy(e);
+  }
+  EXPECT_EQ(4u, pool.capacity());
+
+  pool.destroy(b);
+  pool.destroy(c);
+  EXPECT_EQ(0, Counted::instances);
+}
+
+
+TEST(object_pool, constructor_throws) {
+  crimson::ObjectPool<Counted,4> pool;
+
+  Counted* a = pool.create("a", 1);
+  EXPECT_THROW(pool.create("bad", -1), std::invalid_argument);
+  EXPECT_EQ(1u, pool.size());
+
+  // the slot the failed construction would have used is not lost
+  std::vector<Counted*> items;
+  for (int i = 0; i < 3; ++i) {
+    items.push_back(pool.create("x", i));
+  }
+  EXPECT_EQ(4u, pool.capacity());
+
+  pool.destroy(a);
+  for (auto c : items) {
+    pool.destroy(c);
+  }
+  EXPECT_EQ(0, Counted::instances);
+}
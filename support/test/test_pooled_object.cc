@@ -0,0 +1,118 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "pooled_object.h"
+
+#include "gtest/gtest.h"
+
+
+struct Pooled : public crimson::PooledObject<Pooled,8,4> {
+  static std::atomic_int instances;
+
+  int value;
+
+  Pooled(int _value) : value(_value) {
+    ++instances;
+  }
+
+  virtual ~Pooled() {
+    --instances;
+  }
+};
+
+std::atomic_int Pooled::instances(0);
+
+
+struct BiggerPooled : public Pooled {
+  char extra[100];
+
+  BiggerPooled(int _value) : Pooled(_value) {
+    extra[0] = 'x';
+  }
+};
+
+
+TEST(pooled_object, reuse) {
+  Pooled* a = new Pooled(1);
+  delete a;
+
+  // the most recently freed object is handed out first
+  Pooled* b = new Pooled(2);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(2, b->value);
+
+  std::unique_ptr<Pooled> c(new Pooled(3));
+  EXPECT_NE(b, c.get());
+
+  delete b;
+  c.reset();
+  EXPECT_EQ(0, Pooled::instances);
+}
+
+
+TEST(pooled_object, derived) {
+  // a larger derived class cannot use the pool's slots
+  std::unique_ptr<Pooled> p(new BiggerPooled(4));
+  EXPECT_EQ(4, p->value);
+  EXPECT_EQ('x', static_cast<BiggerPooled*>(p.get())->extra[0]);
+  p.reset();
+  EXPECT_EQ(0, Pooled::instances);
+}
+
+
+TEST(pooled_object, many) {
+  // overflow the per-thread cache so batches go through the depot
+  std::vector<Pooled*> items;
+  for (int i = 0; i < 100; ++i) {
+    items.push_back(new Pooled(i));
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, items[i]->value);
+  }
+  for (auto p : items) {
+    delete p;
+  }
+  EXPECT_EQ(0, Pooled::instances);
+}
+
+
+TEST(pooled_object, producer_consumer) {
+  const int count = 20000;
+  std::vector<std::atomic<Pooled*>> slots(count);
+  for (auto& s : slots) {
+    s = nullptr;
+  }
+
+  // objects are created on one thread and deleted on another, so
+  // freed memory has to flow back through the depot
+  std::thread producer([&] () {
+      for (int i = 0; i < count; ++i) {
+	slots[i] = new Pooled(i);
+      }
+    });
+
+  std::thread consumer([&] () {
+      for (int i = 0; i < count; ++i) {
+	Pooled* p;
+	while (nullptr == (p = slots[i].load())) {
+	  std::this_thread::yield();
+	}
+	EXPECT_EQ(i, p->value);
+	delete p;
+      }
+    });
+
+  producer.join();
+  consumer.join();
+  EXPECT_EQ(0, Pooled::instances);
+}
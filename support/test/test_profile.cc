@@ -0,0 +1,151 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <sstream>
+
+#include "profile.h"
+
+#include "gtest/gtest.h"
+
+
+using Timer = crimson::ProfileTimer<std::chrono::microseconds>;
+using Combiner = crimson::ProfileCombiner<std::chrono::microseconds>;
+using Concurrent = crimson::ConcurrentProfile<std::chrono::microseconds>;
+using Scope = crimson::ProfileScope<std::chrono::microseconds>;
+
+
+TEST(profile, timer) {
+  Timer timer;
+  EXPECT_EQ(0u, timer.get_count());
+  EXPECT_TRUE(std::isnan(timer.get_mean()));
+
+  for (int i = 0; i < 3; ++i) {
+    timer.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    timer.stop();
+  }
+  EXPECT_EQ(3u, timer.get_count());
+  EXPECT_GE(timer.get_low(), 2000);
+  EXPECT_GE(timer.get_percentile(50), uint64_t(timer.get_low()));
+  EXPECT_LE(timer.get_percentile(50), uint64_t(timer.get_high()));
+  EXPECT_EQ(uint64_t(timer.get_high()), timer.get_percentile(100));
+  EXPECT_EQ(3u, timer.get_histogram().get_count());
+}
+
+
+TEST(profile, combine) {
+  Timer fast;
+  Timer slow;
+  for (int i = 0; i < 99; ++i) {
+    fast.start();
+    fast.stop();
+  }
+  slow.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  slow.stop();
+
+  Combiner combiner;
+  combiner.combine(fast);
+  combiner.combine(slow);
+  EXPECT_EQ(100u, combiner.get_count());
+  EXPECT_EQ(fast.get_sum() + slow.get_sum(), combiner.get_sum());
+  EXPECT_EQ(slow.get_high(), combiner.get_high());
+  EXPECT_EQ(fast.get_low(), combiner.get_low());
+  // the one slow duration is the tail
+  EXPECT_LT(combiner.get_percentile(99), 20000u);
+  EXPECT_GE(combiner.get_percentile(100), 20000u);
+  EXPECT_GT(combiner.get_std_dev(), 0.0);
+
+  // combiners combine too
+  Combiner total;
+  total.combine(combiner);
+  total.combine(fast);
+  EXPECT_EQ(199u, total.get_count());
+  EXPECT_EQ(combiner.get_high(), total.get_high());
+}
+
+
+TEST(profile, display) {
+  Combiner empty;
+  std::ostringstream json;
+  empty.display_json(json);
+  EXPECT_EQ("{\"count\":0}", json.str());
+
+  Timer timer;
+  timer.start();
+  timer.stop();
+  std::ostringstream text;
+  timer.display(text);
+  EXPECT_EQ(0u, text.str().find("count:1 mean:"));
+  EXPECT_NE(std::string::npos, text.str().find(" p99.9:"));
+
+  json.str("");
+  timer.display_json(json);
+  EXPECT_EQ(0u, json.str().find("{\"count\":1,\"mean\":"));
+  EXPECT_NE(std::string::npos, json.str().find(",\"p999\":"));
+  EXPECT_EQ('}', json.str().back());
+}
+
+
+TEST(profile, concurrent) {
+  Concurrent profile(true);
+  EXPECT_EQ(0u, profile.get().get_count());
+
+  const int thread_count = 8;
+  const int per_thread = 1000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&profile, t] () {
+	for (int i = 0; i < per_thread; ++i) {
+	  profile.record(std::chrono::microseconds(t));
+	}
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  Combiner combined = profile.get();
+  EXPECT_EQ(uint64_t(thread_count * per_thread), combined.get_count());
+  EXPECT_EQ(per_thread * (thread_count - 1) * thread_count / 2,
+	    combined.get_sum());
+  EXPECT_EQ(0, combined.get_low());
+  EXPECT_EQ(thread_count - 1, combined.get_high());
+
+  profile.clear();
+  EXPECT_EQ(0u, profile.get().get_count());
+}
+
+
+TEST(profile, scope) {
+  Concurrent profile(false);
+  EXPECT_FALSE(profile.is_enabled());
+  {
+    Scope s(profile);
+  }
+  EXPECT_EQ(0u, profile.get().get_count());
+
+  profile.set_enabled(true);
+  {
+    Scope s(profile);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  EXPECT_EQ(1u, profile.get().get_count());
+  EXPECT_GE(profile.get().get_low(), 2000);
+
+  // a scope that started disabled doesn't record
+  profile.set_enabled(false);
+  {
+    Scope s(profile);
+    profile.set_enabled(true);
+  }
+  EXPECT_EQ(1u, profile.get().get_count());
+}
@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "ring_buffer.h"
+
+#include "gtest/gtest.h"
+
+
+using IntRef = std::unique_ptr<int>;
+
+
+TEST(ring_buffer, inline_storage) {
+  crimson::RingBuffer<IntRef,3> ring;
+
+  EXPECT_TRUE(ring.empty());
+  EXPECT_TRUE(ring.is_inline());
+
+  for (int i = 0; i < 3; ++i) {
+    ring.emplace_back(new int(i));
+  }
+  EXPECT_TRUE(ring.is_inline());
+  EXPECT_EQ(3u, ring.size());
+
+  // wrap around the inline slots without growing
+  for (int i = 3; i < 20; ++i) {
+    EXPECT_EQ(i - 3, *ring.front());
+    ring.pop_front();
+    ring.emplace_back(new int(i));
+    EXPECT_EQ(i, *ring.back());
+    EXPECT_TRUE(ring.is_inline());
+  }
+
+  int expected = 17;
+  for (const auto& r : ring) {
+    EXPECT_EQ(expected++, *r);
+  }
+}
+
+
+TEST(ring_buffer, grow_and_shrink) {
+  crimson::RingBuffer<IntRef,2> ring;
+
+  ring.emplace_back(new int(0));
+  ring.emplace_back(new int(1));
+  ring.pop_front();
+
+  // the front is now in the second slot, so growing has to unwrap
+  for (int i = 2; i < 50; ++i) {
+    ring.emplace_back(new int(i));
+  }
+  EXPECT_FALSE(ring.is_inline());
+  EXPECT_EQ(49u, ring.size());
+
+  for (int i = 1; i < 50; ++i) {
+    EXPECT_EQ(i, *ring[i - 1]);
+  }
+
+  int expected = 49;
+  for (auto r = ring.rbegin(); r != ring.rend(); ++r) {
+    EXPECT_EQ(expected--, **r);
+  }
+
+  ring.shrink_to_fit();
+  EXPECT_FALSE(ring.is_inline()) << "elements do not fit inline yet";
+
+  while (ring.size() > 2) {
+    ring.pop_front();
+  }
+  ring.shrink_to_fit();
+  EXPECT_TRUE(ring.is_inline());
+  EXPECT_EQ(48, *ring.front());
+  EXPECT_EQ(49, *ring.back());
+
+  ring.clear();
+  EXPECT_TRUE(ring.empty());
+}
+
+
+TEST(ring_buffer, remove_if_forwards) {
+  crimson::RingBuffer<IntRef,4> ring;
+
+  for (int i = 0; i < 10; ++i) {
+    ring.emplace_back(new int(i));
+  }
+  ring.pop_front();
+  ring.pop_front();
+
+  std::vector<int> visited;
+  bool removed = ring.remove_if([&] (const IntRef& r) -> bool {
+      visited.push_back(*r);
+      return *r % 3 == 0;
+    });
+
+  EXPECT_TRUE(removed);
+  EXPECT_EQ(std::vector<int>({2, 3, 4, 5, 6, 7, 8, 9}), visited);
+
+  std::vector<int> remaining;
+  for (const auto& r : ring) {
+    remaining.push_back(*r);
+  }
+  EXPECT_EQ(std::vector<int>({2, 4, 5, 7, 8}), remaining);
+
+  EXPECT_FALSE(ring.remove_if([] (const IntRef& r) { return false; }));
+  EXPECT_EQ(5u, ring.size());
+}
+
+
+TEST(ring_buffer, remove_if_backwards) {
+  crimson::RingBuffer<IntRef,4> ring;
+
+  // start with a wrapped inline buffer
+  for (int i = 0; i < 3; ++i) {
+    ring.emplace_back(new int(i));
+  }
+  ring.pop_front();
+  ring.pop_front();
+  for (int i = 3; i < 6; ++i) {
+    ring.emplace_back(new int(i));
+  }
+  EXPECT_TRUE(ring.is_inline());
+
+  std::vector<int> visited;
+  bool removed = ring.remove_if([&] (const IntRef& r) -> bool {
+      visited.push_back(*r);
+      return *r == 3 || *r == 5;
+    },
+    true);
+
+  EXPECT_TRUE(removed);
+  EXPECT_EQ(std::vector<int>({5, 4, 3, 2}), visited);
+
+  ASSERT_EQ(2u, ring.size());
+  EXPECT_EQ(2, *ring.front());
+  EXPECT_EQ(4, *ring.back());
+
+  // the ring still works after compaction
+  ring.emplace_back(new int(6));
+  ring.emplace_back(new int(7));
+  ring.emplace_back(new int(8));
+  std::vector<int> remaining;
+  for (const auto& r : ring) {
+    remaining.push_back(*r);
+  }
+  EXPECT_EQ(std::vector<int>({2, 4, 6, 7, 8}), remaining);
+}
+
+
+TEST(ring_buffer, matches_deque) {
+  crimson::RingBuffer<IntRef,2> ring;
+  std::deque<int> reference;
+
+  std::mt19937 gen(5);
+  for (int i = 0; i < 20000; ++i) {
+    int op = gen() % 10;
+    if (op < 5) {
+      ring.emplace_back(new int(i));
+      reference.push_back(i);
+    } else if (op < 9) {
+      if (!reference.empty()) {
+	EXPECT_EQ(reference.front(), *ring.front());
+	ring.pop_front();
+	reference.pop_front();
+      }
+    } else {
+      int m = 2 + gen() % 5;
+      bool backwards = gen() % 2;
+      ring.remove_if([m] (const IntRef& r) { return *r % m == 0; },
+		     backwards);
+      for (auto j = reference.begin(); j != reference.end(); /* empty */) {
+	if (*j % m == 0) {
+	  j = reference.erase(j);
+	} else {
+	  ++j;
+	}
+      }
+      ring.shrink_to_fit();
+    }
+    ASSERT_EQ(reference.size(), ring.size());
+  }
+
+  for (size_t i = 0; i < reference.size(); ++i) {
+    EXPECT_EQ(reference[i], *ring[i]);
+  }
+}
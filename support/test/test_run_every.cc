@@ -0,0 +1,87 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "run_every.h"
+
+#include "gtest/gtest.h"
+
+
+namespace chrono = std::chrono;
+
+
+TEST(run_every, runs_repeatedly) {
+  std::atomic<int> run_count(0);
+  {
+    crimson::RunEvery job(chrono::milliseconds(10), [&] () { ++run_count; });
+    std::this_thread::sleep_for(chrono::milliseconds(200));
+  }
+  int count = run_count;
+
+  // each wait is 10 to 10.6 milliseconds
+  EXPECT_GE(count, 5);
+  EXPECT_LE(count, 20);
+
+  // no runs after destruction
+  std::this_thread::sleep_for(chrono::milliseconds(50));
+  EXPECT_EQ(count, run_count.load());
+}
+
+
+TEST(run_every, destructor_stops_immediately) {
+  std::atomic<int> run_count(0);
+  auto start = chrono::steady_clock::now();
+  {
+    crimson::RunEvery job(chrono::seconds(60), [&] () { ++run_count; });
+  }
+  EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(1));
+  EXPECT_EQ(0, run_count.load());
+}
+
+
+TEST(run_every, destructor_waits_for_body) {
+  std::atomic<bool> started(false);
+  std::atomic<bool> finished(false);
+  {
+    crimson::RunEvery job(chrono::milliseconds(1), [&] () {
+	started = true;
+	std::this_thread::sleep_for(chrono::milliseconds(50));
+	finished = true;
+      });
+    while (!started) {
+      std::this_thread::yield();
+    }
+  }
+  EXPECT_TRUE(finished.load());
+}
+
+
+TEST(run_every, shared_executor) {
+  crimson::TimerService executor(2);
+  const int job_count = 100;
+  std::vector<std::atomic<int>> run_counts(job_count);
+  std::vector<std::unique_ptr<crimson::RunEvery>> jobs;
+
+  for (int i = 0; i < job_count; ++i) {
+    run_counts[i] = 0;
+    jobs.emplace_back(new crimson::RunEvery(chrono::milliseconds(5),
+					    [&, i] () { ++run_counts[i]; },
+					    executor));
+  }
+  std::this_thread::sleep_for(chrono::milliseconds(100));
+  jobs.clear();
+
+  for (int i = 0; i < job_count; ++i) {
+    EXPECT_GT(run_counts[i].load(), 0) << "job " << i;
+  }
+}
@@ -0,0 +1,56 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+#include "stat_mutex.h"
+
+#include "gtest/gtest.h"
+
+
+TEST(stat_mutex, uncontended) {
+  crimson::StatMutex mtx(2);
+
+  for (int i = 0; i < 10; ++i) {
+    std::lock_guard<crimson::StatMutex> g(mtx);
+  }
+  EXPECT_TRUE(mtx.try_lock());
+  mtx.unlock();
+
+  crimson::StatMutex::Stats stats = mtx.stats();
+  EXPECT_EQ(11u, stats.locks);
+  EXPECT_EQ(0u, stats.contended);
+  EXPECT_EQ(0u, stats.wait.get_count());
+  // every other lock is timed
+  EXPECT_EQ(6u, stats.hold.get_count());
+}
+
+
+TEST(stat_mutex, contended) {
+  crimson::StatMutex mtx(1);
+
+  std::unique_lock<crimson::StatMutex> l(mtx);
+  EXPECT_FALSE(mtx.try_lock());
+
+  std::thread waiter([&mtx] () {
+      std::lock_guard<crimson::StatMutex> g(mtx);
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  l.unlock();
+  waiter.join();
+
+  crimson::StatMutex::Stats stats = mtx.stats();
+  EXPECT_EQ(2u, stats.locks);
+  EXPECT_EQ(1u, stats.contended);
+  ASSERT_EQ(1u, stats.wait.get_count());
+  EXPECT_GE(stats.wait.get_high(), 40u * 1000 * 1000);
+  ASSERT_EQ(2u, stats.hold.get_count());
+  EXPECT_GE(stats.hold.get_high(), 40u * 1000 * 1000);
+}
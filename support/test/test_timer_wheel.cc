@@ -0,0 +1,181 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "timer_wheel.h"
+
+#include "gtest/gtest.h"
+
+
+namespace chrono = std::chrono;
+using Clock = crimson::TimerWheel::Clock;
+using Timer = crimson::TimerWheel::Timer;
+
+
+TEST(timer_wheel, fires_in_order_not_early) {
+  crimson::TimerWheel wheel;
+
+  const int timer_count = 20;
+  std::mutex mtx;
+  std::vector<int> order;
+  std::vector<Clock::time_point> fired(timer_count);
+  std::vector<Clock::time_point> due(timer_count);
+  std::vector<std::unique_ptr<Timer>> timers;
+
+  auto start = Clock::now();
+  for (int i = 0; i < timer_count; ++i) {
+    // schedule out of order
+    int n = (i * 7) % timer_count;
+    due[n] = start + chrono::milliseconds(2 * (n + 1));
+    timers.emplace_back(new Timer(wheel, [&, n] () {
+	  std::lock_guard<std::mutex> l(mtx);
+	  fired[n] = Clock::now();
+	  order.push_back(n);
+	}));
+    timers.back()->schedule_by(due[n]);
+  }
+  EXPECT_EQ(size_t(timer_count), wheel.pending_count());
+
+  std::this_thread::sleep_for(chrono::milliseconds(2 * timer_count + 100));
+
+  std::lock_guard<std::mutex> l(mtx);
+  ASSERT_EQ(size_t(timer_count), order.size());
+  for (int i = 0; i < timer_count; ++i) {
+    EXPECT_EQ(i, order[i]);
+    EXPECT_GE(fired[i], due[i]) << "timer " << i << " fired early";
+  }
+  EXPECT_EQ(0u, wheel.pending_count());
+}
+
+
+TEST(timer_wheel, schedule_by_keeps_earliest) {
+  crimson::TimerWheel wheel;
+  std::atomic<int> fire_count(0);
+  Timer timer(wheel, [&] () { ++fire_count; });
+
+  auto start = Clock::now();
+  timer.schedule_by(start + chrono::seconds(10));
+  timer.schedule_by(start + chrono::milliseconds(5));
+  timer.schedule_by(start + chrono::seconds(5));
+  EXPECT_TRUE(timer.is_pending());
+
+  std::this_thread::sleep_for(chrono::milliseconds(100));
+  EXPECT_EQ(1, fire_count.load());
+  EXPECT_FALSE(timer.is_pending());
+}
+
+
+TEST(timer_wheel, cancel) {
+  crimson::TimerWheel wheel;
+  std::atomic<int> fire_count(0);
+  Timer timer(wheel, [&] () { ++fire_count; });
+
+  timer.schedule_by(Clock::now() + chrono::milliseconds(10));
+  EXPECT_TRUE(timer.cancel());
+  EXPECT_FALSE(timer.cancel());
+  EXPECT_EQ(0u, wheel.pending_count());
+
+  std::this_thread::sleep_for(chrono::milliseconds(50));
+  EXPECT_EQ(0, fire_count.load());
+
+  // a cancelled timer can be scheduled again
+  timer.schedule_by(Clock::now());
+  std::this_thread::sleep_for(chrono::milliseconds(50));
+  EXPECT_EQ(1, fire_count.load());
+}
+
+
+TEST(timer_wheel, cancel_sync_waits_for_body) {
+  crimson::TimerWheel wheel;
+  std::atomic<bool> started(false);
+  std::atomic<bool> finished(false);
+  Timer timer(wheel, [&] () {
+      started = true;
+      std::this_thread::sleep_for(chrono::milliseconds(50));
+      finished = true;
+    });
+
+  timer.schedule_by(Clock::now());
+  while (!started) {
+    std::this_thread::yield();
+  }
+  timer.cancel_sync();
+  EXPECT_TRUE(finished.load());
+}
+
+
+TEST(timer_wheel, body_reschedules) {
+  crimson::TimerWheel wheel;
+  std::atomic<int> fire_count(0);
+  std::unique_ptr<Timer> timer;
+  timer.reset(new Timer(wheel, [&] () {
+	if (++fire_count < 5) {
+	  timer->schedule_by(Clock::now() + chrono::milliseconds(1));
+	}
+      }));
+
+  timer->schedule_by(Clock::now());
+  std::this_thread::sleep_for(chrono::milliseconds(100));
+  EXPECT_EQ(5, fire_count.load());
+  timer.reset();
+}
+
+
+// with 1 microsecond ticks these timers start out in the higher
+// levels and reach level 0 by cascading
+TEST(timer_wheel, cascade) {
+  crimson::TimerWheel wheel(chrono::microseconds(1));
+
+  std::mutex mtx;
+  std::vector<Clock::time_point> fired(3);
+  std::vector<Clock::time_point> due(3);
+  std::vector<std::unique_ptr<Timer>> timers;
+
+  auto start = Clock::now();
+  due[0] = start + chrono::microseconds(5000);   // level 2
+  due[1] = start + chrono::microseconds(70000);  // level 2
+  due[2] = start + chrono::microseconds(300000); // level 3
+  for (int i = 0; i < 3; ++i) {
+    timers.emplace_back(new Timer(wheel, [&, i] () {
+	  std::lock_guard<std::mutex> l(mtx);
+	  fired[i] = Clock::now();
+	}));
+    timers.back()->schedule_by(due[i]);
+  }
+
+  std::this_thread::sleep_for(chrono::milliseconds(400));
+
+  std::lock_guard<std::mutex> l(mtx);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_GE(fired[i], due[i]) << "timer " << i;
+    EXPECT_LT(fired[i], due[i] + chrono::milliseconds(50)) << "timer " << i;
+  }
+}
+
+
+TEST(timer_wheel, service) {
+  crimson::TimerService service(3);
+  EXPECT_EQ(3u, service.get_wheel_count());
+
+  std::atomic<int> fire_count(0);
+  std::vector<std::unique_ptr<crimson::TimerService::Timer>> timers;
+  for (int i = 0; i < 10; ++i) {
+    timers.emplace_back(
+      new crimson::TimerService::Timer(service, [&] () { ++fire_count; }));
+    timers.back()->schedule_by(Clock::now() + chrono::milliseconds(i));
+  }
+
+  std::this_thread::sleep_for(chrono::milliseconds(100));
+  EXPECT_EQ(10, fire_count.load());
+}
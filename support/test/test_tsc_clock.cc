@@ -0,0 +1,55 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <chrono>
+#include <thread>
+
+#include "tsc_clock.h"
+
+#include "gtest/gtest.h"
+
+
+namespace chrono = std::chrono;
+using tsc_clock = crimson::tsc_clock;
+
+
+TEST(tsc_clock, advances) {
+  auto prev = tsc_clock::now();
+  const auto end = chrono::steady_clock::now() + chrono::milliseconds(30);
+  uint advanced = 0;
+  while (chrono::steady_clock::now() < end) {
+    auto t = tsc_clock::now();
+    ASSERT_LE(prev, t);
+    if (t > prev) ++advanced;
+    prev = t;
+  }
+  EXPECT_GT(advanced, 0u);
+}
+
+
+TEST(tsc_clock, tracks_steady_clock) {
+  // calibrates this thread
+  const auto end = chrono::steady_clock::now() + chrono::milliseconds(30);
+  while (chrono::steady_clock::now() < end) {
+    (void) tsc_clock::now();
+  }
+
+  auto start = tsc_clock::now();
+  auto steady_start = chrono::steady_clock::now();
+  std::this_thread::sleep_for(chrono::milliseconds(20));
+  auto elapsed = tsc_clock::now() - start;
+  auto steady_elapsed = chrono::steady_clock::now() - steady_start;
+
+  using us = chrono::microseconds;
+  EXPECT_NEAR(chrono::duration_cast<us>(steady_elapsed).count(),
+	      chrono::duration_cast<us>(elapsed).count(),
+	      1000);
+  EXPECT_NEAR(chrono::steady_clock::now().time_since_epoch().count(),
+	      tsc_clock::now_ns(),
+	      1000000);
+}
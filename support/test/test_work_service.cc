@@ -0,0 +1,196 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+#include "work_service.h"
+
+#include "gtest/gtest.h"
+
+
+namespace chrono = std::chrono;
+using Task = crimson::WorkService::Task;
+
+
+// a gate that tasks wait at until it's opened
+struct Gate {
+  std::mutex              mtx;
+  std::condition_variable cv;
+  bool                    open = false;
+  int                     waiters = 0;
+
+  void wait() {
+    std::unique_lock<std::mutex> l(mtx);
+    ++waiters;
+    cv.notify_all();
+    cv.wait(l, [this] { return open; });
+  }
+
+  bool wait_for_waiters(int count) {
+    std::unique_lock<std::mutex> l(mtx);
+    return cv.wait_for(l, chrono::seconds(10),
+		       [&] { return waiters >= count; });
+  }
+
+  void unlock() {
+    std::lock_guard<std::mutex> l(mtx);
+    open = true;
+    cv.notify_all();
+  }
+};
+
+
+TEST(work_service, runs_posted) {
+  crimson::WorkService service(2);
+  EXPECT_EQ(2u, service.get_worker_count());
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  int runs = 0;
+  Task task(service, [&] () {
+      std::lock_guard<std::mutex> l(mtx);
+      ++runs;
+      cv.notify_all();
+    });
+
+  task.post();
+  std::unique_lock<std::mutex> l(mtx);
+  EXPECT_TRUE(cv.wait_for(l, chrono::seconds(10), [&] { return runs > 0; }));
+  l.unlock();
+
+  task.cancel_sync();
+  EXPECT_EQ(1, runs);
+}
+
+
+TEST(work_service, post_while_waiting_or_running) {
+  crimson::WorkService service(1);
+
+  // holds the only worker so posts of task wait
+  Gate blocker_gate;
+  Task blocker(service, [&] () { blocker_gate.wait(); });
+  blocker.post();
+  ASSERT_TRUE(blocker_gate.wait_for_waiters(1));
+
+  Gate gate;
+  std::atomic<int> runs(0);
+  Task task(service, [&] () {
+      ++runs;
+      if (1 == runs) gate.wait();
+    });
+
+  // posts while waiting run the body once
+  task.post();
+  task.post();
+  task.post();
+  blocker_gate.unlock();
+  ASSERT_TRUE(gate.wait_for_waiters(1));
+
+  // posts while running run it once more, afterwards
+  task.post();
+  task.post();
+  EXPECT_EQ(1, runs.load());
+  gate.unlock();
+
+  blocker.cancel_sync();
+  for (int i = 0; i < 1000 && runs < 2; ++i) {
+    std::this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  task.cancel_sync();
+  EXPECT_EQ(2, runs.load());
+}
+
+
+TEST(work_service, never_concurrent) {
+  crimson::WorkService service(4);
+
+  std::atomic<int> running(0);
+  std::atomic<int> overlaps(0);
+  std::atomic<int> runs(0);
+  Task task(service, [&] () {
+      if (running.fetch_add(1) > 0) ++overlaps;
+      std::this_thread::sleep_for(chrono::microseconds(50));
+      --running;
+      ++runs;
+    });
+
+  // posts from several threads, some while the body is running
+  std::vector<std::thread> posters;
+  for (int t = 0; t < 4; ++t) {
+    posters.emplace_back([&task] () {
+	for (int i = 0; i < 200; ++i) {
+	  task.post();
+	  std::this_thread::sleep_for(chrono::microseconds(20));
+	}
+      });
+  }
+  for (auto& p : posters) {
+    p.join();
+  }
+  task.cancel_sync();
+  EXPECT_EQ(0, overlaps.load());
+  EXPECT_LE(2, runs.load());
+}
+
+
+TEST(work_service, blocked_task_leaves_others) {
+  crimson::WorkService service(2);
+
+  Gate gate;
+  Task blocked(service, [&] () { gate.wait(); });
+  blocked.post();
+  ASSERT_TRUE(gate.wait_for_waiters(1));
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool ran = false;
+  Task other(service, [&] () {
+      std::lock_guard<std::mutex> l(mtx);
+      ran = true;
+      cv.notify_all();
+    });
+  other.post();
+
+  {
+    std::unique_lock<std::mutex> l(mtx);
+    EXPECT_TRUE(cv.wait_for(l, chrono::seconds(10), [&] { return ran; }));
+  }
+  gate.unlock();
+}
+
+
+TEST(work_service, cancel_sync_waits_for_body) {
+  crimson::WorkService service(2);
+
+  Gate gate;
+  std::atomic<bool> finished(false);
+  Task task(service, [&] () {
+      gate.wait();
+      std::this_thread::sleep_for(chrono::milliseconds(20));
+      finished = true;
+    });
+  task.post();
+  ASSERT_TRUE(gate.wait_for_waiters(1));
+
+  std::thread opener([&] () { gate.unlock(); });
+  task.cancel_sync();
+  EXPECT_TRUE(finished.load());
+  opener.join();
+}
+
+
+TEST(work_service, global) {
+  crimson::WorkService& service = crimson::WorkService::global();
+  EXPECT_EQ(&service, &crimson::WorkService::global());
+  EXPECT_LT(1u, service.get_worker_count());
+}
@@ -0,0 +1,121 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#pragma once
+
+
+#include <vector>
+#include <iostream>
+
+#include "dmclock_server.h"
+
+
+/*
+ * Plays a recorded sequence of adds and pulls through a
+ * PullPriorityQueue and records what each pull returned. Times and
+ * costs are kept in seconds, so the same trace can be played by code
+ * built with and without DMCLOCK_INTEGER_TIME.
+ */
+
+
+namespace crimson {
+  namespace dmc_trace {
+
+    struct TraceClient {
+      double reservation;
+      double weight;
+      double limit;
+    };
+
+    struct TraceOp {
+      bool     pull;   // otherwise an add
+      uint     client; // for adds
+      double   time;
+      double   cost;
+    };
+
+    struct Trace {
+      std::vector<TraceClient> clients;
+      std::vector<TraceOp>     ops;
+      bool                     allow_limit_break;
+    };
+
+    // what a pull returned
+    struct Pulled {
+      crimson::dmclock::PhaseType phase;
+      int    type;   // 0 returning, 1 future, 2 none
+      uint   client; // when returning
+      double when;   // when future
+
+      bool operator==(const Pulled& other) const {
+	return type == other.type &&
+	  (0 != type || (client == other.client && phase == other.phase)) &&
+	  (1 != type || when == other.when);
+      }
+
+      friend std::ostream& operator<<(std::ostream& out, const Pulled& p) {
+	switch(p.type) {
+	case 0:
+	  return out << "{ client:" << p.client << " phase:" << p.phase << " }";
+	case 1:
+	  return out << "{ future:" << std::fixed << p.when << " }";
+	default:
+	  return out << "{ none }";
+	}
+      }
+    };
+
+    // plays trace with the Time of the including translation unit
+    std::vector<Pulled> play_double(const Trace& trace);
+    std::vector<Pulled> play_integer(const Trace& trace);
+
+
+    namespace {
+
+      struct TraceRequest {
+      };
+
+      std::vector<Pulled> play(const Trace& trace) {
+	namespace dmc = crimson::dmclock;
+	using Queue = dmc::PullPriorityQueue<uint,TraceRequest>;
+
+	std::vector<dmc::ClientInfo> infos;
+	for (const auto& c : trace.clients) {
+	  infos.emplace_back(c.reservation, c.weight, c.limit);
+	}
+	Queue pq([&] (uint c) -> dmc::ClientInfo { return infos[c]; },
+		 trace.allow_limit_break);
+	const dmc::ReqParams req_params(1, 1);
+
+	std::vector<Pulled> result;
+	for (const auto& op : trace.ops) {
+	  const dmc::Time time = dmc::seconds_to_time(op.time);
+	  if (!op.pull) {
+	    pq.add_request_time(TraceRequest{}, op.client, req_params,
+				time, op.cost);
+	    continue;
+	  }
+	  Queue::PullReq pr = pq.pull_request(time);
+	  Pulled p{dmc::PhaseType::reservation, 2, 0, 0.0};
+	  if (pr.is_retn()) {
+	    p.type = 0;
+	    p.client = pr.get_retn().client;
+	    p.phase = pr.get_retn().phase;
+	  } else if (pr.is_future()) {
+	    p.type = 1;
+	    p.when = dmc::time_to_seconds(pr.getTime());
+	  }
+	  result.push_back(p);
+	}
+	return result;
+      }
+
+    } // namespace
+
+  } // namespace dmc_trace
+} // namespace crimson
@@ -0,0 +1,128 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Built with DMCLOCK_INTEGER_TIME=1 and USE_CALENDAR_HEAPS=1. Its
+ * request type is its own, so the queues it instantiates aren't
+ * shared with the other integer time tests, which use heaps.
+ */
+
+
+#include <map>
+#include <mutex>
+
+#include "dmclock_server.h"
+#include "dmclock_util.h"
+#include "gtest/gtest.h"
+
+
+namespace dmc = crimson::dmclock;
+
+
+namespace {
+
+  struct CalendarRequest {
+    int data;
+  };
+
+} // namespace
+
+
+namespace crimson {
+  namespace dmclock {
+
+    // Unset reservation and limit tags are the integer limits, which
+    // the calendar queues must keep out of their windows; most clients
+    // have neither, so they're most of the keys. Ties among clients
+    // may be broken either way, so each pull is checked to come from a
+    // client at the top of its ordering, and no client may be left
+    // limited past its limit tag.
+    TEST(dmclock_integer_time, calendar_heaps) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,CalendarRequest>;
+      using Key = Queue::ClientKey;
+      const int client_count = 300;
+
+      auto client_info_f = [] (ClientId c) -> dmc::ClientInfo {
+	return dmc::ClientInfo(0 == c % 10 ? 1.0 + c * 0.01 : 0.0,
+			       1.0 + c * 0.013,
+			       0 == c % 15 ? 2.0 + c * 0.07 : 0.0);
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1, 1);
+
+      Queue::ClientKeyOf<&RequestTag::reservation,
+			 Queue::ReadyOption::ignore,
+			 false> resv_key_of;
+      Queue::ClientKeyOf<&RequestTag::proportion,
+			 Queue::ReadyOption::raises,
+			 true> ready_key_of;
+      Queue::ClientKeyOf<&RequestTag::limit,
+			 Queue::ReadyOption::lowers,
+			 false> limit_key_of;
+      Queue::ClientKeyCompare compare;
+      auto same_key = [&] (const Key& k1, const Key& k2) -> bool {
+	return !compare(k1, k2) && !compare(k2, k1);
+      };
+
+      const Time start = dmc::seconds_to_time(1.5e9);
+      for (int round = 0; round < 4; ++round) {
+	for (ClientId c = 0; c < client_count; ++c) {
+	  const Time t = start + dmc::seconds_to_time(round + c * 1e-4);
+	  pq.add_request_time(CalendarRequest{c}, c, req_params, t);
+	}
+      }
+
+      Time now = start;
+      int reservation_count = 0;
+      int priority_count = 0;
+      while (!pq.empty()) {
+	// pulling promotes clients whose limits have passed first, so
+	// promote them before taking the keys
+	std::map<ClientId,Key> resv_keys;
+	std::map<ClientId,Key> ready_keys;
+	Key lowest_resv{TimeMax, 3};
+	Key lowest_ready{TimeMax, 3};
+	{
+	  std::lock_guard<decltype(pq.data_mtx)> g(pq.data_mtx);
+	  pq.do_promote_ready(now);
+	  for (auto& i : pq.client_map) {
+	    const Key resv = resv_key_of(*i.second);
+	    const Key ready = ready_key_of(*i.second);
+	    const Key limit = limit_key_of(*i.second);
+	    resv_keys[i.first] = resv;
+	    ready_keys[i.first] = ready;
+	    if (compare(resv, lowest_resv)) lowest_resv = resv;
+	    if (compare(ready, lowest_ready)) lowest_ready = ready;
+	    EXPECT_FALSE(0 == limit.rank && limit.value <= now) <<
+	      "client " << i.first << " still limited";
+	  }
+	}
+
+	Queue::PullReq pr = pq.pull_request(now);
+	if (pr.is_retn()) {
+	  const ClientId c = pr.get_retn().client;
+	  if (PhaseType::reservation == pr.get_retn().phase) {
+	    ++reservation_count;
+	    EXPECT_TRUE(same_key(lowest_resv, resv_keys[c]));
+	  } else {
+	    ++priority_count;
+	    EXPECT_TRUE(same_key(lowest_ready, ready_keys[c]));
+	  }
+	} else {
+	  now += dmc::seconds_to_time(0.01);
+	}
+      }
+      EXPECT_EQ(4 * client_count, reservation_count + priority_count);
+      EXPECT_GT(reservation_count, 0);
+      EXPECT_GT(priority_count, 0);
+    }
+
+  } // namespace dmclock
+} // namespace crimson
@@ -0,0 +1,60 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+/*
+ * Built with DMCLOCK_INTEGER_TIME=1; the tests comparing it with
+ * double time are in test_dmclock_time.cc.
+ */
+
+
+#include "dmclock_trace.h"
+#include "gtest/gtest.h"
+
+
+namespace dmc = crimson::dmclock;
+
+
+std::vector<crimson::dmc_trace::Pulled>
+crimson::dmc_trace::play_integer(const Trace& trace) {
+  return play(trace);
+}
+
+
+namespace crimson {
+  namespace dmclock {
+
+    TEST(dmclock_integer_time, integer_tags) {
+      static_assert(std::is_same<int64_t,dmc::Time>::value,
+		    "Time should be integer nanoseconds");
+
+      dmc::ClientInfo info(4.0, 3.0, 0.0);
+      EXPECT_EQ(250000000, info.reservation_inv);
+      EXPECT_EQ(333333333, info.weight_inv);
+      EXPECT_EQ(0, info.limit_inv);
+
+      // tags far along still advance by exactly the increment
+      const dmc::Time start = dmc::seconds_to_time(1.5e9);
+      dmc::RequestTag prev(start, start, start, start);
+      dmc::ReqParams req_params(1, 1);
+      for (int i = 0; i < 1000; ++i) {
+	prev = dmc::RequestTag(prev, info, req_params, start, 0.0);
+      }
+      EXPECT_EQ(start + 1000 * dmc::Time(250000000), prev.reservation);
+      EXPECT_EQ(start + 1000 * dmc::Time(333333333), prev.proportion);
+      EXPECT_EQ(dmc::min_tag, prev.limit);
+
+      // a cost is in seconds, and doesn't move an unset tag
+      dmc::ClientInfo no_resv(0.0, 1.0, 0.0);
+      dmc::RequestTag t1(prev, info, req_params, start, 0.5);
+      EXPECT_EQ(prev.reservation + 250000000 + 500000000, t1.reservation);
+      dmc::RequestTag t2(prev, no_resv, req_params, start, 0.5);
+      EXPECT_EQ(dmc::max_tag, t2.reservation);
+    }
+
+  } // namespace dmclock
+} // namespace crimson
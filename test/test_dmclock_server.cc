@@ -9,7 +9,14 @@
 #include <chrono>
 #include <iostream>
 #include <list>
+#include <string>
 #include <vector>
+#include <map>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 
 
 #include "dmclock_server.h"
@@ -31,8 +38,9 @@ namespace crimson {
     /*
      * Allows us to test the code provided with the mutex provided locked.
      */
-    static void test_locked(std::mutex& mtx, std::function<void()> code) {
-      std::unique_lock<std::mutex> l(mtx);
+    template<typename M>
+    static void test_locked(M& mtx, std::function<void()> code) {
+      std::unique_lock<M> l(mtx);
       code();
     }
 
@@ -164,6 +172,231 @@ namespace crimson {
     } // TEST
 
 
+    TEST(dmclock_server, client_clean_steps) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      // the cleaning job won't run during the test; the steps are
+      // run by hand instead
+      Queue pq(client_info_f,
+	       std::chrono::seconds(30),
+	       std::chrono::seconds(60),
+	       std::chrono::seconds(20),
+	       false,
+	       dmc::CleanBudget(4));
+
+      ReqParams req_params(1, 1);
+      auto add_and_pull = [&] (ClientId c) {
+	pq.add_request_time(Request{}, c, req_params, dmc::get_time());
+	Queue::PullReq pr = pq.pull_request();
+	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+      };
+
+      for (ClientId c = 1; c <= 10; ++c) {
+	add_and_pull(c);
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      test_locked(pq.data_mtx, [&] () {
+	  pq.start_clean(start);
+	  EXPECT_FALSE(pq.clean_step()) << "nothing to clean yet";
+	});
+
+      for (ClientId c = 11; c <= 15; ++c) {
+	add_and_pull(c);
+      }
+      EXPECT_EQ(15u, pq.client_count());
+
+      // clients 1 through 10 are now past the erase age; each step
+      // visits four clients, starting with the newest
+      test_locked(pq.data_mtx, [&] () {
+	  pq.start_clean(start + std::chrono::seconds(60));
+	  EXPECT_TRUE(pq.clean_step());
+	  EXPECT_EQ(15u, pq.client_map.size());
+	  EXPECT_TRUE(pq.clean_step());
+	  EXPECT_EQ(12u, pq.client_map.size());
+	  EXPECT_TRUE(pq.clean_step());
+	  EXPECT_EQ(8u, pq.client_map.size());
+	  EXPECT_FALSE(pq.clean_step());
+	  EXPECT_EQ(5u, pq.client_map.size());
+	  EXPECT_FALSE(pq.clean_step());
+	});
+      EXPECT_EQ(5u, pq.client_count());
+      EXPECT_EQ(4u, pq.clean_hold_histogram().get_count());
+
+      // remaining clients still work
+      for (ClientId c = 11; c <= 15; ++c) {
+	add_and_pull(c);
+      }
+      add_and_pull(1);
+      EXPECT_EQ(6u, pq.client_count());
+    } // TEST
+
+
+    TEST(dmclock_server, snapshot_during_clean) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f,
+	       std::chrono::seconds(30),
+	       std::chrono::seconds(60),
+	       std::chrono::seconds(20),
+	       false,
+	       dmc::CleanBudget(0));
+
+      ReqParams req_params(1, 1);
+      for (ClientId c = 1; c <= 10; ++c) {
+	pq.add_request_time(Request{}, c, req_params, dmc::get_time());
+      }
+      auto start = std::chrono::steady_clock::now();
+      test_locked(pq.data_mtx, [&] () { pq.start_clean(start); });
+      for (ClientId c = 11; c <= 15; ++c) {
+	pq.add_request_time(Request{}, c, req_params, dmc::get_time());
+      }
+
+      // a snapshot paused after client 9 (clients are listed newest
+      // first) has its cursor moved back when cleaning erases 9, to
+      // the link from 11, the last client before it that remains
+      test_locked(pq.data_mtx, [&] () {
+	  pq.snapshot_cursor = &pq.client_map.find(9)->second->clean_next;
+	  pq.start_clean(start + std::chrono::seconds(60));
+	  EXPECT_FALSE(pq.clean_step());
+	  EXPECT_EQ(5u, pq.client_map.size());
+	  EXPECT_EQ(&pq.client_map.find(11)->second->clean_next,
+		    pq.snapshot_cursor);
+	  EXPECT_EQ(nullptr, *pq.snapshot_cursor);
+	  pq.snapshot_cursor = nullptr;
+	});
+
+      EXPECT_EQ(5u, pq.snapshot(dmc::get_time(), 2).clients.size());
+      EXPECT_EQ(5u, pq.request_count());
+    } // TEST
+
+
+    TEST(dmclock_server, client_clean_piggyback) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f,
+	       std::chrono::milliseconds(20),
+	       std::chrono::milliseconds(40),
+	       std::chrono::milliseconds(10),
+	       false,
+	       dmc::CleanBudget(2, std::chrono::microseconds(0), true));
+
+      EXPECT_FALSE(bool(pq.cleaning_job)) << "no cleaning job when piggyback";
+
+      ReqParams req_params(1, 1);
+      auto add_and_pull = [&] (ClientId c) {
+	pq.add_request_time(Request{}, c, req_params, dmc::get_time());
+	Queue::PullReq pr = pq.pull_request();
+	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+      };
+
+      for (ClientId c = 1; c <= 5; ++c) {
+	add_and_pull(c);
+      }
+      EXPECT_EQ(5u, pq.client_count());
+
+      // keep one client busy; cleaning rides along its calls
+      auto deadline =
+	std::chrono::steady_clock::now() + std::chrono::seconds(5);
+      while (pq.client_count() > 1 &&
+	     std::chrono::steady_clock::now() < deadline) {
+	add_and_pull(100);
+	std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      EXPECT_EQ(1u, pq.client_count()) << "idle clients were erased";
+      EXPECT_GT(pq.clean_hold_histogram().get_count(), 0u);
+    } // TEST
+
+
+    TEST(dmclock_server, idle_client_prop_delta) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+      ClientId client3 = 44;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, false);
+
+      auto lock_pq = [&](std::function<void()> code) {
+	test_locked(pq.data_mtx, code);
+      };
+
+      Request req;
+      dmc::ReqParams req_params(1, 1);
+      auto now = dmc::get_time();
+
+      // the first client has nobody to align with
+      pq.add_request_time(req, client1, req_params, now);
+      pq.add_request_time(req, client1, req_params, now);
+
+      lock_pq([&] () {
+	  EXPECT_DOUBLE_EQ(now,
+			   pq.client_map.at(client1)->effective_prop_tag()) <<
+	    "first active client has no proportional delta";
+	});
+
+      // the second client becomes active later and is aligned with
+      // the lowest proportion tag of the active clients
+      pq.add_request_time(req, client2, req_params,
+			  now + dmc::seconds_to_time(5.0));
+
+      lock_pq([&] () {
+	  EXPECT_DOUBLE_EQ(now,
+			   pq.client_map.at(client2)->effective_prop_tag()) <<
+	    "later client is aligned to the lowest proportion tag";
+	  EXPECT_DOUBLE_EQ(now, pq.prop_heap.top().effective_prop_tag()) <<
+	    "prop heap has lowest proportion tag on top";
+	});
+
+      // once its requests are pulled, the first client competes with
+      // the tag of the last request it had
+      for (int i = 0; i < 3; ++i) {
+	Queue::PullReq pr = pq.pull_request(now + dmc::seconds_to_time(5.0));
+	EXPECT_TRUE(pr.is_retn());
+      }
+      EXPECT_EQ(0u, pq.request_count());
+
+      // the idle client being made active is not used as a minimum
+      lock_pq([&] () {
+	  pq.client_map.at(client2)->idle = true;
+	  pq.prop_heap.adjust(*pq.client_map.at(client2));
+	});
+
+      pq.add_request_time(req, client3, req_params,
+			  now + dmc::seconds_to_time(10.0));
+
+      lock_pq([&] () {
+	  EXPECT_DOUBLE_EQ(now + dmc::seconds_to_time(1.0),
+			   pq.client_map.at(client3)->effective_prop_tag()) <<
+	    "new client aligned to previous tag of first client";
+	});
+    } // TEST
+
+
 #if 0
     TEST(dmclock_server, reservation_timing) {
       using ClientId = int;
@@ -524,182 +757,917 @@ namespace crimson {
     } // TEST
 
 
-    TEST(dmclock_server_pull, pull_weight) {
-      using ClientId = int;
-      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
-      using QueueRef = std::unique_ptr<Queue>;
-
-      ClientId client1 = 17;
-      ClientId client2 = 98;
+    TEST(dmclock_server, cancel) {
+      struct MyReq {
+	int id;
 
-      dmc::ClientInfo info1(0.0, 1.0, 0.0);
-      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+	MyReq(int _id) :
+	  id(_id)
+	{
+	  // empty
+	}
+      }; // MyReq
 
-      QueueRef pq;
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,MyReq>;
 
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
       auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
-	if (client1 == c) return info1;
-	else if (client2 == c) return info2;
-	else {
-	  ADD_FAILURE() << "client info looked up for non-existant client";
-	  return info1;
-	}
+	return info;
       };
 
-      pq = QueueRef(new Queue(client_info_f, false));
-
-      Request req;
+      Queue pq(client_info_f, true);
       ReqParams req_params(1,1);
+      const Time now = dmc::get_time();
 
-      auto now = dmc::get_time();
+      // ids are ten times the cancel key plus a sequence number; key
+      // 0 is no key
+      auto add = [&] (ClientId c, int id) {
+	pq.add_request(Queue::RequestRef(new MyReq(id)), c, req_params,
+		       now, 0.0, id / 10);
+      };
+      add(1, 11);
+      add(1, 1);
+      add(1, 12);
+      add(2, 21);
+      add(2, 13);
+      add(3, 2);
+      EXPECT_EQ(6u, pq.request_count());
 
-      for (int i = 0; i < 5; ++i) {
-	pq->add_request(req, client1, req_params);
-	pq->add_request(req, client2, req_params);
-	now += 0.0001;
+      std::list<int> cancelled;
+      auto capture = [&cancelled] (const MyReq& r) {
+	cancelled.push_back(r.id);
+      };
+      EXPECT_EQ(3u, pq.cancel(1, capture));
+      cancelled.sort();
+      EXPECT_EQ((std::list<int>{11, 12, 13}), cancelled) <<
+	"only key 1's requests";
+      EXPECT_EQ(3u, pq.request_count());
+      EXPECT_EQ(0u, pq.cancel(1)) << "key 1 has nothing left";
+      EXPECT_EQ(0u, pq.cancel(dmc::no_cancel_key)) << "unkeyed stay";
+
+      // pulled and removed requests leave the index too
+      Queue::PullReq pr = pq.pull_request(now);
+      ASSERT_TRUE(pr.is_retn());
+      const int pulled = pr.get_retn().request->id;
+      pq.remove_by_client(3);
+      cancelled.clear();
+      const size_t expected = (21 == pulled) ? 0u : 1u;
+      EXPECT_EQ(expected, pq.cancel(2, capture));
+      EXPECT_EQ(expected, cancelled.size());
+
+      // what's left is still scheduled
+      while (pq.pull_request(now).is_retn()) {
+	// empty
       }
+      EXPECT_EQ(0u, pq.request_count());
+      EXPECT_TRUE(pq.empty());
+    } // TEST
 
-      int c1_count = 0;
-      int c2_count = 0;
-      for (int i = 0; i < 6; ++i) {
-	Queue::PullReq pr = pq->pull_request();
-	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
-	auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
 
-	if (client1 == retn.client) ++c1_count;
-	else if (client2 == retn.client) ++c2_count;
-	else ADD_FAILURE() << "got request from neither of two clients";
+#ifndef DO_NOT_DELAY_TAG_CALC
+    // Cancelling from one queue must leave it scheduling as a twin
+    // that never had the cancelled requests does, whether the
+    // orderings are adjusted client by client or rebuilt. Only holds
+    // when tags are calculated as requests reach the front.
+    template<dmc::SchedIndex S>
+    static void test_cancel_order(int cancelled_every) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request,2,S>;
+      const int client_count = 200;
 
-	EXPECT_EQ(PhaseType::priority, retn.phase);
+      auto client_info_f = [] (ClientId c) -> dmc::ClientInfo {
+	return dmc::ClientInfo(0 == c % 5 ? 1.0 + c * 0.01 : 0.0,
+			       1.0 + c * 0.013,
+			       0 == c % 7 ? 50.0 + c * 0.07 : 0.0);
+      };
+
+      Queue pq(client_info_f, true);
+      Queue twin(client_info_f, true);
+      ReqParams req_params(1, 1);
+      const Time now = dmc::get_time();
+
+      // the cancelled clients' first requests are all cancelled, so
+      // their second requests take over their tags
+      for (ClientId c = 0; c < client_count; ++c) {
+	const Time t = now + dmc::seconds_to_time(c * 1e-5);
+	const bool cancelled = 0 == c % cancelled_every;
+	for (int i = 0; i < 3; ++i) {
+	  const dmc::CancelKey key = cancelled && 0 == i ? 7 : 0;
+	  pq.add_request(typename Queue::RequestRef(new Request{}),
+			 c, req_params, t, 0.0, key);
+	  if (0 == key) {
+	    twin.add_request_time(Request{}, c, req_params, t);
+	  }
+	}
       }
 
-      EXPECT_EQ(2, c1_count) <<
-	"one-third of request should have come from first client";
-      EXPECT_EQ(4, c2_count) <<
-	"two-thirds of request should have come from second client";
+      const size_t expected = (client_count - 1) / cancelled_every + 1;
+      EXPECT_EQ(expected, pq.cancel(7));
+      EXPECT_EQ(twin.request_count(), pq.request_count());
+
+      Time t = now;
+      for (int i = 0; i < 3 * client_count; ++i) {
+	typename Queue::PullReq pr = pq.pull_request(t);
+	typename Queue::PullReq twin_pr = twin.pull_request(t);
+	ASSERT_EQ(twin_pr.type, pr.type);
+	if (pr.is_retn()) {
+	  EXPECT_EQ(twin_pr.get_retn().client, pr.get_retn().client);
+	  EXPECT_EQ(twin_pr.get_retn().phase, pr.get_retn().phase);
+	}
+	t += dmc::seconds_to_time(1e-3);
+      }
     }
 
 
-    TEST(dmclock_server_pull, pull_reservation) {
+    TEST(dmclock_server, cancel_order) {
+      // few clients change, so they're adjusted one by one
+      test_cancel_order<dmc::SchedIndex::heaps>(50);
+      test_cancel_order<dmc::SchedIndex::tournament>(50);
+      // most clients change, so the orderings are rebuilt
+      test_cancel_order<dmc::SchedIndex::heaps>(1);
+      test_cancel_order<dmc::SchedIndex::tournament>(2);
+    } // TEST
+#endif
+
+
+    TEST(dmclock_server, push_ingress) {
       using ClientId = int;
-      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
-      using QueueRef = std::unique_ptr<Queue>;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
 
-      ClientId client1 = 52;
-      ClientId client2 = 8;
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
 
-      dmc::ClientInfo info1(2.0, 0.0, 0.0);
-      dmc::ClientInfo info2(1.0, 0.0, 0.0);
+      std::mutex handled_mtx;
+      std::condition_variable handled_cv;
+      std::vector<int> handled_per_client(4, 0);
+      int handled = 0;
 
       auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
-	if (client1 == c) return info1;
-	else if (client2 == c) return info2;
-	else {
-	  ADD_FAILURE() << "client info looked up for non-existant client";
-	  return info1;
-	}
+	return info;
+      };
+      auto can_handle_f = [] () -> bool { return true; };
+      auto handle_f = [&] (const ClientId& c,
+			   std::unique_ptr<Request> req,
+			   dmc::PhaseType phase) {
+	std::lock_guard<std::mutex> l(handled_mtx);
+	++handled_per_client[c];
+	++handled;
+	handled_cv.notify_one();
       };
 
-      QueueRef pq(new Queue(client_info_f, false));
+      Queue pq(client_info_f, can_handle_f, handle_f, false, true);
+
+      const int per_thread = 500;
+      std::vector<std::thread> producers;
+      for (int t = 0; t < 4; ++t) {
+	producers.emplace_back([&pq, t] () {
+	    ReqParams req_params(1,1);
+	    for (int i = 0; i < per_thread; ++i) {
+	      pq.add_request(Request{}, t, req_params);
+	    }
+	  });
+      }
+      for (auto& t : producers) {
+	t.join();
+      }
 
-      Request req;
-      ReqParams req_params(1,1);
+      // producers return before their requests are handled, so wait
+      // for the ingress thread to get through them
+      std::unique_lock<std::mutex> l(handled_mtx);
+      EXPECT_TRUE(handled_cv.wait_for(l,
+				      std::chrono::seconds(10),
+				      [&] { return 4 * per_thread == handled; }));
+      for (int c = 0; c < 4; ++c) {
+	EXPECT_EQ(per_thread, handled_per_client[c]);
+      }
+    }
 
-      // make sure all times are well before now
-      auto old_time = dmc::get_time() - 100.0;
 
-      for (int i = 0; i < 5; ++i) {
-	pq->add_request_time(req, client1, req_params, old_time);
-	pq->add_request_time(req, client2, req_params, old_time);
-	old_time += 0.001;
-      }
+    // requests still in the ingress queue when their client is
+    // removed or they're cancelled must not reach handle_f
+    TEST(dmclock_server, push_ingress_remove) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
 
-      int c1_count = 0;
-      int c2_count = 0;
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
 
-      for (int i = 0; i < 6; ++i) {
-	Queue::PullReq pr = pq->pull_request();
-	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
-	auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
+      std::atomic<bool> can_handle(false);
+      std::mutex handled_mtx;
+      std::condition_variable handled_cv;
+      std::vector<ClientId> handled;
 
-	if (client1 == retn.client) ++c1_count;
-	else if (client2 == retn.client) ++c2_count;
-	else ADD_FAILURE() << "got request from neither of two clients";
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+      auto can_handle_f = [&] () -> bool { return can_handle.load(); };
+      auto handle_f = [&] (const ClientId& c,
+			   std::unique_ptr<Request> req,
+			   dmc::PhaseType phase) {
+	std::lock_guard<std::mutex> l(handled_mtx);
+	handled.push_back(c);
+	handled_cv.notify_one();
+      };
 
-	EXPECT_EQ(PhaseType::reservation, retn.phase);
+      // a pass dispatches everything ready, so nothing left behind by
+      // the removals could wait for a later pass
+      Queue pq(client_info_f, can_handle_f, handle_f, false, true, 10000);
+      ReqParams req_params(1,1);
+
+      const int count = 1000;
+      for (int i = 0; i < count; ++i) {
+	pq.add_request(Request{}, 1, req_params);
       }
+      size_t removed = 0;
+      pq.remove_by_client(1, false, [&removed] (const Request&) {
+	  ++removed;
+	});
+      EXPECT_EQ(size_t(count), removed);
 
-      EXPECT_EQ(4, c1_count) <<
-	"two-thirds of request should have come from first client";
-      EXPECT_EQ(2, c2_count) <<
-	"one-third of request should have come from second client";
-    } // dmclock_server_pull.pull_reservation
+      for (int i = 0; i < count; ++i) {
+	pq.add_request(Request{}, 2, req_params);
+      }
+      removed = 0;
+      EXPECT_TRUE(pq.remove_by_req_filter([&removed] (const Request&) {
+	    ++removed;
+	    return true;
+	  }));
+      EXPECT_EQ(size_t(count), removed);
 
+      for (int i = 0; i < count; ++i) {
+	pq.add_request(Queue::RequestRef(new Request{}), 4, req_params,
+		       dmc::get_time(), 0.0, 7);
+      }
+      EXPECT_EQ(size_t(count), pq.cancel(7));
+      EXPECT_EQ(0u, pq.request_count());
 
-    // This test shows what happens when a request can be ready (under
-    // limit) but not schedulable since proportion tag is 0. We expect
-    // to get some future and none responses.
-    TEST(dmclock_server_pull, ready_and_under_limit) {
+      can_handle = true;
+      pq.add_request(Request{}, 3, req_params);
+
+      std::unique_lock<std::mutex> l(handled_mtx);
+      EXPECT_TRUE(handled_cv.wait_for(l,
+				      std::chrono::seconds(10),
+				      [&] { return !handled.empty(); }));
+      EXPECT_EQ(std::vector<ClientId>{3}, handled);
+    }
+
+
+    // handle_f runs without data_mtx held, so another thread can add
+    // a request while handle_f is blocked; with data_mtx held this
+    // would wait until the handle_f wait below times out
+    TEST(dmclock_server, push_handle_outside_lock) {
       using ClientId = int;
-      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
-      using QueueRef = std::unique_ptr<Queue>;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
 
-      ClientId client1 = 52;
-      ClientId client2 = 8;
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
 
-      dmc::ClientInfo info1(1.0, 0.0, 0.0);
-      dmc::ClientInfo info2(1.0, 0.0, 0.0);
+      std::mutex mtx;
+      std::condition_variable cv;
+      bool in_handle = false;
+      bool release = false;
+      std::vector<ClientId> handled;
+      std::vector<std::thread::id> handled_on;
 
       auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
-	if (client1 == c) return info1;
-	else if (client2 == c) return info2;
-	else {
-	  ADD_FAILURE() << "client info looked up for non-existant client";
-	  return info1;
+	return info;
+      };
+      auto can_handle_f = [] () -> bool { return true; };
+      auto handle_f = [&] (const ClientId& c,
+			   std::unique_ptr<Request> req,
+			   dmc::PhaseType phase) {
+	std::unique_lock<std::mutex> l(mtx);
+	handled.push_back(c);
+	handled_on.push_back(std::this_thread::get_id());
+	cv.notify_all();
+	if (1 == handled.size()) {
+	  in_handle = true;
+	  cv.notify_all();
+	  EXPECT_TRUE(cv.wait_for(l,
+				  std::chrono::seconds(10),
+				  [&] { return release; }));
 	}
       };
 
-      QueueRef pq(new Queue(client_info_f, false));
-
-      Request req;
+      Queue pq(client_info_f, can_handle_f, handle_f);
       ReqParams req_params(1,1);
 
-      // make sure all times are well before now
-      auto start_time = dmc::get_time() - 100.0;
+      std::thread first([&] () {
+	  pq.add_request(Request{}, 1, req_params);
+	});
 
-      // add six requests; for same client reservations spaced one apart
-      for (int i = 0; i < 3; ++i) {
-	pq->add_request_time(req, client1, req_params, start_time);
-	pq->add_request_time(req, client2, req_params, start_time);
+      {
+	std::unique_lock<std::mutex> l(mtx);
+	EXPECT_TRUE(cv.wait_for(l,
+				std::chrono::seconds(10),
+				[&] { return in_handle; }));
       }
 
-      Queue::PullReq pr = pq->pull_request(start_time + 0.5);
-      EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+      // the first thread is the dispatcher and is blocked in
+      // handle_f, so this returns without handling the request
+      auto start = std::chrono::steady_clock::now();
+      pq.add_request(Request{}, 2, req_params);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      EXPECT_LT(elapsed, std::chrono::seconds(5));
 
-      pr = pq->pull_request(start_time + 0.5);
-      EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+      {
+	std::lock_guard<std::mutex> l(mtx);
+	EXPECT_EQ(1u, handled.size());
+	release = true;
+	cv.notify_all();
+      }
+      const std::thread::id first_id = first.get_id();
+      first.join();
 
-      pr = pq->pull_request(start_time + 0.5);
-      EXPECT_EQ(Queue::NextReqType::future, pr.type) <<
+      // the dispatcher runs only its own pass and hands the second
+      // request's off, so it never pays for another's handle_f
+      std::unique_lock<std::mutex> l(mtx);
+      EXPECT_TRUE(cv.wait_for(l,
+			      std::chrono::seconds(10),
+			      [&] { return 2 == handled.size(); }));
+      ASSERT_EQ(2u, handled.size());
+      EXPECT_EQ(1, handled[0]);
+      EXPECT_EQ(2, handled[1]);
+      EXPECT_EQ(first_id, handled_on[0]);
+      EXPECT_NE(first_id, handled_on[1]);
+    }
+
+
+    TEST(dmclock_server, push_max_per_pass) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      for (uint max_per_pass : { 1u, 3u, 10u }) {
+	int capacity = 0;
+	int handled = 0;
+
+	auto can_handle_f = [&] () -> bool { return handled < capacity; };
+	auto handle_f = [&] (const ClientId& c,
+			     std::unique_ptr<Request> req,
+			     dmc::PhaseType phase) {
+	  ++handled;
+	};
+
+	Queue pq(client_info_f, can_handle_f, handle_f,
+		 false, false, max_per_pass);
+	ReqParams req_params(1,1);
+
+	// nothing can be handled while the requests are added
+	for (int i = 0; i < 5; ++i) {
+	  pq.add_request(Request{}, i, req_params);
+	}
+	EXPECT_EQ(0, handled);
+
+	// free up four slots at once; a single completion fills as
+	// many of them as max_per_pass allows
+	capacity = 4;
+	pq.request_completed();
+	EXPECT_EQ(std::min(4, int(max_per_pass)), handled) <<
+	  "max_per_pass " << max_per_pass;
+	EXPECT_EQ(size_t(5 - handled), pq.request_count());
+      }
+    }
+
+
+    // queues' scheduled wakeups share timer threads, so a handle_f
+    // that blocks on one queue must not delay another queue's wakeup
+    TEST(dmclock_server, push_sched_ahead_isolation) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      // twenty requests a second at most, so each second request
+      // waits for a scheduled wakeup
+      dmc::ClientInfo info(0.0, 1.0, 20.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+      auto can_handle_f = [] () -> bool { return true; };
+
+      std::mutex mtx;
+      std::condition_variable cv;
+      bool release = false;
+      int blocking_handled = 0;
+      int other_handled = 0;
+
+      auto blocking_handle_f = [&] (const ClientId& c,
+				    std::unique_ptr<Request> req,
+				    dmc::PhaseType phase) {
+	std::unique_lock<std::mutex> l(mtx);
+	++blocking_handled;
+	cv.notify_all();
+	if (blocking_handled > 1) {
+	  cv.wait(l, [&] { return release; });
+	}
+      };
+      auto other_handle_f = [&] (const ClientId& c,
+				 std::unique_ptr<Request> req,
+				 dmc::PhaseType phase) {
+	std::lock_guard<std::mutex> l(mtx);
+	++other_handled;
+	cv.notify_all();
+      };
+
+      Queue blocking_pq(client_info_f, can_handle_f, blocking_handle_f);
+      Queue other_pq(client_info_f, can_handle_f, other_handle_f);
+      ReqParams req_params(1,1);
+
+      // the second request is handed over after a wakeup, and blocks
+      blocking_pq.add_request(Request{}, 1, req_params);
+      blocking_pq.add_request(Request{}, 1, req_params);
+      std::unique_lock<std::mutex> l(mtx);
+      ASSERT_TRUE(cv.wait_for(l,
+			      std::chrono::seconds(10),
+			      [&] { return 2 == blocking_handled; }));
+      l.unlock();
+
+      other_pq.add_request(Request{}, 1, req_params);
+      other_pq.add_request(Request{}, 1, req_params);
+      l.lock();
+      EXPECT_TRUE(cv.wait_for(l,
+			      std::chrono::seconds(2),
+			      [&] { return 2 == other_handled; })) <<
+	"other queue's wakeup was held up by a blocked handle_f";
+
+      release = true;
+      cv.notify_all();
+    }
+
+
+    // handed off passes run on the queue's work service, so queues
+    // whose handle_f blocks every worker of the shared service don't
+    // hold up a queue given a service of its own
+    TEST(dmclock_server, push_work_service) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      // each second request waits for a scheduled wakeup, so it's
+      // dispatched by a handed off pass
+      dmc::ClientInfo info(0.0, 1.0, 20.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+      auto can_handle_f = [] () -> bool { return true; };
+
+      std::mutex mtx;
+      std::condition_variable cv;
+      bool release = false;
+      uint blocked = 0;
+      int other_handled = 0;
+      const std::thread::id test_thread = std::this_thread::get_id();
+
+      auto blocking_handle_f = [&] (const ClientId& c,
+				    std::unique_ptr<Request> req,
+				    dmc::PhaseType phase) {
+	// the first request is handed over by the adding thread
+	if (std::this_thread::get_id() == test_thread) {
+	  return;
+	}
+	std::unique_lock<std::mutex> l(mtx);
+	++blocked;
+	cv.notify_all();
+	cv.wait(l, [&] { return release; });
+      };
+      auto other_handle_f = [&] (const ClientId& c,
+				 std::unique_ptr<Request> req,
+				 dmc::PhaseType phase) {
+	std::lock_guard<std::mutex> l(mtx);
+	++other_handled;
+	cv.notify_all();
+      };
+
+      const uint workers = crimson::WorkService::global().get_worker_count();
+      std::vector<std::unique_ptr<Queue>> blocking;
+      ReqParams req_params(1,1);
+      for (uint i = 0; i < workers; ++i) {
+	blocking.emplace_back(
+	  new Queue(client_info_f, can_handle_f, blocking_handle_f));
+	blocking.back()->add_request(Request{}, 1, req_params);
+	blocking.back()->add_request(Request{}, 1, req_params);
+      }
+      std::unique_lock<std::mutex> l(mtx);
+      ASSERT_TRUE(cv.wait_for(l,
+			      std::chrono::seconds(10),
+			      [&] { return workers == blocked; }));
+      l.unlock();
+
+      crimson::WorkService own_service(1);
+      Queue other_pq(client_info_f, can_handle_f, other_handle_f,
+		     std::chrono::minutes(10),
+		     std::chrono::minutes(15),
+		     std::chrono::minutes(6),
+		     false, false, 1, dmc::CleanBudget(),
+		     std::chrono::microseconds(0),
+		     own_service);
+      other_pq.add_request(Request{}, 1, req_params);
+      other_pq.add_request(Request{}, 1, req_params);
+      l.lock();
+      EXPECT_TRUE(cv.wait_for(l,
+			      std::chrono::seconds(2),
+			      [&] { return 2 == other_handled; })) <<
+	"queue with its own work service was held up by blocked workers";
+
+      release = true;
+      cv.notify_all();
+    }
+
+
+    TEST(dmclock_server, push_async_dispatch) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      std::mutex mtx;
+      std::condition_variable cv;
+      int handled = 0;
+      bool can_handle = true;
+      const std::thread::id test_thread = std::this_thread::get_id();
+
+      auto can_handle_f = [&] () -> bool {
+	std::lock_guard<std::mutex> l(mtx);
+	EXPECT_NE(test_thread, std::this_thread::get_id());
+	return can_handle;
+      };
+      auto handle_f = [&] (const ClientId& c,
+			   std::unique_ptr<Request> req,
+			   dmc::PhaseType phase) {
+	std::lock_guard<std::mutex> l(mtx);
+	EXPECT_NE(test_thread, std::this_thread::get_id());
+	++handled;
+	cv.notify_all();
+      };
+
+      crimson::WorkService own_service(1);
+      Queue pq(client_info_f, can_handle_f, handle_f,
+	       std::chrono::minutes(10),
+	       std::chrono::minutes(15),
+	       std::chrono::minutes(6),
+	       false, false, 1, dmc::CleanBudget(),
+	       std::chrono::microseconds(0),
+	       own_service,
+	       true);
+
+      ReqParams req_params(1,1);
+      {
+	std::lock_guard<std::mutex> l(mtx);
+	can_handle = false;
+      }
+      for (int i = 0; i < 5; ++i) {
+	pq.add_request(Request{}, i, req_params);
+      }
+
+      // the requests the server had no room for are dispatched on
+      // completions, which are also handed off
+      {
+	std::lock_guard<std::mutex> l(mtx);
+	can_handle = true;
+      }
+      for (int i = 0; i < 5; ++i) {
+	pq.request_completed();
+      }
+
+      std::unique_lock<std::mutex> l(mtx);
+      EXPECT_TRUE(cv.wait_for(l,
+			      std::chrono::seconds(10),
+			      [&] { return 5 == handled; }));
+    }
+
+
+    // a clock that counts how often it's read
+    struct CountingClock {
+      static std::atomic<uint> reads;
+
+      static Time now() {
+	++reads;
+	return get_time();
+      }
+    };
+    std::atomic<uint> CountingClock::reads(0);
+
+
+    TEST(dmclock_server, push_time_epoch) {
+      using ClientId = int;
+      using Queue =
+	dmc::PushPriorityQueue<ClientId,Request,2,
+			       dmc::SchedIndex::heaps,CountingClock>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+      auto can_handle_f = [] () -> bool { return true; };
+      int handled = 0;
+      auto handle_f = [&] (const ClientId& c,
+			   std::unique_ptr<Request> req,
+			   dmc::PhaseType phase) {
+	++handled;
+      };
+      ReqParams req_params(1,1);
+
+      // without epochs, each request reads the clock when it's added
+      // and again when it's scheduled; the reads are only counted in
+      // clock_stats while profiling is on
+      {
+	Queue pq(client_info_f, can_handle_f, handle_f,
+		 std::chrono::minutes(10),
+		 std::chrono::minutes(15),
+		 std::chrono::minutes(6));
+	pq.set_profiling(false);
+	pq.add_request(Request{}, 0, req_params);
+	EXPECT_EQ(0u, pq.clock_stats().reads);
+	EXPECT_EQ(0u, pq.clock_stats().requests);
+	handled = 0;
+
+	pq.set_profiling(true);
+	CountingClock::reads = 0;
+	for (int i = 0; i < 100; ++i) {
+	  pq.add_request(Request{}, i % 4, req_params);
+	}
+	EXPECT_EQ(100, handled);
+	Queue::ClockStats stats = pq.clock_stats();
+	EXPECT_EQ(200u, CountingClock::reads);
+	EXPECT_EQ(200u, stats.reads);
+	EXPECT_EQ(0u, stats.reuses);
+	EXPECT_EQ(100u, stats.requests);
+	EXPECT_DOUBLE_EQ(2.0, stats.reads_per_request());
+      }
+
+      // with an epoch that outlasts the test, one read serves them all
+      handled = 0;
+      {
+	Queue pq(client_info_f, can_handle_f, handle_f,
+		 std::chrono::minutes(10),
+		 std::chrono::minutes(15),
+		 std::chrono::minutes(6),
+		 false, false, 1, CleanBudget(),
+		 std::chrono::seconds(100));
+	pq.set_profiling(true);
+	CountingClock::reads = 0;
+	for (int i = 0; i < 100; ++i) {
+	  pq.add_request(Request{}, i % 4, req_params);
+	}
+	EXPECT_EQ(100, handled);
+	Queue::ClockStats stats = pq.clock_stats();
+	EXPECT_EQ(1u, CountingClock::reads);
+	EXPECT_EQ(1u, stats.reads);
+	EXPECT_EQ(199u, stats.reuses);
+      }
+
+      // an epoch ends once it's older than the staleness bound
+      handled = 0;
+      {
+	Queue pq(client_info_f, can_handle_f, handle_f,
+		 std::chrono::minutes(10),
+		 std::chrono::minutes(15),
+		 std::chrono::minutes(6),
+		 false, false, 1, CleanBudget(),
+		 std::chrono::milliseconds(5));
+	pq.set_profiling(true);
+	CountingClock::reads = 0;
+	pq.add_request(Request{}, 1, req_params);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	pq.add_request(Request{}, 1, req_params);
+	EXPECT_EQ(2, handled);
+	EXPECT_EQ(2u, pq.clock_stats().reads);
+	EXPECT_EQ(2u, pq.clock_stats().reuses);
+      }
+    }
+
+
+    // a request that's held back by its limit still goes out when its
+    // time arrives, even though the epoch it was judged in is far from
+    // over
+    TEST(dmclock_server, push_time_epoch_future) {
+      using ClientId = int;
+      using Queue =
+	dmc::PushPriorityQueue<ClientId,Request,2,
+			       dmc::SchedIndex::heaps,CountingClock>;
+
+      // two requests a second at most
+      dmc::ClientInfo info(0.0, 1.0, 2.0);
+
+      std::mutex mtx;
+      std::condition_variable cv;
+      int handled = 0;
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+      auto can_handle_f = [] () -> bool { return true; };
+      auto handle_f = [&] (const ClientId& c,
+			   std::unique_ptr<Request> req,
+			   dmc::PhaseType phase) {
+	std::lock_guard<std::mutex> l(mtx);
+	++handled;
+	cv.notify_all();
+      };
+
+      Queue pq(client_info_f, can_handle_f, handle_f,
+	       std::chrono::minutes(10),
+	       std::chrono::minutes(15),
+	       std::chrono::minutes(6),
+	       false, false, 1, CleanBudget(),
+	       std::chrono::seconds(100));
+      ReqParams req_params(1,1);
+
+      pq.add_request(Request{}, 1, req_params);
+      pq.add_request(Request{}, 1, req_params);
+
+      std::unique_lock<std::mutex> l(mtx);
+      EXPECT_EQ(1, handled);
+      EXPECT_TRUE(cv.wait_for(l,
+			      std::chrono::seconds(10),
+			      [&] { return 2 == handled; }));
+    }
+
+
+    TEST(dmclock_server_pull, pull_weight) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+      using QueueRef = std::unique_ptr<Queue>;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+
+      QueueRef pq;
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	if (client1 == c) return info1;
+	else if (client2 == c) return info2;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return info1;
+	}
+      };
+
+      pq = QueueRef(new Queue(client_info_f, false));
+
+      Request req;
+      ReqParams req_params(1,1);
+
+      auto now = dmc::get_time();
+
+      for (int i = 0; i < 5; ++i) {
+	pq->add_request(req, client1, req_params);
+	pq->add_request(req, client2, req_params);
+	now += dmc::seconds_to_time(0.0001);
+      }
+
+      int c1_count = 0;
+      int c2_count = 0;
+      for (int i = 0; i < 6; ++i) {
+	Queue::PullReq pr = pq->pull_request();
+	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+	auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
+
+	if (client1 == retn.client) ++c1_count;
+	else if (client2 == retn.client) ++c2_count;
+	else ADD_FAILURE() << "got request from neither of two clients";
+
+	EXPECT_EQ(PhaseType::priority, retn.phase);
+      }
+
+      EXPECT_EQ(2, c1_count) <<
+	"one-third of request should have come from first client";
+      EXPECT_EQ(4, c2_count) <<
+	"two-thirds of request should have come from second client";
+    }
+
+
+    TEST(dmclock_server_pull, pull_reservation) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+      using QueueRef = std::unique_ptr<Queue>;
+
+      ClientId client1 = 52;
+      ClientId client2 = 8;
+
+      dmc::ClientInfo info1(2.0, 0.0, 0.0);
+      dmc::ClientInfo info2(1.0, 0.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	if (client1 == c) return info1;
+	else if (client2 == c) return info2;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return info1;
+	}
+      };
+
+      QueueRef pq(new Queue(client_info_f, false));
+
+      Request req;
+      ReqParams req_params(1,1);
+
+      // make sure all times are well before now
+      auto old_time = dmc::get_time() - dmc::seconds_to_time(100.0);
+
+      for (int i = 0; i < 5; ++i) {
+	pq->add_request_time(req, client1, req_params, old_time);
+	pq->add_request_time(req, client2, req_params, old_time);
+	old_time += dmc::seconds_to_time(0.001);
+      }
+
+      int c1_count = 0;
+      int c2_count = 0;
+
+      for (int i = 0; i < 6; ++i) {
+	Queue::PullReq pr = pq->pull_request();
+	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+	auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
+
+	if (client1 == retn.client) ++c1_count;
+	else if (client2 == retn.client) ++c2_count;
+	else ADD_FAILURE() << "got request from neither of two clients";
+
+	EXPECT_EQ(PhaseType::reservation, retn.phase);
+      }
+
+      EXPECT_EQ(4, c1_count) <<
+	"two-thirds of request should have come from first client";
+      EXPECT_EQ(2, c2_count) <<
+	"one-third of request should have come from second client";
+    } // dmclock_server_pull.pull_reservation
+
+
+    // This test shows what happens when a request can be ready (under
+    // limit) but not schedulable since proportion tag is 0. We expect
+    // to get some future and none responses.
+    TEST(dmclock_server_pull, ready_and_under_limit) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+      using QueueRef = std::unique_ptr<Queue>;
+
+      ClientId client1 = 52;
+      ClientId client2 = 8;
+
+      dmc::ClientInfo info1(1.0, 0.0, 0.0);
+      dmc::ClientInfo info2(1.0, 0.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	if (client1 == c) return info1;
+	else if (client2 == c) return info2;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return info1;
+	}
+      };
+
+      QueueRef pq(new Queue(client_info_f, false));
+
+      Request req;
+      ReqParams req_params(1,1);
+
+      // make sure all times are well before now
+      auto start_time = dmc::get_time() - dmc::seconds_to_time(100.0);
+
+      // add six requests; for same client reservations spaced one apart
+      for (int i = 0; i < 3; ++i) {
+	pq->add_request_time(req, client1, req_params, start_time);
+	pq->add_request_time(req, client2, req_params, start_time);
+      }
+
+      Queue::PullReq pr =
+	pq->pull_request(start_time + dmc::seconds_to_time(0.5));
+      EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(0.5));
+      EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(0.5));
+      EXPECT_EQ(Queue::NextReqType::future, pr.type) <<
 	"too soon for next reservation";
 
-      pr = pq->pull_request(start_time + 1.5);
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(1.5));
       EXPECT_EQ(Queue::NextReqType::returning, pr.type);
 
-      pr = pq->pull_request(start_time + 1.5);
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(1.5));
       EXPECT_EQ(Queue::NextReqType::returning, pr.type);
 
-      pr = pq->pull_request(start_time + 1.5);
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(1.5));
       EXPECT_EQ(Queue::NextReqType::future, pr.type) <<
 	"too soon for next reservation";
 
-      pr = pq->pull_request(start_time + 2.5);
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(2.5));
       EXPECT_EQ(Queue::NextReqType::returning, pr.type);
 
-      pr = pq->pull_request(start_time + 2.5);
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(2.5));
       EXPECT_EQ(Queue::NextReqType::returning, pr.type);
 
-      pr = pq->pull_request(start_time + 2.5);
+      pr = pq->pull_request(start_time + dmc::seconds_to_time(2.5));
       EXPECT_EQ(Queue::NextReqType::none, pr.type) << "no more requests left";
     }
 
@@ -722,7 +1690,7 @@ namespace crimson {
 
       auto now = dmc::get_time();
 
-      Queue::PullReq pr = pq->pull_request(now + 100);
+      Queue::PullReq pr = pq->pull_request(now + dmc::seconds_to_time(100));
 
       EXPECT_EQ(Queue::NextReqType::none, pr.type);
     }
@@ -750,13 +1718,14 @@ namespace crimson {
       // make sure all times are well before now
       auto now = dmc::get_time();
 
-      pq->add_request_time(req, client1, req_params, now + 100);
+      pq->add_request_time(req, client1, req_params,
+			   now + dmc::seconds_to_time(100));
       Queue::PullReq pr = pq->pull_request(now);
 
       EXPECT_EQ(Queue::NextReqType::future, pr.type);
 
       Time when = boost::get<Time>(pr.data);
-      EXPECT_EQ(now + 100, when);
+      EXPECT_EQ(now + dmc::seconds_to_time(100), when);
     }
 
 
@@ -782,7 +1751,8 @@ namespace crimson {
       // make sure all times are well before now
       auto now = dmc::get_time();
 
-      pq->add_request_time(req, client1, req_params, now + 100);
+      pq->add_request_time(req, client1, req_params,
+			   now + dmc::seconds_to_time(100));
       Queue::PullReq pr = pq->pull_request(now);
 
       EXPECT_EQ(Queue::NextReqType::returning, pr.type);
@@ -814,7 +1784,8 @@ namespace crimson {
       // make sure all times are well before now
       auto now = dmc::get_time();
 
-      pq->add_request_time(req, client1, req_params, now + 100);
+      pq->add_request_time(req, client1, req_params,
+			   now + dmc::seconds_to_time(100));
       Queue::PullReq pr = pq->pull_request(now);
 
       EXPECT_EQ(Queue::NextReqType::returning, pr.type);
@@ -822,5 +1793,479 @@ namespace crimson {
       auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
       EXPECT_EQ(client1, retn.client);
     }
+
+
+    TEST(dmclock_server_pull, add_and_pull_batches) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	if (client1 == c) return info1;
+	else if (client2 == c) return info2;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return info1;
+	}
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1,1);
+
+      std::vector<Queue::AddReq> adds;
+      for (int i = 0; i < 5; ++i) {
+	adds.emplace_back(Queue::RequestRef(new Request), client1, req_params);
+	adds.emplace_back(Queue::RequestRef(new Request), client2, req_params);
+      }
+
+      auto now = dmc::get_time();
+      pq.add_requests(adds.begin(), adds.end(), now);
+      EXPECT_EQ(10u, pq.request_count());
+
+      std::vector<Queue::PullReq::Retn> pulled;
+      Time when = TimeZero;
+      EXPECT_EQ(6u, pq.pull_requests(now, 6, pulled, &when));
+      EXPECT_EQ(now, when) << "more requests may be ready now";
+      ASSERT_EQ(6u, pulled.size());
+
+      int c1_count = 0;
+      int c2_count = 0;
+      for (auto& retn : pulled) {
+	if (client1 == retn.client) ++c1_count;
+	else if (client2 == retn.client) ++c2_count;
+	else ADD_FAILURE() << "got request from neither of two clients";
+
+	EXPECT_EQ(PhaseType::priority, retn.phase);
+	EXPECT_TRUE(bool(retn.request));
+      }
+      EXPECT_EQ(2, c1_count) <<
+	"one-third of request should have come from first client";
+      EXPECT_EQ(4, c2_count) <<
+	"two-thirds of request should have come from second client";
+
+      // the rest come out, and appended to what is in out
+      EXPECT_EQ(4u, pq.pull_requests(now, 100, pulled, &when));
+      EXPECT_EQ(10u, pulled.size());
+      EXPECT_EQ(TimeMax, when);
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    TEST(dmclock_server_pull, pull_batch_future) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(1.0, 0.0, 1.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1,1);
+
+      auto now = dmc::get_time();
+
+      std::vector<Queue::AddReq> adds;
+      adds.emplace_back(Queue::RequestRef(new Request), 52, req_params);
+      pq.add_requests(adds.begin(), adds.end(),
+		      now + dmc::seconds_to_time(100));
+
+      std::vector<Queue::PullReq::Retn> pulled;
+      Time when = TimeZero;
+      EXPECT_EQ(0u, pq.pull_requests(now, 8, pulled, &when));
+      EXPECT_TRUE(pulled.empty());
+      EXPECT_EQ(now + dmc::seconds_to_time(100), when);
+
+      EXPECT_EQ(1u, pq.pull_requests(now + dmc::seconds_to_time(100), 8,
+				     pulled));
+      EXPECT_EQ(52, pulled.front().client);
+    }
+
+
+    // with the tournament tree index, each pulled request comes from a
+    // client that was at the top of the ordering for its phase (ties
+    // among clients can be broken differently than with the heaps)
+    TEST(dmclock_server_pull, pull_sched_index) {
+      using ClientId = int;
+      using Queue =
+	dmc::PullPriorityQueue<ClientId,Request,2,dmc::SchedIndex::tournament>;
+      using HeapId = Queue::HeapId;
+      const int client_count = 20;
+
+      auto client_info_f = [] (ClientId c) -> dmc::ClientInfo {
+	return dmc::ClientInfo(0 == c % 3 ? 1.0 + c * 0.1 : 0.0,
+			       1.0 + c * 0.13,
+			       0 == c % 4 ? 2.0 + c * 0.07 : 0.0);
+      };
+
+      Queue pq(client_info_f, true);
+      ReqParams req_params(1, 1);
+
+      Queue::ClientKeysOf keys_of;
+      Queue::ClientKeyCompare compare;
+      // the key of client in ordering id, and the lowest key of any
+      // client
+      auto key_of = [&] (ClientId c, HeapId id) -> Queue::ClientKey {
+	return keys_of(*pq.client_map.at(c))[static_cast<uint>(id)];
+      };
+      auto lowest_key = [&] (HeapId id) -> Queue::ClientKey {
+	auto i = pq.client_map.begin();
+	Queue::ClientKey lowest = keys_of(*i->second)[static_cast<uint>(id)];
+	for (++i; i != pq.client_map.end(); ++i) {
+	  Queue::ClientKey k = keys_of(*i->second)[static_cast<uint>(id)];
+	  if (compare(k, lowest)) {
+	    lowest = k;
+	  }
+	}
+	return lowest;
+      };
+      auto same_key = [&] (const Queue::ClientKey& k1,
+			   const Queue::ClientKey& k2) -> bool {
+	return !compare(k1, k2) && !compare(k2, k1);
+      };
+
+      int reservation_count = 0;
+      int priority_count = 0;
+      Time now = dmc::get_time();
+      for (int round = 0; round < 50; ++round) {
+	for (ClientId c = round % 3; c < client_count; c += 1 + round % 2) {
+	  pq.add_request_time(Request{}, c, req_params,
+			      now + dmc::seconds_to_time(c * 1e-4), 0.0);
+	}
+	for (int i = 0; i < 12; ++i) {
+	  // pulling promotes clients whose limits have passed first, so
+	  // keys are compared only after the pull, except for the
+	  // pulled client's
+	  std::map<ClientId,std::array<Queue::ClientKey,3>> before;
+	  for (auto& c : pq.client_map) {
+	    before[c.first] = keys_of(*c.second);
+	  }
+	  test_locked(pq.data_mtx, [&] () { pq.do_promote_ready(now); });
+	  Queue::ClientKey lowest_resv = lowest_key(HeapId::reservation);
+	  Queue::ClientKey lowest_ready = lowest_key(HeapId::ready);
+	  std::map<ClientId,Queue::ClientKey> ready_keys;
+	  for (auto& c : pq.client_map) {
+	    ready_keys[c.first] = key_of(c.first, HeapId::ready);
+	  }
+
+	  Queue::PullReq pr = pq.pull_request(now);
+	  if (!pr.is_retn()) {
+	    continue;
+	  }
+	  ClientId c = pr.get_retn().client;
+	  if (PhaseType::reservation == pr.get_retn().phase) {
+	    ++reservation_count;
+	    EXPECT_TRUE(same_key(lowest_resv,
+				 before[c][static_cast<uint>(HeapId::reservation)]));
+	  } else {
+	    ++priority_count;
+	    EXPECT_TRUE(same_key(lowest_ready, ready_keys[c]));
+	  }
+	}
+	now += dmc::seconds_to_time(0.25);
+      }
+      EXPECT_GT(reservation_count, 0);
+      EXPECT_GT(priority_count, 0);
+    }
+
+
+    // a request type using the pooled allocation path
+    struct PooledRequest : public crimson::PooledObject<PooledRequest> {
+      int id;
+      std::string name;
+
+      PooledRequest(int _id, const std::string& _name) :
+	id(_id),
+	name(_name)
+      {
+	// empty
+      }
+    };
+
+
+    TEST(dmclock_server_pull, emplace_and_move_request) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,PooledRequest>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1,1);
+
+      pq.emplace_request(17, req_params, 1, "first");
+      pq.add_request(Queue::RequestRef(new PooledRequest(2, "second")),
+		     17,
+		     req_params);
+      pq.add_request(Queue::RequestRef(new PooledRequest(3, "third")), 17);
+
+      EXPECT_EQ(3u, pq.request_count());
+
+      for (int i = 1; i <= 3; ++i) {
+	Queue::PullReq pr = pq.pull_request();
+	ASSERT_TRUE(pr.is_retn());
+	auto& retn = pr.get_retn();
+	EXPECT_EQ(17, retn.client);
+	EXPECT_EQ(i, retn.request->id);
+      }
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    // a client id with no std::hash, hashed by the queue's H
+    struct PairClient {
+      int pool;
+      int id;
+
+      bool operator==(const PairClient& other) const {
+	return pool == other.pool && id == other.id;
+      }
+    };
+
+    struct PairClientHash {
+      static std::atomic<uint> calls;
+
+      size_t operator()(const PairClient& c) const {
+	++calls;
+	return std::hash<int>()(c.pool) * 31 + std::hash<int>()(c.id);
+      }
+    };
+
+    std::atomic<uint> PairClientHash::calls(0);
+
+
+    TEST(dmclock_server_pull, client_hash) {
+      using Queue = dmc::PullPriorityQueue<PairClient,Request,2,
+					   dmc::SchedIndex::heaps,
+					   dmc::DefaultClock,
+					   PairClientHash>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (const PairClient& c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1,1);
+
+      PairClientHash::calls = 0;
+      for (int i = 0; i < 6; ++i) {
+	pq.add_request(Request{}, PairClient{i % 2, i % 3}, req_params);
+      }
+      EXPECT_EQ(6u, pq.client_count());
+      EXPECT_LT(0u, PairClientHash::calls.load()) <<
+	"client_map didn't use the queue's hash";
+
+      for (int i = 0; i < 6; ++i) {
+	Queue::PullReq pr = pq.pull_request();
+	ASSERT_TRUE(pr.is_retn());
+      }
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    TEST(dmclock_server_pull, pull_stats) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      const ClientId resv_client = 1;
+      const ClientId limit_client = 2;
+      dmc::ClientInfo resv_info(1.0, 0.0, 0.0);
+      dmc::ClientInfo limit_info(0.0, 1.0, 1.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return resv_client == c ? resv_info : limit_info;
+      };
+
+      Queue pq(client_info_f, true);
+      ReqParams req_params(1,1);
+      const Time now = dmc::get_time();
+
+      auto pull = [&] (Time t) -> Queue::PullReq::Retn {
+	Queue::PullReq pr = pq.pull_request(t);
+	EXPECT_TRUE(pr.is_retn());
+	return std::move(pr.get_retn());
+      };
+
+      pq.add_request_time(Request{}, limit_client, req_params, now);
+      EXPECT_EQ(PhaseType::priority,
+		pull(now + dmc::seconds_to_time(0.25)).phase);
+
+      pq.add_request_time(Request{}, resv_client, req_params,
+			  now + dmc::seconds_to_time(1));
+      EXPECT_EQ(PhaseType::reservation,
+		pull(now + dmc::seconds_to_time(3)).phase);
+
+      pq.add_request_time(Request{}, limit_client, req_params,
+			  now + dmc::seconds_to_time(3));
+      pq.add_request_time(Request{}, limit_client, req_params,
+			  now + dmc::seconds_to_time(3));
+      QueueStats stats = pq.stats();
+      EXPECT_EQ(2u, stats.queued);
+      EXPECT_EQ(1u, stats.backlogged_clients);
+
+      // the first is within its limit, and the second only goes out
+      // by breaking it
+      EXPECT_EQ(PhaseType::priority,
+		pull(now + dmc::seconds_to_time(3)).phase);
+      EXPECT_EQ(PhaseType::priority,
+		pull(now + dmc::seconds_to_time(3)).phase);
+
+      stats = pq.stats();
+      EXPECT_EQ(1u, stats.reservation_count);
+      EXPECT_EQ(3u, stats.priority_count);
+      EXPECT_EQ(1u, stats.limit_break_count);
+      EXPECT_EQ(0u, stats.queued);
+      EXPECT_EQ(0u, stats.backlogged_clients);
+
+      ASSERT_EQ(1u, stats.reservation_wait.get_count());
+      EXPECT_NEAR(2e9, double(stats.reservation_wait.get_low()), 1e3);
+      ASSERT_EQ(3u, stats.priority_wait.get_count());
+      EXPECT_EQ(0u, stats.priority_wait.get_low());
+      EXPECT_NEAR(0.25e9, double(stats.priority_wait.get_high()), 1e3);
+
+      EXPECT_EQ(4u, stats.backlog.get_count());
+      EXPECT_EQ(1u, stats.backlog.get_low());
+      EXPECT_EQ(2u, stats.backlog.get_high());
+
+      // every add and pull took data_mtx
+      EXPECT_GE(stats.lock.locks, 8u);
+      EXPECT_EQ(stats.lock.contended, stats.lock.wait.get_count());
+
+      // removals keep the gauges up to date
+      for (int i = 0; i < 3; ++i) {
+	pq.add_request_time(Request{}, resv_client, req_params,
+			    now + dmc::seconds_to_time(10));
+	pq.add_request_time(Request{}, limit_client, req_params,
+			    now + dmc::seconds_to_time(10));
+      }
+      EXPECT_EQ(6u, pq.stats().queued);
+      EXPECT_EQ(2u, pq.stats().backlogged_clients);
+      pq.remove_by_client(resv_client);
+      EXPECT_EQ(3u, pq.stats().queued);
+      EXPECT_EQ(1u, pq.stats().backlogged_clients);
+      int seen = 0;
+      pq.remove_by_req_filter([&seen] (const Request& r) -> bool {
+	  return 0 == seen++ % 2;
+	});
+      EXPECT_EQ(1u, pq.stats().queued);
+      EXPECT_EQ(1u, pq.stats().backlogged_clients);
+      EXPECT_EQ(pq.request_count(), pq.stats().queued);
+    }
+
+
+    TEST(dmclock_server_pull, pull_snapshot) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+      using Snapshot = dmc::ClientSnapshot<ClientId>;
+
+      // client 1 has a reservation; 2 is limited to one request a
+      // second; 3 has no limit; 4 will have nothing queued
+      auto client_info_f = [] (ClientId c) -> dmc::ClientInfo {
+	switch (c) {
+	case 1:  return dmc::ClientInfo(1.0, 1.0, 0.0);
+	case 2:  return dmc::ClientInfo(0.0, 1.0, 1.0);
+	default: return dmc::ClientInfo(0.0, 1.0, 0.0);
+	}
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1,1);
+      const Time now = dmc::get_time();
+
+      for (int i = 0; i < 3; ++i) {
+	pq.add_request_time(Request{}, 1, req_params, now);
+	pq.add_request_time(Request{}, 2, req_params, now);
+	pq.add_request_time(Request{}, 3, req_params, now);
+      }
+      pq.add_request_time(Request{}, 4, req_params, now);
+      pq.remove_by_client(4);
+      EXPECT_EQ(9u, pq.request_count());
+
+      // every batch size sees every client
+      for (uint batch : {0u, 1u, 3u, 100u}) {
+	dmc::QueueSnapshot<ClientId> snap = pq.snapshot(now, batch);
+	EXPECT_EQ(now, snap.time);
+	ASSERT_EQ(4u, snap.clients.size());
+
+	std::map<ClientId,Snapshot> by_client;
+	for (const auto& c : snap.clients) {
+	  by_client.emplace(c.client, c);
+	}
+	ASSERT_EQ(4u, by_client.size());
+
+	EXPECT_EQ(dmc::ClientPhase::reservation, by_client.at(1).phase);
+	EXPECT_EQ(3u, by_client.at(1).request_count);
+	EXPECT_EQ(now, by_client.at(1).next_tag.reservation);
+	EXPECT_EQ(1.0, by_client.at(1).info.reservation);
+
+	EXPECT_EQ(dmc::ClientPhase::priority, by_client.at(2).phase);
+	EXPECT_EQ(dmc::ClientPhase::priority, by_client.at(3).phase);
+	EXPECT_FALSE(by_client.at(3).idle);
+
+	EXPECT_EQ(dmc::ClientPhase::empty, by_client.at(4).phase);
+	EXPECT_EQ(0u, by_client.at(4).request_count);
+      }
+
+      // once client 2 has had a request its limit holds it back
+      for (int i = 0; i < 4; ++i) {
+	(void) pq.pull_request(now);
+      }
+      dmc::QueueSnapshot<ClientId> snap = pq.snapshot(now);
+      for (const auto& c : snap.clients) {
+	if (2 == c.client) {
+	  EXPECT_EQ(dmc::ClientPhase::limited, c.phase);
+	  EXPECT_EQ(2u, c.request_count);
+	  EXPECT_GT(c.next_tag.limit, now);
+	}
+      }
+      EXPECT_EQ(5u, pq.request_count());
+    }
+
+
+    TEST(dmclock_server_pull, pull_profiling) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(1.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1,1);
+
+      // with profiling off the timers record nothing
+      pq.set_profiling(false);
+      pq.add_request(Request{}, 1, req_params);
+      (void) pq.pull_request();
+      EXPECT_EQ(0u, pq.add_request_timer.get().get_count());
+      EXPECT_EQ(0u, pq.pull_request_timer.get().get_count());
+
+      pq.set_profiling(true);
+      std::vector<std::thread> threads;
+      for (int t = 0; t < 4; ++t) {
+	threads.emplace_back([&pq, &req_params, t] () {
+	    for (int i = 0; i < 50; ++i) {
+	      pq.add_request(Request{}, t, req_params);
+	      (void) pq.pull_request();
+	    }
+	  });
+      }
+      for (auto& t : threads) {
+	t.join();
+      }
+      EXPECT_EQ(200u, pq.add_request_timer.get().get_count());
+      EXPECT_EQ(200u, pq.pull_request_timer.get().get_count());
+    }
   } // namespace dmclock
 } // namespace crimson
@@ -0,0 +1,340 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+#include "dmclock_sharded_server.h"
+#include "dmclock_util.h"
+#include "gtest/gtest.h"
+
+
+namespace dmc = crimson::dmclock;
+
+
+namespace crimson {
+  namespace dmclock {
+
+    struct ShardRequest {
+      int id;
+    };
+
+
+    TEST(dmclock_server_sharded, pull_weight) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,ShardRequest>;
+
+      // with two shards these clients land in different shards
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	if (client1 == c) return info1;
+	else if (client2 == c) return info2;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return info1;
+	}
+      };
+
+      Queue pq(client_info_f, 2, false);
+
+      ShardRequest req{0};
+      ReqParams req_params(1,1);
+
+      auto now = dmc::get_time();
+
+      for (int i = 0; i < 5; ++i) {
+	pq.add_request_time(req, client1, req_params, now);
+	pq.add_request_time(req, client2, req_params, now);
+      }
+
+      EXPECT_EQ(2u, pq.client_count());
+      EXPECT_EQ(10u, pq.request_count());
+
+      int c1_count = 0;
+      int c2_count = 0;
+      for (int i = 0; i < 6; ++i) {
+	Queue::PullReq pr = pq.pull_request(now);
+	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+	auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
+
+	if (client1 == retn.client) ++c1_count;
+	else if (client2 == retn.client) ++c2_count;
+	else ADD_FAILURE() << "got request from neither of two clients";
+
+	EXPECT_EQ(PhaseType::priority, retn.phase);
+      }
+
+      EXPECT_EQ(2, c1_count) <<
+	"one-third of request should have come from first client";
+      EXPECT_EQ(4, c2_count) <<
+	"two-thirds of request should have come from second client";
+
+      // the statistics cover both shards
+      QueueStats stats = pq.stats();
+      EXPECT_EQ(6u, stats.priority_count);
+      EXPECT_EQ(6u, stats.priority_wait.get_count());
+      EXPECT_EQ(4u, stats.queued);
+      EXPECT_EQ(2u, stats.backlogged_clients);
+      EXPECT_EQ(10u, stats.backlog.get_count());
+
+      // as does the snapshot
+      QueueSnapshot<ClientId> snap = pq.snapshot(now);
+      ASSERT_EQ(2u, snap.clients.size());
+      size_t queued = 0;
+      for (const auto& c : snap.clients) {
+	EXPECT_TRUE(client1 == c.client || client2 == c.client);
+	queued += c.request_count;
+      }
+      EXPECT_EQ(4u, queued);
+    }
+
+
+    TEST(dmclock_server_sharded, pull_reservation) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,ShardRequest>;
+
+      // with three shards these clients land in different shards
+      ClientId client1 = 52;
+      ClientId client2 = 8;
+
+      dmc::ClientInfo info1(2.0, 0.0, 0.0);
+      dmc::ClientInfo info2(1.0, 0.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	if (client1 == c) return info1;
+	else if (client2 == c) return info2;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return info1;
+	}
+      };
+
+      Queue pq(client_info_f, 3, false);
+
+      ShardRequest req{0};
+      ReqParams req_params(1,1);
+
+      // make sure all times are well before now
+      auto old_time = dmc::get_time() - dmc::seconds_to_time(100.0);
+
+      for (int i = 0; i < 5; ++i) {
+	pq.add_request_time(req, client1, req_params, old_time);
+	pq.add_request_time(req, client2, req_params, old_time);
+	old_time += dmc::seconds_to_time(0.001);
+      }
+
+      int c1_count = 0;
+      int c2_count = 0;
+
+      for (int i = 0; i < 6; ++i) {
+	Queue::PullReq pr = pq.pull_request();
+	EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+	auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
+
+	if (client1 == retn.client) ++c1_count;
+	else if (client2 == retn.client) ++c2_count;
+	else ADD_FAILURE() << "got request from neither of two clients";
+
+	EXPECT_EQ(PhaseType::reservation, retn.phase);
+      }
+
+      EXPECT_EQ(4, c1_count) <<
+	"two-thirds of request should have come from first client";
+      EXPECT_EQ(2, c2_count) <<
+	"one-third of request should have come from second client";
+    }
+
+
+    TEST(dmclock_server_sharded, pull_future_and_none) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,ShardRequest>;
+
+      dmc::ClientInfo info(1.0, 0.0, 1.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, 4, false);
+
+      ShardRequest req{0};
+      ReqParams req_params(1,1);
+
+      auto now = dmc::get_time();
+
+      Queue::PullReq pr = pq.pull_request(now);
+      EXPECT_EQ(Queue::NextReqType::none, pr.type);
+
+      pq.add_request_time(req, 52, req_params,
+			  now + dmc::seconds_to_time(100));
+      pr = pq.pull_request(now);
+
+      EXPECT_EQ(Queue::NextReqType::future, pr.type);
+      EXPECT_EQ(now + dmc::seconds_to_time(100), boost::get<Time>(pr.data));
+
+      pr = pq.pull_request(now + dmc::seconds_to_time(100));
+      EXPECT_EQ(Queue::NextReqType::returning, pr.type);
+      EXPECT_EQ(52, boost::get<Queue::PullReq::Retn>(pr.data).client);
+    }
+
+
+    TEST(dmclock_server_sharded, emplace_request) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,ShardRequest>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, 2, false);
+      ReqParams req_params(1,1);
+
+      for (int i = 1; i <= 3; ++i) {
+	pq.emplace_request(17, req_params, ShardRequest{i});
+      }
+      EXPECT_EQ(3u, pq.request_count());
+
+      for (int i = 1; i <= 3; ++i) {
+	Queue::PullReq pr = pq.pull_request();
+	ASSERT_EQ(Queue::NextReqType::returning, pr.type);
+	auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
+	EXPECT_EQ(17, retn.client);
+	EXPECT_EQ(i, retn.request->id);
+      }
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    TEST(dmclock_server_sharded, clean_publishes_tops) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,ShardRequest>;
+
+      dmc::ClientInfo info(1.0, 0.0, 1.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, 4,
+	       std::chrono::milliseconds(100),
+	       std::chrono::milliseconds(200),
+	       std::chrono::milliseconds(50));
+
+      ReqParams req_params(1,1);
+      auto now = dmc::get_time();
+
+      pq.add_request_time(ShardRequest{0}, 52, req_params,
+			  now + dmc::seconds_to_time(100));
+      EXPECT_EQ(Queue::NextReqType::future, pq.pull_request(now).type);
+
+      // wait for the cleaning job to erase the client
+      for (int i = 0; i < 200 && pq.client_count() > 0; ++i) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      ASSERT_EQ(0u, pq.client_count());
+
+      EXPECT_EQ(Queue::NextReqType::none, pq.pull_request(now).type) <<
+	"the erased client's tags are no longer published";
+    }
+
+
+    TEST(dmclock_server_sharded, pull_locked) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,ShardRequest>;
+
+      auto client_info_f = [] (ClientId c) -> dmc::ClientInfo {
+	return dmc::ClientInfo(0 == c % 3 ? 1.0 : 0.0,
+			       1.0 + c,
+			       0 == c % 4 ? 2.0 : 0.0);
+      };
+
+      // pulling with every shard locked must choose as the lock-free
+      // path does
+      Queue pq(client_info_f, 4, true);
+      Queue twin(client_info_f, 4, true);
+
+      ReqParams req_params(1,1);
+      auto now = dmc::get_time();
+
+      for (ClientId c = 0; c < 12; ++c) {
+	for (int i = 0; i < 4; ++i) {
+	  pq.add_request_time(ShardRequest{i}, c, req_params, now);
+	  twin.add_request_time(ShardRequest{i}, c, req_params, now);
+	}
+      }
+
+      for (int i = 0; i < 48; ++i) {
+	const Time t = now + i * 0.1;
+	Queue::PullReq pr = pq.pull_locked(t);
+	Queue::PullReq twin_pr = twin.pull_request(t);
+	ASSERT_EQ(twin_pr.type, pr.type);
+	if (pr.is_retn()) {
+	  EXPECT_EQ(twin_pr.get_retn().client, pr.get_retn().client);
+	  EXPECT_EQ(twin_pr.get_retn().phase, pr.get_retn().phase);
+	}
+      }
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    TEST(dmclock_server_sharded, concurrent_add_pull) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,ShardRequest>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> dmc::ClientInfo {
+	return info;
+      };
+
+      Queue pq(client_info_f, 4, false);
+
+      const int thread_count = 4;
+      const int per_thread = 2000;
+
+      std::vector<std::thread> adders;
+      for (int t = 0; t < thread_count; ++t) {
+	adders.emplace_back([&pq, t] () {
+	    for (int i = 0; i < per_thread; ++i) {
+	      pq.add_request(ShardRequest{t * per_thread + i}, i % 37);
+	    }
+	  });
+      }
+
+      std::vector<int> pulled(thread_count * per_thread, 0);
+      int pull_count = 0;
+      while (pull_count < thread_count * per_thread) {
+	Queue::PullReq pr = pq.pull_request();
+	if (pr.is_retn()) {
+	  ++pulled[pr.get_retn().request->id];
+	  ++pull_count;
+	}
+      }
+
+      for (auto& t : adders) {
+	t.join();
+      }
+
+      EXPECT_TRUE(pq.empty());
+      EXPECT_EQ(0u, pq.request_count());
+      for (size_t i = 0; i < pulled.size(); ++i) {
+	EXPECT_EQ(1, pulled[i]) << "request " << i << " pulled once";
+      }
+    }
+  } // namespace dmclock
+} // namespace crimson
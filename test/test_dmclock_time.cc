@@ -0,0 +1,123 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <random>
+#include <atomic>
+#include <thread>
+
+#include "dmclock_trace.h"
+#include "gtest/gtest.h"
+
+
+namespace dmc = crimson::dmclock;
+namespace tr = crimson::dmc_trace;
+
+
+std::vector<tr::Pulled> tr::play_double(const Trace& trace) {
+  return play(trace);
+}
+
+
+namespace crimson {
+  namespace dmclock {
+
+    // Builds a trace whose rates, times, and costs are all multiples
+    // of powers of two no finer than 1/256 of a second, which doubles
+    // and integer nanoseconds both hold exactly; with other values
+    // the two can break near-ties differently. Clients come and go, so
+    // idle clients rejoin with a prop_delta.
+    static tr::Trace make_trace(uint seed, bool allow_limit_break) {
+      std::mt19937 prng(seed);
+      const double reservations[] = { 0.0, 0.0, 0.5, 1.0, 4.0 };
+      const double weights[] = { 1.0, 2.0, 4.0, 8.0, 16.0 };
+      const double limits[] = { 0.0, 0.0, 8.0, 16.0, 32.0 };
+
+      tr::Trace trace;
+      trace.allow_limit_break = allow_limit_break;
+      for (uint c = 0; c < 16; ++c) {
+	trace.clients.push_back(tr::TraceClient{reservations[prng() % 5],
+						weights[prng() % 5],
+						limits[prng() % 5]});
+      }
+
+      // the order of a current epoch time
+      double time = 1.5e9;
+      for (uint i = 0; i < 4000; ++i) {
+	time += (prng() % 9) / 256.0;
+	if (prng() % 2) {
+	  // a quarter of the clients get most of the adds
+	  uint client = prng() % 4 ? prng() % 4 : prng() % 16;
+	  double cost = prng() % 4 ? 0.0 : 1.0 / 128;
+	  trace.ops.push_back(tr::TraceOp{false, client, time, cost});
+	} else {
+	  trace.ops.push_back(tr::TraceOp{true, 0, time, 0.0});
+	}
+      }
+      return trace;
+    }
+
+
+    // integer nanosecond tags schedule recorded traces in the same
+    // order as double tags
+    TEST(dmclock_time, integer_matches_double) {
+      uint futures = 0;
+      for (uint seed : { 1, 2, 3 }) {
+	for (bool allow_limit_break : { false, true }) {
+	  tr::Trace trace = make_trace(seed, allow_limit_break);
+	  std::vector<tr::Pulled> doubles = tr::play_double(trace);
+	  std::vector<tr::Pulled> integers = tr::play_integer(trace);
+
+	  ASSERT_EQ(doubles.size(), integers.size());
+	  uint returned = 0;
+	  for (size_t i = 0; i < doubles.size(); ++i) {
+	    ASSERT_EQ(doubles[i], integers[i]) << "seed " << seed <<
+	      " limit break " << allow_limit_break << " pull " << i;
+	    if (0 == doubles[i].type) ++returned;
+	    if (1 == doubles[i].type) ++futures;
+	  }
+	  EXPECT_GT(returned, 0u);
+	}
+      }
+      EXPECT_GT(futures, 0u);
+    }
+
+
+
+    template<typename Clock>
+    static void check_clock_advances() {
+      dmc::Time prev = Clock::now();
+      const auto end =
+	std::chrono::steady_clock::now() + std::chrono::milliseconds(30);
+      uint advanced = 0;
+      while (std::chrono::steady_clock::now() < end) {
+	dmc::Time t = Clock::now();
+	ASSERT_LE(prev, t);
+	if (t > prev) ++advanced;
+	prev = t;
+      }
+      EXPECT_GT(advanced, 0u);
+    }
+
+
+    TEST(dmclock_time, clocks_advance) {
+      check_clock_advances<dmc::WallClock>();
+      check_clock_advances<dmc::SteadyClock>();
+      check_clock_advances<dmc::CoarseClock>();
+      check_clock_advances<dmc::TscClock>();
+
+      // once calibrated the time stamp counter tracks the steady clock
+      std::this_thread::sleep_for(std::chrono::milliseconds(30));
+      dmc::Time tsc = dmc::TscClock::now();
+      dmc::Time steady = dmc::SteadyClock::now();
+      EXPECT_NEAR(dmc::time_to_seconds(steady), dmc::time_to_seconds(tsc),
+		  0.001);
+    }
+
+
+  } // namespace dmclock
+} // namespace crimson
@@ -0,0 +1,100 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ */
+
+
+#include <time.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <vector>
+
+#include "dmclock_server.h"
+#include "gtest/gtest.h"
+
+
+namespace dmc = crimson::dmclock;
+
+
+// Replaces gettimeofday for this program, so tests can move the time
+// of day as if the system clock were set, by wall_clock_step seconds;
+// it's a program of its own so the other tests see the real time.
+#if defined(__GLIBC__) && !defined(__USE_TIME_BITS64)
+#define TEST_WALL_CLOCK_STEP 1
+
+static std::atomic<long> wall_clock_step(0);
+
+#if __GLIBC_PREREQ(2, 31)
+extern "C" int gettimeofday(struct timeval* tv, void* tz) __THROW {
+#else
+extern "C" int gettimeofday(struct timeval* tv, __timezone_ptr_t tz) __THROW {
+#endif
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  tv->tv_sec = now.tv_sec + wall_clock_step;
+  tv->tv_usec = now.tv_nsec / 1000;
+  return 0;
+}
+#endif
+
+
+namespace crimson {
+  namespace dmclock {
+
+#if TEST_WALL_CLOCK_STEP
+    struct StepRequest {
+    };
+
+    // adds a request for client 1, sets the clock back an hour, adds
+    // a request for client 2, and returns the clients of the requests
+    // that can then be pulled
+    template<typename Queue>
+    static std::vector<int> pull_across_wall_clock_step() {
+      // reservations only, so requests can be pulled once their tags
+      // are reached
+      Queue pq([] (int) -> dmc::ClientInfo {
+	  return dmc::ClientInfo(1.0, 0.0, 0.0);
+	},
+	false);
+      dmc::ReqParams req_params(1, 1);
+
+      wall_clock_step = 0;
+      pq.add_request(StepRequest{}, 1, req_params);
+      wall_clock_step = -3600;
+      pq.add_request(StepRequest{}, 2, req_params);
+
+      std::vector<int> clients;
+      for (int i = 0; i < 2; ++i) {
+	typename Queue::PullReq pr = pq.pull_request();
+	if (pr.is_retn()) {
+	  clients.push_back(pr.get_retn().client);
+	}
+      }
+      wall_clock_step = 0;
+      return clients;
+    }
+
+
+    // with the default (monotonic) clock, setting the time of day
+    // doesn't change which requests are scheduled or in what order
+    TEST(dmclock_wall_clock, wall_clock_step) {
+      using SteadyQueue = dmc::PullPriorityQueue<int,StepRequest>;
+      using WallQueue = dmc::PullPriorityQueue<int,StepRequest,2,
+					       dmc::SchedIndex::heaps,
+					       dmc::WallClock>;
+
+      EXPECT_EQ(std::vector<int>({ 1, 2 }),
+		pull_across_wall_clock_step<SteadyQueue>());
+
+      // whereas a queue on the time of day takes the later request
+      // first and holds the earlier one for an hour
+      EXPECT_EQ(std::vector<int>({ 2 }),
+		pull_across_wall_clock_step<WallQueue>());
+    }
+#endif
+
+  } // namespace dmclock
+} // namespace crimson